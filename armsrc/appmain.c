@@ -322,6 +322,8 @@ void set_hw_capabilities(void)
 	if (I2C_is_available()) {
 		hw_capabilities |= HAS_SMARTCARD_SLOT;
 	}
+
+	hw_capabilities |= HAS_COMPACT_FRAMES;
 	
 	if (false) { // TODO: implement a test
 		hw_capabilities |= HAS_EXTRA_FLASH_MEM;
@@ -1007,6 +1009,9 @@ void UsbPacketReceived(uint8_t *packet, int len)
 		case CMD_LF_SNOOP_RAW_ADC_SAMPLES:
 			cmd_send(CMD_ACK,SnoopLF(),0,0,0,0);
 			break;
+		case CMD_LF_STREAM_ADC_SAMPLES:
+			StreamLF(c->arg[0], c->arg[1]);
+			break;
 		case CMD_HID_DEMOD_FSK:
 			CmdHIDdemodFSK(c->arg[0], 0, 0, 0, 1);
 			break;
@@ -1052,6 +1057,11 @@ void UsbPacketReceived(uint8_t *packet, int len)
 			SimulateTagLowFrequency(c->arg[0], c->arg[1], 1);
 			LED_A_OFF();
 			break;
+		case CMD_SIMULATE_TAG_125K_COMPACT:
+			LED_A_ON();
+			SimulateTagLowFrequencyCompact(c->arg[0], c->arg[1], c->d.asBytes, 1);
+			LED_A_OFF();
+			break;
 		case CMD_LF_SIMULATE_BIDIR:
 			SimulateTagLowFrequencyBidir(c->arg[0], c->arg[1]);
 			break;
@@ -1073,6 +1083,9 @@ void UsbPacketReceived(uint8_t *packet, int len)
 		case CMD_T55XX_RESET_READ:
 			T55xxResetRead();
 			break;
+		case CMD_T55XX_CLONE_BATCH:
+			T55xxCloneBatch(c->arg[0], c->arg[1]);
+			break;
 		case CMD_PCF7931_READ:
 			ReadPCF7931();
 			break;
@@ -1091,6 +1104,9 @@ void UsbPacketReceived(uint8_t *packet, int len)
 		case CMD_EM4X_PROTECT:
 			EM4xProtect(c->arg[0], c->arg[1], c->arg[2]);
 			break;
+		case CMD_LF_WATCH:
+			CmdLFWatch(c->arg[0], c->arg[1], 1);
+			break;
 		case CMD_AWID_DEMOD_FSK: // Set realtime AWID demodulation
 			CmdAWIDdemodFSK(c->arg[0], 0, 0, 1);
 			break;
@@ -1148,7 +1164,10 @@ void UsbPacketReceived(uint8_t *packet, int len)
 			break;
 					
 		case CMD_ISO_15693_FIND_AFI:
-			BruteforceIso15693Afi(c->arg[0]);
+			InventoryIso15693(ISO15693_INV_SWEEP, 0);
+			break;
+		case CMD_ISO_15693_INVENTORY:
+			InventoryIso15693(c->arg[0], c->arg[1]);
 			break;	
 			
 		case CMD_ISO_15693_DEBUG:
@@ -1236,6 +1255,12 @@ void UsbPacketReceived(uint8_t *packet, int len)
 		case CMD_MIFAREUC_SETPWD: 
 			MifareUSetPwd(c->arg[0], c->d.asBytes);
 			break;
+		case CMD_MIFAREU_FINGERPRINT:
+			MifareUFingerprint(c->arg[0], c->d.asBytes);
+			break;
+		case CMD_MIFAREU_CHKKEYS:
+			MifareUChkKeys(c->arg[0], c->arg[1], c->d.asBytes);
+			break;
 		case CMD_MIFARE_READSC:
 			MifareReadSector(c->arg[0], c->arg[1], c->arg[2], c->d.asBytes);
 			break;
@@ -1257,6 +1282,9 @@ void UsbPacketReceived(uint8_t *packet, int len)
 		case CMD_MIFARE_CHKKEYS:
 			MifareChkKeys(c->arg[0], c->arg[1], c->arg[2], c->d.asBytes);
 			break;
+		case CMD_MIFARE_AUDIT:
+			MifareAudit(c->arg[0], c->arg[1], c->arg[2], c->d.asBytes);
+			break;
 		case CMD_SIMULATE_MIFARE_CARD:
 			MifareSim(c->arg[0], c->arg[1], c->arg[2], c->d.asBytes);
 			break;
@@ -1288,6 +1316,12 @@ void UsbPacketReceived(uint8_t *packet, int len)
 		case CMD_MIFARE_CGETBLOCK:
 			MifareCGetBlock(c->arg[0], c->arg[1], c->arg[2], c->d.asBytes);
 			break;
+		case CMD_MIFARE_CSETBLOCKS:
+			MifareCSetBlocks(c->arg[0], c->arg[1], c->arg[2], c->d.asBytes);
+			break;
+		case CMD_MIFARE_CGETBLOCKS:
+			MifareCGetBlocks(c->arg[0], c->arg[1], c->arg[2], c->d.asBytes);
+			break;
 		case CMD_MIFARE_CIDENT:
 			MifareCIdent();
 			break;
@@ -1345,6 +1379,10 @@ void UsbPacketReceived(uint8_t *packet, int len)
 			break;
 #endif
 
+		case CMD_HF_SEARCH:
+			HfSearch(c->arg[0], c->arg[1], c->arg[2]);
+			break;
+
 #ifdef WITH_SMARTCARD
 		case CMD_SMART_ATR: {
 			SmartCardAtr();
@@ -1401,7 +1439,7 @@ void UsbPacketReceived(uint8_t *packet, int len)
 				cmd_send(CMD_DOWNLOADED_RAW_ADC_SAMPLES_125K,i,len,BigBuf_get_traceLen(),BigBuf+c->arg[0]+i,len);
 			}
 			// Trigger a finish downloading signal with an ACK frame
-			cmd_send(CMD_ACK,1,0,BigBuf_get_traceLen(),getSamplingConfig(),sizeof(sample_config));
+			cmd_send(CMD_ACK,1,0,BigBuf_get_traceLen(),getCaptureConfig(),sizeof(sample_config));
 			LED_B_OFF();
 			break;
 
@@ -1529,15 +1567,12 @@ void  __attribute__((noreturn)) AppMain(void)
 	LCDInit();
 #endif
 
-  byte_t rx[sizeof(UsbCommand)];
-	size_t rx_len;
+  UsbCommand rx;
   
 	for(;;) {
-    if (usb_poll()) {
-      rx_len = usb_read(rx,sizeof(UsbCommand));
-      if (rx_len) {
-        UsbPacketReceived(rx,rx_len);
-      }
+    // both frame layouts, see UsbCompactHeader
+    if (cmd_receive(&rx)) {
+      UsbPacketReceived((uint8_t*)&rx,sizeof(UsbCommand));
     }
 		WDT_HIT();
 
@@ -0,0 +1,172 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// HF tag discovery. Probes the HF protocols one after the other with the HF
+// FPGA image loaded once and returns a short identification record for the
+// first tag that answers.
+//-----------------------------------------------------------------------------
+
+#include "proxmark3.h"
+#include "apps.h"
+#include "util.h"
+#include "string.h"
+#include "cmd.h"
+#include "usb_cdc.h"	// for usb_poll_validate_length
+#include "BigBuf.h"
+#include "fpgaloader.h"
+#include "iso14443a.h"
+#include "iso14443b.h"
+#include "iso15693.h"
+#include "legicrf.h"
+#include "hfsearch.h"
+
+// time with the field off between two protocols, resets the tags
+#define HF_SEARCH_FIELD_OFF_MS  5
+
+// rounds without an answer before a tag counts as removed in continuous mode
+#define HF_SEARCH_GONE_ROUNDS   2
+
+static void HfSearchFieldOff(void)
+{
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	LED_D_OFF();
+	SpinDelay(HF_SEARCH_FIELD_OFF_MS);
+}
+
+#ifdef WITH_ISO14443a
+static bool HfSearch14a(hf_search_result_t *card)
+{
+	iso14a_card_select_t card_info;
+
+	iso14443a_setup(FPGA_HF_ISO14443A_READER_LISTEN);
+	SpinDelay(HF_SEARCH_POWERUP_MS);
+
+	if (!iso14443a_select_card(NULL, &card_info, NULL, true, 0, true))
+		return false;
+
+	card->protocol = HF_SEARCH_14A;
+	card->uidlen = card_info.uidlen;
+	memcpy(card->uid, card_info.uid, card_info.uidlen);
+	memcpy(card->atqa, card_info.atqa, 2);
+	card->sak = card_info.sak;
+	return true;
+}
+#endif
+
+// one pass over all requested protocols. Stops at the first tag that answers.
+static bool HfSearchRound(uint8_t protocols, hf_search_result_t *card)
+{
+	memset(card, 0, sizeof(hf_search_result_t));
+
+#ifdef WITH_ISO14443a
+	if (protocols & HF_SEARCH_14A) {
+		HfSearchFieldOff();
+		if (HfSearch14a(card)) return true;
+	}
+#endif
+#ifdef WITH_ICLASS
+	if (protocols & HF_SEARCH_ICLASS) {
+		HfSearchFieldOff();
+		if (iClass_Identify(card)) return true;
+	}
+#endif
+#ifdef WITH_ISO15693
+	if (protocols & HF_SEARCH_15) {
+		HfSearchFieldOff();
+		if (Iso15693Identify(card)) return true;
+	}
+#endif
+#ifdef WITH_ISO14443b
+	if (protocols & (HF_SEARCH_14B | HF_SEARCH_SRX)) {
+		HfSearchFieldOff();
+		if (iso14443b_identify(protocols, card)) return true;
+	}
+#endif
+#ifdef WITH_LEGICRF
+	if (protocols & HF_SEARCH_LEGIC) {
+		HfSearchFieldOff();
+		if (LegicRfIdentify(card)) return true;
+	}
+#endif
+
+	return false;
+}
+
+static bool HfSearchSameTag(hf_search_result_t *a, hf_search_result_t *b)
+{
+	return a->protocol == b->protocol && a->uidlen == b->uidlen && !memcmp(a->uid, b->uid, a->uidlen);
+}
+
+//-----------------------------------------------------------------------------
+// protocols - HF_SEARCH_xx mask
+// flags     - 0: one round
+//             HF_SEARCH_WAIT: rounds until a tag answers
+//             HF_SEARCH_CONTINUOUS: report every new tag in the field
+// timeout   - ms, for WAIT and CONTINUOUS. 0 - until button press or usb command
+//-----------------------------------------------------------------------------
+void HfSearch(uint8_t protocols, uint8_t flags, uint32_t timeout)
+{
+	hf_search_result_t card, last;
+	bool haveLast = false;
+	uint16_t missed = 0;
+	uint16_t round = 0;
+	bool userCancelled = false;
+
+	LEDsoff();
+	LED_A_ON();
+
+	// all protocols run on the same image. Only the major/minor modes change between them.
+	FpgaDownloadAndGo(FPGA_BITSTREAM_HF);
+	clear_trace();
+	set_tracing(true);
+
+	uint32_t start = GetTickCount();
+	for (;;) {
+		WDT_HIT();
+
+		// keep the trace of the last round only
+		if (flags & HF_SEARCH_CONTINUOUS)
+			clear_trace();
+
+		bool found = HfSearchRound(protocols, &card);
+		round++;
+
+		if (found) {
+			card.round = round;
+			card.time = GetTickCount() - start;
+			missed = 0;
+
+			if (!(flags & HF_SEARCH_CONTINUOUS)) {
+				cmd_send(CMD_ACK, 1, round, 0, &card, sizeof(card));
+				break;
+			}
+
+			// the same tag stays in the field - report it once
+			if (!haveLast || !HfSearchSameTag(&card, &last)) {
+				LED_B_ON();
+				cmd_send(CMD_ACK, 1, round, 0, &card, sizeof(card));
+				LED_B_OFF();
+				memcpy(&last, &card, sizeof(card));
+				haveLast = true;
+			}
+		} else if (haveLast && ++missed >= HF_SEARCH_GONE_ROUNDS) {
+			haveLast = false;
+		}
+
+		if (!(flags & (HF_SEARCH_WAIT | HF_SEARCH_CONTINUOUS)))
+			break;
+
+		if (timeout && GetTickCount() - start > timeout)
+			break;
+
+		userCancelled = BUTTON_PRESS() || usb_poll_validate_length();
+		if (userCancelled)
+			break;
+	}
+
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	LEDsoff();
+	cmd_send(CMD_ACK, userCancelled ? 0xFF : 0, round, 0, NULL, 0);
+}
@@ -21,6 +21,7 @@
 
 #ifdef WITH_SMARTCARD
 #include "smartcard.h"
+#include "sc_wait.h"
 #endif
 
 
@@ -257,33 +258,15 @@ static void I2C_Reset_EnterBootloader(void) {
 	WaitMS(10);
 }
 
-// Wait max 1800ms or until SCL goes LOW.
-// It timeout reading response from card
-// Which ever comes first
-bool WaitSCL_L_timeout(void){
-	volatile uint16_t delay = 1800;
-	while ( delay-- ) {
-		// exit on SCL LOW
-		if (!SCL_read)
-			return true;
-
-		WaitMS(1);
-	}
-	return (delay == 0);
-}
-
-static bool I2C_WaitForSim() {
-	// wait for data from card
-	if (!WaitSCL_L_timeout())
-		return false;
-
-	// 8051 speaks with smart card.
-	// 1000*50*3.07 = 153.5ms
-	// 1byte transfer == 1ms with max frame being 256bytes
-	if (!WaitSCL_H_delay(10 * 1000 * 50))
-		return false;
-
-	return true;
+// Wait until the 8051 has the answer of the card: SCL goes low within 1800ms while
+// it speaks with the card, max 1535ms low, then <settle> ticks after it is released.
+// SCL is sampled back to back instead of every 1ms, see common/sc_wait.c.
+// false if it timed out.
+static bool I2C_WaitForSim(uint32_t settle) {
+	sc_wait_t w;
+	sc_wait_start(&w, GetTicks(), settle);
+	while (sc_wait_poll(&w, SCL_read, GetTicks()) != SC_WAIT_DONE) {};
+	return !w.timeout;
 }
 
 // Send i2c ACK
@@ -427,9 +410,6 @@ static int16_t I2C_BufferRead(uint8_t *data, uint8_t len, uint8_t device_cmd, ui
 	if ( !data || len == 0 )
 		return 0;
 
-	// extra wait  500us (514us measured)
-	// 200us  (xx measured)
-	WaitUS(600);
 	bool bBreak = true;
 	uint16_t readcount = 0;
 
@@ -613,9 +593,10 @@ static bool sc_rx_bytes(uint8_t* dest, uint8_t *destlen) {
  	uint8_t i = 3;
 	int16_t len = 0;
 	while (i--) {
-		
-		I2C_WaitForSim();
-	
+
+		// extra wait 500us (514us measured) after SCL is released
+		I2C_WaitForSim(SC_WAIT_SETTLE_TIME);
+
 		len = I2C_BufferRead(dest, *destlen, I2C_DEVICE_CMD_READ, I2C_DEVICE_ADDRESS_MAIN);
 		
 		if ( len > 1 ){
@@ -649,7 +630,7 @@ static bool GetATR(smart_card_atr_t *card_ptr) {
 
 	// wait for sim card to answer.
 	// 1byte = 1ms, max frame 256bytes. Should wait 256ms at least just in case.
-	if (!I2C_WaitForSim()) 
+	if (!I2C_WaitForSim(0))
 		return false;
 
 	// read bytes from module
@@ -1663,6 +1663,27 @@ uint8_t handshakeIclassTag(uint8_t *card_data) {
 	return handshakeIclassTag_ext(card_data, false);
 }
 
+// Identify an iCLASS tag for hf search: CSN and, if readable, the e-purse.
+// Same setup as setupIclassReader without resetting the trace and with a short power up.
+bool iClass_Identify(hf_search_result_t *card) {
+	uint8_t card_data[16];
+
+	iso14443a_setup(FPGA_HF_ISO14443A_READER_MOD);
+	SpinDelay(HF_SEARCH_POWERUP_MS);
+
+	uint8_t read_status = handshakeIclassTag(card_data);
+	if (read_status == 0) return false;
+
+	card->protocol = HF_SEARCH_ICLASS;
+	card->uidlen = 8;
+	memcpy(card->uid, card_data, 8);
+	if (read_status == 2) {
+		card->infolen = 8;
+		memcpy(card->info, card_data + 8, 8);
+	}
+	return true;
+}
+
 
 // Reader iClass Anticollission
 void ReaderIClass(uint8_t arg0) {
@@ -19,6 +19,7 @@
 #include "iso14443crc.h"
 #include "fpgaloader.h"
 #include "BigBuf.h"
+#include "srxdump.h"
 
 #define RECEIVE_SAMPLES_TIMEOUT 64 // TR0 max is 256/fs = 256/(848kHz) = 302us or 64 samples from FPGA
 #define ISO14443B_DMA_BUFFER_SIZE 128
@@ -950,18 +951,122 @@ void iso14443b_setup() {
 }
 
 //-----------------------------------------------------------------------------
-// Read a SRI512 ISO 14443B tag.
+// Identify an ISO 14443B or ST SRx tag for hf search. Switches the field on,
+// tags are only woken up, not selected.
+//-----------------------------------------------------------------------------
+bool iso14443b_identify(uint8_t protocols, hf_search_result_t *card)
+{
+	static const uint8_t wupb[] = { 0x05, 0x00, 0x08, 0x39, 0x73 };
+	uint8_t cmd[4];
+
+	iso14443b_setup();
+	SpinDelay(HF_SEARCH_POWERUP_MS);
+
+	if (protocols & HF_SEARCH_14B) {
+		CodeAndTransmit14443bAsReader(wupb, sizeof(wupb));
+		GetSamplesFor14443bDemod(RECEIVE_SAMPLES_TIMEOUT, true);
+		// ATQB: 0x50, PUPI, application data, protocol info, CRC
+		if (Demod.len >= 14 && Demod.output[0] == 0x50) {
+			card->protocol = HF_SEARCH_14B;
+			card->uidlen = 4;
+			memcpy(card->uid, Demod.output + 1, 4);
+			card->infolen = 7;
+			memcpy(card->info, Demod.output + 5, 7);
+			return true;
+		}
+	}
+
+	if (protocols & HF_SEARCH_SRX) {
+		// INITIATE
+		cmd[0] = 0x06;
+		cmd[1] = 0x00;
+		ComputeCrc14443(CRC_14443_B, cmd, 2, &cmd[2], &cmd[3]);
+		CodeAndTransmit14443bAsReader(cmd, 4);
+		GetSamplesFor14443bDemod(RECEIVE_SAMPLES_TIMEOUT, true);
+		if (Demod.len != 3)
+			return false;
+		uint8_t chipid = Demod.output[0];
+
+		// SELECT
+		cmd[0] = 0x0E;
+		cmd[1] = chipid;
+		ComputeCrc14443(CRC_14443_B, cmd, 2, &cmd[2], &cmd[3]);
+		CodeAndTransmit14443bAsReader(cmd, 4);
+		GetSamplesFor14443bDemod(RECEIVE_SAMPLES_TIMEOUT, true);
+		if (Demod.len != 3 || Demod.output[0] != chipid)
+			return false;
+
+		// GET UID
+		cmd[0] = 0x0B;
+		ComputeCrc14443(CRC_14443_B, cmd, 1, &cmd[1], &cmd[2]);
+		CodeAndTransmit14443bAsReader(cmd, 3);
+		GetSamplesFor14443bDemod(RECEIVE_SAMPLES_TIMEOUT, true);
+		if (Demod.len != 10)
+			return false;
+		ComputeCrc14443(CRC_14443_B, Demod.output, 8, &cmd[2], &cmd[3]);
+		if (cmd[2] != Demod.output[8] || cmd[3] != Demod.output[9])
+			return false;
+
+		card->protocol = HF_SEARCH_SRX;
+		card->uidlen = 8;
+		for (int i = 0; i < 8; i++)
+			card->uid[i] = Demod.output[7 - i];
+		card->infolen = 1;
+		card->info[0] = chipid;
+		return true;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Send an ST SRx command and wait for an answer of len bytes with a good CRC.
+// Tries up to SRX_DUMP_RETRIES times. Returns one of the SRX_BLOCK_xx. The
+// answer that status belongs to goes to answer (len bytes): the good one, or
+// for a CRC error the last one of the right length.
+//-----------------------------------------------------------------------------
+static uint8_t srx_exchange(uint8_t *cmd, int cmdlen, uint8_t *answer, int len)
+{
+	uint8_t crc[2];
+	uint8_t status = SRX_BLOCK_NO_ANSWER;
+
+	ComputeCrc14443(CRC_14443_B, cmd, cmdlen - 2, &cmd[cmdlen - 2], &cmd[cmdlen - 1]);
+	for (int i = 0; i < SRX_DUMP_RETRIES; i++) {
+		CodeAndTransmit14443bAsReader(cmd, cmdlen);
+		GetSamplesFor14443bDemod(RECEIVE_SAMPLES_TIMEOUT, true);
+		if (Demod.len != len)
+			continue;
+		memcpy(answer, Demod.output, len);
+		ComputeCrc14443(CRC_14443_B, answer, len - 2, &crc[0], &crc[1]);
+		if (crc[0] == answer[len - 2] && crc[1] == answer[len - 1])
+			return SRX_BLOCK_OK;
+		status = SRX_BLOCK_CRC_ERROR;
+	}
+	return status;
+}
+
+//-----------------------------------------------------------------------------
+// Read a SRI512/SRIX4K ISO 14443B tag.
 //
 // SRI512 tags are just simple memory tags, here we're looking at making a dump
 // of the contents of the memory. No anticollision algorithm is done, we assume
 // we have a single tag in the field.
 //
-// I tried to be systematic and check every answer of the tag, every CRC, etc...
+// All blocks are read in one session, every answer and CRC is checked and
+// failed blocks are retried. The dump goes to the client in binary frames
+// (see srxdump.h), blocks 0 to dwLast and then the system block.
 //-----------------------------------------------------------------------------
 void ReadSTMemoryIso14443b(uint32_t dwLast)
 {
+	srx_dump_frame_t frame;
+	uint8_t cmd[4];
+	uint8_t answer[10];
+	uint8_t result = SRX_DUMP_OK;
+	int total = dwLast + 2;
+	int lost = 0;
+
 	LED_A_ON();
-	uint8_t i = 0x00;
+	memset(&frame, 0, sizeof(frame));
 
 	FpgaDownloadAndGo(FPGA_BITSTREAM_HF);
 	// Make sure that we start from off, since the tags are stateful;
@@ -982,111 +1087,63 @@ void ReadSTMemoryIso14443b(uint32_t dwLast)
 	clear_trace();
 	set_tracing(true);
 
-	// First command: wake up the tag using the INITIATE command
-	uint8_t cmd1[] = {0x06, 0x00, 0x97, 0x5b};
-	CodeAndTransmit14443bAsReader(cmd1, sizeof(cmd1));
-	GetSamplesFor14443bDemod(RECEIVE_SAMPLES_TIMEOUT, true);
-
-	if (Demod.len == 0) {
-		FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
-		DbpString("No response from tag");
-		LEDsoff();
-		return;
-	} else {
-		Dbprintf("Randomly generated Chip ID (+ 2 byte CRC): %02x %02x %02x",
-				Demod.output[0], Demod.output[1], Demod.output[2]);
-	}
-
-	// There is a response, SELECT the uid
-	DbpString("Now SELECT tag:");
-	cmd1[0] = 0x0E; // 0x0E is SELECT
-	cmd1[1] = Demod.output[0];
-	ComputeCrc14443(CRC_14443_B, cmd1, 2, &cmd1[2], &cmd1[3]);
-	CodeAndTransmit14443bAsReader(cmd1, sizeof(cmd1));
-	GetSamplesFor14443bDemod(RECEIVE_SAMPLES_TIMEOUT, true);
-	if (Demod.len != 3) {
-		FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
-		Dbprintf("Expected 3 bytes from tag, got %d", Demod.len);
-		LEDsoff();
-		return;
+	// First command: wake up the tag using the INITIATE command,
+	// the answer is the randomly generated chip id
+	cmd[0] = 0x06;
+	cmd[1] = 0x00;
+	if (srx_exchange(cmd, 4, answer, 3) != SRX_BLOCK_OK) {
+		result = SRX_DUMP_NO_TAG;
+		goto out;
 	}
-	// Check the CRC of the answer:
-	ComputeCrc14443(CRC_14443_B, Demod.output, 1 , &cmd1[2], &cmd1[3]);
-	if(cmd1[2] != Demod.output[1] || cmd1[3] != Demod.output[2]) {
-		FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
-		DbpString("CRC Error reading select response.");
-		LEDsoff();
-		return;
-	}
-	// Check response from the tag: should be the same UID as the command we just sent:
-	if (cmd1[1] != Demod.output[0]) {
-		FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
-		Dbprintf("Bad response to SELECT from Tag, aborting: %02x %02x", cmd1[1], Demod.output[0]);
-		LEDsoff();
-		return;
+	frame.chipid = answer[0];
+
+	// SELECT the chip id, the tag repeats it
+	cmd[0] = 0x0E;
+	cmd[1] = frame.chipid;
+	if (srx_exchange(cmd, 4, answer, 3) != SRX_BLOCK_OK || answer[0] != frame.chipid) {
+		result = SRX_DUMP_SELECT_FAILED;
+		goto out;
 	}
 
-	// Tag is now selected,
-	// First get the tag's UID:
-	cmd1[0] = 0x0B;
-	ComputeCrc14443(CRC_14443_B, cmd1, 1 , &cmd1[1], &cmd1[2]);
-	CodeAndTransmit14443bAsReader(cmd1, 3); // Only first three bytes for this one
-	GetSamplesFor14443bDemod(RECEIVE_SAMPLES_TIMEOUT, true);
-	if (Demod.len != 10) {
-		FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
-		Dbprintf("Expected 10 bytes from tag, got %d", Demod.len);
-		LEDsoff();
-		return;
-	}
-	// The check the CRC of the answer (use cmd1 as temporary variable):
-	ComputeCrc14443(CRC_14443_B, Demod.output, 8, &cmd1[2], &cmd1[3]);
-	if(cmd1[2] != Demod.output[8] || cmd1[3] != Demod.output[9]) {
-		Dbprintf("CRC Error reading block! Expected: %04x got: %04x",
-				(cmd1[2]<<8)+cmd1[3], (Demod.output[8]<<8)+Demod.output[9]);
-		// Do not return;, let's go on... (we should retry, maybe ?)
+	// Tag is now selected, get its UID
+	cmd[0] = 0x0B;
+	if (srx_exchange(cmd, 3, answer, 10) != SRX_BLOCK_OK) {
+		result = SRX_DUMP_UID_FAILED;
+		goto out;
 	}
-	Dbprintf("Tag UID (64 bits): %08x %08x",
-			(Demod.output[7]<<24) + (Demod.output[6]<<16) + (Demod.output[5]<<8) + Demod.output[4],
-			(Demod.output[3]<<24) + (Demod.output[2]<<16) + (Demod.output[1]<<8) + Demod.output[0]);
-
-	// Now loop to read all 16 blocks, address from 0 to last block
-	Dbprintf("Tag memory dump, block 0 to %d", dwLast);
-	cmd1[0] = 0x08;
-	i = 0x00;
-	dwLast++;
-	for (;;) {
-		if (i == dwLast) {
-			DbpString("System area block (0xff):");
-			i = 0xff;
+	for (int i = 0; i < 8; i++)
+		frame.uid[i] = answer[7 - i];
+
+	// Now read all blocks, address from 0 to last block and the system block
+	cmd[0] = 0x08;
+	for (int pos = 0; pos < total; pos++) {
+		int n = pos - frame.first;
+		uint8_t status = SRX_BLOCK_NO_ANSWER;
+
+		if (lost < SRX_DUMP_MAX_LOST) {
+			cmd[1] = (pos == total - 1) ? SRX_DUMP_SYSTEM_BLOCK : pos;
+			status = srx_exchange(cmd, 4, answer, 6);
+			if (status != SRX_BLOCK_NO_ANSWER)
+				memcpy(frame.data[n], answer, SRX_DUMP_BLOCK_SIZE);
+			lost = (status == SRX_BLOCK_NO_ANSWER) ? lost + 1 : 0;
 		}
-		cmd1[1] = i;
-		ComputeCrc14443(CRC_14443_B, cmd1, 2, &cmd1[2], &cmd1[3]);
-		CodeAndTransmit14443bAsReader(cmd1, sizeof(cmd1));
-		GetSamplesFor14443bDemod(RECEIVE_SAMPLES_TIMEOUT, true);
-		if (Demod.len != 6) { // Check if we got an answer from the tag
-			FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
-			DbpString("Expected 6 bytes from tag, got less...");
-			LEDsoff();
-			return;
+		if (status == SRX_BLOCK_NO_ANSWER)
+			result = SRX_DUMP_TAG_LOST;
+		frame.status[n] = status;
+		frame.count++;
+
+		if (frame.count == SRX_DUMP_FRAME_BLOCKS && pos < total - 1) {
+			cmd_send(CMD_ACK, result, total, 0, &frame, sizeof(frame));
+			frame.first += frame.count;
+			frame.count = 0;
+			memset(frame.status, 0, sizeof(frame.status));
+			memset(frame.data, 0, sizeof(frame.data));
 		}
-		// The check the CRC of the answer (use cmd1 as temporary variable):
-		ComputeCrc14443(CRC_14443_B, Demod.output, 4, &cmd1[2], &cmd1[3]);
-		if(cmd1[2] != Demod.output[4] || cmd1[3] != Demod.output[5]) {
-			Dbprintf("CRC Error reading block! Expected: %04x got: %04x",
-					(cmd1[2]<<8)+cmd1[3], (Demod.output[4]<<8)+Demod.output[5]);
-			// Do not return;, let's go on... (we should retry, maybe ?)
-		}
-		// Now print out the memory location:
-		Dbprintf("Address=%02x, Contents=%08x, CRC=%04x", i,
-				(Demod.output[3]<<24) + (Demod.output[2]<<16) + (Demod.output[1]<<8) + Demod.output[0],
-				(Demod.output[4]<<8)+Demod.output[5]);
-		if (i == 0xff) {
-			break;
-		}
-		i++;
 	}
-	
+
+out:
 	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	cmd_send(CMD_ACK, result, total, 1, &frame, sizeof(frame));
 	LEDsoff();
 }
 
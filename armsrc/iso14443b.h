@@ -15,10 +15,13 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include "hfsearch.h"
 
 extern int iso14443b_apdu(uint8_t const *message, size_t message_length, uint8_t *response);
 extern void iso14443b_setup();
 extern int iso14443b_select_card();
+extern bool iso14443b_identify(uint8_t protocols, hf_search_result_t *card);
 extern void SimulateIso14443bTag(void);
 extern void ReadSTMemoryIso14443b(uint32_t);
 extern void SnoopIso14443b(void);
@@ -61,6 +61,7 @@
 #include "cmd.h"
 #include "BigBuf.h"
 #include "fpgaloader.h"
+#include "usb_cdc.h"	// for usb_poll_validate_length
 
 #define arraylen(x) (sizeof(x)/sizeof((x)[0]))
 
@@ -178,6 +179,30 @@ static void CodeIso15693AsReader(uint8_t *cmd, int n)
 	ToSendMax++;
 }
 
+// EOF alone. Switches the tags to the next slot of a 16 slot inventory.
+static void CodeIso15693AsReaderEOF(void)
+{
+	ToSendReset();
+
+	// Give it a bit of slack at the beginning
+	for(int i = 0; i < 24; i++) {
+		ToSendStuffBit(1);
+	}
+
+	// EOF
+	ToSendStuffBit(1);
+	ToSendStuffBit(1);
+	ToSendStuffBit(0);
+	ToSendStuffBit(1);
+
+	// Fill remainder of last byte with 1
+	for(int i = 0; i < 4; i++) {
+		ToSendStuffBit(1);
+	}
+
+	ToSendMax++;
+}
+
 // encode data using "1 out of 256" scheme
 // data rate is 1,66 kbit/s (fc/8192)
 // is designed for more robust communication over longer distances
@@ -554,12 +579,14 @@ static void DecodeTagReset(DecodeTag_t *DecodeTag)
 
 
 /*
- *  Receive and decode the tag response, also log to tracebuffer
+ *  Receive and decode the tag response, also log to tracebuffer.
+ *  sof (optional) is set if a tag started to answer, even if the frame was broken (collision)
  */
-static int GetIso15693AnswerFromTag(uint8_t* response, uint16_t max_len, int timeout)
+static int GetIso15693AnswerFromTagExt(uint8_t* response, uint16_t max_len, int timeout, bool *sof)
 {
 	int samples = 0;
 	bool gotFrame = false;
+	bool gotSof = false;
 
 	uint16_t *dmaBuf = (uint16_t*)BigBuf_malloc(ISO15693_DMA_BUFFER_SIZE*sizeof(uint16_t));
 	
@@ -604,6 +631,10 @@ static int GetIso15693AnswerFromTag(uint8_t* response, uint16_t max_len, int tim
 			break;
 		}
 
+		if (DecodeTag.state >= STATE_TAG_RECEIVING_DATA) {
+			gotSof = true;
+		}
+
 		if (samples > timeout && DecodeTag.state < STATE_TAG_RECEIVING_DATA) {
 			DecodeTag.len = 0;
 			break;
@@ -621,10 +652,18 @@ static int GetIso15693AnswerFromTag(uint8_t* response, uint16_t max_len, int tim
 		LogTrace(DecodeTag.output, DecodeTag.len, 0, 0, NULL, false);
 	}
 
+	if (sof) *sof = gotSof || gotFrame;
+
 	return DecodeTag.len;
 }
 
 
+static int GetIso15693AnswerFromTag(uint8_t* response, uint16_t max_len, int timeout)
+{
+	return GetIso15693AnswerFromTagExt(response, max_len, timeout, NULL);
+}
+
+
 //=============================================================================
 // An ISO15693 decoder for reader commands.
 //
@@ -1465,6 +1504,38 @@ void ReaderIso15693(uint32_t parameter)
 }
 
 
+// Identify an ISO 15693 tag for hf search. The same IDENTIFY (inventory) request as in
+// ReaderIso15693, but with a short energize time. Leaves the field on.
+bool Iso15693Identify(hf_search_result_t *card)
+{
+	uint8_t answer[ISO15693_MAX_RESPONSE_LENGTH];
+
+	FpgaDownloadAndGo(FPGA_BITSTREAM_HF);
+	SetAdcMuxFor(GPIO_MUXSEL_HIPKD);
+	FpgaSetupSsc(FPGA_MAJOR_MODE_HF_READER);
+	LED_D_ON();
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_HF_READER);
+	SpinDelay(HF_SEARCH_POWERUP_MS);
+	StartCountSspClk();
+
+	BuildIdentifyRequest();
+	TransmitTo15693Tag(ToSend, ToSendMax, 0);
+	int answerLen = GetIso15693AnswerFromTag(answer, sizeof(answer), DELAY_ISO15693_VCD_TO_VICC_READER * 2);
+
+	// flags, DSFID, UID, CRC
+	if (answerLen < 12 || (answer[0] & ISO15693_RES_ERROR) || Crc(answer, 12) != ISO15693_CRC_CHECK)
+		return false;
+
+	card->protocol = HF_SEARCH_15;
+	card->uidlen = 8;
+	for (int i = 0; i < 8; i++)
+		card->uid[i] = answer[9 - i];
+	card->infolen = 1;
+	card->info[0] = answer[1];
+	return true;
+}
+
+
 // Simulate an ISO15693 TAG.
 // For Inventory command: print command and send Inventory Response with given UID
 // TODO: interpret other reader commands and send appropriate response
@@ -1505,56 +1576,136 @@ void SimTagIso15693(uint32_t parameter, uint8_t *uid)
 }
 
 
-// Since there is no standardized way of reading the AFI out of a tag, we will brute force it
-// (some manufactures offer a way to read the AFI, though)
-void BruteforceIso15693Afi(uint32_t speed)
+// answer flags of InventoryRequest
+#define INV_ANSWER     0x01
+#define INV_COLLISION  0x02
+
+typedef struct {
+	iso15693_inv_record_t records[USB_CMD_DATA_SIZE / sizeof(iso15693_inv_record_t)];
+	uint16_t count;
+	uint32_t requests;
+	uint32_t start_time;
+} inventory_ctx_t;
+
+static void InventorySendRecords(inventory_ctx_t *ctx, uint8_t status)
+{
+	cmd_send(CMD_ACK, ctx->count, status, ctx->requests, ctx->records, ctx->count * sizeof(iso15693_inv_record_t));
+	ctx->count = 0;
+}
+
+static void InventoryAddRecord(inventory_ctx_t *ctx, uint8_t afi, uint8_t *answer)
+{
+	iso15693_inv_record_t *record = &ctx->records[ctx->count++];
+	record->afi = afi;
+	memcpy(record->uid, &answer[2], 8);
+	record->dsfid = answer[1];
+	if (ctx->count == arraylen(ctx->records)) {
+		InventorySendRecords(ctx, 0);
+	}
+}
+
+// One inventory request with node's mask. Every slot with a valid answer gives a record.
+// Collided slots of a 16 slot inventory are scheduled in inv.
+static uint8_t InventoryRequest(inventory_ctx_t *ctx, iso15693_inv_t *inv, const iso15693_inv_node_t *node, bool slot1, bool use_afi, uint8_t afi)
+{
+	uint8_t req[ISO15693_INV_MAX_REQUEST];
+	uint8_t answer[ISO15693_MAX_RESPONSE_LENGTH];
+	uint8_t result = 0;
+
+	int reqlen = Iso15693InvBuildRequest(req, slot1, use_afi, afi, node);
+	CodeIso15693AsReader(req, reqlen);
+	ctx->requests++;
+
+	for (int slot = 0; slot < (slot1 ? 1 : 16); slot++) {
+		if (slot > 0) {
+			CodeIso15693AsReaderEOF();
+		}
+		TransmitTo15693Tag(ToSend, ToSendMax, ctx->start_time);
+
+		bool sof = false;
+		int answerLen = GetIso15693AnswerFromTagExt(answer, sizeof(answer), DELAY_ISO15693_VCD_TO_VICC_READER * 2, &sof);
+		ctx->start_time = GetCountSspClk() + DELAY_ISO15693_VICC_TO_VCD_READER;
+
+		if (answerLen == 12 && !(answer[0] & ISO15693_RES_ERROR) && Crc(answer, 12) == ISO15693_CRC_CHECK) {
+			InventoryAddRecord(ctx, use_afi ? afi : 0, answer);
+			result |= INV_ANSWER;
+		} else if (sof || answerLen > 0) {
+			result |= INV_COLLISION;
+			if (!slot1) Iso15693InvCollision(inv, node, slot);
+		}
+	}
+
+	return result;
+}
+
+// all tags answering the AFI (or all tags without AFI). Returns INV_xx of all requests
+static uint8_t InventoryTree(inventory_ctx_t *ctx, bool use_afi, uint8_t afi, uint8_t *status)
 {
+	iso15693_inv_t inv;
+	iso15693_inv_node_t node;
+	uint8_t result = 0;
+
+	Iso15693InvInit(&inv);
+	while (Iso15693InvNext(&inv, &node)) {
+		WDT_HIT();
+		result |= InventoryRequest(ctx, &inv, &node, false, use_afi, afi);
+	}
+	if (inv.overflow) {
+		*status |= ISO15693_INV_INCOMPLETE;
+	}
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// 16 slot inventory of all tags in the field, or the tags with the AFI.
+// With ISO15693_INV_SWEEP the AFIs are probed with single slot inventories
+// (Iso15693AfiNext order) and a full inventory is only done for AFIs with collisions.
+// The (AFI, UID, DSFID) records are sent in CMD_ACK frames: arg0 records,
+// arg1 ISO15693_INV_xx status, arg2 inventory requests sent so far.
+//-----------------------------------------------------------------------------
+void InventoryIso15693(uint32_t flags, uint8_t afi)
+{
+	inventory_ctx_t ctx;
+	ctx.count = 0;
+	ctx.requests = 0;
+	ctx.start_time = 0;
+	uint8_t status = ISO15693_INV_DONE;
+
 	LEDsoff();
 	LED_A_ON();
 
-	uint8_t data[6];
-	uint8_t recv[ISO15693_MAX_RESPONSE_LENGTH];
-	
-	int datalen=0, recvlen=0;
+	set_tracing(true);
+	clear_trace();
 
 	Iso15693InitReader();
 	StartCountSspClk();
-	
-	// first without AFI
-	// Tags should respond without AFI and with AFI=0 even when AFI is active
-
-	data[0] = ISO15693_REQ_DATARATE_HIGH | ISO15693_REQ_INVENTORY | ISO15693_REQINV_SLOT1;
-	data[1] = ISO15693_INVENTORY;
-	data[2] = 0; // mask length
-	datalen = AddCrc(data,3);
-	recvlen = SendDataTag(data, datalen, false, speed, recv, sizeof(recv), 0);
-	uint32_t start_time = GetCountSspClk() + DELAY_ISO15693_VICC_TO_VCD_READER;
-	WDT_HIT();
-	if (recvlen>=12) {
-		Dbprintf("NoAFI UID=%s", sprintUID(NULL, &recv[2]));
-	}
 
-	// now with AFI
+	bool use_afi = (flags & ISO15693_INV_AFI) && !(flags & ISO15693_INV_SWEEP);
+	uint8_t result = InventoryTree(&ctx, use_afi, afi, &status);
 
-	data[0] = ISO15693_REQ_DATARATE_HIGH | ISO15693_REQ_INVENTORY | ISO15693_REQINV_AFI | ISO15693_REQINV_SLOT1;
-	data[1] = ISO15693_INVENTORY;
-	data[2] = 0; // AFI
-	data[3] = 0; // mask length
+	if (flags & ISO15693_INV_SWEEP) {
+		// no tags at all - no AFI will answer
+		int a = result ? Iso15693AfiNext(-1, false) : -1;
+		while (a >= 0) {
+			if (BUTTON_PRESS() || usb_poll_validate_length()) {
+				status |= ISO15693_INV_ABORTED;
+				break;
+			}
+			WDT_HIT();
 
-	for (int i = 0; i < 256; i++) {
-		data[2] = i & 0xFF;
-		datalen = AddCrc(data,4);
-		recvlen = SendDataTag(data, datalen, false, speed, recv, sizeof(recv), start_time);
-		start_time = GetCountSspClk() + DELAY_ISO15693_VICC_TO_VCD_READER;
-		WDT_HIT();
-		if (recvlen >= 12) {
-			Dbprintf("AFI=%i UID=%s", i, sprintUID(NULL, &recv[2]));
+			iso15693_inv_node_t root = {0, 0};
+			result = InventoryRequest(&ctx, NULL, &root, true, true, a);
+			if (result & INV_COLLISION) {
+				InventoryTree(&ctx, true, a, &status);
+			}
+			a = Iso15693AfiNext(a, result != 0);
 		}
 	}
-	Dbprintf("AFI Bruteforcing done.");
 
-   	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
 	LEDsoff();
+
+	InventorySendRecords(&ctx, status);
 }
 
 // Allows to directly send commands to the tag via the client
@@ -12,12 +12,16 @@
 #define __ISO15693_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "hfsearch.h"
+#include "iso15693tools.h"
 
 void SnoopIso15693(void);
 void AcquireRawAdcSamplesIso15693(void);
 void ReaderIso15693(uint32_t parameter);
+bool Iso15693Identify(hf_search_result_t *card);
 void SimTagIso15693(uint32_t parameter, uint8_t *uid);
-void BruteforceIso15693Afi(uint32_t speed);
+void InventoryIso15693(uint32_t flags, uint8_t afi);
 void DirectTag15693Command(uint32_t datalen,uint32_t speed, uint32_t recv, uint8_t data[]); 
 void SetTag15693Uid(uint8_t *uid);
 void SetDebugIso15693(uint32_t flag);
@@ -413,6 +413,43 @@ OUT:
   StopTicks();
 }
 
+// Identify a LEGIC Prime tag for hf search: card type and UID (bytes 0-3).
+// Switches the field off again.
+bool LegicRfIdentify(hf_search_result_t *card) {
+  legic_card_select_t legic;
+  bool found = false;
+
+  init_reader(false);
+
+  uint8_t card_type = setup_phase(SESSION_IV);
+  if(init_card(card_type, &legic) != 0) {
+    goto OUT;
+  }
+
+  for(uint8_t i = 0; i < sizeof(legic.uid); ++i) {
+    int16_t byte = read_byte(i, legic.cmdsize);
+    if(byte == -1) {
+      goto OUT;
+    }
+    card->uid[i] = byte;
+  }
+
+  card->protocol = HF_SEARCH_LEGIC;
+  card->uidlen = sizeof(legic.uid);
+  card->infolen = 3;
+  card->info[0] = legic.tagtype;
+  card->info[1] = legic.cardsize & 0xFF;
+  card->info[2] = legic.cardsize >> 8;
+  found = true;
+
+OUT:
+  FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+  LED_B_OFF();
+  LED_D_OFF();
+  StopTicks();
+  return found;
+}
+
 void LegicRfWriter(int bytes, int offset) {
   uint8_t *BigBuf = BigBuf_get_addr();
 
@@ -12,7 +12,11 @@
 #ifndef __LEGICRF_H
 #define __LEGICRF_H
 
+#include <stdbool.h>
+#include "hfsearch.h"
+
 extern void LegicRfReader(int bytes, int offset);
 extern void LegicRfWriter(int bytes, int offset);
+extern bool LegicRfIdentify(hf_search_result_t *card);
 
 #endif /* __LEGICRF_H */
@@ -15,10 +15,13 @@
 #include "crc16.h"
 #include "string.h"
 #include "lfdemod.h"
+#include "lfsim.h"
+#include "lfwatch.h"
 #include "lfsampling.h"
 #include "protocols.h"
 #include "usb_cdc.h" // for usb_poll_validate_length
 #include "fpgaloader.h"
+#include "t55xxclone.h"
 
 /**
  * Function to do a modulation and then get samples.
@@ -435,10 +438,13 @@ void WriteTItag(uint32_t idhi, uint32_t idlo, uint16_t crc)
 	DbpString("Now use `lf ti read` to check");
 }
 
-void SimulateTagLowFrequency(int period, int gap, int ledcontrol)
+// plays the period samples in BigBuf, or the samples of the expander e
+static void SimulateTagLowFrequencyEx(int period, int gap, int ledcontrol, lfsim_expander_t *e)
 {
 	int i;
 	uint8_t *tab = BigBuf_get_addr();
+	uint8_t sample = e ? lfsimExpanderNext(e) : 0;
+	bool end = false;
 
 	//note FpgaDownloadAndGo destroys the bigbuf so be sure this is called before now...
 	//FpgaDownloadAndGo(FPGA_BITSTREAM_LF);  
@@ -472,13 +478,19 @@ void SimulateTagLowFrequency(int period, int gap, int ledcontrol)
 		if (ledcontrol)
 			LED_D_ON();
 
-		if(tab[i])
+		if(e ? (sample & 1) : tab[i])
 			OPEN_COIL();
 		else
 			SHORT_COIL();
 
 		if (ledcontrol)
 			LED_D_OFF();
+
+		// prepare the next sample while the clock is high
+		if (e) {
+			end = sample & LFSIM_PERIOD_END;
+			sample = lfsimExpanderNext(e);
+		}
 		ii=0;
 		//wait until SSC_CLK goes LOW
 		while(AT91C_BASE_PIOA->PIO_PDSR & GPIO_SSC_CLK) {
@@ -496,7 +508,7 @@ void SimulateTagLowFrequency(int period, int gap, int ledcontrol)
 		}
 
 		i++;
-		if(i == period) {
+		if(e ? end : i == period) {
 
 			i = 0;
 			if (gap) {
@@ -508,6 +520,33 @@ void SimulateTagLowFrequency(int period, int gap, int ledcontrol)
 	}
 }
 
+void SimulateTagLowFrequency(int period, int gap, int ledcontrol)
+{
+	SimulateTagLowFrequencyEx(period, gap, ledcontrol, NULL);
+}
+
+// simulate a lfsim_desc_t of len bytes, expanded symbol by symbol
+void SimulateTagLowFrequencyCompact(size_t len, int gap, uint8_t *desc, int ledcontrol)
+{
+	// set LF first, FpgaDownloadAndGo destroys the bigbuf
+	FpgaDownloadAndGo(FPGA_BITSTREAM_LF);
+	BigBuf_free();
+
+	// the command buffer is reused for the next command, keep a copy
+	if (len > USB_CMD_DATA_SIZE)
+		len = USB_CMD_DATA_SIZE;
+	uint8_t *copy = BigBuf_malloc(len);
+	lfsim_expander_t *e = (lfsim_expander_t *)BigBuf_malloc(sizeof(lfsim_expander_t));
+	memcpy(copy, desc, len);
+	if (!lfsimExpanderInit(e, (lfsim_desc_t *)copy, len)) {
+		DbpString("Invalid sim description");
+		return;
+	}
+
+	Dbprintf("Simulating type: %d, clk: %d, length: %d, gap: %d", e->desc->type, e->desc->clk, e->desc->length, gap);
+	SimulateTagLowFrequencyEx(0, gap, ledcontrol, e);
+}
+
 #define DEBUG_FRAME_CONTENTS 1
 void SimulateTagLowFrequencyBidir(int divisor, int t0)
 {
@@ -561,37 +600,6 @@ static void fc(int c, int *n)
 		}
 	}
 }
-// compose fc/X fc/Y waveform (FSKx)
-static void fcAll(uint8_t fc, int *n, uint8_t clock, uint16_t *modCnt) 
-{
-	uint8_t *dest = BigBuf_get_addr();
-	uint8_t halfFC = fc/2;
-	uint8_t wavesPerClock = clock/fc;
-	uint8_t mod = clock % fc;    //modifier
-	uint8_t modAdj = fc/mod;     //how often to apply modifier
-	bool modAdjOk = !(fc % mod); //if (fc % mod==0) modAdjOk=true;
-	// loop through clock - step field clock
-	for (uint8_t idx=0; idx < wavesPerClock; idx++){
-		// put 1/2 FC length 1's and 1/2 0's per field clock wave (to create the wave)
-		memset(dest+(*n), 0, fc-halfFC);  //in case of odd number use extra here
-		memset(dest+(*n)+(fc-halfFC), 1, halfFC);
-		*n += fc;
-	}
-	if (mod>0) (*modCnt)++;
-	if ((mod>0) && modAdjOk){  //fsk2 
-		if ((*modCnt % modAdj) == 0){ //if 4th 8 length wave in a rf/50 add extra 8 length wave
-			memset(dest+(*n), 0, fc-halfFC);
-			memset(dest+(*n)+(fc-halfFC), 1, halfFC);
-			*n += fc;
-		}
-	}
-	if (mod>0 && !modAdjOk){  //fsk1
-		memset(dest+(*n), 0, mod-(mod/2));
-		memset(dest+(*n)+(mod-(mod/2)), 1, mod/2);
-		*n += mod;
-	}
-}
-
 // prepare a waveform pattern in the buffer based on the ID given then
 // simulate a HID tag until the button is pressed
 void CmdHIDsimTAG(int hi2, int hi, int lo, int ledcontrol)
@@ -679,31 +687,16 @@ void CmdHIDsimTAG(int hi2, int hi, int lo, int ledcontrol)
 void CmdFSKsimTAG(uint16_t arg1, uint16_t arg2, size_t size, uint8_t *BitStream)
 {
 	int ledcontrol=1;
-	int n=0, i=0;
 	uint8_t fcHigh = arg1 >> 8;
 	uint8_t fcLow = arg1 & 0xFF;
-	uint16_t modCnt = 0;
 	uint8_t clk = arg2 & 0xFF;
 	uint8_t invert = (arg2 >> 8) & 1;
 
 	// set LF so we don't kill the bigbuf we are setting with simulation data.
 	FpgaDownloadAndGo(FPGA_BITSTREAM_LF);
 
-	for (i=0; i<size; i++){
-		if (BitStream[i] == invert){
-			fcAll(fcLow, &n, clk, &modCnt);
-		} else {
-			fcAll(fcHigh, &n, clk, &modCnt);
-		}
-	}
+	int n = fskSimWave(BigBuf_get_addr(), BIGBUF_SIZE, BitStream, size, fcHigh, fcLow, clk, invert);
 	Dbprintf("Simulating with fcHigh: %d, fcLow: %d, clk: %d, invert: %d, n: %d",fcHigh, fcLow, clk, invert, n);
-	/*Dbprintf("DEBUG: First 32:");
-	uint8_t *dest = BigBuf_get_addr();
-	i=0;
-	Dbprintf("%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d", dest[i],dest[i+1],dest[i+2],dest[i+3],dest[i+4],dest[i+5],dest[i+6],dest[i+7],dest[i+8],dest[i+9],dest[i+10],dest[i+11],dest[i+12],dest[i+13],dest[i+14],dest[i+15]);
-	i+=16;
-	Dbprintf("%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d", dest[i],dest[i+1],dest[i+2],dest[i+3],dest[i+4],dest[i+5],dest[i+6],dest[i+7],dest[i+8],dest[i+9],dest[i+10],dest[i+11],dest[i+12],dest[i+13],dest[i+14],dest[i+15]);
-	*/
 	if (ledcontrol)
 		LED_A_ON();
 
@@ -713,52 +706,10 @@ void CmdFSKsimTAG(uint16_t arg1, uint16_t arg2, size_t size, uint8_t *BitStream)
 		LED_A_OFF();
 }
 
-// compose ask waveform for one bit(ASK)
-static void askSimBit(uint8_t c, int *n, uint8_t clock, uint8_t manchester)
-{
-	uint8_t *dest = BigBuf_get_addr();
-	uint8_t halfClk = clock/2;
-	// c = current bit 1 or 0
-	if (manchester==1){
-		memset(dest+(*n), c, halfClk);
-		memset(dest+(*n) + halfClk, c^1, halfClk);
-	} else {
-		memset(dest+(*n), c, clock);
-	}
-	*n += clock;
-}
-
-static void biphaseSimBit(uint8_t c, int *n, uint8_t clock, uint8_t *phase)
-{
-	uint8_t *dest = BigBuf_get_addr();
-	uint8_t halfClk = clock/2;
-	if (c){
-		memset(dest+(*n), c ^ 1 ^ *phase, halfClk);
-		memset(dest+(*n) + halfClk, c ^ *phase, halfClk);
-	} else {
-		memset(dest+(*n), c ^ *phase, clock);
-		*phase ^= 1;
-	}
-	*n += clock;
-}
-
-static void stAskSimBit(int *n, uint8_t clock) {
-	uint8_t *dest = BigBuf_get_addr();
-	uint8_t halfClk = clock/2;
-	//ST = .5 high .5 low 1.5 high .5 low 1 high	
-	memset(dest+(*n), 1, halfClk);
-	memset(dest+(*n) + halfClk, 0, halfClk);
-	memset(dest+(*n) + clock, 1, clock + halfClk);
-	memset(dest+(*n) + clock*2 + halfClk, 0, halfClk);
-	memset(dest+(*n) + clock*3, 1, clock);
-	*n += clock*4;
-}
-
 // args clock, ask/man or askraw, invert, transmission separator
 void CmdASKsimTag(uint16_t arg1, uint16_t arg2, size_t size, uint8_t *BitStream)
 {
 	int ledcontrol = 1;
-	int n=0, i=0;
 	uint8_t clk = (arg1 >> 8) & 0xFF;
 	uint8_t encoding = arg1 & 0xFF;
 	uint8_t separator = arg2 & 1;
@@ -767,95 +718,28 @@ void CmdASKsimTag(uint16_t arg1, uint16_t arg2, size_t size, uint8_t *BitStream)
 	// set LF so we don't kill the bigbuf we are setting with simulation data.
 	FpgaDownloadAndGo(FPGA_BITSTREAM_LF);
 
-	if (encoding==2){  //biphase
-		uint8_t phase=0;
-		for (i=0; i<size; i++){
-			biphaseSimBit(BitStream[i]^invert, &n, clk, &phase);
-		}
-		if (phase==1) { //run a second set inverted to keep phase in check
-			for (i=0; i<size; i++){
-				biphaseSimBit(BitStream[i]^invert, &n, clk, &phase);
-			}
-		}
-	} else {  // ask/manchester || ask/raw
-		for (i=0; i<size; i++){
-			askSimBit(BitStream[i]^invert, &n, clk, encoding);
-		}
-		if (encoding==0 && BitStream[0]==BitStream[size-1]){ //run a second set inverted (for ask/raw || biphase phase)
-			for (i=0; i<size; i++){
-				askSimBit(BitStream[i]^invert^1, &n, clk, encoding);
-			}
-		}
-	}
-	if (separator==1 && encoding == 1)
-		stAskSimBit(&n, clk);
-	else if (separator==1)
+	int n = askSimWave(BigBuf_get_addr(), BIGBUF_SIZE, BitStream, size, clk, encoding, invert, separator);
+	if (separator==1 && encoding != LFSIM_ASK_MANCHESTER)
 		Dbprintf("sorry but separator option not yet available");
 
 	Dbprintf("Simulating with clk: %d, invert: %d, encoding: %d, separator: %d, n: %d",clk, invert, encoding, separator, n);
-	//DEBUG
-	//Dbprintf("First 32:");
-	//uint8_t *dest = BigBuf_get_addr();
-	//i=0;
-	//Dbprintf("%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d", dest[i],dest[i+1],dest[i+2],dest[i+3],dest[i+4],dest[i+5],dest[i+6],dest[i+7],dest[i+8],dest[i+9],dest[i+10],dest[i+11],dest[i+12],dest[i+13],dest[i+14],dest[i+15]);
-	//i+=16;
-	//Dbprintf("%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d", dest[i],dest[i+1],dest[i+2],dest[i+3],dest[i+4],dest[i+5],dest[i+6],dest[i+7],dest[i+8],dest[i+9],dest[i+10],dest[i+11],dest[i+12],dest[i+13],dest[i+14],dest[i+15]);
-	
 	if (ledcontrol) LED_A_ON();
 	SimulateTagLowFrequency(n, 0, ledcontrol);
 	if (ledcontrol) LED_A_OFF();
 }
 
-//carrier can be 2,4 or 8
-static void pskSimBit(uint8_t waveLen, int *n, uint8_t clk, uint8_t *curPhase, bool phaseChg)
-{
-	uint8_t *dest = BigBuf_get_addr();
-	uint8_t halfWave = waveLen/2;
-	//uint8_t idx;
-	int i = 0;
-	if (phaseChg){
-		// write phase change
-		memset(dest+(*n), *curPhase^1, halfWave);
-		memset(dest+(*n) + halfWave, *curPhase, halfWave);
-		*n += waveLen;
-		*curPhase ^= 1;
-		i += waveLen;
-	}
-	//write each normal clock wave for the clock duration
-	for (; i < clk; i+=waveLen){
-		memset(dest+(*n), *curPhase, halfWave);
-		memset(dest+(*n) + halfWave, *curPhase^1, halfWave);
-		*n += waveLen;
-	}
-}
-
 // args clock, carrier, invert,
 void CmdPSKsimTag(uint16_t arg1, uint16_t arg2, size_t size, uint8_t *BitStream)
 {
 	int ledcontrol=1;
-	int n=0, i=0;
 	uint8_t clk = arg1 >> 8;
 	uint8_t carrier = arg1 & 0xFF;
 	uint8_t invert = arg2 & 0xFF;
-	uint8_t curPhase = 0;
 	// set LF so we don't kill the bigbuf we are setting with simulation data.
 	FpgaDownloadAndGo(FPGA_BITSTREAM_LF);
 
-	for (i=0; i<size; i++){
-		if (BitStream[i] == curPhase){
-			pskSimBit(carrier, &n, clk, &curPhase, false);
-		} else {
-			pskSimBit(carrier, &n, clk, &curPhase, true);
-		}
-	}
+	int n = pskSimWave(BigBuf_get_addr(), BIGBUF_SIZE, BitStream, size, carrier, clk, invert);
 	Dbprintf("Simulating with Carrier: %d, clk: %d, invert: %d, n: %d",carrier, clk, invert, n);
-	//Dbprintf("DEBUG: First 32:");
-	//uint8_t *dest = BigBuf_get_addr();
-	//i=0;
-	//Dbprintf("%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d", dest[i],dest[i+1],dest[i+2],dest[i+3],dest[i+4],dest[i+5],dest[i+6],dest[i+7],dest[i+8],dest[i+9],dest[i+10],dest[i+11],dest[i+12],dest[i+13],dest[i+14],dest[i+15]);
-	//i+=16;
-	//Dbprintf("%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d", dest[i],dest[i+1],dest[i+2],dest[i+3],dest[i+4],dest[i+5],dest[i+6],dest[i+7],dest[i+8],dest[i+9],dest[i+10],dest[i+11],dest[i+12],dest[i+13],dest[i+14],dest[i+15]);
-		   
 	if (ledcontrol) LED_A_ON();
 	SimulateTagLowFrequency(n, 0, ledcontrol);
 	if (ledcontrol) LED_A_OFF();
@@ -1188,6 +1072,103 @@ void CmdIOdemodFSK(int findone, int *high, int *low, int ledcontrol)
 	if (ledcontrol) LED_A_OFF();
 }
 
+/**
+* Watches for HID, AWID, ioProx and EM410x tags at once. The DMA samples into a
+* ring without pause. Each completed chunk runs the demod of the next protocol
+* over its window of the last chunks (see lfWatchDemod), so a single run covers
+* 5 or 8 chunks of one protocol instead of all of them. A demod that takes
+* longer than the two chunks the DMA has queued stops the sampling. The protocol
+* in turn then waits for a full window again, the others don't run meanwhile.
+* New credentials go out in CMD_LF_WATCH_RECORDS arg0 = records, arg1 = sample.
+* Ends with CMD_ACK arg0 = samples, arg1 = demod runs, arg2 = DMA restarts and
+* lfwatch_stats_t. Samples count the time the DMA was stopped too.
+* @param protocols - mask of 1 << LFWATCH_xxx
+* @param findone - stop after the first credential
+**/
+void CmdLFWatch(uint32_t protocols, int findone, int ledcontrol)
+{
+	lfwatch_t watch;
+	lfwatch_record_t rec[LFWATCH_MAX_RECORDS];
+	lfwatch_stats_t stats = {0, 0};
+	lfWatchInit(&watch, protocols ? protocols : LFWATCH_ALL);
+
+	// Configure to go in 125Khz listen mode
+	LFSetupFPGAForADC(95, true);
+	StartTicks();
+
+	BigBuf_free();
+	uint8_t *ring = BigBuf_malloc(LFWATCH_RING_CHUNKS * LFWATCH_CHUNK_SIZE);
+	uint8_t *work = BigBuf_malloc(LFWATCH_WINDOW_CHUNKS * LFWATCH_CHUNK_SIZE);
+
+	// head - chunks completed by the DMA, the DMA fills chunk head and has head + 1 queued.
+	// contiguous - completed chunks before head without a gap
+	uint32_t head = 0, contiguous = 0;
+	uint32_t demods = 0, restarts = 0;
+	// sample - samples since the start, lost ones included. 12 ticks per sample at 125kHz
+	uint32_t sample = 0, chunkTicks = GetTicks();
+
+	if (ledcontrol) LED_A_ON();
+	FpgaSetupSscDma(ring, LFWATCH_CHUNK_SIZE);
+	AT91C_BASE_PDC_SSC->PDC_RNPR = (uint32_t) (ring + LFWATCH_CHUNK_SIZE);
+
+	while(!BUTTON_PRESS() && !usb_poll_validate_length()) {
+		WDT_HIT();
+		if (AT91C_BASE_SSC->SSC_SR & AT91C_SSC_TXRDY) {
+			AT91C_BASE_SSC->SSC_THR = 0x43;
+		}
+
+		if (AT91C_BASE_PDC_SSC->PDC_RNCR != 0) continue;
+
+		// both buffers done, the DMA stopped while we were demodulating. What came after them is lost
+		bool stopped = (AT91C_BASE_PDC_SSC->PDC_RCR == 0);
+		uint32_t now = GetTicks();
+		head += stopped ? 2 : 1;
+		contiguous += stopped ? 2 : 1;
+		if (contiguous > LFWATCH_WINDOW_CHUNKS)
+			contiguous = LFWATCH_WINDOW_CHUNKS;
+		if (stopped) {
+			restarts++;
+			FpgaSetupSscDma(ring + (head % LFWATCH_RING_CHUNKS) * LFWATCH_CHUNK_SIZE, LFWATCH_CHUNK_SIZE);
+			// the two chunks were sampled from the last chunk on, the rest of the time is lost
+			uint32_t elapsed = (now - chunkTicks) / 12;
+			if (elapsed > 2 * LFWATCH_CHUNK_SIZE) {
+				stats.lost += elapsed - 2 * LFWATCH_CHUNK_SIZE;
+				sample += elapsed - 2 * LFWATCH_CHUNK_SIZE;
+			}
+		}
+		sample += (stopped ? 2 : 1) * LFWATCH_CHUNK_SIZE;
+		chunkTicks = now;
+		AT91C_BASE_PDC_SSC->PDC_RNPR = (uint32_t) (ring + ((head + 1) % LFWATCH_RING_CHUNKS) * LFWATCH_CHUNK_SIZE);
+		AT91C_BASE_PDC_SSC->PDC_RNCR = LFWATCH_CHUNK_SIZE;
+
+		if (contiguous >= LFWATCH_MIN_CHUNKS) {
+			int n = lfWatchDemod(&watch, ring, LFWATCH_RING_CHUNKS * LFWATCH_CHUNK_SIZE, (head % LFWATCH_RING_CHUNKS) * LFWATCH_CHUNK_SIZE,
+				contiguous * LFWATCH_CHUNK_SIZE, work, sample, rec, LFWATCH_MAX_RECORDS);
+			if (n >= 0) {
+				uint32_t us = (GetTicks() - now) * 2 / 3;
+				if (us > stats.maxDemod)
+					stats.maxDemod = us;
+				demods++;
+			}
+			if (n > 0) {
+				LED_B_ON();
+				cmd_send(CMD_LF_WATCH_RECORDS, n, sample, 0, rec, n * sizeof(lfwatch_record_t));
+				LED_B_OFF();
+				if (findone) break;
+			}
+		}
+		// the next chunk doesn't follow the window
+		if (stopped)
+			contiguous = 0;
+	}
+
+	AT91C_BASE_PDC_SSC->PDC_PTCR = AT91C_PDC_RXTDIS;
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	if (ledcontrol) LED_A_OFF();
+	BigBuf_free();
+	cmd_send(CMD_ACK, sample, demods, restarts, &stats, sizeof(stats));
+}
+
 /*------------------------------
  * T5555/T5557/T5567/T5577 routines
  *------------------------------
@@ -1453,42 +1434,202 @@ void WriteT55xx(uint32_t *blockdata, uint8_t startblock, uint8_t numblocks) {
 	}
 }
 
-// Copy a HID-like card (e.g. HID Proximity, Paradox) to a T55x7 compatible card
-void CopyHIDtoT55x7(uint32_t hi2, uint32_t hi, uint32_t lo, uint8_t longFMT, uint8_t preamble) {
-	uint32_t data[] = {0,0,0,0,0,0,0};
-	uint8_t last_block = 0;
+/*-------------- Bulk cloning -----------*/
 
-	if (longFMT) {
-		// Ensure no more than 84 bits supplied
-		if (hi2>0xFFFFF) {
-			DbpString("Tags can only have 84 bits.");
-			return;
+#define T55XX_CLONE_PROBE_SAMPLES  2048    // capture to see if a tag is in the field
+#define T55XX_CLONE_GONE_POLLS     3       // polls without a tag before the next card is accepted
+#define T55XX_CLONE_RESET_MS       50      // field off after the write, the tag restarts with the new config
+#define T55XX_CLONE_POR_MS         70      // extra wait for tags with POR delay set
+#define T55XX_CLONE_ATTEMPTS       2
+#define T55XX_CLONE_MAX_ERR        20
+
+static bool T55xxCloneTagPresent(void) {
+	DoPartialAcquisition(0, true, T55XX_CLONE_PROBE_SAMPLES, 0);
+	return !justNoise(BigBuf_get_addr(), T55XX_CLONE_PROBE_SAMPLES);
+}
+
+// demodulated bits contain the repeating blocks 1..maxblock at some offset, maybe inverted.
+// error bits (7) are skipped. compared - number of bits compared
+static bool T55xxCloneMatch(uint8_t *bits, size_t len, uint8_t *expect, uint16_t cycle, uint16_t *compared) {
+	for (uint16_t offset = 0; offset < cycle; offset++) {
+		for (uint8_t inv = 0; inv < 2; inv++) {
+			uint16_t good = 0;
+			size_t i;
+			for (i = 0; i < len; i++) {
+				if (bits[i] > 1) continue;
+				if (bits[i] != (expect[(offset + i) % cycle] ^ inv)) break;
+				good++;
+			}
+			if (i == len && good >= cycle) {
+				*compared = good;
+				return true;
+			}
 		}
-		// Build the 6 data blocks for supplied 84bit ID
-		last_block = 6;
-		// load preamble & long format identifier (9E manchester encoded)
-		data[1] = (preamble << 24) | 0x96A900 | (manchesterEncode2Bytes((hi2 >> 16) & 0xF) & 0xFF);
-		// load raw id from hi2, hi, lo to data blocks (manchester encoded)
-		data[2] = manchesterEncode2Bytes(hi2 & 0xFFFF);
-		data[3] = manchesterEncode2Bytes(hi >> 16);
-		data[4] = manchesterEncode2Bytes(hi & 0xFFFF);
-		data[5] = manchesterEncode2Bytes(lo >> 16);
-		data[6] = manchesterEncode2Bytes(lo & 0xFFFF);
-	} else {
-		// Ensure no more than 44 bits supplied
-		if (hi>0xFFF) {
-			DbpString("Tags can only have 44 bits.");
-			return;
+	}
+	return false;
+}
+
+// reads the regular read stream of the tag and compares it with the blocks it sends
+// according to the new block 0 (T55x7 layout only)
+static uint8_t T55xxCloneVerify(uint32_t *blocks, uint8_t numblocks, uint16_t *compared) {
+	static const uint8_t rates[] = {8, 16, 32, 40, 50, 64, 100, 128};
+	uint32_t block0 = blocks[0];
+	uint8_t rate = rates[(block0 >> 18) & 0x7];
+	uint8_t modulation = (block0 >> 12) & 0x1F;
+	uint8_t maxBlock = (block0 >> 5) & 0x7;
+	bool xMode = block0 & (1 << 17);
+	bool aor = block0 & (1 << 9);
+	bool st = block0 & (1 << 3);
+	bool por = block0 & (1 << 0);
+
+	*compared = 0;
+	if (xMode || aor || st || maxBlock == 0 || maxBlock >= numblocks)
+		return T55XX_CLONE_UNVERIFIED;
+
+	uint8_t expect[(T55XX_CLONE_MAX_BLOCKS - 1) * 32];
+	uint16_t cycle = maxBlock * 32;
+	for (uint16_t i = 0; i < cycle; i++)
+		expect[i] = (blocks[1 + i / 32] >> (31 - i % 32)) & 1;
+
+	// at least one full cycle after the demod found its start
+	size_t size = (cycle + 64) * rate + 1024;
+	if (size > BigBuf_max_traceLen() - T55XX_CLONE_JOB_SIZE) size = BigBuf_max_traceLen() - T55XX_CLONE_JOB_SIZE;
+
+	// power cycle, the tag starts sending with the new config
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	WaitMS(T55XX_CLONE_RESET_MS);
+	LFSetupFPGAForADC(95, true);
+	if (por) WaitMS(T55XX_CLONE_POR_MS);
+	DoPartialAcquisition(0, true, size, 0);
+
+	uint8_t *dest = BigBuf_get_addr();
+	int clk = rate, invert = 0, startIdx = 0, errCnt = -1;
+	switch (modulation) {
+		case 0:    // direct
+			errCnt = nrzRawDemod(dest, &size, &clk, &invert, &startIdx);
+			break;
+		case 1:    // PSK1
+		case 2:    // PSK2
+			errCnt = pskRawDemod_ext(dest, &size, &clk, &invert, &startIdx);
+			if (errCnt >= 0 && modulation == 2)
+				psk1TOpsk2(dest, size);
+			break;
+		case 4:    // FSK1  RF/8 RF/5
+		case 5:    // FSK2  RF/8 RF/10
+		case 6:    // FSK1a RF/5 RF/8
+		case 7: {  // FSK2a RF/10 RF/8
+			uint8_t fcHigh = (modulation & 1) ? 10 : 8;
+			uint8_t fcLow = (modulation & 1) ? 8 : 5;
+			int n = fskdemod(dest, size, rate, 0, fcHigh, fcLow, &startIdx);
+			errCnt = (n > 0) ? 0 : -1;
+			size = (n > 0) ? n : 0;
+			break;
+		}
+		case 8:    // manchester
+			errCnt = askdemod_ext(dest, &size, &clk, &invert, T55XX_CLONE_MAX_ERR, 0, 1, &startIdx);
+			break;
+		case 0x10: // biphase
+			errCnt = askdemod_ext(dest, &size, &clk, &invert, T55XX_CLONE_MAX_ERR, 0, 0, &startIdx);
+			if (errCnt >= 0) {
+				int offset = 0;
+				errCnt = BiphaseRawDecode(dest, &size, &offset, invert);
+			}
+			break;
+		default:
+			return T55XX_CLONE_UNVERIFIED;
+	}
+
+	if (errCnt < 0 || size < cycle)
+		return T55XX_CLONE_NO_SIGNAL;
+	if (!T55xxCloneMatch(dest, size, expect, cycle, compared))
+		return T55XX_CLONE_MISMATCH;
+	return T55XX_CLONE_OK;
+}
+
+/*
+ * Programs the cards of the job uploaded to the start of BigBuf one after the other.
+ * Waits for every card to be placed on the antenna, writes it, reads it back
+ * and reports a t55xx_clone_result_t. Ends after the last card, on button press or usb command.
+ */
+void T55xxCloneBatch(uint16_t cards, uint8_t flags) {
+	t55xx_clone_result_t result;
+	// out of the way of the verification samples, BigBuf is more than twice the job size
+	uint8_t *job = BigBuf_get_addr() + BigBuf_max_traceLen() - T55XX_CLONE_JOB_SIZE;
+	memcpy(job, BigBuf_get_addr(), T55XX_CLONE_JOB_SIZE);
+	uint32_t pos = 0;
+	uint16_t card = 0;
+	bool userCancelled = false;
+
+	LEDsoff();
+	LFSetupFPGAForADC(95, true);
+	StartTicks();
+
+	for (card = 0; card < cards; card++) {
+		uint32_t blocks[T55XX_CLONE_MAX_BLOCKS];
+		uint8_t numblocks = (pos < T55XX_CLONE_JOB_SIZE) ? job[pos] : 0;
+		memset(&result, 0, sizeof(result));
+		result.card = card;
+		if (numblocks == 0 || numblocks > T55XX_CLONE_MAX_BLOCKS || pos + 1 + numblocks * 4 > T55XX_CLONE_JOB_SIZE) {
+			// the records after it can't be found either
+			result.status = T55XX_CLONE_BAD_RECORD;
+			cmd_send(CMD_ACK, 1, card, 0, &result, sizeof(result));
+			break;
 		}
-		// Build the 3 data blocks for supplied 44bit ID
-		last_block = 3;
-		// load preamble
-		data[1] = (preamble << 24) | (manchesterEncode2Bytes(hi) & 0xFFFFFF);
-		data[2] = manchesterEncode2Bytes(lo >> 16);
-		data[3] = manchesterEncode2Bytes(lo & 0xFFFF);
+		memcpy(blocks, job + pos + 1, numblocks * 4);
+		pos += 1 + numblocks * 4;
+		result.block0 = blocks[0];
+
+		// the previous tag has to leave the field before the next one counts
+		bool waitRemoval = (card > 0);
+		uint8_t empty = 0;
+		LED_A_ON();
+		for (;;) {
+			WDT_HIT();
+			userCancelled = BUTTON_PRESS() || usb_poll_validate_length();
+			if (userCancelled) break;
+			bool present = T55xxCloneTagPresent();
+			if (waitRemoval) {
+				empty = present ? 0 : empty + 1;
+				if (empty >= T55XX_CLONE_GONE_POLLS) waitRemoval = false;
+			} else if (present) {
+				break;
+			}
+		}
+		LED_A_OFF();
+		if (userCancelled) break;
+
+		uint32_t start = GetTickCount();
+		LED_B_ON();
+		do {
+			WriteT55xx(blocks, 0, numblocks);
+			result.attempts++;
+			if (flags & T55XX_CLONE_NOVERIFY) {
+				result.status = T55XX_CLONE_UNVERIFIED;
+				break;
+			}
+			result.status = T55xxCloneVerify(blocks, numblocks, &result.bits);
+		} while ((result.status == T55XX_CLONE_MISMATCH || result.status == T55XX_CLONE_NO_SIGNAL) && result.attempts < T55XX_CLONE_ATTEMPTS);
+		LED_B_OFF();
+		result.time = GetTickCount() - start;
+		cmd_send(CMD_ACK, 1, card, 0, &result, sizeof(result));
+
+		// field back on to see the tag leave
+		LFSetupFPGAForADC(95, true);
+	}
+
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	LEDsoff();
+	cmd_send(CMD_ACK, userCancelled ? 0xFF : 0, card, 0, NULL, 0);
+}
+
+// Copy a HID-like card (e.g. HID Proximity, Paradox) to a T55x7 compatible card
+void CopyHIDtoT55x7(uint32_t hi2, uint32_t hi, uint32_t lo, uint8_t longFMT, uint8_t preamble) {
+	uint32_t data[] = {0,0,0,0,0,0,0};
+	uint8_t numblocks = HIDtoT55x7Blocks(hi2, hi, lo, longFMT, preamble, data);
+	if (numblocks == 0) {
+		DbpString(longFMT ? "Tags can only have 84 bits." : "Tags can only have 44 bits.");
+		return;
 	}
-	// load chip config block
-	data[0] = T55x7_BITRATE_RF_50 | T55x7_MODULATION_FSK2a | last_block << T55x7_MAXBLOCK_SHIFT;
 
 	//TODO add selection of chip for Q5 or T55x7
 	// data[0] = (((50-2)/2)<<T5555_BITRATE_SHIFT) | T5555_MODULATION_FSK2 | T5555_INVERT_OUTPUT | last_block << T5555_MAXBLOCK_SHIFT;
@@ -1496,7 +1637,7 @@ void CopyHIDtoT55x7(uint32_t hi2, uint32_t hi, uint32_t lo, uint8_t longFMT, uin
 	LED_D_ON();
 	// Program the data blocks for supplied ID
 	// and the block 0 for HID format
-	WriteT55xx(data, 0, last_block+1);
+	WriteT55xx(data, 0, numblocks);
 
 	LED_D_OFF();
 
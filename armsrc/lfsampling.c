@@ -11,10 +11,11 @@
 #include "util.h"
 #include "string.h"
 #include "lfsampling.h"
-#include "usb_cdc.h"	// for usb_poll_validate_length
+#include "usb_cdc.h"	// for usb_poll_validate_length, usb_tx_free
 #include "fpgaloader.h"
+#include "lfcompress.h"
 
-sample_config config = { 1, 8, 1, 95, 0, 0 } ;
+sample_config config = { 1, 8, 1, 95, 0, 0, 0 } ;
 
 void printConfig()
 {
@@ -25,6 +26,7 @@ void printConfig()
 	Dbprintf("  [a] averaging:         %d ", config.averaging);
 	Dbprintf("  [t] trigger threshold: %d ", config.trigger_threshold);
 	Dbprintf("  [s] samples to skip:   %d ", config.samples_to_skip);
+	Dbprintf("  [c] compress:          %d ", config.compress);
 }
 
 
@@ -35,7 +37,7 @@ void printConfig()
  * Other functions may read samples and ignore the sampling config,
  * such as functions to read the UID from a prox tag or similar.
  *
- * Values set to '0' implies no change (except for averaging, threshold, samples_to_skip)
+ * Values set to '0' implies no change (except for averaging, threshold, samples_to_skip, compress)
  * @brief setSamplingConfig
  * @param sc
  */
@@ -46,6 +48,7 @@ void setSamplingConfig(sample_config *sc)
 	if(sc->decimation!= 0) config.decimation= sc->decimation;
 	if(sc->trigger_threshold != -1) config.trigger_threshold= sc->trigger_threshold;
 	if(sc->samples_to_skip != -1) config.samples_to_skip = sc->samples_to_skip;
+	if(sc->compress != -1) config.compress = sc->compress;
 
 	config.averaging= sc->averaging;
 	if(config.bits_per_sample > 8)	config.bits_per_sample = 8;
@@ -59,6 +62,19 @@ sample_config* getSamplingConfig()
 	return &config;
 }
 
+/**
+ * @brief Sampling config of the capture in BigBuf. Sent with the download, so the
+ * client knows how to unpack it. compress is only set if BigBuf starts with the tag
+ * of a compressed capture, whatever wrote BigBuf last.
+ */
+sample_config* getCaptureConfig()
+{
+	static sample_config capture;
+	capture = config;
+	capture.compress = memcmp(BigBuf_get_addr(), LFCOMPRESS_TAG, LFCOMPRESS_TAG_LEN) == 0;
+	return &capture;
+}
+
 typedef struct {
 	uint8_t * buffer;
 	uint32_t numbits;
@@ -119,12 +135,15 @@ void LFSetupFPGAForADC(int divisor, bool lf_field)
  * @param trigger_threshold - a threshold. The sampling won't commence until this threshold has been reached. Set
  * to -1 to ignore threshold.
  * @param silent - is true, now outputs are made. If false, dbprints the status
+ * @param compress - 8 bits/sample only. Samples are compressed (common/lfcompress.c) while sampling, bufsize
+ * is then the number of samples (0 - until BigBuf is full)
  * @return the number of bits occupied by the samples.
  */
-uint32_t DoAcquisition(uint8_t decimation, uint32_t bits_per_sample, bool averaging, int trigger_threshold, bool silent, int bufsize, int cancel_after, int samples_to_skip)
+uint32_t DoAcquisition(uint8_t decimation, uint32_t bits_per_sample, bool averaging, int trigger_threshold, bool silent, int bufsize, int cancel_after, int samples_to_skip, bool compress)
 {
 	//.
 	uint8_t *dest = BigBuf_get_addr();
+	int max_samples = bufsize;
 	bufsize = (bufsize > 0 && bufsize < BigBuf_max_traceLen()) ? bufsize : BigBuf_max_traceLen();
 
 	//memset(dest, 0, bufsize); //creates issues with cmdread (marshmellow)
@@ -134,6 +153,16 @@ uint32_t DoAcquisition(uint8_t decimation, uint32_t bits_per_sample, bool averag
 
 	if(decimation < 1) decimation = 1;
 
+	compress = compress && bits_per_sample == 8;
+	// without a sample count a compressed capture stops at twice the uncompressed length
+	if(compress && max_samples <= 0) max_samples = 2 * BigBuf_max_traceLen();
+	if(compress && max_samples > LFCOMPRESS_MAX_SAMPLES) max_samples = LFCOMPRESS_MAX_SAMPLES;
+	lfcompress_t packer;
+	if(compress) {
+		memcpy(dest, LFCOMPRESS_TAG, LFCOMPRESS_TAG_LEN);
+		lfCompressInit(&packer, dest + LFCOMPRESS_TAG_LEN, BigBuf_max_traceLen() - LFCOMPRESS_TAG_LEN);
+	}
+
 	// Use a bit stream to handle the output
 	BitstreamOut data = { dest , 0, 0};
 	int sample_counter = 0;
@@ -186,6 +215,12 @@ uint32_t DoAcquisition(uint8_t decimation, uint32_t bits_per_sample, bool averag
 				sample_sum =0;
 			}
 			//Store the sample
+			if(compress){
+				if(!lfCompressPush(&packer, sample)) break;
+				sample_total_saved ++;
+				if(sample_total_saved >= max_samples) break;
+				continue;
+			}
 			sample_total_saved ++;
 			if(bits_per_sample == 8){
 				dest[sample_total_saved-1] = sample;
@@ -207,9 +242,14 @@ uint32_t DoAcquisition(uint8_t decimation, uint32_t bits_per_sample, bool averag
 		}
 	}
 
+	if(compress)
+		data.numbits = (LFCOMPRESS_TAG_LEN + lfCompressFinish(&packer)) << 3;
+
 	if(!silent)
 	{
 		Dbprintf("Done, saved %d out of %d seen samples at %d bits/sample",sample_total_saved, sample_total_numbers,bits_per_sample);
+		if(compress)
+			Dbprintf("compressed to %d bytes", data.numbits >> 3);
 		Dbprintf("buffer samples: %02x %02x %02x %02x %02x %02x %02x %02x ...",
 					dest[0], dest[1], dest[2], dest[3], dest[4], dest[5], dest[6], dest[7]);
 	}
@@ -225,7 +265,7 @@ uint32_t DoAcquisition(uint8_t decimation, uint32_t bits_per_sample, bool averag
  */
 uint32_t DoAcquisition_default(int trigger_threshold, bool silent)
 {
-	return DoAcquisition(1,8,0,trigger_threshold,silent,0,0,0);
+	return DoAcquisition(1,8,0,trigger_threshold,silent,0,0,0,false);
 }
 uint32_t DoAcquisition_config(bool silent, int sample_size)
 {
@@ -236,11 +276,12 @@ uint32_t DoAcquisition_config(bool silent, int sample_size)
 				  ,silent
 				  ,sample_size
 				  ,0
-				  ,config.samples_to_skip);
+				  ,config.samples_to_skip
+				  ,config.compress);
 }
 
 uint32_t DoPartialAcquisition(int trigger_threshold, bool silent, int sample_size, int cancel_after) {
-	return DoAcquisition(1,8,0,trigger_threshold,silent,sample_size,cancel_after,0);
+	return DoAcquisition(1,8,0,trigger_threshold,silent,sample_size,cancel_after,0,false);
 }
 
 uint32_t ReadLF(bool activeField, bool silent, int sample_size)
@@ -273,6 +314,102 @@ uint32_t SnoopLF()
 	return ret;
 }
 
+/**
+* Streams the samples to the client until button press or usb command.
+* The DMA fills a ring of LF_STREAM_CHUNKS chunks while the finished chunks go
+* over USB, CMD_LF_STREAMED_ADC_SAMPLES arg0 = index of the first sample,
+* arg1 = samples, arg2 = compressed bytes (0 - raw samples).
+* If USB can't keep up, the oldest chunk is dropped and the client sees a gap in arg0.
+* Ends with CMD_ACK arg0 = samples sent, arg1 = samples dropped, arg2 = DMA restarts
+* (SSC overruns, lost samples of unknown count).
+* @param activeField - field on (reader) or off (snoop)
+* @param max_samples - stop after this many samples. 0 - no limit
+**/
+#define LF_STREAM_CHUNKS      8
+#define LF_STREAM_CHUNK_SIZE  4096
+#define LF_STREAM_FRAMES      (LF_STREAM_CHUNK_SIZE / USB_CMD_DATA_SIZE)
+void StreamLF(bool activeField, uint32_t max_samples)
+{
+	printConfig();
+	LFSetupFPGAForADC(config.divisor, activeField);
+
+	BigBuf_free();
+	uint8_t *ring = BigBuf_malloc(LF_STREAM_CHUNKS * LF_STREAM_CHUNK_SIZE);
+	uint8_t *packed = BigBuf_malloc(USB_CMD_DATA_SIZE);
+	lfcompress_t packer;
+
+	// chunks are counted from the start. head - chunks completed by the DMA, tail - chunks sent.
+	// the DMA fills chunk head and has head + 1 queued.
+	uint32_t head = 0, tail = 0;
+	uint8_t frame = 0;              // next frame in chunk tail
+	uint32_t sent = 0, lost = 0, restarts = 0;
+
+	LED_A_ON();
+	FpgaSetupSscDma(ring, LF_STREAM_CHUNK_SIZE);
+	AT91C_BASE_PDC_SSC->PDC_RNPR = (uint32_t) (ring + LF_STREAM_CHUNK_SIZE);
+
+	while(!BUTTON_PRESS() && !usb_poll_validate_length()) {
+		WDT_HIT();
+		if (AT91C_BASE_SSC->SSC_SR & AT91C_SSC_TXRDY) {
+			AT91C_BASE_SSC->SSC_THR = 0x43;
+		}
+
+		if (AT91C_BASE_PDC_SSC->PDC_RNCR == 0) {
+			// both buffers done, the DMA stopped while we were sending. Start again with a fresh pair
+			bool stopped = (AT91C_BASE_PDC_SSC->PDC_RCR == 0);
+			head += stopped ? 2 : 1;
+			// never queue a chunk that wasn't sent, drop the oldest instead
+			while (head + 1 - tail >= LF_STREAM_CHUNKS) {
+				tail++;
+				frame = 0;
+				lost += LF_STREAM_CHUNK_SIZE;
+			}
+			if (stopped) {
+				restarts++;
+				FpgaSetupSscDma(ring + (head % LF_STREAM_CHUNKS) * LF_STREAM_CHUNK_SIZE, LF_STREAM_CHUNK_SIZE);
+			}
+			AT91C_BASE_PDC_SSC->PDC_RNPR = (uint32_t) (ring + ((head + 1) % LF_STREAM_CHUNKS) * LF_STREAM_CHUNK_SIZE);
+			AT91C_BASE_PDC_SSC->PDC_RNCR = LF_STREAM_CHUNK_SIZE;
+		}
+
+		if (tail == head) continue;
+
+		// the USB queue is full. Keep the DMA going while the host reads
+		if (usb_tx_free() < sizeof(UsbCommand)) continue;
+
+		// one frame per pass, so the DMA is serviced between two frames
+		uint8_t *samples = ring + (tail % LF_STREAM_CHUNKS) * LF_STREAM_CHUNK_SIZE + frame * USB_CMD_DATA_SIZE;
+		uint32_t index = tail * LF_STREAM_CHUNK_SIZE + frame * USB_CMD_DATA_SIZE;
+		uint32_t len = 0;
+		if (config.compress) {
+			lfCompressInit(&packer, packed, USB_CMD_DATA_SIZE);
+			uint32_t i;
+			for (i = 0; i < USB_CMD_DATA_SIZE; i++)
+				if (!lfCompressPush(&packer, samples[i])) break;
+			if (i == USB_CMD_DATA_SIZE)
+				len = lfCompressFinish(&packer);
+			if (len >= USB_CMD_DATA_SIZE)
+				len = 0;
+		}
+		LED_B_ON();
+		cmd_send(CMD_LF_STREAMED_ADC_SAMPLES, index, USB_CMD_DATA_SIZE, len, len ? packed : samples, len ? len : USB_CMD_DATA_SIZE);
+		LED_B_OFF();
+		sent += USB_CMD_DATA_SIZE;
+
+		if (++frame == LF_STREAM_FRAMES) {
+			frame = 0;
+			tail++;
+		}
+		if (max_samples && sent + lost >= max_samples) break;
+	}
+
+	AT91C_BASE_PDC_SSC->PDC_PTCR = AT91C_PDC_RXTDIS;
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	LEDsoff();
+	BigBuf_free();
+	cmd_send(CMD_ACK, sent, lost, restarts, 0, 0);
+}
+
 /**
 * acquisition of Cotag LF signal. Similar to other LF,  since the Cotag has such long datarate RF/384
 * and is Manchester?,  we directly gather the manchester data into bigbuff
@@ -20,6 +20,12 @@ uint32_t SampleLF(bool silent, int sample_size);
 **/
 uint32_t SnoopLF();
 
+/**
+* Streams samples to the client (CMD_LF_STREAMED_ADC_SAMPLES) until button press, usb command
+* or max_samples (0 - no limit). Uses the sampling config divisor and compress settings.
+**/
+void StreamLF(bool activeField, uint32_t max_samples);
+
 // adds sample size to default options
 uint32_t DoPartialAcquisition(int trigger_threshold, bool silent, int sample_size, int cancel_after);
 
@@ -65,6 +71,12 @@ void setSamplingConfig(sample_config *sc);
 
 sample_config * getSamplingConfig();
 
+/**
+ * @brief Sampling config of the capture in BigBuf, with compress set if BigBuf holds a
+ * compressed capture (starts with LFCOMPRESS_TAG).
+ */
+sample_config * getCaptureConfig();
+
 void printConfig();
 
 
@@ -19,6 +19,7 @@
 #include "parity.h"
 #include "crc.h"
 #include "fpgaloader.h"
+#include "protocols.h"
 
 #define HARDNESTED_AUTHENTICATION_TIMEOUT 848			// card times out 1ms after wrong authentication (according to NXP documentation)
 #define HARDNESTED_PRE_AUTHENTICATION_LEADTIME 400		// some (non standard) cards need a pause after select before they are ready for first authentication 
@@ -608,6 +609,249 @@ void MifareUSetPwd(uint8_t arg0, uint8_t *datain){
 	LEDsoff();
 }
 
+//-----------------------------------------------------------------------------
+// Ultralight/NTAG fingerprint and key check
+//-----------------------------------------------------------------------------
+static bool MifareUAuth(uint8_t keyType, uint8_t *key, uint8_t *pack) {
+	if (keyType == MFU_KEY_3DES)
+		return mifare_ultra_auth(key);
+	if (keyType == MFU_KEY_PWD)
+		return mifare_ul_ev1_auth(key, pack);
+	return true;
+}
+
+// the tag goes back to idle after a NAK, a wrong CRC or a failed authentication
+static bool MifareUReselect(uint8_t keyType, uint8_t *key, uint8_t *pack) {
+	if (!iso14443a_select_card(NULL, NULL, NULL, true, 0, true))
+		return false;
+	return MifareUAuth(keyType, key, pack);
+}
+
+// cmd needs room for the CRC. True if the answer has len bytes and a good
+// CRC, the answer without CRC goes to data
+static bool MifareUCmd(uint8_t *cmd, uint8_t cmdlen, uint8_t *data, int len) {
+	uint8_t answer[MAX_FRAME_SIZE];
+	uint8_t par[MAX_PARITY_SIZE];
+
+	AppendCrc14443a(cmd, cmdlen);
+	ReaderTransmit(cmd, cmdlen + 2, NULL);
+	if (ReaderReceive(answer, par) != len + 2 || !CheckCrc14443(CRC_14443_A, answer, len + 2))
+		return false;
+	if (data)
+		memcpy(data, answer, len);
+	return true;
+}
+
+static bool MifareUCmd2(uint8_t cmd, uint8_t arg, uint8_t *data, int len) {
+	uint8_t frame[4] = {cmd, arg};
+	return MifareUCmd(frame, 2, data, len);
+}
+
+// first config page from GET_VERSION, 0 if unknown. Same as the type table in client/cmdhfmfu.c
+static uint8_t MifareUConfigPage(uint8_t *version) {
+	if (version[2] == 0x03)
+		return (version[6] == 0x0B) ? 0x10 : 0x25;  // EV1 48 / 128 bytes
+	if (version[2] != 0x04)
+		return 0;
+	switch ((version[3] << 8) | version[6]) {
+		case 0x010B: return 0x10;                   // NTAG 210
+		case 0x010E: return 0x25;                   // NTAG 212
+		case 0x020F: return 0x29;                   // NTAG 213
+		case 0x0211: return 0x83;                   // NTAG 215
+		case 0x0213: return 0xE3;                   // NTAG 216
+		default:     return 0;
+	}
+}
+
+// Runs the type probes and reads everything `hf mfu info` shows in one go.
+// Every failed command costs a reselect, no field reset.
+// arg0 = MFU_KEY_NONE or a key in datain (16 bytes, 4 used for EV1/NTAG)
+void MifareUFingerprint(uint8_t arg0, uint8_t *datain) {
+	mfu_fingerprint_t fp;
+	iso14a_card_select_t card;
+	uint8_t keyType = arg0;
+	uint8_t key[16] = {0x00};
+	uint8_t answer[MAX_FRAME_SIZE];
+	uint8_t par[MAX_PARITY_SIZE];
+	uint8_t cmd[4];
+
+	memset(&fp, 0, sizeof(fp));
+	memcpy(key, datain, sizeof(key));
+
+	LED_A_ON(); LED_B_OFF(); LED_C_OFF();
+	iso14443a_setup(FPGA_HF_ISO14443A_READER_LISTEN);
+
+	clear_trace();
+	set_tracing(true);
+
+	if (!iso14443a_select_card(NULL, &card, NULL, true, 0, true))
+		goto out;
+	fp.flags |= MFU_FP_SELECTED;
+	memcpy(fp.uid, card.uid, sizeof(fp.uid));
+	fp.uidlen = card.uidlen;
+	memcpy(fp.atqa, card.atqa, sizeof(fp.atqa));
+	fp.sak = card.sak;
+
+	// not Ultralight family, the client stops here
+	if (card.uidlen != 7 || (card.sak & 0x38) != 0x00)
+		goto out;
+
+	// Infineon my-d is told apart by its uid alone
+	if (card.uid[0] != 0x05) {
+		cmd[0] = MIFARE_ULEV1_VERSION;
+		if (MifareUCmd(cmd, 1, fp.version, sizeof(fp.version)))
+			fp.flags |= MFU_FP_VERSION;
+		// no or an unknown version: UL vs UL-C vs NTAG203
+		if (!(fp.flags & MFU_FP_VERSION) || (fp.version[2] != 0x03 && fp.version[2] != 0x04)) {
+			if (!MifareUReselect(MFU_KEY_NONE, NULL, NULL))
+				goto out;
+			if (MifareUCmd2(MIFARE_ULC_AUTH_1, 0x00, NULL, 9))
+				fp.flags |= MFU_FP_ULC_AUTH;
+			if (!MifareUReselect(MFU_KEY_NONE, NULL, NULL))
+				goto out;
+
+			if (!(fp.flags & MFU_FP_ULC_AUTH)) {
+				if (MifareUCmd2(MIFARE_CMD_READBLOCK, 0x29, NULL, 16)) {
+					fp.flags |= MFU_FP_READ_29;
+					if (MifareUCmd2(MIFARE_CMD_READBLOCK, 0x30, NULL, 16))
+						fp.flags |= MFU_FP_READ_30;
+				} else {
+					// Fudan check, READ page 0 with a wrong CRC: NXP answers 01, Fudan 00
+					if (!MifareUReselect(MFU_KEY_NONE, NULL, NULL))
+						goto out;
+					uint8_t badcrc[] = {MIFARE_CMD_READBLOCK, 0x00, 0x02, 0xA7};
+					ReaderTransmit(badcrc, sizeof(badcrc), NULL);
+					if (ReaderReceive(answer, par) == 1) {
+						fp.flags |= MFU_FP_BAD_CRC;
+						fp.badcrc = answer[0];
+					}
+				}
+				if (!MifareUReselect(MFU_KEY_NONE, NULL, NULL))
+					goto out;
+			}
+		}
+	}
+
+	// magic tags ACK the first part of a compatibility write to page 0.
+	// The second part is never sent, the tag drops the write on the next WUPA
+	if (!MifareUReselect(MFU_KEY_NONE, NULL, NULL))
+		goto out;
+	cmd[0] = MIFARE_CMD_WRITEBLOCK;
+	cmd[1] = 0x00;
+	AppendCrc14443a(cmd, 2);
+	ReaderTransmit(cmd, sizeof(cmd), NULL);
+	if (ReaderReceive(answer, par) && answer[0] == CARD_ACK)
+		fp.flags |= MFU_FP_MAGIC;
+
+	fp.flags |= MFU_FP_PROBED;
+
+	// plain UL and NTAG203 have no authentication
+	if (keyType != MFU_KEY_NONE) {
+		if (fp.flags & MFU_FP_ULC_AUTH)
+			keyType = MFU_KEY_3DES;
+		else if (fp.flags & MFU_FP_VERSION)
+			keyType = MFU_KEY_PWD;
+		else
+			keyType = MFU_KEY_NONE;
+	}
+	if (keyType != MFU_KEY_NONE) {
+		if (MifareUReselect(keyType, key, fp.pack))
+			fp.flags |= MFU_FP_AUTH;
+		else
+			keyType = MFU_KEY_NONE;    // key refused, read what is readable without it
+	}
+	if (keyType == MFU_KEY_NONE && !MifareUReselect(MFU_KEY_NONE, NULL, NULL))
+		goto out;
+
+	if (MifareUCmd2(MIFARE_CMD_READBLOCK, 0x00, fp.pages, 16))
+		fp.flags |= MFU_FP_PAGES;
+	else if (!MifareUReselect(keyType, key, fp.pack))
+		goto out;
+
+	if (fp.flags & MFU_FP_ULC_AUTH) {
+		if (MifareUCmd2(MIFARE_CMD_READBLOCK, 0x28, fp.ulc_config, 16))
+			fp.flags |= MFU_FP_ULC_CONFIG;
+		else if (!MifareUReselect(keyType, key, fp.pack))
+			goto out;
+		if (fp.flags & MFU_FP_MAGIC) {
+			if (MifareUCmd2(MIFARE_CMD_READBLOCK, 0x2C, fp.ulc_key, 16))
+				fp.flags |= MFU_FP_ULC_KEY;
+			else if (!MifareUReselect(keyType, key, fp.pack))
+				goto out;
+		}
+	}
+
+	if (fp.flags & MFU_FP_VERSION) {
+		// UL EV1 counters, NTAG has a single NFC counter with another meaning
+		if (fp.version[2] == 0x03) {
+			for (int i = 0; i < 3; i++) {
+				if (!MifareUCmd2(MIFARE_ULEV1_CHECKTEAR, i, &fp.tearing[i], 1)
+						&& !MifareUReselect(keyType, key, fp.pack))
+					goto out;
+				if (MifareUCmd2(MIFARE_ULEV1_READ_CNT, i, fp.counters[i], 3))
+					fp.counters_ok |= 1 << i;
+				else if (!MifareUReselect(keyType, key, fp.pack))
+					goto out;
+			}
+		}
+
+		if (MifareUCmd2(MIFARE_ULEV1_READSIG, 0x00, fp.signature, 32))
+			fp.flags |= MFU_FP_SIGNATURE;
+		else if (!MifareUReselect(keyType, key, fp.pack))
+			goto out;
+
+		fp.cfgpage = MifareUConfigPage(fp.version);
+		if (fp.cfgpage && MifareUCmd2(MIFARE_CMD_READBLOCK, fp.cfgpage, fp.config, 16))
+			fp.flags |= MFU_FP_CONFIG;
+	}
+
+out:
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	cmd_send(CMD_ACK, (fp.flags & MFU_FP_SELECTED) ? 1 : 0, 0, 0, &fp, sizeof(fp));
+	LEDsoff();
+}
+
+// Dictionary check for UL-C 3des keys and EV1/NTAG passwords. Stops at the
+// first key that works. Every failed EV1/NTAG password counts towards AUTHLIM.
+// arg0 = key type (MFU_KEY_3DES or MFU_KEY_PWD), arg1 = key count
+// answer: arg0 = 1 found, arg1 = index of the key, arg2 = keys tried, data = PACK
+void MifareUChkKeys(uint8_t arg0, uint8_t arg1, uint8_t *datain) {
+	uint8_t keyType = arg0;
+	uint8_t keyCount = arg1;
+	int keyLen = (keyType == MFU_KEY_3DES) ? 16 : 4;
+	uint8_t pack[4] = {0x00};
+	int i;
+
+	if (keyType != MFU_KEY_3DES && keyType != MFU_KEY_PWD)
+		keyCount = 0;
+	if (keyCount > USB_CMD_DATA_SIZE / keyLen)
+		keyCount = USB_CMD_DATA_SIZE / keyLen;
+
+	LED_A_ON(); LED_B_OFF(); LED_C_OFF();
+	iso14443a_setup(FPGA_HF_ISO14443A_READER_LISTEN);
+
+	clear_trace();
+	set_tracing(true);
+
+	for (i = 0; i < keyCount; i++) {
+		if (BUTTON_PRESS())
+			break;
+		if (!iso14443a_select_card(NULL, NULL, NULL, true, 0, true))
+			break;
+		if (MifareUAuth(keyType, datain + i * keyLen, pack)) {
+			FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+			cmd_send(CMD_ACK, 1, i, i + 1, pack, sizeof(pack));
+			LEDsoff();
+			return;
+		}
+	}
+
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	cmd_send(CMD_ACK, 0, 0, i, NULL, 0);
+	LEDsoff();
+}
+
+
 // Return 1 if the nonce is invalid else return 0
 int valid_nonce(uint32_t Nt, uint32_t NtEnc, uint32_t Ks1, uint8_t *parity) {
 	return ((oddparity8((Nt >> 24) & 0xFF) == ((parity[0]) ^ oddparity8((NtEnc >> 24) & 0xFF) ^ BIT(Ks1,16))) & \
@@ -1027,6 +1271,167 @@ void MifareChkKeys(uint16_t arg0, uint16_t arg1, uint8_t arg2, uint8_t *datain)
 	MF_DBGLEVEL = OLD_MF_DBGLEVEL;
 }
 
+//-----------------------------------------------------------------------------
+// MIFARE Classic access condition audit. One authenticated walk per sector
+// and key: the trailer is read first, then only the data blocks the access
+// bits allow the key to read.
+// arg0 = sector count, arg1/arg2 = sectors with a key A/B (bit per sector)
+// datain = key A of all sectors followed by key B of all sectors (dumpkeys.bin)
+//-----------------------------------------------------------------------------
+static const uint8_t mf_audit_data_rights[8] = {0xFF, 0x99, 0x11, 0x30, 0x31, 0x10, 0xF9, 0x00};
+static const uint16_t mf_audit_trailer_rights[8] = {0x001B, 0x001F, 0x000A, 0x1702, 0x1302, 0x0602, 0x0202, 0x0202};
+
+static bool MifareAuditAuth(struct Crypto1State *pcs, uint32_t *cuid, bool *authenticated, uint8_t blockNo, uint8_t keyType, uint8_t *key) {
+	uint8_t uid[10];
+	uint64_t ui64Key = bytes_to_num(key, 6);
+
+	// nested while the card is authenticated, saves the select
+	if (*authenticated && !mifare_classic_auth(pcs, *cuid, blockNo, keyType, ui64Key, AUTH_NESTED))
+		return true;
+
+	// a failed authentication or read leaves the card idle
+	*authenticated = false;
+	if (!iso14443a_select_card(uid, NULL, cuid, true, 0, true))
+		return false;
+	if (mifare_classic_auth(pcs, *cuid, blockNo, keyType, ui64Key, AUTH_FIRST))
+		return false;
+	*authenticated = true;
+	return true;
+}
+
+static void MifareAuditDecode(mf_audit_sector_t *r, uint8_t *trailer) {
+	uint8_t c1 = trailer[7] >> 4;
+	uint8_t c2 = trailer[8] & 0x0F;
+	uint8_t c3 = trailer[8] >> 4;
+
+	memcpy(r->access, trailer + 6, 4);
+	if ((trailer[6] & 0x0F) != (~c1 & 0x0F) || (trailer[6] >> 4) != (~c2 & 0x0F) || (trailer[7] & 0x0F) != (~c3 & 0x0F))
+		return;
+
+	r->flags |= MF_AUDIT_ACL_OK;
+	uint8_t cond = ((c1 >> 3) & 1) << 2 | ((c2 >> 3) & 1) << 1 | ((c3 >> 3) & 1);
+	r->trailer_rights = mf_audit_trailer_rights[cond];
+	// key B readable in the trailer conditions 000, 001 and 010
+	if (cond <= 2)
+		r->flags |= MF_AUDIT_KEYB_DATA;
+	for (int g = 0; g < 3; g++) {
+		cond = ((c1 >> g) & 1) << 2 | ((c2 >> g) & 1) << 1 | ((c3 >> g) & 1);
+		r->rights[g] = mf_audit_data_rights[cond];
+		if (r->flags & MF_AUDIT_KEYB_DATA)
+			r->rights[g] &= 0x0F;
+	}
+}
+
+static bool MifareAuditReadable(mf_audit_sector_t *r, uint8_t blockNo, uint8_t blocks, uint8_t keyType) {
+	// without valid access bits everything is tried
+	if (!(r->flags & MF_AUDIT_ACL_OK))
+		return true;
+	if (blockNo == blocks - 1)
+		return r->trailer_rights & (MF_ACL_READ_ACCESS << (8 * keyType));
+	uint8_t group = (blocks == 4) ? blockNo : blockNo / 5;
+	return r->rights[group] & (MF_ACL_READ << (4 * keyType));
+}
+
+static void MifareAuditValue(mf_audit_sector_t *r, uint8_t blockNo, uint8_t blocks, uint8_t *data) {
+	for (int i = 0; i < 4; i++) {
+		if (data[i] != (data[i + 4] ^ 0xFF) || data[i] != data[i + 8])
+			return;
+	}
+	if (data[12] != (data[13] ^ 0xFF) || data[12] != data[14] || data[12] != (data[15] ^ 0xFF))
+		return;
+
+	uint8_t group = (blocks == 4) ? blockNo : blockNo / 5;
+	uint16_t groupMask = (blocks == 4) ? (1 << blockNo) : (0x1F << (group * 5));
+	if (!(r->value & groupMask)) {
+		r->values[group] = (int32_t)(data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+		r->value_addr[group] = data[12];
+	}
+	r->value |= 1 << blockNo;
+}
+
+void MifareAudit(uint8_t arg0, uint64_t arg1, uint64_t arg2, uint8_t *datain)
+{
+	uint8_t sectorCount = arg0;
+	uint64_t knownKeys[2] = {arg1, arg2};
+
+	mf_audit_sector_t reports[MF_AUDIT_FRAME_SECTORS];
+	uint8_t count = 0;
+	uint8_t uid[10];
+	uint8_t block[16];
+	uint32_t cuid = 0;
+	bool authenticated = false;
+	struct Crypto1State mpcs = {0, 0};
+	struct Crypto1State *pcs = &mpcs;
+
+	LED_A_ON();
+	LED_B_OFF();
+	LED_C_OFF();
+	iso14443a_setup(FPGA_HF_ISO14443A_READER_LISTEN);
+
+	clear_trace();
+	set_tracing(true);
+
+	if (!iso14443a_select_card(uid, NULL, &cuid, true, 0, true)) {
+		if (MF_DBGLEVEL >= 1)	Dbprintf("Can't select card");
+		cmd_send(CMD_ACK, MF_AUDIT_NO_CARD, 0, 1, NULL, 0);
+		FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+		LEDsoff();
+		return;
+	}
+
+	for (uint8_t sectorNo = 0; sectorNo < sectorCount; sectorNo++) {
+		mf_audit_sector_t *r = &reports[count];
+		uint8_t firstBlock = FirstBlockOfSector(sectorNo);
+		uint8_t blocks = NumBlocksPerSector(sectorNo);
+
+		memset(r, 0, sizeof(mf_audit_sector_t));
+		r->sector = sectorNo;
+		for (uint8_t keyType = 0; keyType < 2; keyType++) {
+			uint8_t *key = datain + (keyType * sectorCount + sectorNo) * 6;
+			if (!((knownKeys[keyType] >> sectorNo) & 1))
+				continue;
+			if (keyType == MF_KEY_B && (r->flags & MF_AUDIT_KEYB_DATA))
+				continue;
+			if (!MifareAuditAuth(pcs, &cuid, &authenticated, firstBlock, keyType, key))
+				continue;
+			r->flags |= keyType ? MF_AUDIT_AUTH_B : MF_AUDIT_AUTH_A;
+
+			// trailer first, the access bits decide which blocks are read
+			for (uint8_t i = 0; i < blocks; i++) {
+				uint8_t blockNo = (i == 0) ? blocks - 1 : i - 1;
+				if ((r->read & (1 << blockNo)) || !MifareAuditReadable(r, blockNo, blocks, keyType))
+					continue;
+				if (!authenticated && !MifareAuditAuth(pcs, &cuid, &authenticated, firstBlock, keyType, key))
+					break;
+				if (mifare_classic_readblock(pcs, cuid, firstBlock + blockNo, block)) {
+					authenticated = false;
+					continue;
+				}
+				r->read |= 1 << blockNo;
+				if (blockNo == blocks - 1)
+					MifareAuditDecode(r, block);
+				else
+					MifareAuditValue(r, blockNo, blocks, block);
+			}
+		}
+
+		count++;
+		if (count == MF_AUDIT_FRAME_SECTORS || sectorNo == sectorCount - 1) {
+			LED_B_ON();
+			cmd_send(CMD_ACK, MF_AUDIT_OK, count, sectorNo == sectorCount - 1, reports, count * sizeof(mf_audit_sector_t));
+			LED_B_OFF();
+			count = 0;
+		}
+	}
+
+	if (authenticated)
+		mifare_classic_halt(pcs, cuid);
+	crypto1_destroy(pcs);
+
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	LEDsoff();
+}
+
 //-----------------------------------------------------------------------------
 // MIFARE commands set debug level
 //
@@ -1513,6 +1918,186 @@ void MifareCGetBlock(uint32_t arg0, uint32_t arg1, uint32_t arg2, uint8_t *datai
 	}
 }
 
+// magic card backdoor: wupC1 (+ wupC2 for gen1a)
+static bool MifareCUnlock(uint8_t workFlags) {
+	uint8_t wupC1[]       = { 0x40 };
+	uint8_t wupC2[]       = { 0x43 };
+	uint8_t receivedAnswer[MAX_MIFARE_FRAME_SIZE];
+	uint8_t receivedAnswerPar[MAX_MIFARE_PARITY_SIZE];
+
+	ReaderTransmitBitsPar(wupC1,7,0, NULL);
+	if(!ReaderReceive(receivedAnswer, receivedAnswerPar) || (receivedAnswer[0] != 0x0a)) {
+		if (MF_DBGLEVEL >= 1)	Dbprintf("wupC1 error");
+		return false;
+	};
+
+	// do no issue for gen1b magic tag
+	if (!(workFlags & 0x40)) {
+		ReaderTransmit(wupC2, sizeof(wupC2), NULL);
+		if(!ReaderReceive(receivedAnswer, receivedAnswerPar) || (receivedAnswer[0] != 0x0a)) {
+			if (MF_DBGLEVEL >= 1)	Dbprintf("wupC2 error");
+			return false;
+		};
+	}
+	return true;
+}
+
+// multi block version of MifareCSetBlock/MifareCGetBlock. Blocks are read/written in one backdoor session,
+// the session is kept between commands if no halt/reset flags are given.
+// arg0 - work flags (the same as MifareCGetBlock), arg1 - first block, arg2 - blocks count (max USB_CMD_DATA_SIZE / 16)
+// answer: arg0 - isOK, arg1 - bitmap of the blocks that failed,
+//         arg2 - 0 or, if the card was lost and the field is off, 1 + index of the first block not tried
+void MifareCSetBlocks(uint32_t arg0, uint32_t arg1, uint32_t arg2, uint8_t *datain){
+	uint8_t workFlags = arg0;
+	uint8_t firstBlock = arg1;
+	uint8_t blocksCount = MIN(arg2, USB_CMD_DATA_SIZE / 16);
+
+	// variables
+	uint32_t errorMask = 0;
+	bool unlocked = !(workFlags & 0x02);
+	bool cardLost = false;
+	uint32_t lostAt = 0;
+	uint8_t d_block[18] = {0x00};
+
+	uint8_t receivedAnswer[MAX_MIFARE_FRAME_SIZE];
+	uint8_t receivedAnswerPar[MAX_MIFARE_PARITY_SIZE];
+
+	if (workFlags & 0x08) {
+		LED_A_ON();
+		LED_B_OFF();
+		LED_C_OFF();
+		iso14443a_setup(FPGA_HF_ISO14443A_READER_LISTEN);
+
+		clear_trace();
+		set_tracing(true);
+	}
+
+	for (int i = 0; i < blocksCount; i++) {
+		WDT_HIT();
+
+		// the card leaves the backdoor state after a NACK. Unlock it again.
+		if (!unlocked) {
+			if (!MifareCUnlock(workFlags)) {
+				errorMask |= (0xFFFFFFFF << i);
+				cardLost = true;
+				lostAt = i + 1;
+				break;
+			}
+			unlocked = true;
+		}
+
+		if ((mifare_sendcmd_short(NULL, 0, 0xA0, firstBlock + i, receivedAnswer, receivedAnswerPar, NULL) != 1) || (receivedAnswer[0] != 0x0a)) {
+			if (MF_DBGLEVEL >= 1)	Dbprintf("write block %d send command error", firstBlock + i);
+			errorMask |= 1U << i;
+			unlocked = false;
+			continue;
+		};
+
+		memcpy(d_block, datain + i * 16, 16);
+		AppendCrc14443a(d_block, 16);
+
+		ReaderTransmit(d_block, sizeof(d_block), NULL);
+		if ((ReaderReceive(receivedAnswer, receivedAnswerPar) != 1) || (receivedAnswer[0] != 0x0a)) {
+			if (MF_DBGLEVEL >= 1)	Dbprintf("write block %d send data error", firstBlock + i);
+			errorMask |= 1U << i;
+			unlocked = false;
+		};
+	}
+
+	if ((workFlags & 0x04) && !cardLost) {
+		// do no issue halt command for gen1b magic tag (#db# halt error. response len: 1)
+		if (!(workFlags & 0x40)) {
+			if (mifare_classic_halt(NULL, 0)) {
+				if (MF_DBGLEVEL > 2)	Dbprintf("Halt error");
+				// Continue, some magic tags misbehavies and send an answer to it.
+			}
+		}
+	}
+
+	if (blocksCount < 32)
+		errorMask &= (1U << blocksCount) - 1;
+
+	LED_B_ON();
+	cmd_send(CMD_ACK, errorMask == 0, errorMask, lostAt, NULL, 0);
+	LED_B_OFF();
+
+	if ((workFlags & 0x10) || cardLost) {
+		FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+		LEDsoff();
+	}
+}
+
+void MifareCGetBlocks(uint32_t arg0, uint32_t arg1, uint32_t arg2, uint8_t *datain){
+	uint8_t workFlags = arg0;
+	uint8_t firstBlock = arg1;
+	uint8_t blocksCount = MIN(arg2, USB_CMD_DATA_SIZE / 16);
+
+	// variables
+	uint32_t errorMask = 0;
+	bool unlocked = !(workFlags & 0x02);
+	bool cardLost = false;
+	uint32_t lostAt = 0;
+	uint8_t data[USB_CMD_DATA_SIZE];
+
+	uint8_t receivedAnswer[MAX_MIFARE_FRAME_SIZE];
+	uint8_t receivedAnswerPar[MAX_MIFARE_PARITY_SIZE];
+
+	if (workFlags & 0x08) {
+		LED_A_ON();
+		LED_B_OFF();
+		LED_C_OFF();
+		iso14443a_setup(FPGA_HF_ISO14443A_READER_LISTEN);
+
+		clear_trace();
+		set_tracing(true);
+	}
+
+	memset(data, 0x00, sizeof(data));
+	for (int i = 0; i < blocksCount; i++) {
+		WDT_HIT();
+
+		if (!unlocked) {
+			if (!MifareCUnlock(workFlags)) {
+				errorMask |= (0xFFFFFFFF << i);
+				cardLost = true;
+				lostAt = i + 1;
+				break;
+			}
+			unlocked = true;
+		}
+
+		if ((mifare_sendcmd_short(NULL, 0, 0x30, firstBlock + i, receivedAnswer, receivedAnswerPar, NULL) != 18)) {
+			if (MF_DBGLEVEL >= 1)	Dbprintf("read block %d send command error", firstBlock + i);
+			errorMask |= 1U << i;
+			unlocked = false;
+			continue;
+		};
+		memcpy(data + i * 16, receivedAnswer, 16);
+	}
+
+	if ((workFlags & 0x04) && !cardLost) {
+		// do no issue halt command for gen1b magic tag (#db# halt error. response len: 1)
+		if (!(workFlags & 0x40)) {
+			if (mifare_classic_halt(NULL, 0)) {
+				if (MF_DBGLEVEL > 1)	Dbprintf("Halt error");
+				// Continue, some magic tags misbehavies and send an answer to it.
+			}
+		}
+	}
+
+	if (blocksCount < 32)
+		errorMask &= (1U << blocksCount) - 1;
+
+	LED_B_ON();
+	cmd_send(CMD_ACK, errorMask == 0, errorMask, lostAt, data, blocksCount * 16);
+	LED_B_OFF();
+
+	if ((workFlags & 0x10) || cardLost) {
+		FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+		LEDsoff();
+	}
+}
+
 void MifareCIdent(){
 
 	// card commands
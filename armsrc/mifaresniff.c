@@ -134,7 +134,8 @@ bool RAMFUNC MfSniffLogic(const uint8_t *data, uint16_t len, uint8_t *parity, ui
 }
 
 bool RAMFUNC MfSniffSend(uint16_t maxTimeoutMs) {
-	if (BigBuf_get_traceLen() && (GetTickCount() > timerData + maxTimeoutMs)) {
+	// send after a pause in the communication, or before the trace overflows at a busy reader
+	if (BigBuf_get_traceLen() && ((GetTickCount() > timerData + maxTimeoutMs) || (BigBuf_get_traceLen() > BigBuf_max_traceLen() / 4 * 3))) {
 		return intMfSniffSend();
 	}
 	return false;
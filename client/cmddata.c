@@ -22,6 +22,7 @@
 #include "cmdparser.h"// already included in cmdmain.h
 #include "usb_cmd.h"  // already included in cmdmain.h and proxmark3.h
 #include "lfdemod.h"  // for demod code
+#include "lfcompress.h" // for compressed captures
 #include "loclass/cipherutils.h" // for decimating samples in getsamples
 #include "cmdlfem4x.h"// for em410x demod
 
@@ -1204,6 +1205,7 @@ int getSamples(int n, bool silent)
 	GetFromBigBuf(got, n, 0, &response, -1, false);
 	if (!silent) PrintAndLog("Data fetched");
 	uint8_t bits_per_sample = 8;
+	bool compressed = false;
 
 	//Old devices without this feature would send 0 at arg[0]
 	if(response.arg[0] > 0)
@@ -1212,8 +1214,21 @@ int getSamples(int n, bool silent)
 		if (!silent) PrintAndLog("Samples @ %d bits/smpl, decimation 1:%d ", sc->bits_per_sample
 		    , sc->decimation);
 		bits_per_sample = sc->bits_per_sample;
+		compressed = (sc->compress == 1);
 	}
-	if(bits_per_sample < 8)
+	if(compressed)
+	{
+		int len = -1;
+		if (n > LFCOMPRESS_TAG_LEN && memcmp(got, LFCOMPRESS_TAG, LFCOMPRESS_TAG_LEN) == 0)
+			len = lfDecompress(got + LFCOMPRESS_TAG_LEN, n - LFCOMPRESS_TAG_LEN, GraphBuffer, MAX_GRAPH_TRACE_LEN);
+		if (len < 0) {
+			PrintAndLog("Compressed capture is corrupt");
+			len = 0;
+		}
+		GraphTraceLen = len;
+		if (!silent) PrintAndLog("Unpacked %d samples from %d bytes", len, n);
+	}
+	else if(bits_per_sample < 8)
 	{
 		if (!silent) PrintAndLog("Unpacking...");
 		BitstreamIn bout = { got, bits_per_sample * n,  0};
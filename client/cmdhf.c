@@ -12,9 +12,11 @@
 #include "cmdhf.h"
 
 #include <math.h>
+#include <string.h>
 #include "usb_cmd.h"
 #include "comms.h"
 #include "ui.h"
+#include "util.h"
 #include "cmdparser.h"
 #include "cliparser/cliparser.h"
 #include "cmdhf14a.h"
@@ -32,6 +34,7 @@
 #include "cmddata.h"
 #include "graph.h"
 #include "fpga.h"
+#include "hfsearch.h"
 
 static int CmdHelp(const char *Cmd);
 
@@ -42,37 +45,142 @@ int CmdHFTune(const char *Cmd)
   return 0;
 }
 
-int CmdHFSearch(const char *Cmd){
-	int ans = 0;
-	PrintAndLog("");
-	ans = CmdHF14AInfo("s");
-	if (ans > 0) {
-		PrintAndLog("\nValid ISO14443A Tag Found - Quiting Search\n");
-		return ans;
-	}
-	ans = HFiClassReader("", false, false);
-	if (ans) {
-		PrintAndLog("\nValid iClass Tag (or PicoPass Tag) Found - Quiting Search\n");
-		return ans;
+static void PrintHFSearchResult(hf_search_result_t *card)
+{
+	switch (card->protocol) {
+		case HF_SEARCH_14A:
+			PrintAndLogEx(SUCCESS, "ISO14443A  UID: %s ATQA: %02x %02x SAK: %02x", sprint_hex(card->uid, card->uidlen), card->atqa[1], card->atqa[0], card->sak);
+			break;
+		case HF_SEARCH_ICLASS:
+			if (card->infolen)
+				PrintAndLogEx(SUCCESS, "iCLASS     CSN: %s CC: %s", sprint_hex(card->uid, card->uidlen), sprint_hex(card->info, card->infolen));
+			else
+				PrintAndLogEx(SUCCESS, "iCLASS     CSN: %s", sprint_hex(card->uid, card->uidlen));
+			break;
+		case HF_SEARCH_15:
+			PrintAndLogEx(SUCCESS, "ISO15693   UID: %s DSFID: %02x", sprint_hex(card->uid, card->uidlen), card->info[0]);
+			break;
+		case HF_SEARCH_14B:
+			PrintAndLogEx(SUCCESS, "ISO14443B  PUPI: %s App data: %s Protocol info: %s", sprint_hex(card->uid, card->uidlen), sprint_hex(card->info, 4), sprint_hex(card->info + 4, 3));
+			break;
+		case HF_SEARCH_SRX:
+			PrintAndLogEx(SUCCESS, "ST SRx     UID: %s Chip ID: %02x", sprint_hex(card->uid, card->uidlen), card->info[0]);
+			break;
+		case HF_SEARCH_LEGIC: {
+			uint16_t cardsize = card->info[1] | (card->info[2] << 8);
+			const char *type = card->info[0] == 0x0d ? "MIM22" : card->info[0] == 0x1d ? "MIM256" : "MIM1024";
+			PrintAndLogEx(SUCCESS, "LEGIC      UID: %s Type: %s (%d bytes)", sprint_hex(card->uid, card->uidlen), type, cardsize);
+			break;
+		}
+		default:
+			PrintAndLogEx(WARNING, "Unknown protocol %02x", card->protocol);
+			return;
 	}
-	ans = HF15Reader("", false);
-	if (ans) {
-		PrintAndLog("\nValid ISO15693 Tag Found - Quiting Search\n");
-		return ans;
+	PrintAndLogEx(INFO, "           found in round %d after %d ms", card->round, card->time);
+}
+
+// full info with the protocol's own command
+static int HFSearchInfo(hf_search_result_t *card)
+{
+	int ans = 0;
+	switch (card->protocol) {
+		case HF_SEARCH_14A:
+			ans = CmdHF14AInfo("s");
+			break;
+		case HF_SEARCH_ICLASS:
+			ans = HFiClassReader("", false, false);
+			break;
+		case HF_SEARCH_15:
+			ans = HF15Reader("", false);
+			break;
+		case HF_SEARCH_14B:
+		case HF_SEARCH_SRX:
+			ans = HF14BInfo(false);
+			break;
+		case HF_SEARCH_LEGIC:
+			ans = CmdLegicRFRead("") == 0;
+			break;
 	}
-	//14b is longest test currently (and rarest chip type) ... put last
-	ans = HF14BInfo(false);
-	if (ans) {
-		PrintAndLog("\nValid ISO14443B Tag Found - Quiting Search\n");
-		return ans;
+	return ans;
+}
+
+int CmdHFSearch(const char *Cmd)
+{
+	CLIParserInit("hf search",
+		"Searches for known HF tags. The device probes ISO14443A, iCLASS, ISO15693, ISO14443B, ST SRx and LEGIC\n"
+		"one after the other with a short field reset in between and stops at the first tag that answers.\n"
+		"Without options the full information for the tag found is shown.",
+		"Usage:\n\thf search          -> find a tag and show its information\n"
+		"\thf search -q       -> find a tag and only show its identification\n"
+		"\thf search -w -t 5000 -> wait up to 5s for any tag\n"
+		"\thf search -c       -> show every new tag in the field until a key is pressed\n");
+	void* argtable[] = {
+		arg_param_begin,
+		arg_lit0("qQ",  "quick",      "only show the identification record"),
+		arg_lit0("wW",  "wait",       "wait until a tag is in the field"),
+		arg_lit0("cC",  "continuous", "show every new tag until a key or the button is pressed"),
+		arg_int0("tT",  "timeout",    "<ms>", "timeout for wait and continuous mode, 0 - no timeout (default)"),
+		arg_param_end
+	};
+	CLIExecWithReturn(Cmd, argtable, true);
+
+	bool quick = arg_get_lit(1);
+	bool wait = arg_get_lit(2);
+	bool continuous = arg_get_lit(3);
+	uint32_t timeout = arg_get_int_def(4, 0);
+	CLIParserFree();
+
+	uint8_t flags = 0;
+	if (wait) flags |= HF_SEARCH_WAIT;
+	if (continuous) flags |= HF_SEARCH_CONTINUOUS;
+
+	UsbCommand c = {CMD_HF_SEARCH, {HF_SEARCH_ALL, flags, timeout}};
+	clearCommandBuffer();
+	SendCommand(&c);
+
+	if (flags)
+		PrintAndLogEx(NORMAL, "Waiting for tags. Press a key or the button to stop...");
+
+	// one record per tag found. The last answer has arg0 != 1.
+	hf_search_result_t card = {0};
+	int found = 0;
+	bool aborted = false;
+	UsbCommand resp;
+	while (true) {
+		if (flags && !aborted && ukbhit()) {
+			getchar();
+			// any command ends the search on the device
+			UsbCommand off = {CMD_FPGA_MAJOR_MODE_OFF};
+			SendCommand(&off);
+			aborted = true;
+		}
+
+		if (!WaitForResponseTimeout(CMD_ACK, &resp, flags ? 100 : 2500)) {
+			if (!flags) {
+				PrintAndLogEx(WARNING, "command execution time out");
+				return 0;
+			}
+			continue;
+		}
+
+		if ((resp.arg[0] & 0xff) != 1)
+			break;
+
+		memcpy(&card, resp.d.asBytes, sizeof(hf_search_result_t));
+		PrintHFSearchResult(&card);
+		found++;
 	}
-	ans = CmdLegicRFRead("");
-	if (ans == 0) {
-		PrintAndLog("\nValid Legic Tag Found - Quiting Search\n");
-		return ans;
+
+	if (!found) {
+		PrintAndLogEx(NORMAL, "\nno known/supported 13.56 MHz tags found\n");
+		return 0;
 	}
-	PrintAndLog("\nno known/supported 13.56 MHz tags found\n");
-	return 0;
+
+	if (quick || continuous)
+		return found;
+
+	PrintAndLogEx(NORMAL, "");
+	return HFSearchInfo(&card);
 }
 
 int CmdHFSnoop(const char *Cmd)
@@ -151,7 +259,7 @@ static command_t CommandTable[] =
 	{"tune",    CmdHFTune,      0, "Continuously measure HF antenna tuning"},
 	{"list",    CmdHFList,      1, "List protocol data in trace buffer"},
 	{"plot",    CmdHFPlot,      0, "Plot signal"},
-	{"search",  CmdHFSearch,    0, "Search for known HF tags [preliminary]"},
+	{"search",  CmdHFSearch,    0, "Search for known HF tags"},
 	{"snoop",   CmdHFSnoop,     0, "<samples to skip (10000)> <triggers to skip (1)> Generic HF Snoop"},
 	{NULL,      NULL,           0, NULL}
 };
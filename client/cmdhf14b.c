@@ -23,6 +23,7 @@
 #include "cmdparser.h"
 #include "cmdmain.h"
 #include "taginfo.h"
+#include "srxdump.h"
 
 
 static int CmdHelp(const char *Cmd);
@@ -50,16 +51,102 @@ int CmdHF14BSnoop(const char *Cmd)
   return 0;
 }
 
+typedef struct {
+  uint8_t uid[8];
+  uint8_t chipid;
+  int blocks;                   // memory blocks + the system block
+  uint8_t status[SRX_DUMP_SRIX4K_BLOCKS + 1];
+  uint8_t data[SRX_DUMP_SRIX4K_BLOCKS + 1][SRX_DUMP_BLOCK_SIZE];
+} srx_dump_t;
+
+static const char *srx_dump_result(int result)
+{
+  switch (result) {
+    case SRX_DUMP_OK:            return "ok";
+    case SRX_DUMP_NO_TAG:        return "no response from tag";
+    case SRX_DUMP_SELECT_FAILED: return "tag didn't answer SELECT";
+    case SRX_DUMP_UID_FAILED:    return "couldn't read the tag UID";
+    case SRX_DUMP_TAG_LOST:      return "tag lost, some blocks have no answer";
+    default:                     return "unknown";
+  }
+}
+
+/* Read the whole memory of a SRI512 or SRIX4K tag in one session.
+ * Returns the session status (SRX_DUMP_xx) or -1 if the device didn't answer
+ */
+static int srx_read_dump(bool srix4k, srx_dump_t *dump)
+{
+  UsbCommand resp;
+  UsbCommand c = {srix4k ? CMD_READ_SRIX4K_TAG : CMD_READ_SRI512_TAG};
+  int result = -1;
+
+  memset(dump, 0, sizeof(srx_dump_t));
+  clearCommandBuffer();
+  SendCommand(&c);
+
+  do {
+    if (!WaitForResponseTimeout(CMD_ACK, &resp, 2500)) {
+      PrintAndLog("timeout while waiting for reply.");
+      return -1;
+    }
+    srx_dump_frame_t *frame = (srx_dump_frame_t *)resp.d.asBytes;
+    result = resp.arg[0];
+    dump->blocks = resp.arg[1];
+    if (dump->blocks > SRX_DUMP_SRIX4K_BLOCKS + 1 || frame->count > SRX_DUMP_FRAME_BLOCKS
+      || frame->first + frame->count > dump->blocks) {
+      PrintAndLog("bad reply from device.");
+      return -1;
+    }
+    memcpy(dump->uid, frame->uid, sizeof(dump->uid));
+    dump->chipid = frame->chipid;
+    memcpy(dump->status + frame->first, frame->status, frame->count);
+    memcpy(dump->data + frame->first, frame->data, frame->count * SRX_DUMP_BLOCK_SIZE);
+  } while (!resp.arg[2]);
+
+  return result;
+}
+
+static void srx_print_dump(const char *tagname, srx_dump_t *dump)
+{
+  static const char *block_status[] = {"", "CRC error", "no answer"};
+
+  PrintAndLog("%s UID: %s  chip id: %02X", tagname, sprint_hex(dump->uid, sizeof(dump->uid)), dump->chipid);
+  PrintAndLog("block | data        | ascii");
+  PrintAndLog("------+-------------+------");
+  for (int i = 0; i < dump->blocks; i++) {
+    uint8_t blockno = (i == dump->blocks - 1) ? SRX_DUMP_SYSTEM_BLOCK : i;
+    if (dump->status[i] == SRX_BLOCK_NO_ANSWER) {
+      PrintAndLog("   %02X | -- -- -- -- |       %s", blockno, block_status[SRX_BLOCK_NO_ANSWER]);
+      continue;
+    }
+    PrintAndLog("   %02X | %s| %-4s  %s", blockno, sprint_hex(dump->data[i], SRX_DUMP_BLOCK_SIZE),
+        sprint_ascii(dump->data[i], SRX_DUMP_BLOCK_SIZE), block_status[dump->status[i]]);
+  }
+}
+
+static int srx_read(bool srix4k)
+{
+  srx_dump_t dump;
+
+  int result = srx_read_dump(srix4k, &dump);
+  if (result < 0)
+    return 1;
+  if (result == SRX_DUMP_OK || result == SRX_DUMP_TAG_LOST)
+    srx_print_dump(srix4k ? "SRIX4K" : "SRI512", &dump);
+  if (result != SRX_DUMP_OK) {
+    PrintAndLog("Read failed: %s", srx_dump_result(result));
+    return 1;
+  }
+  return 0;
+}
+
 /* New command to read the contents of a SRI512 tag
  * SRI512 tags are ISO14443-B modulated memory tags,
  * this command just dumps the contents of the memory
  */
 int CmdSri512Read(const char *Cmd)
 {
-  UsbCommand c = {CMD_READ_SRI512_TAG, {strtol(Cmd, NULL, 0), 0, 0}};
-  clearCommandBuffer();
-  SendCommand(&c);
-  return 0;
+  return srx_read(false);
 }
 
 /* New command to read the contents of a SRIX4K tag
@@ -68,10 +155,86 @@ int CmdSri512Read(const char *Cmd)
  */
 int CmdSrix4kRead(const char *Cmd)
 {
-  UsbCommand c = {CMD_READ_SRIX4K_TAG, {strtol(Cmd, NULL, 0), 0, 0}};
-  clearCommandBuffer();
-  SendCommand(&c);
-  return 0;
+  return srx_read(true);
+}
+
+/* Save the memory of a SRI512 or SRIX4K tag to a binary and an eml file.
+ * Blocks 0 to the last one and then the system block, 4 bytes each as the
+ * tag sends them
+ */
+int CmdSriDump(const char *Cmd)
+{
+  char cmdp = param_getchar(Cmd, 0);
+  char filename[FILE_PATH_SIZE] = {0};
+  srx_dump_t dump;
+  FILE *f;
+
+  if (cmdp != '1' && cmdp != '2') {
+    PrintAndLog("Read all blocks of a SRIX4K | SRI512 tag and save them");
+    PrintAndLog("to `filename.bin` and `filename.eml` (default hf-14b-<UID>-dump)");
+    PrintAndLog("The system block 0xFF comes after the last memory block.");
+    PrintAndLog("Usage:  hf 14b dump <1|2> [f <filename w/o .bin>]");
+    PrintAndLog("    [1 = SRIX4K]");
+    PrintAndLog("    [2 = SRI512]");
+    PrintAndLog("     sample: hf 14b dump 1");
+    PrintAndLog("           : hf 14b dump 2 f mytag");
+    return 0;
+  }
+  bool srix4k = (cmdp == '1');
+
+  char ctmp = param_getchar(Cmd, 1);
+  if (ctmp == 'f' || ctmp == 'F') {
+    if (param_getstr(Cmd, 2, filename, FILE_PATH_SIZE - 5) == 0) {
+      PrintAndLog("Filename missing");
+      return 1;
+    }
+  }
+
+  int result = srx_read_dump(srix4k, &dump);
+  if (result < 0)
+    return 1;
+  if (result != SRX_DUMP_OK) {
+    PrintAndLog("Read failed: %s", srx_dump_result(result));
+    if (result != SRX_DUMP_TAG_LOST)
+      return 1;
+  }
+  srx_print_dump(srix4k ? "SRIX4K" : "SRI512", &dump);
+
+  int errors = 0;
+  for (int i = 0; i < dump.blocks; i++) {
+    if (dump.status[i] != SRX_BLOCK_OK)
+      errors++;
+  }
+  if (errors)
+    PrintAndLog("%d block(s) couldn't be read, they are saved as read or zero", errors);
+
+  // user supplied filename?
+  if (filename[0] == '\0') {
+    char *fptr = filename + sprintf(filename, "hf-14b-");
+    FillFileNameByUID(fptr, dump.uid, "-dump", sizeof(dump.uid));
+  }
+  char *fnameptr = filename + strlen(filename);
+
+  sprintf(fnameptr, ".bin");
+  if ((f = fopen(filename, "wb")) == NULL) {
+    PrintAndLog("Could not create file name %s", filename);
+    return 1;
+  }
+  fwrite(dump.data, SRX_DUMP_BLOCK_SIZE, dump.blocks, f);
+  fclose(f);
+  PrintAndLog("Saved %d blocks to %s", dump.blocks, filename);
+
+  sprintf(fnameptr, ".eml");
+  if ((f = fopen(filename, "w")) == NULL) {
+    PrintAndLog("Could not create file name %s", filename);
+    return 1;
+  }
+  for (int i = 0; i < dump.blocks; i++)
+    fprintf(f, "%s\n", sprint_hex_inrow(dump.data[i], SRX_DUMP_BLOCK_SIZE));
+  fclose(f);
+  PrintAndLog("Saved %d blocks to %s", dump.blocks, filename);
+
+  return errors ? 1 : 0;
 }
 
 int rawClose(void){
@@ -681,6 +844,7 @@ static command_t CommandTable[] =
   {"sri512read",  CmdSri512Read,  0, "Read contents of a SRI512 tag"},
   {"srix4kread",  CmdSrix4kRead,  0, "Read contents of a SRIX4K tag"},
   {"sriwrite",    CmdSriWrite,    0, "Write data to a SRI512 | SRIX4K tag"},
+  {"dump",        CmdSriDump,     0, "Save all blocks of a SRI512 | SRIX4K tag to .bin/.eml"},
   {"raw",         CmdHF14BCmdRaw, 0, "Send raw hex data to tag"},
   {NULL, NULL, 0, NULL}
 };
@@ -20,6 +20,7 @@ int CmdHF14BSim(const char *Cmd);
 int CmdHF14BSnoop(const char *Cmd);
 int CmdSri512Read(const char *Cmd);
 int CmdSrix4kRead(const char *Cmd);
+int CmdSriDump(const char *Cmd);
 int CmdHF14BWrite( const char *cmd);
 int HF14BInfo(bool verbose);
 
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 
 #include "comms.h"
 #include "graph.h"
@@ -38,6 +39,7 @@
 #include "protocols.h"
 #include "cmdmain.h"
 #include "taginfo.h"
+#include "util_posix.h"
 
 #define Crc(data,datalen)     Iso15693Crc(data,datalen)
 #define AddCrc(data,datalen)  Iso15693AddCrc(data,datalen)
@@ -293,13 +295,418 @@ int CmdHF15Sim(const char *Cmd)
 	return 0;
 }
 
-// finds the AFI (Application Family Idendifier) of a card, by trying all values
+// tag seen in an inventory. afi is the most specific AFI request it answered
+typedef struct {
+	uint8_t uid[8];
+	uint8_t dsfid;
+	uint8_t afi;
+	int afi_rank;
+} hf15_inv_tag_t;
+
+// number of AFI nibbles a request specifies. The tag's own AFI is the one with the highest rank
+static int hf15_afi_rank(uint8_t afi)
+{
+	return ((afi & 0xF0) != 0) + ((afi & 0x0F) != 0);
+}
+
+// merges the records of one UID. returns the number of tags
+static int hf15_inv_collect(iso15693_inv_record_t *records, int count, hf15_inv_tag_t *tags, int maxtags)
+{
+	int ntags = 0;
+	for (int i = 0; i < count; i++) {
+		int t;
+		for (t = 0; t < ntags; t++) {
+			if (!memcmp(tags[t].uid, records[i].uid, 8))
+				break;
+		}
+		if (t == ntags) {
+			if (ntags == maxtags)
+				continue;
+			memcpy(tags[t].uid, records[i].uid, 8);
+			tags[t].dsfid = records[i].dsfid;
+			tags[t].afi = records[i].afi;
+			tags[t].afi_rank = -1;
+			ntags++;
+		}
+		int rank = hf15_afi_rank(records[i].afi);
+		if (rank > tags[t].afi_rank) {
+			tags[t].afi = records[i].afi;
+			tags[t].afi_rank = rank;
+		}
+	}
+	return ntags;
+}
+
+static void hf15_inv_print(hf15_inv_tag_t *tags, int ntags, bool show_afi)
+{
+	if (show_afi) {
+		PrintAndLog(" UID              | AFI | DSFID | Manufacturer");
+		PrintAndLog("------------------+-----+-------+-------------");
+	} else {
+		PrintAndLog(" UID              | DSFID | Manufacturer");
+		PrintAndLog("------------------+-------+-------------");
+	}
+	for (int i = 0; i < ntags; i++) {
+		if (show_afi)
+			PrintAndLog(" %s |  %02X |    %02X | %s", sprintUID(NULL, tags[i].uid), tags[i].afi, tags[i].dsfid, getManufacturerName(tags[i].uid[6]));
+		else
+			PrintAndLog(" %s |    %02X | %s", sprintUID(NULL, tags[i].uid), tags[i].dsfid, getManufacturerName(tags[i].uid[6]));
+	}
+}
+
+// runs the inventory on the device and collects the records of all answer frames.
+// returns the number of records or -1. *records has to be freed
+static int hf15_inventory(uint32_t cmd, uint32_t flags, uint8_t afi, iso15693_inv_record_t **records, uint8_t *status, uint32_t *requests)
+{
+	UsbCommand c = {cmd, {flags, afi, 0}};
+	UsbCommand resp;
+	int count = 0;
+
+	*records = NULL;
+	clearCommandBuffer();
+	SendCommand(&c);
+
+	while (true) {
+		if (!WaitForResponseTimeout(CMD_ACK, &resp, 5000)) {
+			PrintAndLog("command execution time out");
+			free(*records);
+			*records = NULL;
+			return -1;
+		}
+
+		int n = resp.arg[0];
+		if (n > USB_CMD_DATA_SIZE / sizeof(iso15693_inv_record_t))
+			n = USB_CMD_DATA_SIZE / sizeof(iso15693_inv_record_t);
+		if (n > 0) {
+			iso15693_inv_record_t *r = realloc(*records, (count + n) * sizeof(iso15693_inv_record_t));
+			if (r == NULL) {
+				PrintAndLog("Cannot allocate memory for inventory");
+				free(*records);
+				*records = NULL;
+				return -1;
+			}
+			*records = r;
+			memcpy(*records + count, resp.d.asBytes, n * sizeof(iso15693_inv_record_t));
+			count += n;
+		}
+
+		if (resp.arg[1] & ISO15693_INV_DONE) {
+			*status = resp.arg[1];
+			*requests = resp.arg[2];
+			return count;
+		}
+	}
+}
+
+static int hf15_inventory_cmd(uint32_t cmd, uint32_t flags, uint8_t afi)
+{
+	iso15693_inv_record_t *records;
+	uint8_t status = 0;
+	uint32_t requests = 0;
+
+	uint64_t t1 = msclock();
+	int count = hf15_inventory(cmd, flags, afi, &records, &status, &requests);
+	if (count < 0)
+		return 0;
+	t1 = msclock() - t1;
+
+	hf15_inv_tag_t *tags = calloc(count ? count : 1, sizeof(hf15_inv_tag_t));
+	if (tags == NULL) {
+		free(records);
+		return 0;
+	}
+	int ntags = hf15_inv_collect(records, count, tags, count);
+	free(records);
+
+	if (ntags == 0) {
+		PrintAndLog("No Tag found.");
+	} else {
+		hf15_inv_print(tags, ntags, (flags & ISO15693_INV_SWEEP) || cmd == CMD_ISO_15693_FIND_AFI);
+	}
+	free(tags);
+
+	PrintAndLog("\n%d tag(s) found with %u inventory requests in %" PRIu64 " ms", ntags, requests, t1);
+	if (status & ISO15693_INV_INCOMPLETE)
+		PrintAndLog("Too many collisions, the inventory may be incomplete.");
+	if (status & ISO15693_INV_ABORTED)
+		PrintAndLog("Aborted.");
+	return ntags;
+}
+
+// lists all tags in the field with a 16 slot anticollision inventory
+int CmdHF15Inventory(const char *Cmd)
+{
+	char cmdp = param_getchar(Cmd, 0);
+	if (cmdp == 'h' || cmdp == 'H') {
+		PrintAndLog("Usage:  hf 15 inventory [afi <AFI>]");
+		PrintAndLog("        lists all ISO15693 tags in the field (16 slot anticollision)");
+		PrintAndLog("        afi <AFI> - only tags of the application family (hex)");
+		PrintAndLog("sample: hf 15 inventory");
+		PrintAndLog("        hf 15 inventory afi 10");
+		return 0;
+	}
+
+	uint32_t flags = 0;
+	uint8_t afi = 0;
+	if (cmdp == 'a' || cmdp == 'A') {
+		if (param_gethex(Cmd, 1, &afi, 2)) {
+			PrintAndLog("AFI must include 2 HEX symbols");
+			return 0;
+		}
+		flags |= ISO15693_INV_AFI;
+	}
+
+	return hf15_inventory_cmd(CMD_ISO_15693_INVENTORY, flags, afi);
+}
+
+// finds the AFI (Application Family Idendifier) of all cards in the field.
 // (There is no standard way of reading the AFI, allthough some tags support this)
+// Families are probed first, sub-families only for the families that answered.
 int CmdHF15Afi(const char *Cmd)
 {
-	UsbCommand c = {CMD_ISO_15693_FIND_AFI, {strtol(Cmd, NULL, 0), 0, 0}};
-	SendCommand(&c);
-	return 0;
+	char cmdp = param_getchar(Cmd, 0);
+	if (cmdp == 'h' || cmdp == 'H') {
+		PrintAndLog("Usage:  hf 15 findafi");
+		PrintAndLog("        inventory of all ISO15693 tags in the field with their AFI");
+		return 0;
+	}
+	return hf15_inventory_cmd(CMD_ISO_15693_FIND_AFI, ISO15693_INV_SWEEP, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Inventory scheduling against simulated tag populations
+//-----------------------------------------------------------------------------
+typedef struct {
+	uint8_t uid[8];
+	uint8_t afi;
+	uint8_t dsfid;
+} hf15_simtag_t;
+
+typedef struct {
+	hf15_simtag_t *tags;
+	int ntags;
+	iso15693_inv_record_t *records;
+	int nrecords;
+	int maxrecords;
+	uint32_t requests;
+} hf15_sim_t;
+
+// the tags' side of one inventory request built by Iso15693InvBuildRequest. Same results as InventoryRequest on the device
+static uint8_t hf15_sim_request(hf15_sim_t *sim, iso15693_inv_t *inv, const iso15693_inv_node_t *node, bool slot1, bool use_afi, uint8_t afi)
+{
+	uint8_t req[ISO15693_INV_MAX_REQUEST];
+	int reqlen = Iso15693InvBuildRequest(req, slot1, use_afi, afi, node);
+	sim->requests++;
+	if (Crc(req, reqlen) != ISO15693_CRC_CHECK || req[1] != ISO15693_INVENTORY)
+		return 0;
+
+	// parse the request the way a tag does
+	int n = 2;
+	bool req_afi = req[0] & ISO15693_REQINV_AFI;
+	uint8_t afi_value = req_afi ? req[n++] : 0;
+	uint8_t masklen = req[n++];
+	uint64_t mask = 0;
+	for (int i = 0; i < (masklen + 7) / 8; i++)
+		mask |= (uint64_t)req[n++] << (8 * i);
+	int slots = (req[0] & ISO15693_REQINV_SLOT1) ? 1 : 16;
+
+	int responders[16] = {0};
+	int last[16] = {0};
+	for (int t = 0; t < sim->ntags; t++) {
+		if (req_afi && !Iso15693AfiMatch(afi_value, sim->tags[t].afi))
+			continue;
+		uint64_t uid = 0;
+		for (int i = 0; i < 8; i++)
+			uid |= (uint64_t)sim->tags[t].uid[i] << (8 * i);
+		if (masklen < 64 && (uid & ((1ULL << masklen) - 1)) != mask)
+			continue;
+		if (masklen == 64 && uid != mask)
+			continue;
+		int slot = slots == 1 || masklen >= 64 ? 0 : (uid >> masklen) & 0x0F;
+		responders[slot]++;
+		last[slot] = t;
+	}
+
+	uint8_t result = 0;
+	for (int slot = 0; slot < slots; slot++) {
+		if (responders[slot] == 1) {
+			if (sim->nrecords < sim->maxrecords) {
+				iso15693_inv_record_t *r = &sim->records[sim->nrecords++];
+				r->afi = use_afi ? afi : 0;
+				memcpy(r->uid, sim->tags[last[slot]].uid, 8);
+				r->dsfid = sim->tags[last[slot]].dsfid;
+			}
+			result |= 0x01;
+		} else if (responders[slot] > 1) {
+			result |= 0x02;
+			if (slots > 1)
+				Iso15693InvCollision(inv, node, slot);
+		}
+	}
+	return result;
+}
+
+static uint8_t hf15_sim_tree(hf15_sim_t *sim, bool use_afi, uint8_t afi, bool *overflow)
+{
+	iso15693_inv_t inv;
+	iso15693_inv_node_t node;
+	uint8_t result = 0;
+
+	Iso15693InvInit(&inv);
+	while (Iso15693InvNext(&inv, &node))
+		result |= hf15_sim_request(sim, &inv, &node, false, use_afi, afi);
+	if (inv.overflow)
+		*overflow = true;
+	return result;
+}
+
+// the same schedule as InventoryIso15693 with ISO15693_INV_SWEEP
+static bool hf15_sim_sweep(hf15_sim_t *sim)
+{
+	bool overflow = false;
+	uint8_t result = hf15_sim_tree(sim, false, 0, &overflow);
+	int a = result ? Iso15693AfiNext(-1, false) : -1;
+	while (a >= 0) {
+		iso15693_inv_node_t root = {0, 0};
+		result = hf15_sim_request(sim, NULL, &root, true, true, a);
+		if (result & 0x02)
+			hf15_sim_tree(sim, true, a, &overflow);
+		a = Iso15693AfiNext(a, result != 0);
+	}
+	return !overflow;
+}
+
+static uint32_t hf15_sim_rand(uint32_t *state)
+{
+	// xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// populations: 0 - random UIDs, 1 - consecutive serial numbers, 2 - UIDs that differ in the upper bits only
+static void hf15_sim_population(hf15_simtag_t *tags, int ntags, int kind, uint32_t *rnd)
+{
+	uint32_t base = hf15_sim_rand(rnd);
+	for (int t = 0; t < ntags; t++) {
+		uint32_t lo = hf15_sim_rand(rnd);
+		uint32_t hi = hf15_sim_rand(rnd);
+		if (kind == 1)
+			lo = base + t;
+		if (kind == 2) {
+			lo = base;
+			hi = (hi & 0xFFFF0000) | t;
+		}
+		for (int i = 0; i < 4; i++) {
+			tags[t].uid[i] = (lo >> (8 * i)) & 0xFF;
+			tags[t].uid[4 + i] = (hi >> (8 * i)) & 0xFF;
+		}
+		tags[t].uid[7] = 0xE0;
+		// a quarter of the tags without AFI
+		uint32_t r = hf15_sim_rand(rnd);
+		tags[t].afi = (r & 3) ? (r >> 8) & 0xFF : 0;
+		tags[t].dsfid = (r >> 16) & 0xFF;
+	}
+	// the simulated population must not contain the same UID twice
+	for (int t = 1; t < ntags; t++) {
+		for (int u = 0; u < t; u++) {
+			if (!memcmp(tags[t].uid, tags[u].uid, 8)) {
+				tags[t].uid[0] ^= 0x01;
+				u = -1;
+			}
+		}
+	}
+}
+
+// checks that the inventory finds every tag with its AFI
+int CmdHF15InvTest(const char *Cmd)
+{
+	char cmdp = param_getchar(Cmd, 0);
+	if (cmdp == 'h' || cmdp == 'H') {
+		PrintAndLog("Usage:  hf 15 invtest [<max tags> [<rounds> [<seed>]]]");
+		PrintAndLog("        runs the 16 slot inventory and AFI sweep against simulated tag populations");
+		PrintAndLog("        defaults: 64 tags, 20 rounds");
+		return 0;
+	}
+
+	int maxtags = param_get32ex(Cmd, 0, 64, 10);
+	int rounds = param_get32ex(Cmd, 1, 20, 10);
+	uint32_t rnd = param_get32ex(Cmd, 2, 1, 10);
+	if (maxtags < 1) maxtags = 1;
+	if (rnd == 0) rnd = 1;
+
+	const char *kinds[] = {"random", "serial", "upper bits"};
+	hf15_simtag_t *tags = calloc(maxtags, sizeof(hf15_simtag_t));
+	hf15_inv_tag_t *found = calloc(maxtags, sizeof(hf15_inv_tag_t));
+	hf15_sim_t sim;
+	sim.maxrecords = maxtags * 8 + 16;
+	sim.records = calloc(sim.maxrecords, sizeof(iso15693_inv_record_t));
+	if (!tags || !found || !sim.records) {
+		PrintAndLog("Cannot allocate memory");
+		free(tags);
+		free(found);
+		free(sim.records);
+		return 0;
+	}
+
+	int failed = 0;
+	PrintAndLog("population | rounds | tags | inventory req | sweep req | result");
+	for (int kind = 0; kind < 3; kind++) {
+		uint64_t invRequests = 0, sweepRequests = 0, tagCount = 0;
+		int kindFailed = 0;
+		for (int r = 0; r < rounds; r++) {
+			int ntags = 1 + hf15_sim_rand(&rnd) % maxtags;
+			hf15_sim_population(tags, ntags, kind, &rnd);
+			sim.tags = tags;
+			sim.ntags = ntags;
+			tagCount += ntags;
+
+			// plain inventory
+			bool overflow = false;
+			sim.nrecords = 0;
+			sim.requests = 0;
+			hf15_sim_tree(&sim, false, 0, &overflow);
+			invRequests += sim.requests;
+			int nfound = hf15_inv_collect(sim.records, sim.nrecords, found, maxtags);
+			bool ok = !overflow && nfound == ntags;
+
+			// AFI sweep. Every tag with its own AFI
+			sim.nrecords = 0;
+			sim.requests = 0;
+			ok &= hf15_sim_sweep(&sim);
+			sweepRequests += sim.requests;
+			nfound = hf15_inv_collect(sim.records, sim.nrecords, found, maxtags);
+			ok &= nfound == ntags;
+			for (int f = 0; f < nfound && ok; f++) {
+				int t;
+				for (t = 0; t < ntags; t++) {
+					if (!memcmp(found[f].uid, tags[t].uid, 8))
+						break;
+				}
+				if (t == ntags || found[f].afi != tags[t].afi || found[f].dsfid != tags[t].dsfid)
+					ok = false;
+			}
+			if (!ok)
+				kindFailed++;
+		}
+		PrintAndLog("%-10s | %6d | %4.1f | %13.1f | %9.1f | %s", kinds[kind], rounds,
+			(double)tagCount / rounds, (double)invRequests / rounds, (double)sweepRequests / rounds,
+			kindFailed ? "FAIL" : "OK");
+		failed += kindFailed;
+	}
+
+	free(tags);
+	free(found);
+	free(sim.records);
+
+	if (failed)
+		PrintAndLog("Test(s) [ ERROR ] %d population(s) not inventoried completely", failed);
+	else
+		PrintAndLog("Test(s) [ OK ]");
+	return failed;
 }
 
 // Reads all memory pages
@@ -380,7 +787,9 @@ static command_t CommandTable15[] =
 	{"reader",  CmdHF15Reader,  0, "Act like an ISO15693 reader"},
 	{"sim",     CmdHF15Sim,     0, "Fake an ISO15693 tag"},
 	{"cmd",     CmdHF15Cmd,     0, "Send direct commands to ISO15693 tag"},
-	{"findafi", CmdHF15Afi,     0, "Brute force AFI of an ISO15693 tag"},
+	{"inventory", CmdHF15Inventory, 0, "List all ISO15693 tags in the field (16 slot anticollision)"},
+	{"findafi", CmdHF15Afi,     0, "Find the AFI of all ISO15693 tags in the field"},
+	{"invtest", CmdHF15InvTest, 1, "Test the inventory on simulated tag populations"},
 	{"dumpmemory", CmdHF15DumpMem,     0, "Read all memory pages of an ISO15693 tag"},
 	{"csetuid",	CmdHF15CSetUID,	0,	"Set UID for magic Chinese card"},
 	{NULL, NULL, 0, NULL}
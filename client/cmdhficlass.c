@@ -15,6 +15,9 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <dirent.h>
 #include "iso14443crc.h" // Can also be used for iClass, using 0xE012 as CRC-type
 #include "comms.h"
 #include "ui.h"
@@ -373,19 +376,220 @@ static int readKeyfile(const char *filename, size_t len, uint8_t* buffer) {
 
 int usage_hf_iclass_decrypt(void) {
 	PrintAndLog("Usage: hf iclass decrypt f <tagdump>");
+	PrintAndLog("       hf iclass decrypt d <directory> [c <csvfile>]");
+	PrintAndLog("Options:");
+	PrintAndLog("  f <tagdump>   : decrypt one dump and show the blocks");
+	PrintAndLog("  d <directory> : decrypt all .bin dumps in the directory in parallel and list");
+	PrintAndLog("                  the config blocks and credentials");
+	PrintAndLog("  c <csvfile>   : (optional) also write the list as csv");
 	PrintAndLog("");
 	PrintAndLog("OBS! In order to use this function, the file 'iclass_decryptionkey.bin' must reside");
 	PrintAndLog("in the working directory. The file should be 16 bytes binary data");
 	PrintAndLog("");
-	PrintAndLog("example: hf iclass decrypt f tagdump_12312342343.bin");
+	PrintAndLog("Only the blocks of application area 1 after block 6 are decrypted, the end of the");
+	PrintAndLog("area is taken from the configuration block. The decrypted dumps are saved as");
+	PrintAndLog("iclass_tagdump-<csn>-decrypted.bin");
 	PrintAndLog("");
-	PrintAndLog("OBS! This is pretty stupid implementation, it tries to decrypt every block after block 6. ");
-	PrintAndLog("Correct behaviour would be to decrypt only the application areas where the key is valid,");
-	PrintAndLog("which is defined by the configuration block.");
+	PrintAndLog("example: hf iclass decrypt f tagdump_12312342343.bin");
+	PrintAndLog("example: hf iclass decrypt d dumps c site.csv");
 	return 1;
 }
 
+typedef struct {
+	char filename[FILE_PATH_SIZE];
+	uint8_t *dump;
+	size_t len;
+	uint8_t endblock;       // last decrypted block
+	uint8_t bits;           // credential length, 0 if there is none
+	uint64_t credential;
+} iclass_decrypt_job_t;
+
+typedef struct {
+	mbedtls_des3_context *ctx;
+	iclass_decrypt_job_t *jobs;
+	size_t count;
+	size_t next;
+	pthread_mutex_t lock;
+} iclass_decrypt_batch_t;
+
+// Decrypts the blocks 7 up to the end of AA1 in place. Returns the last decrypted block.
+static uint8_t iClassDecryptDump(mbedtls_des3_context *ctx, uint8_t *dump, size_t len) {
+	size_t blocks = len / 8;
+	if (blocks < 8)
+		return 0;
+
+	// config block 1, app limit. The same default as mem_app_config()
+	size_t endblock = dump[8];
+	if (endblock < 6)
+		endblock = 26;
+	if (endblock > blocks - 1)
+		endblock = blocks - 1;
+
+	for (size_t i = 7; i <= endblock; i++)
+		mbedtls_des3_crypt_ecb(ctx, dump + i * 8, dump + i * 8);
+	return endblock;
+}
+
+// The credential in block 7 is right aligned with a leading sentinel bit
+static uint8_t iClassGetCredential(uint8_t *block7, uint64_t *credential) {
+	uint64_t v = bytes_to_num(block7, 8);
+	uint8_t bits = 63;
+	while (bits > 0 && !(v & (1ULL << bits)))
+		bits--;
+	if (bits == 0)
+		return 0;
+	*credential = v & ((1ULL << bits) - 1);
+	return bits;
+}
+
+static void *iClassDecryptThread(void *arg) {
+	iclass_decrypt_batch_t *b = (iclass_decrypt_batch_t *)arg;
+
+	for (;;) {
+		pthread_mutex_lock(&b->lock);
+		size_t i = b->next++;
+		pthread_mutex_unlock(&b->lock);
+		if (i >= b->count)
+			break;
+
+		iclass_decrypt_job_t *job = &b->jobs[i];
+		FILE *f = fopen(job->filename, "rb");
+		if (!f)
+			continue;
+		fseek(f, 0, SEEK_END);
+		long fsize = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		if (fsize > 0 && (job->dump = malloc(fsize)) != NULL)
+			job->len = fread(job->dump, 1, fsize, f);
+		fclose(f);
+
+		job->endblock = iClassDecryptDump(b->ctx, job->dump, job->len);
+		if (job->endblock)
+			job->bits = iClassGetCredential(job->dump + 7 * 8, &job->credential);
+	}
+	return NULL;
+}
+
+static int job_cmp(const void *a, const void *b) {
+	return strcmp(((iclass_decrypt_job_t *)a)->filename, ((iclass_decrypt_job_t *)b)->filename);
+}
+
+static void iClassSaveDecrypted(uint8_t *dump, size_t len) {
+	//Use the first block (CSN) for filename
+	char outfilename[FILE_PATH_SIZE] = { 0 };
+	snprintf(outfilename,FILE_PATH_SIZE,"iclass_tagdump-%02x%02x%02x%02x%02x%02x%02x%02x-decrypted",
+			 dump[0],dump[1],dump[2],dump[3],
+			 dump[4],dump[5],dump[6],dump[7]);
+	saveFile(outfilename, "bin", dump, len);
+}
+
+static int iClassDecryptDirectory(mbedtls_des3_context *ctx, const char *dirname, const char *csvname) {
+	DIR *dp = opendir(dirname);
+	if (dp == NULL) {
+		PrintAndLog("Could not open directory %s", dirname);
+		return 1;
+	}
+
+	iclass_decrypt_job_t *jobs = NULL;
+	size_t count = 0;
+	struct dirent *ep;
+	while ((ep = readdir(dp)) != NULL) {
+		size_t namelen = strlen(ep->d_name);
+		if (namelen < 4 || strcmp(ep->d_name + namelen - 4, ".bin") || strstr(ep->d_name, "-decrypted"))
+			continue;
+		iclass_decrypt_job_t *p = realloc(jobs, (count + 1) * sizeof(iclass_decrypt_job_t));
+		if (p == NULL) {
+			PrintAndLog("Cannot allocate memory for the dumps");
+			break;
+		}
+		jobs = p;
+		memset(&jobs[count], 0, sizeof(iclass_decrypt_job_t));
+		snprintf(jobs[count].filename, FILE_PATH_SIZE, "%s/%s", dirname, ep->d_name);
+		count++;
+	}
+	closedir(dp);
+	if (count == 0) {
+		PrintAndLog("No .bin dumps in %s", dirname);
+		free(jobs);
+		return 1;
+	}
+	qsort(jobs, count, sizeof(iclass_decrypt_job_t), job_cmp);
+
+	uint64_t t1 = msclock();
+	iclass_decrypt_batch_t batch = {ctx, jobs, count, 0, PTHREAD_MUTEX_INITIALIZER};
+	size_t threads = num_CPUs();
+	if (threads < 1) threads = 1;
+	if (threads > count) threads = count;
+	pthread_t thread_id[threads];
+	for (size_t i = 0; i < threads; i++)
+		pthread_create(&thread_id[i], NULL, iClassDecryptThread, &batch);
+	for (size_t i = 0; i < threads; i++)
+		pthread_join(thread_id[i], NULL);
+	t1 = msclock() - t1;
+
+	FILE *csv = NULL;
+	if (csvname && csvname[0]) {
+		csv = fopen(csvname, "w");
+		if (csv == NULL)
+			PrintAndLog("Could not create file %s", csvname);
+		else
+			fprintf(csv, "file,csn,app_limit,otp,block_writelock,chip_config,mem_config,eas,fuses,bits,credential,facility,card\n");
+	}
+
+	PrintAndLog("CSN                     |AA1|Fuses|Bits|Credential      |  FC|   CN| File");
+	PrintAndLog("------------------------+---+-----+----+----------------+----+-----+-----");
+	size_t decrypted = 0;
+	for (size_t i = 0; i < count; i++) {
+		iclass_decrypt_job_t *job = &jobs[i];
+		if (job->endblock == 0) {
+			PrintAndLog("%-24s|   |     |    |                |    |     | %s", job->dump ? "too short" : "read failed", job->filename);
+			continue;
+		}
+		decrypted++;
+		uint8_t *d = job->dump;
+		char cred[17] = "", fc[5] = "", cn[6] = "";
+		if (job->bits) {
+			snprintf(cred, sizeof(cred), "%" PRIx64, job->credential);
+			// H10301: even parity, 8 bit facility code, 16 bit card number, odd parity
+			if (job->bits == 26) {
+				snprintf(fc, sizeof(fc), "%u", (unsigned int)(job->credential >> 17) & 0xFF);
+				snprintf(cn, sizeof(cn), "%u", (unsigned int)(job->credential >> 1) & 0xFFFF);
+			}
+		}
+		PrintAndLog("%s| %02X|  %02X | %3u|%16s|%4s|%5s| %s", sprint_hex(d, 8), job->endblock, d[15], job->bits, cred, fc, cn, job->filename);
+		if (csv) {
+			fprintf(csv, "%s,%s,%02X,%02X%02X,%02X,%02X,%02X,%02X,%02X,%u,%s,%s,%s\n", job->filename, sprint_hex_inrow(d, 8),
+				d[8], d[9], d[10], d[11], d[12], d[13], d[14], d[15], job->bits, cred, fc, cn);
+		}
+	}
+	if (csv) {
+		fclose(csv);
+		PrintAndLog("Saved the list to %s", csvname);
+	}
+	PrintAndLog("Decrypted %u of %u dumps in %" PRIu64 " ms", (unsigned int)decrypted, (unsigned int)count, t1);
+
+	for (size_t i = 0; i < count; i++) {
+		if (jobs[i].endblock)
+			iClassSaveDecrypted(jobs[i].dump, jobs[i].len / 8 * 8);
+		free(jobs[i].dump);
+	}
+
+	free(jobs);
+	return 0;
+}
+
 int CmdHFiClassDecrypt(const char *Cmd) {
+	char opt = param_getchar(Cmd, 0);
+	if (strlen(Cmd)<1 || opt == 'h')
+		return usage_hf_iclass_decrypt();
+
+	char filename[FILE_PATH_SIZE] = { 0 };
+	char csvname[FILE_PATH_SIZE] = { 0 };
+	if ((opt != 'f' && opt != 'd') || param_getstr(Cmd, 1, filename, sizeof(filename)) == 0)
+		return usage_hf_iclass_decrypt();
+	if (opt == 'd' && param_getchar(Cmd, 2) == 'c' && param_getstr(Cmd, 3, csvname, sizeof(csvname)) == 0)
+		return usage_hf_iclass_decrypt();
+
 	uint8_t key[16] = { 0 };
 	if(readKeyfile("iclass_decryptionkey.bin", 16, key))
 	{
@@ -393,54 +597,42 @@ int CmdHFiClassDecrypt(const char *Cmd) {
 		return 1;
 	}
 	PrintAndLog("Decryption file found... ");
-	char opt = param_getchar(Cmd, 0);
-	if (strlen(Cmd)<1 || opt == 'h')
-		return usage_hf_iclass_decrypt();
 
-	//Open the tagdump-file
-	FILE *f;
-	char filename[FILE_PATH_SIZE];
-	if(opt == 'f' && param_getstr(Cmd, 1, filename, sizeof(filename)) > 0) {
-		f = fopen(filename, "rb");
-		if ( f == NULL ) {
-			PrintAndLog("Could not find file %s", filename);
-			return 1;
-		}
-	} else {
-		return usage_hf_iclass_decrypt();
+	// the key schedule is set up once for all dumps
+	mbedtls_des3_context ctx = { {0} };
+	mbedtls_des3_set2key_dec( &ctx, key);
+
+	if (opt == 'd') {
+		int res = iClassDecryptDirectory(&ctx, filename, csvname);
+		mbedtls_des3_free(&ctx);
+		return res;
 	}
 
+	//Open the tagdump-file
+	FILE *f = fopen(filename, "rb");
+	if ( f == NULL ) {
+		PrintAndLog("Could not find file %s", filename);
+		return 1;
+	}
 	fseek(f, 0, SEEK_END);
 	long fsize = ftell(f);
 	fseek(f, 0, SEEK_SET);
-	uint8_t enc_dump[8] = {0};
-	uint8_t *decrypted = malloc(fsize);
-	mbedtls_des3_context ctx = { {0} };
-	mbedtls_des3_set2key_dec( &ctx, key);
-	size_t bytes_read = fread(enc_dump, 1, 8, f);
+	uint8_t *decrypted = malloc(fsize > 0 ? fsize : 1);
+	size_t bytes_read = fread(decrypted, 1, fsize > 0 ? fsize : 0, f);
+	fclose(f);
 
-	//Use the first block (CSN) for filename
-	char outfilename[FILE_PATH_SIZE] = { 0 };
-	snprintf(outfilename,FILE_PATH_SIZE,"iclass_tagdump-%02x%02x%02x%02x%02x%02x%02x%02x-decrypted",
-			 enc_dump[0],enc_dump[1],enc_dump[2],enc_dump[3],
-			 enc_dump[4],enc_dump[5],enc_dump[6],enc_dump[7]);
+	uint8_t endblock = iClassDecryptDump(&ctx, decrypted, bytes_read);
+	mbedtls_des3_free(&ctx);
+	if (endblock == 0) {
+		PrintAndLog("File %s is too short for a tag dump", filename);
+		free(decrypted);
+		return 1;
+	}
 
-	size_t blocknum =0;
-	while(bytes_read == 8)
-	{
-		if(blocknum < 7)
-		{
-			memcpy(decrypted+(blocknum*8), enc_dump, 8);
-		}else{
-			mbedtls_des3_crypt_ecb(&ctx, enc_dump,decrypted +(blocknum*8) );
-		}
+	for (size_t blocknum = 0; blocknum < bytes_read / 8; blocknum++)
 		printvar("decrypted block", decrypted +(blocknum*8), 8);
-		bytes_read = fread(enc_dump, 1, 8, f);
-		blocknum++;
-	}
-	fclose(f);
 
-	saveFile(outfilename,"bin", decrypted, blocknum*8);
+	iClassSaveDecrypted(decrypted, bytes_read / 8 * 8);
 	free(decrypted);
 	return 0;
 }
@@ -1860,7 +2052,7 @@ static command_t CommandTable[] =
 	{"calcnewkey",  CmdHFiClassCalcNewKey,      	1,	"[options..] Calc Diversified keys (blocks 3 & 4) to write new keys"},
 	{"chk",         CmdHFiClassCheckKeys,        	0,	"            Check keys"},	
 	{"clone",       CmdHFiClassCloneTag,        	0,	"[options..] Authenticate and Clone from iClass bin file"},
-	{"decrypt",     CmdHFiClassDecrypt,         	1,	"[f <fname>] Decrypt tagdump" },
+	{"decrypt",     CmdHFiClassDecrypt,         	1,	"[f <fname>|d <dir>] Decrypt tagdump(s)" },
 	{"dump",        CmdHFiClassReader_Dump,     	0,	"[options..] Authenticate and Dump iClass tag's AA1"},
 	{"eload",       CmdHFiClassELoad,           	0,	"[f <fname>] (experimental) Load data into iClass emulator memory"},
 	{"encryptblk",  CmdHFiClassEncryptBlk,      	1,	"<BlockData> Encrypt given block data"},
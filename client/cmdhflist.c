@@ -802,13 +802,13 @@ static bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, boo
 }
 
 
-bool is_last_record(uint16_t tracepos, uint8_t *trace, uint16_t traceLen)
+bool is_last_record(uint32_t tracepos, uint8_t *trace, uint32_t traceLen)
 {
 	return(tracepos + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint16_t) >= traceLen);
 }
 
 
-bool next_record_is_response(uint16_t tracepos, uint8_t *trace)
+bool next_record_is_response(uint32_t tracepos, uint8_t *trace)
 {
 	uint16_t next_records_datalen = *((uint16_t *)(trace + tracepos + sizeof(uint32_t) + sizeof(uint16_t)));
 
@@ -816,7 +816,7 @@ bool next_record_is_response(uint16_t tracepos, uint8_t *trace)
 }
 
 
-bool merge_topaz_reader_frames(uint32_t timestamp, uint32_t *duration, uint16_t *tracepos, uint16_t traceLen, uint8_t *trace, uint8_t *frame, uint8_t *topaz_reader_command, uint16_t *data_len)
+bool merge_topaz_reader_frames(uint32_t timestamp, uint32_t *duration, uint32_t *tracepos, uint32_t traceLen, uint8_t *trace, uint8_t *frame, uint8_t *topaz_reader_command, uint16_t *data_len)
 {
 
 #define MAX_TOPAZ_READER_CMD_LEN    16
@@ -855,7 +855,7 @@ bool merge_topaz_reader_frames(uint32_t timestamp, uint32_t *duration, uint16_t
 }
 
 
-uint16_t printTraceLine(uint16_t tracepos, uint16_t traceLen, uint8_t *trace, uint8_t protocol, bool showWaitCycles, bool markCRCBytes)
+uint32_t printTraceLine(uint32_t tracepos, uint32_t traceLen, uint8_t *trace, uint8_t protocol, bool showWaitCycles, bool markCRCBytes)
 {
 	bool isResponse;
 	uint16_t data_len, parity_len;
@@ -938,15 +938,19 @@ uint16_t printTraceLine(uint16_t tracepos, uint16_t traceLen, uint8_t *trace, ui
 
 	for (int j = 0; j < data_len && j/16 < 16; j++) {
 		uint8_t parityBits = parityBytes[j>>3];
+		char *pos = line[j/16] + ((j % 16) * 4);
+		pos[0] = ' ';
+		sprint_hex_inrow_r(pos + 1, SPRINT_HEX_INROW_SIZE(1), &frame[j], 1);
 		if (protocol != ISO_14443B
 			&& protocol != ISO_15693
 			&& protocol != ISO_7816_4
 			&& (isResponse || protocol == ISO_14443A)
 			&& (oddparity8(frame[j]) != ((parityBits >> (7-(j&0x0007))) & 0x01))) {
-			snprintf(line[j/16]+(( j % 16) * 4), 110, " %02x!", frame[j]);
+			pos[3] = '!';
 		} else {
-			snprintf(line[j/16]+(( j % 16) * 4), 110, " %02x ", frame[j]);
+			pos[3] = ' ';
 		}
+		pos[4] = '\0';
 	}
 
 	if (markCRCBytes) {
@@ -1017,8 +1021,9 @@ uint16_t printTraceLine(uint16_t tracepos, uint16_t traceLen, uint8_t *trace, ui
 			annotateIso14443a(&explanation[1], sizeof(explanation) - 1, mfData, mfDataLen);
 		}
 		uint8_t crcc = iso14443A_CRC_check(isResponse, mfData, mfDataLen);
+		char hex[SPRINT_HEX_SIZE(sizeof(mfData))];
 		PrintAndLog("            |          * | dec |%-64s | %-4s| %s",
-			sprint_hex(mfData, mfDataLen),
+			sprint_hex_r(hex, sizeof(hex), mfData, mfDataLen),
 			(crcc == 0 ? "!crc" : (crcc == 1 ? " ok " : "    ")),
 			(true) ? explanation : "");
 	};
@@ -1160,6 +1165,7 @@ int CmdHFList(const char *Cmd)
 	uint8_t *trace;
 	uint32_t tracepos = 0;
 	uint32_t traceLen = 0;
+	bool ownTrace = true;     // false if trace points to the PCSC trace buffer
 
 	if (loadFromFile) {
 		#define TRACE_CHUNK_SIZE (1<<16)        // 64K to start with. Will be enough for BigBuf and some room for future extensions
@@ -1193,6 +1199,7 @@ int CmdHFList(const char *Cmd)
 	} else if (PCSCtrace) {
 		trace = pcsc_get_trace_addr();
 		traceLen = pcsc_get_traceLen();
+		ownTrace = false;
 	} else {
 		trace = malloc(USB_CMD_DATA_SIZE);
 		// Query for the size of the trace
@@ -1215,6 +1222,9 @@ int CmdHFList(const char *Cmd)
 		FILE *tracefile = NULL;
 		if ((tracefile = fopen(filename,"wb")) == NULL) {
 			PrintAndLog("Could not create file %s", filename);
+			if (ownTrace) {
+				free(trace);
+			}
 			return 1;
 		}
 		fwrite(trace, 1, traceLen, tracefile);
@@ -1237,7 +1247,9 @@ int CmdHFList(const char *Cmd)
 		}
 	}
 
-	free(trace);
+	if (ownTrace) {
+		free(trace);
+	}
 	return 0;
 }
 
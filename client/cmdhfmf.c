@@ -456,6 +456,125 @@ int CmdHF14AMfDump(const char *Cmd)
 	return 0;
 }
 
+static const char *mf_audit_keys(uint16_t rights, uint16_t bitA, uint16_t bitB) {
+	if ((rights & bitA) && (rights & bitB)) return "AB";
+	if (rights & bitA) return "A ";
+	if (rights & bitB) return "B ";
+	return "- ";
+}
+
+static void mf_audit_print(mf_audit_sector_t *r) {
+	uint8_t blocks = NumBlocksPerSector(r->sector);
+	uint8_t firstBlock = FirstBlockOfSector(r->sector);
+	int read = 0;
+	for (int i = 0; i < blocks; i++)
+		if (r->read & (1 << i)) read++;
+
+	PrintAndLog("Sector %2d: auth %s %s, access %s, read %d/%d blocks%s", r->sector,
+		(r->flags & MF_AUDIT_AUTH_A) ? "A" : "-", (r->flags & MF_AUDIT_AUTH_B) ? "B" : "-",
+		(r->read & (1 << (blocks - 1))) ? sprint_hex_inrow(r->access, 4) : "-", read, blocks,
+		(r->read & (1 << (blocks - 1))) && !(r->flags & MF_AUDIT_ACL_OK) ? ", access bits invalid" : "");
+	if (!(r->flags & MF_AUDIT_ACL_OK))
+		return;
+
+	for (int g = 0; g < 3; g++) {
+		char name[20];
+		if (blocks == 4)
+			snprintf(name, sizeof(name), "block  %3d", firstBlock + g);
+		else
+			snprintf(name, sizeof(name), "blocks %3d-%3d", firstBlock + g * 5, firstBlock + g * 5 + 4);
+		uint8_t rights = r->rights[g];
+		char value[40] = "";
+		uint16_t groupMask = (blocks == 4) ? (1 << g) : (0x1F << (g * 5));
+		if (r->value & groupMask)
+			snprintf(value, sizeof(value), "  value %d (addr %d)", r->values[g], r->value_addr[g]);
+		PrintAndLog("  %-15s: read %s write %s incr %s dec %s%s", name,
+			mf_audit_keys(rights, MF_ACL_READ, MF_ACL_READ << 4),
+			mf_audit_keys(rights, MF_ACL_WRITE, MF_ACL_WRITE << 4),
+			mf_audit_keys(rights, MF_ACL_INC, MF_ACL_INC << 4),
+			mf_audit_keys(rights, MF_ACL_DEC, MF_ACL_DEC << 4),
+			value);
+	}
+	uint16_t t = r->trailer_rights;
+	PrintAndLog("  %-15s: key A write %s access read %s write %s key B read %s write %s%s", "trailer",
+		mf_audit_keys(t, MF_ACL_WRITE_KEYA, MF_ACL_WRITE_KEYA << 8),
+		mf_audit_keys(t, MF_ACL_READ_ACCESS, MF_ACL_READ_ACCESS << 8),
+		mf_audit_keys(t, MF_ACL_WRITE_ACCESS, MF_ACL_WRITE_ACCESS << 8),
+		mf_audit_keys(t, MF_ACL_READ_KEYB, MF_ACL_READ_KEYB << 8),
+		mf_audit_keys(t, MF_ACL_WRITE_KEYB, MF_ACL_WRITE_KEYB << 8),
+		(r->flags & MF_AUDIT_KEYB_DATA) ? "  (key B is data)" : "");
+}
+
+int CmdHF14AMfAudit(const char *Cmd)
+{
+	uint8_t keys[2 * 40 * 6];
+	char filename[FILE_PATH_SIZE] = "dumpkeys.bin";
+
+	char cmdp = param_getchar(Cmd, 0);
+	if (cmdp == 'h' || cmdp == 'H') {
+		PrintAndLog("Audits the access conditions and value blocks of all sectors on the device.");
+		PrintAndLog("The keys are taken from a key file written by 'hf mf chk ... d' or 'hf mf nested ... d'.");
+		PrintAndLog("For each sector the device reads the trailer, decodes the access bits and reads the");
+		PrintAndLog("data blocks the keys may read, in one authenticated walk per key.");
+		PrintAndLog("Usage:   hf mf audit [card memory] [f <keyfile>]");
+		PrintAndLog("  [card memory]: 0 = 320 bytes (Mifare Mini), 1 = 1K (default), 2 = 2K, 4 = 4K");
+		PrintAndLog("  f <keyfile>  : key A of all sectors followed by key B, default dumpkeys.bin");
+		PrintAndLog("");
+		PrintAndLog("Samples: hf mf audit");
+		PrintAndLog("         hf mf audit 4 f mykeys.bin");
+		return 0;
+	}
+	uint8_t numSectors = ParamCardSizeSectors(cmdp);
+	int paramn = (cmdp == 'f' || cmdp == 'F' || cmdp == 0x00) ? 0 : 1;
+	if (tolower(param_getchar(Cmd, paramn)) == 'f') {
+		if (param_getstr(Cmd, paramn + 1, filename, sizeof(filename)) == 0) {
+			PrintAndLog("Key file name missing");
+			return 1;
+		}
+	}
+
+	FILE *fkeys = fopen(filename, "rb");
+	if (fkeys == NULL) {
+		PrintAndLog("Could not find file %s", filename);
+		return 1;
+	}
+	size_t bytes_read = fread(keys, 1, 2 * numSectors * 6, fkeys);
+	fclose(fkeys);
+	if (bytes_read != 2 * numSectors * 6) {
+		PrintAndLog("File reading error (%s).", filename);
+		return 2;
+	}
+
+	uint64_t allSectors = (1ULL << numSectors) - 1;
+	UsbCommand c = {CMD_MIFARE_AUDIT, {numSectors, allSectors, allSectors}};
+	memcpy(c.d.asBytes, keys, 2 * numSectors * 6);
+	clearCommandBuffer();
+	SendCommand(&c);
+
+	uint64_t t1 = msclock();
+	int audited = 0;
+	bool last = false;
+	while (!last) {
+		UsbCommand resp;
+		if (!WaitForResponseTimeout(CMD_ACK, &resp, 5000)) {
+			PrintAndLog("Command execute timeout");
+			return 1;
+		}
+		if (resp.arg[0] == MF_AUDIT_NO_CARD) {
+			PrintAndLog("Can't select card");
+			return 1;
+		}
+		mf_audit_sector_t *reports = (mf_audit_sector_t *)resp.d.asBytes;
+		for (int i = 0; i < resp.arg[1] && i < MF_AUDIT_FRAME_SECTORS; i++) {
+			mf_audit_print(&reports[i]);
+			audited++;
+		}
+		last = resp.arg[2];
+	}
+	PrintAndLog("Audited %d sectors in %" PRIu64 " ms", audited, msclock() - t1);
+	return 0;
+}
+
 int CmdHF14AMfRestore(const char *Cmd)
 {
 	uint8_t sectorNo,blockNo;
@@ -2213,15 +2332,34 @@ int CmdHF14AMfCSetBlk(const char *Cmd)
 }
 
 
+static void mfCPrintFailedBlocks(const char *msg, uint32_t *errorMap, int blocksCount) {
+	char line[200] = {0};
+	int pos = 0;
+
+	PrintAndLog("%s", msg);
+	for (int i = 0; i < blocksCount; i++) {
+		if (!(errorMap[i / 32] & (1U << (i % 32))))
+			continue;
+		pos += snprintf(line + pos, sizeof(line) - pos, "%d ", i);
+		if (pos > 70) {
+			PrintAndLog("  %s", line);
+			pos = 0;
+		}
+	}
+	if (pos)
+		PrintAndLog("  %s", line);
+}
+
 int CmdHF14AMfCLoad(const char *Cmd)
 {
 	FILE * f;
 	char filename[FILE_PATH_SIZE] = {0x00};
 	char * fnameptr = filename;
 	char buf[256] = {0x00};
-	uint8_t buf8[256] = {0x00};
+	uint8_t card[256 * 16] = {0x00};
+	uint32_t errorMap[256 / 32] = {0};
 	uint8_t fillFromEmulator = 0;
-	int i, len, blockNum, flags = 0, gen = 0, numblock = 64;
+	int i, len, blockNum, res, gen = 0, numblock = 64;
 
 	if (param_getchar(Cmd, 0) == 'h' || param_getchar(Cmd, 0)== 0x00) {
 		PrintAndLog("It loads magic Chinese card from the file `filename.eml`");
@@ -2244,24 +2382,12 @@ int CmdHF14AMfCLoad(const char *Cmd)
 	PrintAndLog("Loading magic mifare %dK", numblock == 256 ? 4:1);
 
 	if (fillFromEmulator) {
-		for (blockNum = 0; blockNum < numblock; blockNum += 1) {
-			if (mfEmlGetMem(buf8, blockNum, 1)) {
+		for (blockNum = 0; blockNum < numblock; blockNum += MF_CBLOCKS_PER_CMD) {
+			if (mfEmlGetMem(card + blockNum * 16, blockNum, MF_CBLOCKS_PER_CMD)) {
 				PrintAndLog("Cant get block: %d", blockNum);
 				return 2;
 			}
-			if (blockNum == 0) flags = CSETBLOCK_INIT_FIELD + CSETBLOCK_WUPC;               // switch on field and send magic sequence
-			if (blockNum == 1) flags = 0;                                                   // just write
-			if (blockNum == numblock - 1) flags = CSETBLOCK_HALT + CSETBLOCK_RESET_FIELD;       // Done. Magic Halt and switch off field.
-
-			if (gen == 2)
-				/* generation 1b magic card */
-				flags |= CSETBLOCK_MAGIC_1B;
-			if (mfCSetBlock(blockNum, buf8, NULL, 0, flags)) {
-				PrintAndLog("Cant set magic card block: %d", blockNum);
-				return 3;
-			}
 		}
-		return 0;
 	} else {
 		param_getstr(Cmd, 0, filename, sizeof(filename));
 
@@ -2299,20 +2425,8 @@ int CmdHF14AMfCLoad(const char *Cmd)
 				return 2;
 			}
 			for (i = 0; i < 32; i += 2)
-				sscanf(&buf[i], "%02x", (unsigned int *)&buf8[i / 2]);
+				sscanf(&buf[i], "%02x", (unsigned int *)&card[blockNum * 16 + i / 2]);
 
-			if (blockNum == 0) flags = CSETBLOCK_INIT_FIELD + CSETBLOCK_WUPC;               // switch on field and send magic sequence
-			if (blockNum == 1) flags = 0;                                                   // just write
-			if (blockNum == numblock - 1) flags = CSETBLOCK_HALT + CSETBLOCK_RESET_FIELD;       // Done. Switch off field.
-
-			if (gen == 2)
-				/* generation 1b magic card */
-				flags |= CSETBLOCK_MAGIC_1B;
-			if (mfCSetBlock(blockNum, buf8, NULL, 0, flags)) {
-				PrintAndLog("Can't set magic card block: %d", blockNum);
-				fclose(f);
-				return 3;
-			}
 			blockNum++;
 
 			if (blockNum >= numblock) break;  // magic card type - mifare 1K 64 blocks, mifare 4k 256 blocks
@@ -2324,12 +2438,25 @@ int CmdHF14AMfCLoad(const char *Cmd)
 			PrintAndLog("File content error. There must be %d blocks", numblock);
 			return 4;
 		}
-		PrintAndLog("Loaded from file: %s", filename);
-		return 0;
 	}
+
+	// all blocks in one magic session, MF_CBLOCKS_PER_CMD blocks per command
+	uint64_t t1 = msclock();
+	res = mfCSetCard(card, numblock, gen == 2, errorMap);
+	if (res < 0)
+		return 3;
+	if (res) {
+		mfCPrintFailedBlocks("Can't set magic card blocks:", errorMap, numblock);
+		return 3;
+	}
+
+	if (!fillFromEmulator)
+		PrintAndLog("Loaded from file: %s", filename);
+	PrintAndLog("%d blocks written in %" PRIu64 " ms", numblock, msclock() - t1);
 	return 0;
 }
 
+
 int CmdHF14AMfCGetBlk(const char *Cmd) {
 	uint8_t memBlock[16];
 	uint8_t blockNo = 0;
@@ -2381,6 +2508,8 @@ int CmdHF14AMfCGetBlk(const char *Cmd) {
 
 int CmdHF14AMfCGetSc(const char *Cmd) {
 	uint8_t memBlock[16] = {0x00};
+	uint8_t sectorData[16 * 16] = {0x00};
+	uint32_t errorMask = 0;
 	uint8_t sectorNo = 0;
 	int i, res, flags, gen = 0, baseblock = 0, sect_size = 4;
 
@@ -2402,7 +2531,10 @@ int CmdHF14AMfCGetSc(const char *Cmd) {
 
 	gen = mfCIdentify();
 
-	flags = CSETBLOCK_INIT_FIELD + CSETBLOCK_WUPC;
+	flags = CSETBLOCK_SINGLE_OPER;
+	if (gen == 2)
+		/* generation 1b magic card */
+		flags |= CSETBLOCK_MAGIC_1B;
 	if (sectorNo < 32 ) {
 		baseblock = sectorNo * 4;
 	} else {
@@ -2411,19 +2543,14 @@ int CmdHF14AMfCGetSc(const char *Cmd) {
 	}
 	if (sectorNo > 31) sect_size = 16;
 
+	// whole sector in one command
+	res = mfCGetBlocks(baseblock, sect_size, sectorData, flags, &errorMask, NULL);
 	for (i = 0; i < sect_size; i++) {
-		if (i == 1) flags = 0;
-		if (i == sect_size - 1) flags = CSETBLOCK_HALT + CSETBLOCK_RESET_FIELD;
-
-		if (gen == 2)
-			/* generation 1b magic card */
-			flags |= CSETBLOCK_MAGIC_1B;
-
-		res = mfCGetBlock(baseblock + i, memBlock, flags);
-		if (res) {
+		if (res == 1 || (errorMask & (1U << i))) {
 			PrintAndLog("Can't read block. %d error=%d", baseblock + i, res);
 			return 1;
 		}
+		memcpy(memBlock, sectorData + i * 16, 16);
 
 		PrintAndLog("block %3d data:%s", baseblock + i, sprint_hex(memBlock, 16));
 
@@ -2450,11 +2577,9 @@ int CmdHF14AMfCSave(const char *Cmd) {
 	char filename[FILE_PATH_SIZE] = {0x00};
 	char * fnameptr = filename;
 	uint8_t fillFromEmulator = 0;
-	uint8_t buf[256] = {0x00};
-	int i, j, len, flags, gen = 0, numblock = 64;
-
-	// memset(filename, 0, sizeof(filename));
-	// memset(buf, 0, sizeof(buf));
+	uint8_t card[256 * 16] = {0x00};
+	uint32_t errorMap[256 / 32] = {0};
+	int i, j, len, res, gen = 0, numblock = 64;
 
 	if (param_getchar(Cmd, 0) == 'h') {
 		PrintAndLog("It saves `magic Chinese` card dump into the file `filename.eml` or `cardID.eml`");
@@ -2478,23 +2603,31 @@ int CmdHF14AMfCSave(const char *Cmd) {
 	gen = mfCIdentify();
 	PrintAndLog("Saving magic mifare %dK", numblock == 256 ? 4:1);
 
-	if (fillFromEmulator) {
-		// put into emulator
-		flags = CSETBLOCK_INIT_FIELD + CSETBLOCK_WUPC;
-		for (i = 0; i < numblock; i++) {
-			if (i == 1) flags = 0;
-			if (i == numblock - 1) flags = CSETBLOCK_HALT + CSETBLOCK_RESET_FIELD;
-
-			if (gen == 2)
-				/* generation 1b magic card */
-				flags |= CSETBLOCK_MAGIC_1B;
+	// all blocks in one magic session, MF_CBLOCKS_PER_CMD blocks per command
+	uint64_t t1 = msclock();
+	res = mfCGetCard(card, numblock, gen == 2, errorMap);
+	if (res < 0)
+		return 1;
+	if (res == numblock) {
+		PrintAndLog("Cant get block: %d", 0);
+		return 1;
+	}
+	PrintAndLog("%d blocks read in %" PRIu64 " ms", numblock, msclock() - t1);
 
-			if (mfCGetBlock(i, buf, flags)) {
-				PrintAndLog("Cant get block: %d", i);
-				break;
-			}
+	// save what we got before the first failed block. The same as before with block by block reading.
+	int blocksRead = numblock;
+	for (i = 0; i < numblock; i++) {
+		if (errorMap[i / 32] & (1U << (i % 32))) {
+			mfCPrintFailedBlocks("Cant get blocks:", errorMap, numblock);
+			blocksRead = i;
+			break;
+		}
+	}
 
-			if (mfEmlSetMem(buf, i, 1)) {
+	if (fillFromEmulator) {
+		// put into emulator
+		for (i = 0; i < blocksRead; i += MF_CBLOCKS_PER_CMD) {
+			if (mfEmlSetMem(card + i * 16, i, MIN(MF_CBLOCKS_PER_CMD, blocksRead - i))) {
 				PrintAndLog("Cant set emul block: %d", i);
 				return 3;
 			}
@@ -2509,19 +2642,13 @@ int CmdHF14AMfCSave(const char *Cmd) {
 		ctmp = param_getchar(Cmd, 0);
 		if (len < 1 || (ctmp == '4')) {
 			// get filename
-
-			flags = CSETBLOCK_SINGLE_OPER;
-			if (gen == 2)
-				/* generation 1b magic card */
-				flags |= CSETBLOCK_MAGIC_1B;
-			if (mfCGetBlock(0, buf, flags)) {
-				PrintAndLog("Cant get block: %d", 0);
+			if (errorMap[0] & 0x01) {
 				len = sprintf(fnameptr, "dump");
 				fnameptr += len;
 			}
 			else {
 				for (j = 0; j < 7; j++, fnameptr += 2)
-					sprintf(fnameptr, "%02x", buf[j]);
+					sprintf(fnameptr, "%02x", card[j]);
 			}
 		} else {
 			//memcpy(filename, Cmd, len);
@@ -2539,20 +2666,9 @@ int CmdHF14AMfCSave(const char *Cmd) {
 		}
 
 		// put hex
-		flags = CSETBLOCK_INIT_FIELD + CSETBLOCK_WUPC;
-		for (i = 0; i < numblock; i++) {
-			if (i == 1) flags = 0;
-			if (i == numblock - 1) flags = CSETBLOCK_HALT + CSETBLOCK_RESET_FIELD;
-
-			if (gen == 2)
-				/* generation 1b magic card */
-				flags |= CSETBLOCK_MAGIC_1B;
-			if (mfCGetBlock(i, buf, flags)) {
-				PrintAndLog("Cant get block: %d", i);
-				break;
-			}
+		for (i = 0; i < blocksRead; i++) {
 			for (j = 0; j < 16; j++)
-				fprintf(f, "%02x", buf[j]);
+				fprintf(f, "%02x", card[i * 16 + j]);
 			fprintf(f,"\n");
 		}
 		fclose(f);
@@ -2564,33 +2680,88 @@ int CmdHF14AMfCSave(const char *Cmd) {
 }
 
 
+typedef struct {
+	bool wantLogToFile;
+	bool wantDecrypt;
+	bool wantSaveToEmlFile;
+	int num;
+} mf_sniff_ctx_t;
+
+// prints, logs and decrypts the complete trace records in buf. Returns the number of bytes consumed,
+// a record cut at the end of a USB packet is left for the next call.
+static int mfSniffProcess(mf_sniff_ctx_t *ctx, uint8_t *buf, int bufLen) {
+	uint8_t *bufPtr = buf;
+	uint8_t parity[16];
+
+	while (buf + bufLen - bufPtr >= 8) {
+		uint16_t len = *((uint16_t *)(bufPtr + 6));      // skip (void) timing information
+		bool isTag = false;
+		if (len & 0x8000) {
+			isTag = true;
+			len &= 0x7fff;
+		}
+		int parlen = (len - 1) / 8 + 1;
+		if (buf + bufLen - bufPtr < 8 + len + parlen)
+			break;
+		uint8_t *frame = bufPtr + 8;
+
+		if ((len == 14) && (frame[0] == 0xff) && (frame[1] == 0xff) && (frame[12] == 0xff) && (frame[13] == 0xff)) {
+			uint8_t uid[7];
+			uint8_t atqa[2];
+			memcpy(uid, frame + 2, 7);
+			memcpy(atqa, frame + 2 + 7, 2);
+			uint8_t uid_len = (atqa[0] & 0xC0) == 0x40 ? 7 : 4;
+			uint8_t sak = frame[11];
+			PrintAndLog("tag select uid:%s atqa:0x%02x%02x sak:0x%02x",
+				sprint_hex(uid + (7 - uid_len), uid_len),
+				atqa[1],
+				atqa[0],
+				sak);
+			if (ctx->wantLogToFile || ctx->wantDecrypt) {
+				FillFileNameByUID(logHexFileName, uid + (7 - uid_len), ".log", uid_len);
+				AddLogCurrentDT(logHexFileName);
+			}
+			if (ctx->wantDecrypt)
+				mfTraceInit(uid, atqa, sak, ctx->wantSaveToEmlFile);
+		} else {
+			oddparitybuf(frame, len, parity);
+			char hex[SPRINT_HEX_SIZE(len)], par[SPRINT_BIN_SIZE(len)], cpar[SPRINT_BIN_SIZE(len)];
+			PrintAndLog("%s(%d):%s [%s] c[%s]%c",
+				isTag ? "TAG":"RDR",
+				ctx->num,
+				sprint_hex_r(hex, sizeof(hex), frame, len),
+				printBitsPar_r(par, sizeof(par), frame + len, len),
+				printBitsPar_r(cpar, sizeof(cpar), parity, len),
+				memcmp(frame + len, parity, len / 8 + 1) ? '!' : ' ');
+			if (ctx->wantLogToFile)
+				AddLogHex(logHexFileName, isTag ? "TAG: ":"RDR: ", frame, len);
+			if (ctx->wantDecrypt)
+				mfTraceDecode(frame, len, frame[len], ctx->wantSaveToEmlFile);
+			ctx->num++;
+		}
+		bufPtr += 8 + len + parlen;
+	}
+
+	return bufPtr - buf;
+}
+
 int CmdHF14AMfSniff(const char *Cmd){
 
-	bool wantLogToFile = 0;
-	bool wantDecrypt = 0;
-	//bool wantSaveToEml = 0; TODO
-	bool wantSaveToEmlFile = 0;
+	mf_sniff_ctx_t ctx = {0};
 
 	//var
 	int res = 0;
 	int len = 0;
-	int parlen = 0;
-	int blockLen = 0;
 	int pckNum = 0;
-	int num = 0;
-	uint8_t uid[7];
-	uint8_t uid_len;
-	uint8_t atqa[2] = {0x00};
-	uint8_t sak;
-	bool isTag;
 	uint8_t *buf = NULL;
 	uint16_t bufsize = 0;
-	uint8_t *bufPtr = NULL;
-	uint8_t parity[16];
+	int bufLen = 0;         // received bytes of the current trace
+	int bufDone = 0;        // bytes already processed
 
 	char ctmp = param_getchar(Cmd, 0);
 	if ( ctmp == 'h' || ctmp == 'H' ) {
 		PrintAndLog("It continuously gets data from the field and saves it to: log, emulator, emulator file.");
+		PrintAndLog("Data is decoded as it arrives. Cards are decrypted in separate sessions, keys are recovered on each sniffed auth.");
 		PrintAndLog("You can specify:");
 		PrintAndLog("    l - save encrypted sequence to logfile `uid.log`");
 		PrintAndLog("    d - decrypt sequence and put it to log file `uid.log`");
@@ -2603,10 +2774,10 @@ int CmdHF14AMfSniff(const char *Cmd){
 
 	for (int i = 0; i < 4; i++) {
 		ctmp = param_getchar(Cmd, i);
-		if (ctmp == 'l' || ctmp == 'L') wantLogToFile = true;
-		if (ctmp == 'd' || ctmp == 'D') wantDecrypt = true;
+		if (ctmp == 'l' || ctmp == 'L') ctx.wantLogToFile = true;
+		if (ctmp == 'd' || ctmp == 'D') ctx.wantDecrypt = true;
 		//if (ctmp == 'e' || ctmp == 'E') wantSaveToEml = true; TODO
-		if (ctmp == 'f' || ctmp == 'F') wantSaveToEmlFile = true;
+		if (ctmp == 'f' || ctmp == 'F') ctx.wantSaveToEmlFile = true;
 	}
 
 	printf("-------------------------------------------------------------------------\n");
@@ -2651,75 +2822,39 @@ int CmdHF14AMfSniff(const char *Cmd){
 						if (p == NULL) {
 							PrintAndLog("Cannot allocate memory for trace");
 							free(buf);
+							mfTraceEnd();
 							return 2;
 						}
 						buf = p;
+						bufsize = traceLen;
 					}
-					bufPtr = buf;
-					bufsize = traceLen;
 					memset(buf, 0x00, traceLen);
+					bufLen = 0;
+					bufDone = 0;
+					printf(">\n");
 				}
-				memcpy(bufPtr, resp.d.asBytes, len);
-				bufPtr += len;
+				if (bufLen + len > bufsize)
+					len = bufsize - bufLen;
+				memcpy(buf + bufLen, resp.d.asBytes, len);
+				bufLen += len;
 				pckNum++;
+
+				// decode what we have so far, don't wait for the rest of the trace
+				bufDone += mfSniffProcess(&ctx, buf + bufDone, bufLen - bufDone);
 			}
 
-			if (res == 2) {                             // received all data, start displaying
-				blockLen = bufPtr - buf;
-				bufPtr = buf;
-				printf(">\n");
-				PrintAndLog("received trace len: %d packages: %d", blockLen, pckNum);
-				while (bufPtr - buf < blockLen) {
-					bufPtr += 6;                        // skip (void) timing information
-					len = *((uint16_t *)bufPtr);
-					if(len & 0x8000) {
-						isTag = true;
-						len &= 0x7fff;
-					} else {
-						isTag = false;
-					}
-					parlen = (len - 1) / 8 + 1;
-					bufPtr += 2;
-					if ((len == 14) && (bufPtr[0] == 0xff) && (bufPtr[1] == 0xff) && (bufPtr[12] == 0xff) && (bufPtr[13] == 0xff)) {
-						memcpy(uid, bufPtr + 2, 7);
-						memcpy(atqa, bufPtr + 2 + 7, 2);
-						uid_len = (atqa[0] & 0xC0) == 0x40 ? 7 : 4;
-						sak = bufPtr[11];
-						PrintAndLog("tag select uid:%s atqa:0x%02x%02x sak:0x%02x",
-							sprint_hex(uid + (7 - uid_len), uid_len),
-							atqa[1],
-							atqa[0],
-							sak);
-						if (wantLogToFile || wantDecrypt) {
-							FillFileNameByUID(logHexFileName, uid + (7 - uid_len), ".log", uid_len);
-							AddLogCurrentDT(logHexFileName);
-						}
-						if (wantDecrypt)
-							mfTraceInit(uid, atqa, sak, wantSaveToEmlFile);
-					} else {
-						oddparitybuf(bufPtr, len, parity);
-						PrintAndLog("%s(%d):%s [%s] c[%s]%c",
-							isTag ? "TAG":"RDR",
-							num,
-							sprint_hex(bufPtr, len),
-							printBitsPar(bufPtr + len, len),
-							printBitsPar(parity, len),
-							memcmp(bufPtr + len, parity, len / 8 + 1) ? '!' : ' ');
-						if (wantLogToFile)
-							AddLogHex(logHexFileName, isTag ? "TAG: ":"RDR: ", bufPtr, len);
-						if (wantDecrypt)
-							mfTraceDecode(bufPtr, len, bufPtr[len], wantSaveToEmlFile);
-						num++;
-					}
-					bufPtr += len;
-					bufPtr += parlen;   // ignore parity
-				}
+			if (res == 2) {                             // received all data
+				PrintAndLog("received trace len: %d packages: %d", bufLen, pckNum);
+				if (bufDone != bufLen)
+					PrintAndLog("trace is truncated, %d bytes skipped", bufLen - bufDone);
+				mfTraceFlush();
 				pckNum = 0;
 			}
 		} // resp not NULL
 	} // while (true)
 
 	free(buf);
+	mfTraceEnd();
 
 	msleep(300); // wait for exiting arm side.
 	PrintAndLog("Done.");
@@ -2973,6 +3108,7 @@ static command_t CommandTable[] =
   {"rdsc",             CmdHF14AMfRdSc,          0, "Read MIFARE classic sector"},
   {"dump",             CmdHF14AMfDump,          0, "Dump MIFARE classic tag to binary file"},
   {"restore",          CmdHF14AMfRestore,       0, "Restore MIFARE classic binary file to BLANK tag"},
+  {"audit",            CmdHF14AMfAudit,         0, "Audit access conditions and value blocks of all sectors on the device"},
   {"wrbl",             CmdHF14AMfWrBl,          0, "Write MIFARE classic block"},
   {"auth4",            CmdHF14AMfAuth4,         0, "ISO14443-4 AES authentication"},
   {"chk",              CmdHF14AMfChk,           0, "Test block keys"},
@@ -505,7 +505,9 @@ static const float *p_K;
 	
 static uint32_t cuid;
 static noncelist_t nonces[256];
-static uint8_t best_first_bytes[256];
+static uint8_t best_first_bytes[256];            // a heap on expected_num_brute_force, best byte first
+static bool expected_brute_force_dirty[256];     // expected_num_brute_force of this first byte needs an update
+static uint64_t last_num_states_coarse[NUM_SUMS];
 static uint64_t maximum_states = 0;
 static uint8_t best_first_byte_smallest_bitarray = 0;
 static uint16_t first_byte_Sum = 0;
@@ -595,7 +597,10 @@ static void init_nonce_memory(void)
 		nonces[i].num_states_bitarray[ODD_STATE] = 1 << 24;
 		nonces[i].all_bitflips_dirty[EVEN_STATE] = false;
 		nonces[i].all_bitflips_dirty[ODD_STATE] = false;
+		best_first_bytes[i] = i;
+		expected_brute_force_dirty[i] = true;
 	}
+	memset(last_num_states_coarse, 0, sizeof(last_num_states_coarse));
 	first_byte_num = 0;
 	first_byte_Sum = 0;
 }
@@ -624,22 +629,12 @@ static void free_nonces_memory(void)
 }
 
 
-// static double p_hypergeometric_cache[257][NUM_SUMS][257];
-
-// #define CACHE_INVALID -1.0
-// static void init_p_hypergeometric_cache(void)
-// {
-	// for (uint16_t n = 0; n <= 256; n++) {
-		// for (uint16_t i_K = 0; i_K < NUM_SUMS; i_K++) {
-			// for (uint16_t k = 0; k <= 256; k++) {
-				// p_hypergeometric_cache[n][i_K][k] = CACHE_INVALID;
-			// }
-		// }
-	// }
-// }
+// P(X=k) for all k of a (K, n) pair, filled on first use. The values don't depend on the tag,
+// the table is kept for the next run.
+static double *p_hypergeometric_cache[NUM_SUMS][257];
 
 
-static double p_hypergeometric(uint16_t i_K, uint16_t n, uint16_t k) 
+static double *p_hypergeometric_row(uint16_t i_K, uint16_t n)
 {
 	// for efficient computation we are using the recursive definition
 	//						(K-k+1) * (n-k+1)
@@ -650,28 +645,33 @@ static double p_hypergeometric(uint16_t i_K, uint16_t n, uint16_t k)
 	// P(X=0) = -----------------------------
 	//               N*(N-1)*...*(N-n+1)
 
-	
+	double *row = p_hypergeometric_cache[i_K][n];
+	if (row != NULL) {
+		return row;
+	}
+	row = p_hypergeometric_cache[i_K][n] = malloc(sizeof(double) * (n+1));
+	if (row == NULL) {
+		printf("Out of memory error in p_hypergeometric(). Aborting...\n");
+		exit(4);
+	}
+
 	uint16_t const N = 256;
 	uint16_t K = sums[i_K];
 
-	// if (p_hypergeometric_cache[n][i_K][k] != CACHE_INVALID) {
-		// return p_hypergeometric_cache[n][i_K][k];
-	// }
-	
-	if (n-k > N-K || k > K) return 0.0;	// avoids log(x<=0) in calculation below
-	if (k == 0) {
-		// use logarithms to avoid overflow with huge factorials (double type can only hold 170!)
-		double log_result = 0.0;
-		for (int16_t i = N-K; i >= N-K-n+1; i--) {
-			log_result += log(i);
-		} 
-		for (int16_t i = N; i >= N-n+1; i--) {
-			log_result -= log(i);
-		}
-		// p_hypergeometric_cache[n][i_K][k] = exp(log_result);
-		return exp(log_result);
-	} else {
-		if (n-k == N-K) {	// special case. The published recursion below would fail with a divide by zero exception
+	for (uint16_t k = 0; k <= n; k++) {
+		if (n-k > N-K || k > K) {	// avoids log(x<=0) in calculation below
+			row[k] = 0.0;
+		} else if (k == 0) {
+			// use logarithms to avoid overflow with huge factorials (double type can only hold 170!)
+			double log_result = 0.0;
+			for (int16_t i = N-K; i >= N-K-n+1; i--) {
+				log_result += log(i);
+			}
+			for (int16_t i = N; i >= N-n+1; i--) {
+				log_result -= log(i);
+			}
+			row[k] = exp(log_result);
+		} else if (n-k == N-K) {	// special case. The published recursion below would fail with a divide by zero exception
 			double log_result = 0.0;
 			for (int16_t i = k+1; i <= n; i++) {
 				log_result += log(i);
@@ -679,12 +679,19 @@ static double p_hypergeometric(uint16_t i_K, uint16_t n, uint16_t k)
 			for (int16_t i = K+1; i <= N; i++) {
 				log_result -= log(i);
 			}
-			// p_hypergeometric_cache[n][i_K][k] = exp(log_result);
-			return exp(log_result);
+			row[k] = exp(log_result);
 		} else { 			// recursion
-			return (p_hypergeometric(i_K, n, k-1) * (K-k+1) * (n-k+1) / (k * (N-K-n+k)));
+			row[k] = row[k-1] * (K-k+1) * (n-k+1) / (k * (N-K-n+k));
 		}
 	}
+	return row;
+}
+
+
+static double p_hypergeometric(uint16_t i_K, uint16_t n, uint16_t k)
+{
+	if (k > n) return 0.0;
+	return p_hypergeometric_row(i_K, n)[k];
 }
 	
 	
@@ -767,7 +774,10 @@ static uint32_t estimated_num_states_part_sum(uint8_t first_byte, uint16_t part_
 }
 
 
-static uint64_t estimated_num_states(uint8_t first_byte, uint16_t sum_a0, uint16_t sum_a8)
+// part_sum_states[][][] holds the counts of one first byte already done, PART_SUM_STATES_UNKNOWN if not.
+// Each count is an AND over the 2^24 bit arrays, the same ones come up for several Sum(a8)
+#define PART_SUM_STATES_UNKNOWN		0xffffffff
+static uint64_t estimated_num_states(uint8_t first_byte, uint16_t sum_a0, uint16_t sum_a8, uint32_t part_sum_states[2][NUM_PART_SUMS][NUM_PART_SUMS])
 {
 	uint64_t num_states = 0;
 	for (uint8_t p = 0; p < NUM_PART_SUMS; p++) {
@@ -776,8 +786,13 @@ static uint64_t estimated_num_states(uint8_t first_byte, uint16_t sum_a0, uint16
 				for (uint8_t r = 0; r < NUM_PART_SUMS; r++) {
 					for (uint8_t s = 0; s < NUM_PART_SUMS; s++) {
 						if (2*r*(16-2*s) + (16-2*r)*2*s == sum_a8) {
-							num_states += (uint64_t)estimated_num_states_part_sum(first_byte, p, r, ODD_STATE) 
-										* estimated_num_states_part_sum(first_byte, q, s, EVEN_STATE);
+							if (part_sum_states[ODD_STATE][p][r] == PART_SUM_STATES_UNKNOWN) {
+								part_sum_states[ODD_STATE][p][r] = estimated_num_states_part_sum(first_byte, p, r, ODD_STATE);
+							}
+							if (part_sum_states[EVEN_STATE][q][s] == PART_SUM_STATES_UNKNOWN) {
+								part_sum_states[EVEN_STATE][q][s] = estimated_num_states_part_sum(first_byte, q, s, EVEN_STATE);
+							}
+							num_states += (uint64_t)part_sum_states[ODD_STATE][p][r] * part_sum_states[EVEN_STATE][q][s];
 						}
 					}
 				}
@@ -813,14 +828,15 @@ static void update_p_K(void)
 {
 	if (hardnested_stage & CHECK_2ND_BYTES) {
 		uint64_t total_count = 0;
+		uint64_t num_states[NUM_SUMS];
 		uint16_t sum_a0 = sums[first_byte_Sum];
 		for (uint8_t sum_a8_idx = 0; sum_a8_idx < NUM_SUMS; sum_a8_idx++) {
 			uint16_t sum_a8 = sums[sum_a8_idx];
-			total_count += estimated_num_states_coarse(sum_a0, sum_a8);
+			num_states[sum_a8_idx] = estimated_num_states_coarse(sum_a0, sum_a8);
+			total_count += num_states[sum_a8_idx];
 		}
 		for (uint8_t sum_a8_idx = 0; sum_a8_idx < NUM_SUMS; sum_a8_idx++) {
-			uint16_t sum_a8 = sums[sum_a8_idx];
-			my_p_K[sum_a8_idx] = (float)estimated_num_states_coarse(sum_a0, sum_a8) / total_count;
+			my_p_K[sum_a8_idx] = (float)num_states[sum_a8_idx] / total_count;
 		}
 		// printf("my_p_K = [");
 		// for (uint8_t sum_a8_idx = 0; sum_a8_idx < NUM_SUMS; sum_a8_idx++) {
@@ -852,13 +868,33 @@ static void update_sum_bitarrays(odd_even_t odd_even)
 }
 
 
-static int compare_expected_num_brute_force(const void *b1, const void *b2)
+static bool better_first_byte(uint16_t pos1, uint16_t pos2)
+{
+	return nonces[best_first_bytes[pos1]].expected_num_brute_force < nonces[best_first_bytes[pos2]].expected_num_brute_force;
+}
+
+
+static void swap_first_bytes(uint16_t pos1, uint16_t pos2)
+{
+	uint8_t tmp = best_first_bytes[pos1];
+	best_first_bytes[pos1] = best_first_bytes[pos2];
+	best_first_bytes[pos2] = tmp;
+}
+
+
+static void sift_down_first_byte(uint16_t pos)
 {
-	uint8_t index1 = *(uint8_t *)b1;
-	uint8_t index2 = *(uint8_t *)b2;
-	float score1 = nonces[index1].expected_num_brute_force;
-	float score2 = nonces[index2].expected_num_brute_force;
-	return (score1 > score2) - (score1 < score2);
+	while (2*pos+1 < 256) {
+		uint16_t child = 2*pos+1;
+		if (child+1 < 256 && better_first_byte(child+1, child)) {
+			child++;
+		}
+		if (!better_first_byte(child, pos)) {
+			break;
+		}
+		swap_first_bytes(pos, child);
+		pos = child;
+	}
 }
 
 
@@ -911,6 +947,7 @@ static void update_expected_brute_force(uint8_t best_byte) {
 		prob_all_failed -= nonces[best_byte].sum_a8_guess[i].prob;
 		nonces[best_byte].expected_num_brute_force += prob_all_failed * (float)nonces[best_byte].sum_a8_guess[i].num_states / 2.0;
 	}
+	expected_brute_force_dirty[best_byte] = true;	// num_states aren't the coarse estimates any more
 	return;
 }
 
@@ -918,22 +955,39 @@ static void update_expected_brute_force(uint8_t best_byte) {
 static float sort_best_first_bytes(void)
 {
 	
-	// initialize best_first_bytes, do a rough estimation on remaining states for each Sum_a8 property
-	// and the expected number of states to brute force
+	// do a rough estimation on remaining states for each Sum_a8 property. It is the same for all first bytes.
+	uint64_t num_states_coarse[NUM_SUMS];
+	uint16_t num_dirty = 0;
+	for (uint8_t j = 0; j < NUM_SUMS; j++) {
+		num_states_coarse[j] = estimated_num_states_coarse(sums[first_byte_Sum], sums[j]);
+	}
+	if (memcmp(num_states_coarse, last_num_states_coarse, sizeof(num_states_coarse)) != 0) {
+		memcpy(last_num_states_coarse, num_states_coarse, sizeof(num_states_coarse));
+		memset(expected_brute_force_dirty, true, sizeof(expected_brute_force_dirty));
+	}
+
+	// update the expected number of states to brute force for the first bytes with new nonces
 	for (uint16_t i = 0; i < 256; i++) {
-		best_first_bytes[i] = i;
+		if (!expected_brute_force_dirty[i]) continue;
 		float prob_all_failed = 1.0;
 		nonces[i].expected_num_brute_force = 0.0;
 		for (uint8_t j = 0; j < NUM_SUMS; j++) {
-			nonces[i].sum_a8_guess[j].num_states = estimated_num_states_coarse(sums[first_byte_Sum], sums[nonces[i].sum_a8_guess[j].sum_a8_idx]);
+			nonces[i].sum_a8_guess[j].num_states = num_states_coarse[nonces[i].sum_a8_guess[j].sum_a8_idx];
 			nonces[i].expected_num_brute_force += nonces[i].sum_a8_guess[j].prob * (float)nonces[i].sum_a8_guess[j].num_states / 2.0;
 			prob_all_failed -= nonces[i].sum_a8_guess[j].prob;
 			nonces[i].expected_num_brute_force += prob_all_failed * (float)nonces[i].sum_a8_guess[j].num_states / 2.0;
 		}
+		num_dirty++;
 	}
-	
-	// sort based on expected number of states to brute force
-	qsort(best_first_bytes, 256, 1, compare_expected_num_brute_force);
+
+	// and rebuild the heap. Only the best byte and its runner-up are needed in order,
+	// the brute forcer checks candidate keys against the other bytes in any order.
+	if (num_dirty > 0) {
+		for (int16_t pos = 127; pos >= 0; pos--) {
+			sift_down_first_byte(pos);
+		}
+	}
+	memset(expected_brute_force_dirty, false, sizeof(expected_brute_force_dirty));
 
 	// printf("refine estimations: ");
 	#define NUM_REFINES	1
@@ -941,9 +995,12 @@ static float sort_best_first_bytes(void)
 	for (uint16_t i = 0; i < NUM_REFINES; i++) {
 		// printf("%d...", i);
 		uint16_t first_byte = best_first_bytes[i];
+		uint32_t part_sum_states[2][NUM_PART_SUMS][NUM_PART_SUMS];
+		memset(part_sum_states, 0xff, sizeof(part_sum_states));
 		for (uint8_t j = 0; j < NUM_SUMS && nonces[first_byte].sum_a8_guess[j].prob > 0.05; j++) {
-			nonces[first_byte].sum_a8_guess[j].num_states = estimated_num_states(first_byte, sums[first_byte_Sum], sums[nonces[first_byte].sum_a8_guess[j].sum_a8_idx]);
+			nonces[first_byte].sum_a8_guess[j].num_states = estimated_num_states(first_byte, sums[first_byte_Sum], sums[nonces[first_byte].sum_a8_guess[j].sum_a8_idx], part_sum_states);
 		}
+		expected_brute_force_dirty[first_byte] = true;	// back to the coarse estimates next time
 		// while (nonces[first_byte].sum_a8_guess[0].num_states == 0
 				// || nonces[first_byte].sum_a8_guess[1].num_states == 0
 				// || nonces[first_byte].sum_a8_guess[2].num_states == 0) {
@@ -984,21 +1041,12 @@ static float sort_best_first_bytes(void)
 		}
 	}
 
-	// copy best byte to front:
-	float least_expected_brute_force = (1LL << 48);
-	uint8_t best_byte = 0;
-	for (uint16_t i = 0; i < 10; i++) {
-		uint16_t first_byte = best_first_bytes[i];
-		if (nonces[first_byte].expected_num_brute_force < least_expected_brute_force) {
-			least_expected_brute_force = nonces[first_byte].expected_num_brute_force;
-			best_byte = i;
-		}
-	}
-	if (best_byte != 0) {
-		// printf("0x%02x <-> 0x%02x", best_first_bytes[0], best_first_bytes[best_byte]);
-		uint8_t tmp = best_first_bytes[0];
-		best_first_bytes[0] = best_first_bytes[best_byte];
-		best_first_bytes[best_byte] = tmp;
+	// copy best byte to front. The runner-up is the better child of the heap top.
+	// The refined byte is dirty, it is put back into place on the next call.
+	uint16_t second = better_first_byte(2, 1) ? 2 : 1;
+	if (better_first_byte(second, 0)) {
+		// printf("0x%02x <-> 0x%02x", best_first_bytes[0], best_first_bytes[second]);
+		swap_first_bytes(0, second);
 	}
 
 	return nonces[best_first_bytes[0]].expected_num_brute_force;
@@ -1077,6 +1125,7 @@ static void estimate_sum_a8(void)
 				}
 				qsort(nonces[i].sum_a8_guess, NUM_SUMS, sizeof(guess_sum_a8_t), compare_sum_a8_guess);
 				nonces[i].sum_a8_guess_dirty = false;
+				expected_brute_force_dirty[i] = true;
 			}
 		}
 	}
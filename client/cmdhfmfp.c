@@ -19,6 +19,7 @@
 #include "comms.h"
 #include "cmdmain.h"
 #include "util.h"
+#include "util_posix.h"
 #include "ui.h"
 #include "cmdhf14a.h"
 #include "mifare.h"
@@ -717,18 +718,26 @@ int CmdHFMFPMAD(const char *cmd) {
             memcpy(akey, key, 16);
         }
 
+        uint8_t sectors[ARRAYLEN(mad)] = {0};
+        size_t sectorcnt = 0;
         for (int i = 0; i < madlen; i++) {
-            if (aaid == mad[i]) {
-                uint8_t vsector[16 * 4] = {0};
-                if (mfpReadSector(i + 1, keyB ? MF_KEY_B : MF_KEY_A, akey, vsector, false)) {
-                    PrintAndLogEx(NORMAL, "");
-                    PrintAndLogEx(ERR, "read sector %d error.", i + 1);
-                    return 2;
-                }
-
-                for (int j = 0; j < (verbose ? 4 : 3); j ++)
-                    PrintAndLogEx(NORMAL, " [%03d] %s", (i + 1) * 4 + j, sprint_hex(&vsector[j * 16], 16));
-            }
+            if (aaid == mad[i])
+                sectors[sectorcnt++] = i + 1;
+        }
+
+        // all the application sectors in one session
+        uint8_t vdata[ARRAYLEN(mad) * 16 * 16] = {0};
+        if (sectorcnt && mfpReadSectors(sectors, sectorcnt, keyB ? MF_KEY_B : MF_KEY_A, akey, vdata, false)) {
+            PrintAndLogEx(NORMAL, "");
+            PrintAndLogEx(ERR, "read sectors error.");
+            return 2;
+        }
+
+        uint8_t *vsector = vdata;
+        for (int i = 0; i < sectorcnt; i++) {
+            for (int j = 0; j < (verbose ? 4 : 3); j ++)
+                PrintAndLogEx(NORMAL, " [%03d] %s", sectors[i] * 4 + j, sprint_hex(&vsector[j * 16], 16));
+            vsector += mfNumBlocksPerSector(sectors[i]) * 16;
         }
     }
 
@@ -807,20 +816,26 @@ int CmdHFMFPNDEF(const char *cmd) {
         return 10;
     }
 
-    printf("data reading:");
+    uint8_t sectors[ARRAYLEN(mad)] = {0};
+    size_t sectorcnt = 0;
     for (int i = 0; i < madlen; i++) {
-        if (ndefAID == mad[i]) {
-            uint8_t vsector[16 * 4] = {0};
-            if (mfpReadSector(i + 1, keyB ? MF_KEY_B : MF_KEY_A, ndefkey, vsector, false)) {
-                PrintAndLogEx(ERR, "read sector %d error.", i + 1);
-                return 2;
-            }
+        if (ndefAID == mad[i])
+            sectors[sectorcnt++] = i + 1;
+    }
 
-            memcpy(&data[datalen], vsector, 16 * 3);
-            datalen += 16 * 3;
+    printf("data reading:");
+    // all the NDEF sectors in one session
+    uint8_t vdata[ARRAYLEN(mad) * 16 * 16] = {0};
+    if (sectorcnt && mfpReadSectors(sectors, sectorcnt, keyB ? MF_KEY_B : MF_KEY_A, ndefkey, vdata, false)) {
+        PrintAndLogEx(ERR, "read sectors error.");
+        return 2;
+    }
 
-            printf(".");
-        }
+    uint8_t *vsector = vdata;
+    for (int i = 0; i < sectorcnt; i++) {
+        memcpy(&data[datalen], vsector, 16 * 3);
+        datalen += 16 * 3;
+        vsector += mfNumBlocksPerSector(sectors[i]) * 16;
     }
     printf(" OK\n");
 
@@ -839,6 +854,239 @@ int CmdHFMFPNDEF(const char *cmd) {
     return 0;
 }
 
+static const uint8_t mfpDefaultKeys[][16] = {
+	{0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff},
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+	{0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7},
+	{0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7},
+	{0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7},
+	{0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f},
+};
+
+// dictionary: 32 hex symbols per line, lines beginning with # are comments
+static int mfpLoadDictionary(const char *filename, uint8_t **keys, size_t *keycount) {
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		PrintAndLogEx(ERR, "File: %s: not found or locked.", filename);
+		return 1;
+	}
+
+	char buf[256];
+	size_t allocated = *keycount;
+	while (fgets(buf, sizeof(buf), f)) {
+		if (buf[0] == '#' || strlen(buf) < 32)
+			continue;
+
+		uint8_t key[16] = {0};
+		int keylen = 0;
+		buf[32] = 0x00;
+		if (param_gethex_to_eol(buf, 0, key, sizeof(key), &keylen) || keylen != 16) {
+			PrintAndLogEx(WARNING, "File content error. '%s' must include 32 HEX symbols", buf);
+			continue;
+		}
+
+		if (*keycount == allocated) {
+			allocated += 256;
+			uint8_t *p = realloc(*keys, allocated * 16);
+			if (!p) {
+				PrintAndLogEx(ERR, "Cannot allocate memory for keys");
+				fclose(f);
+				return 2;
+			}
+			*keys = p;
+		}
+
+		memcpy(&(*keys)[*keycount * 16], key, 16);
+		(*keycount)++;
+	}
+	fclose(f);
+
+	return 0;
+}
+
+int CmdHFMFPChk(const char *cmd) {
+	CLIParserInit("hf mfp chk",
+		"Checks keys on Mifare Plus SL3 card. Found keys keep the session: the next sector is checked with "
+		"AuthenticateNonFirst without field reset. With --phase1 and --phase2 checks keys against a sniffed "
+		"authentication without a card.",
+		"Usage:\n\thf mfp chk -> check default keys on all sectors\n"
+			"\thf mfp chk -s 2 -e 5 -d mfp_keys.dic -> check keys from dictionary on sectors 2..5\n"
+			"\thf mfp chk --phase1 90<card answer> --phase2 72<reader data> -d mfp_keys.dic -> offline check\n");
+
+	void* argtable[] = {
+		arg_param_begin,
+		arg_lit0("vV",  "verbose",  "show internal data."),
+		arg_int0("sS",  "startsec", "start sector (by default 0).", NULL),
+		arg_int0("eE",  "endsec",   "end sector (by default 31).", NULL),
+		arg_lit0("aA",  "keya",     "check only key A"),
+		arg_lit0("bB",  "keyb",     "check only key B"),
+		arg_str0("kK",  "key",      "<Key (HEX 16 bytes)>", "key to check"),
+		arg_str0("dD",  "dict",     "<file>", "dictionary file: 32 HEX symbols per line"),
+		arg_str0(NULL,  "phase1",   "<HEX>", "sniffed card answer to authentication: 90 + E(K, RndB)"),
+		arg_str0(NULL,  "phase2",   "<HEX>", "sniffed reader second part of authentication: 72 + E(K, RndA || RndB')"),
+		arg_param_end
+	};
+	CLIExecWithReturn(cmd, argtable, true);
+
+	bool verbose = arg_get_lit(1);
+	int startSector = arg_get_int_def(2, 0);
+	int endSector = arg_get_int_def(3, 31);
+	bool checkA = !arg_get_lit(5) || arg_get_lit(4);
+	bool checkB = !arg_get_lit(4) || arg_get_lit(5);
+	uint8_t ukey[16] = {0};
+	int ukeylen = 0;
+	CLIGetHexWithReturn(6, ukey, &ukeylen);
+	uint8_t dictname[250] = {0};
+	int dictnamelen = 0;
+	CLIGetStrWithReturn(7, dictname, &dictnamelen);
+	uint8_t phase1[1 + 16 + 2] = {0};
+	int phase1len = 0;
+	CLIGetHexWithReturn(8, phase1, &phase1len);
+	uint8_t phase2[1 + 32 + 2] = {0};
+	int phase2len = 0;
+	CLIGetHexWithReturn(9, phase2, &phase2len);
+	CLIParserFree();
+
+	if (ukeylen && ukeylen != 16) {
+		PrintAndLogEx(ERR, "<Key> must be 16 bytes long instead of: %d", ukeylen);
+		return 1;
+	}
+
+	// code byte and CRC may be left in sniffed data
+	uint8_t *p1 = (phase1len == 17 || phase1len == 19) ? &phase1[1] : phase1;
+	uint8_t *p2 = (phase2len == 33 || phase2len == 35) ? &phase2[1] : phase2;
+	bool offline = phase1len || phase2len;
+	if (offline && ((p1 == phase1 && phase1len != 16) || (p2 == phase2 && phase2len != 32))) {
+		PrintAndLogEx(ERR, "phase1 must be 16 bytes and phase2 32 bytes long (code byte and CRC are allowed)");
+		return 1;
+	}
+
+	if (startSector < 0 || endSector > 39 || startSector > endSector) {
+		PrintAndLogEx(ERR, "Sectors must be in range 0..39");
+		return 1;
+	}
+
+	uint8_t *keys = NULL;
+	size_t keycount = 0;
+	if (ukeylen) {
+		keys = malloc(16);
+		if (!keys) {
+			PrintAndLogEx(ERR, "Cannot allocate memory for keys");
+			return 2;
+		}
+		memcpy(keys, ukey, 16);
+		keycount = 1;
+	}
+
+	if (dictnamelen && mfpLoadDictionary((char *)dictname, &keys, &keycount)) {
+		free(keys);
+		return 2;
+	}
+
+	if (!keycount) {
+		PrintAndLogEx(INFO, "No key specified, trying default keys");
+		keys = malloc(sizeof(mfpDefaultKeys));
+		if (!keys) {
+			PrintAndLogEx(ERR, "Cannot allocate memory for keys");
+			return 2;
+		}
+		memcpy(keys, mfpDefaultKeys, sizeof(mfpDefaultKeys));
+		keycount = ARRAYLEN(mfpDefaultKeys);
+	}
+	PrintAndLogEx(INFO, "Loaded %zu keys", keycount);
+
+	uint64_t t1 = msclock();
+
+	if (offline) {
+		size_t keyindex = 0;
+		int res = MifareAuth4CheckKeys(p1, p2, keys, keycount, &keyindex);
+		t1 = msclock() - t1;
+		if (res)
+			PrintAndLogEx(WARNING, "Key not found. Checked %zu keys in %" PRIu64 " ms", keycount, t1);
+		else
+			PrintAndLogEx(SUCCESS, "Key found: %s (%" PRIu64 " ms)", sprint_hex_inrow(&keys[keyindex * 16], 16), t1);
+		free(keys);
+		return res;
+	}
+
+	// found key index per sector and key type. -1 - not found
+	int found[40][2];
+	memset(found, 0xff, sizeof(found));
+	mf4Session session;
+	session.Authenticated = false;
+	bool fieldOn = false;
+	bool aborted = false;
+
+	for (int sector = startSector; sector <= endSector && !aborted; sector++) {
+		for (int keyType = 0; keyType < 2 && !aborted; keyType++) {
+			if ((keyType == 0 && !checkA) || (keyType == 1 && !checkB))
+				continue;
+
+			uint16_t uKeyNum = 0x4000 + sector * 2 + keyType;
+			uint8_t keyn[2] = {uKeyNum >> 8, uKeyNum & 0xff};
+
+			for (size_t i = 0; i < keycount; i++) {
+				if (ukbhit()) {
+					PrintAndLogEx(WARNING, "\naborted via keyboard!");
+					aborted = true;
+					break;
+				}
+
+				bool following = fieldOn && session.Authenticated;
+				int res = MifareAuth4Ex(&session, keyn, &keys[i * 16], !fieldOn, true, !following, true, verbose);
+				if (!res) {
+					found[sector][keyType] = i;
+					fieldOn = true;
+					break;
+				}
+
+				// any error drops the field
+				fieldOn = false;
+				if (following) {
+					// card may not accept AuthenticateNonFirst here. retry with a new session.
+					i--;
+					continue;
+				}
+
+				// card rejects the key number itself. no need to check other keys.
+				if (res == 3) {
+					if (verbose)
+						PrintAndLogEx(INFO, "Sector %d key %04x rejected by card", sector, uKeyNum);
+					break;
+				}
+				if (res == 2) {
+					PrintAndLogEx(ERR, "Card exchange error. Stopped.");
+					aborted = true;
+					break;
+				}
+			}
+			printf(".");
+			fflush(stdout);
+		}
+	}
+	DropField();
+	t1 = msclock() - t1;
+	PrintAndLogEx(NORMAL, "\n");
+
+	PrintAndLogEx(NORMAL, "|---|----------------------------------|----------------------------------|");
+	PrintAndLogEx(NORMAL, "|sec|              key A               |              key B               |");
+	PrintAndLogEx(NORMAL, "|---|----------------------------------|----------------------------------|");
+	for (int sector = startSector; sector <= endSector; sector++) {
+		char keyA[33] = "-";
+		char keyB[33] = "-";
+		if (found[sector][0] >= 0)
+			snprintf(keyA, sizeof(keyA), "%s", sprint_hex_inrow(&keys[found[sector][0] * 16], 16));
+		if (found[sector][1] >= 0)
+			snprintf(keyB, sizeof(keyB), "%s", sprint_hex_inrow(&keys[found[sector][1] * 16], 16));
+		PrintAndLogEx(NORMAL, "|%03d| %32s | %32s |", sector, keyA, keyB);
+	}
+	PrintAndLogEx(NORMAL, "|---|----------------------------------|----------------------------------|");
+	PrintAndLogEx(INFO, "Time: %" PRIu64 " ms", t1);
+
+	free(keys);
+	return 0;
+}
+
 static command_t CommandTable[] =
 {
   {"help",             CmdHelp,					1, "This help"},
@@ -850,6 +1098,7 @@ static command_t CommandTable[] =
   {"rdbl",  	       CmdHFMFPRdbl,			0, "Read blocks"},
   {"rdsc",  	       CmdHFMFPRdsc,			0, "Read sectors"},
   {"wrbl",  	       CmdHFMFPWrbl,			0, "Write blocks"},
+  {"chk",              CmdHFMFPChk,             1, "Check keys (on card or against sniffed authentication)"},
   {"mad",              CmdHFMFPMAD,             0, "Checks and prints MAD"},
   {"ndef",             CmdHFMFPNDEF,            0, "Prints NDEF records from card"},
   {NULL,               NULL,					0, NULL}
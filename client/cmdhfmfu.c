@@ -12,6 +12,9 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include "comms.h"
 #include "usb_cmd.h"
 #include "cmdmain.h"
@@ -22,6 +25,7 @@
 #include "mifare.h"
 #include "util.h"
 #include "util_posix.h"
+#include "iso14443crc.h"
 #include "protocols.h"
 #include "taginfo.h"
 
@@ -174,60 +178,6 @@ static int ul_select(iso14a_card_select_t *card, bool clear_trace) {
 }
 
 
-// This read command will return 16 bytes.
-static int ul_read(uint8_t page, uint8_t *response, uint16_t responseLength) {
-	uint8_t cmd[] = {MIFARE_CMD_READBLOCK, page};
-	int len = ul_send_cmd_raw(cmd, sizeof(cmd), response, responseLength);
-	return len;
-}
-
-
-static int ul_halt(void) {
-	uint8_t cmd[] = {ISO14443A_CMD_HALT, 0x00};
-	uint8_t response;
-	int len = ul_send_cmd_raw(cmd, sizeof(cmd), &response, sizeof(response));
-	return len;
-}
-
-
-static int ul_comp_write_ex(uint8_t page, uint8_t *data, uint8_t datalen, bool first_part_only) {
-
-	uint8_t cmd[18] = {0x00};
-	datalen = ( datalen > 16) ? 16 : datalen;
-
-	cmd[0] = MIFARE_CMD_WRITEBLOCK;
-	cmd[1] = page;
-
-	uint8_t response = {0xff};
-	ul_send_cmd_raw(cmd, 2, &response, sizeof(response));
-	if (response != CARD_ACK)
-		return -1;
-	if (first_part_only)
-		return 0;
-
-	memcpy(cmd, data, datalen);
-	ul_send_cmd_raw(cmd, 16, &response, sizeof(response));
-	if (response != CARD_ACK)
-		return -1;
-
-	return 0;
-}
-
-
-// not used yet
-// static int ul_comp_write(uint8_t page, uint8_t *data, uint8_t datalen) {
-	// return ul_comp_write_ex(page, data, datalen, false);
-// }
-
-
-static int ulc_requestAuthentication(uint8_t *nonce, uint16_t nonceLength) {
-
-	uint8_t cmd[] = {MIFARE_ULC_AUTH_1, 0x00};
-	int len = ul_send_cmd_raw(cmd, sizeof(cmd), nonce, nonceLength);
-	return len;
-}
-
-
 static int ulc_authentication(uint8_t *key, bool switch_off_field) {
 
 	UsbCommand c = {CMD_MIFAREUC_AUTH, {switch_off_field}};
@@ -313,38 +263,6 @@ static int ulev1_readSignature(uint8_t *response, uint16_t responseLength) {
 }
 
 
-// Fudan check checks for which error is given for a command with incorrect crc
-// NXP UL chip responds with 01, fudan 00.
-// other possible checks:
-//  send a0 + crc
-//  UL responds with 00, fudan doesn't respond
-//  or
-//  send a200 + crc
-//  UL doesn't respond, fudan responds with 00
-//  or
-//  send 300000 + crc (read with extra byte(s))
-//  UL responds with read of page 0, fudan doesn't respond.
-//
-// make sure field is off before calling this function
-static int ul_fudan_check(void) {
-	iso14a_card_select_t card;
-	if (!ul_select(&card, false))
-		return UL_ERROR;
-
-	UsbCommand c = {CMD_READER_ISO_14443a, {ISO14A_RAW | ISO14A_NO_DISCONNECT, 4, 0}};
-
-	uint8_t cmd[4] = {0x30,0x00,0x02,0xa7}; //wrong crc on purpose  should be 0xa8
-	memcpy(c.d.asBytes, cmd, 4);
-	clearCommandBuffer();
-	SendCommand(&c);
-	UsbCommand resp;
-	if (!WaitForResponseTimeout(CMD_ACK, &resp, 1500)) return UL_ERROR;
-	if (resp.arg[0] != 1) return UL_ERROR;
-
-	return (!resp.d.asBytes[0]) ? FUDAN_UL : UL; //if response == 0x00 then Fudan, else Genuine NXP
-}
-
-
 static int ul_print_default(uint8_t *data) {
 
 	uint8_t uid[7];
@@ -475,6 +393,13 @@ static int ulc_print_3deskey(uint8_t *data) {
 	return 0;
 }
 
+// key in the order of the dictionaries, shown as the tag stores it
+static void ulc_print_found_key(uint8_t *key) {
+	uint8_t keySwap[16];
+	memcpy(keySwap, SwapEndian64(key, 16, 8), 16);
+	ulc_print_3deskey(keySwap);
+}
+
 
 static int ulc_print_configuration(uint8_t *data) {
 
@@ -535,20 +460,15 @@ static int ulev1_print_configuration(uint8_t *data, uint8_t startPage) {
 }
 
 
-static int ulev1_print_counters(void) {
+static int ulev1_print_counters(mfu_fingerprint_t *fp) {
 	PrintAndLogEx(NORMAL, "--- Tag Counters");
-	uint8_t tear[1] = {0};
-	uint8_t counter[3] = {0,0,0};
-	uint16_t len = 0;
 	for ( uint8_t i = 0; i<3; ++i) {
-		ulev1_readTearing(i, tear, sizeof(tear));
-		len = ulev1_readCounter(i, counter, sizeof(counter) );
-		if (len == 3) {
-			PrintAndLogEx(NORMAL, "       [%0d] : %s", i, sprint_hex(counter,3));
-			PrintAndLogEx(NORMAL, "                    - %02X tearing %s", tear[0], ( tear[0]==0xBD)?"Ok":"failure");
+		if (fp->counters_ok & (1 << i)) {
+			PrintAndLogEx(NORMAL, "       [%0d] : %s", i, sprint_hex(fp->counters[i], 3));
+			PrintAndLogEx(NORMAL, "                    - %02X tearing %s", fp->tearing[i], ( fp->tearing[i]==0xBD)?"Ok":"failure");
 		}
 	}
-	return len;
+	return 0;
 }
 
 
@@ -578,42 +498,75 @@ static int ulev1_print_version(uint8_t *data){
 }
 
 
-static int ul_magic_test(void) {
-	// try a compatibility write to page0, and see if tag answers with ACK/NACK to the first part of the command
-	iso14a_card_select_t card;
-	if (!ul_select(&card, false))
-		return UL_ERROR;
-	int status = ul_comp_write_ex(0, NULL, 0, true);
-	if (status == 0) {
-		return MAGIC;
+// all probes and reads for `hf mfu info` in one command. keyType MFU_KEY_NONE or a key (UL-C 16 bytes, EV1/NTAG 4 bytes)
+static int ul_fingerprint(uint8_t keyType, uint8_t *key, mfu_fingerprint_t *fp) {
+	UsbCommand c = {CMD_MIFAREU_FINGERPRINT, {keyType, 0, 0}};
+	if (keyType != MFU_KEY_NONE)
+		memcpy(c.d.asBytes, key, 16);
+	clearCommandBuffer();
+	SendCommand(&c);
+
+	UsbCommand resp;
+	if (!WaitForResponseTimeout(CMD_ACK, &resp, 2500)) {
+		PrintAndLogEx(WARNING, "command execution time out");
+		return 0;
 	}
-	return 0;
+	memcpy(fp, resp.d.asBytes, sizeof(mfu_fingerprint_t));
+	if (!resp.arg[0]) {
+		PrintAndLogEx(WARNING, "iso14443a card select failed");
+		return 0;
+	}
+	return 1;
 }
 
 
-uint32_t GetHF14AMfU_Type(void){
+// Check up to keyCount keys on the device, one command per MFU_CHK_xx_KEYS keys.
+// Returns 1 and the index in found if a key works, 0 if none, -1 if the check was stopped
+static int ul_check_keys(uint8_t keyType, uint8_t *keys, size_t keyCount, size_t *found, uint8_t *pack) {
+	size_t keyLen = (keyType == MFU_KEY_3DES) ? 16 : 4;
+	size_t chunk = (keyType == MFU_KEY_3DES) ? MFU_CHK_3DES_KEYS : MFU_CHK_PWD_KEYS;
 
-	TagTypeUL_t tagtype = UNKNOWN;
-	iso14a_card_select_t card;
-	uint8_t version[10] = {0x00};
-	int len;
+	for (size_t i = 0; i < keyCount; i += chunk) {
+		size_t n = (keyCount - i < chunk) ? keyCount - i : chunk;
+		UsbCommand c = {CMD_MIFAREU_CHKKEYS, {keyType, n, 0}};
+		memcpy(c.d.asBytes, keys + i * keyLen, n * keyLen);
+		clearCommandBuffer();
+		SendCommand(&c);
 
-	if (!ul_select(&card, true)) {
-		DropField();
-		msleep(200);
-		return UL_ERROR;
+		UsbCommand resp;
+		if (!WaitForResponseTimeout(CMD_ACK, &resp, 2000 + n * 50)) {
+			PrintAndLogEx(WARNING, "command execution time out");
+			return -1;
+		}
+		if (resp.arg[0] == 1) {
+			*found = i + resp.arg[1];
+			memcpy(pack, resp.d.asBytes, 4);
+			return 1;
+		}
+		if (resp.arg[2] < n) {
+			PrintAndLogEx(WARNING, "Tag lost or button pressed after %u keys", (unsigned int)(i + resp.arg[2]));
+			return -1;
+		}
 	}
+	return 0;
+}
+
+
+static uint32_t ul_type_from_fingerprint(mfu_fingerprint_t *fp) {
+
+	TagTypeUL_t tagtype = UNKNOWN;
+	uint8_t *version = fp->version;
 
 	// Check for Ultralight Family
-	if (card.uidlen != 7 || (card.sak & 0x38) != 0x00) {
-		DropField();
-		PrintAndLogEx(NORMAL, "Tag is not Ultralight | NTAG | MY-D  [ATQA: %02X %02X SAK: %02X]\n", card.atqa[1], card.atqa[0], card.sak);
+	if (fp->uidlen != 7 || (fp->sak & 0x38) != 0x00) {
+		PrintAndLogEx(NORMAL, "Tag is not Ultralight | NTAG | MY-D  [ATQA: %02X %02X SAK: %02X]\n", fp->atqa[1], fp->atqa[0], fp->sak);
 		return UL_ERROR;
 	}
+	if (!(fp->flags & MFU_FP_PROBED))
+		return UL_ERROR;
 
-	if (card.uid[0] != 0x05) {
-		len  = ulev1_getVersion(version, sizeof(version));
-		if (len == 10) {
+	if (fp->uid[0] != 0x05) {
+		if (fp->flags & MFU_FP_VERSION) {
 			if (version[2] == 0x03 && version[6] == 0x0B)
 				tagtype = UL_EV1_48;
 			else if (version[2] == 0x03 && version[6] != 0x0B)
@@ -638,50 +591,24 @@ uint32_t GetHF14AMfU_Type(void){
 
 		// UL vs UL-C vs ntag203 test
 		if (tagtype == UNKNOWN) {
-			ul_halt();
-			if (!ul_select(&card, false)) {
-				DropField();
-				msleep(200);
-				return UL_ERROR;
-			}
-
-			// do UL_C check first...
-			uint8_t nonce[11] = {0x00};
-			len = ulc_requestAuthentication(nonce, sizeof(nonce));
-			ul_halt();
-			if (len == 11) {
+			if (fp->flags & MFU_FP_ULC_AUTH)
 				tagtype = UL_C;
-			} else {
-				// need to re-select after authentication error
-				if (!ul_select(&card, false)) {
-					DropField();
-					msleep(200);
-					return UL_ERROR;
-				}
-
-				uint8_t data[16] = {0x00};
-				// read page 0x29 (last valid ntag203 page)
-				len = ul_read(0x29, data, sizeof(data));
-				if (len <= 1) {
-					tagtype = UL;
-				} else {
-					// read page 0x30 (should error if it is a ntag203)
-					len = ul_read(0x30, data, sizeof(data));
-					if (len <= 1) {
-						ul_halt();
-						tagtype = NTAG_203;
-					}
-				}
-			}
+			else if (!(fp->flags & MFU_FP_READ_29))    // page 0x29 is the last valid ntag203 page
+				tagtype = UL;
+			else if (!(fp->flags & MFU_FP_READ_30))
+				tagtype = NTAG_203;
 		}
+
+		// Fudan check: a READ with a wrong CRC is answered with 01 by NXP, 00 by Fudan
 		if (tagtype & UL) {
-			tagtype = ul_fudan_check();
-			ul_halt();
+			if (!(fp->flags & MFU_FP_BAD_CRC))
+				return UL_ERROR;
+			tagtype = fp->badcrc ? UL : FUDAN_UL;
 		}
 
 	} else {  // manufacturer Infineon. Check for my-d variants
 
-		uint8_t nib = (card.uid[1] & 0xf0) >> 4;
+		uint8_t nib = (fp->uid[1] & 0xf0) >> 4;
 		switch (nib) {
 			case 1: tagtype = MY_D; break;                      //or SLE 66RxxS ... up to 512 pages of 8 user bytes...
 			case 2: tagtype = MY_D_NFC; break;                  //or SLE 66RxxP ... up to 512 pages of 8 user bytes... (or in nfc mode FF pages of 4 bytes)
@@ -690,13 +617,25 @@ uint32_t GetHF14AMfU_Type(void){
 		}
 	}
 
-	tagtype |= ul_magic_test();
-	
+	// magic tags ACK a compatibility write to page0
+	if (fp->flags & MFU_FP_MAGIC)
+		tagtype |= MAGIC;
+
 	if (tagtype == (UNKNOWN | MAGIC)) tagtype = (UL_MAGIC);
 
-	DropField();
-	msleep(200);
-	
+	return tagtype;
+}
+
+
+uint32_t GetHF14AMfU_Type(void){
+
+	mfu_fingerprint_t fp;
+
+	if (!ul_fingerprint(MFU_KEY_NONE, NULL, &fp))
+		return UL_ERROR;
+
+	TagTypeUL_t tagtype = ul_type_from_fingerprint(&fp);
+
 	printf("Tagtype: %08x\n", tagtype);
 	return tagtype;
 }
@@ -724,7 +663,6 @@ static int usage_hf_mfu_info(void) {
 static int CmdHF14AMfUInfo(const char *Cmd) {
 
 	uint8_t authlim = 0xff;
-	iso14a_card_select_t card;
 	bool errors = false;
 	uint8_t keybytes[16] = {0x00};
 	uint8_t *authenticationkey = keybytes;
@@ -734,7 +672,6 @@ static int CmdHF14AMfUInfo(const char *Cmd) {
 	bool swapEndian = false;
 	uint8_t cmdp = 0;
 	uint8_t pack[4] = {0,0,0,0};
-	int len = 0;
 
 	while(param_getchar(Cmd, cmdp) != 0x00)
 	{
@@ -772,7 +709,16 @@ static int CmdHF14AMfUInfo(const char *Cmd) {
 	if (errors)
 		return usage_hf_mfu_info();
 
-	TagTypeUL_t tagtype = GetHF14AMfU_Type();
+	// Swap endianness
+	if (swapEndian && hasAuthKey) 
+		authenticationkey = SwapEndian64(authenticationkey, keyLen, (keyLen == 16) ? 8 : 4 );
+
+	// the device authenticates with 3des on UL-C, PWD_AUTH on the rest
+	mfu_fingerprint_t fp;
+	if (!ul_fingerprint(hasAuthKey ? MFU_KEY_3DES : MFU_KEY_NONE, authenticationkey, &fp))
+		return -1;
+
+	TagTypeUL_t tagtype = ul_type_from_fingerprint(&fp);
 	if (tagtype == UL_ERROR) {
 		return -1;
 	}
@@ -781,25 +727,15 @@ static int CmdHF14AMfUInfo(const char *Cmd) {
 	PrintAndLogEx(NORMAL, "-------------------------------------------------------------");
 	ul_print_type(tagtype, 6);
 
-	// Swap endianness
-	if (swapEndian && hasAuthKey) 
-		authenticationkey = SwapEndian64(authenticationkey, keyLen, (keyLen == 16) ? 8 : 4 );
-
-	if (!ul_auth_select(&card, tagtype, hasAuthKey, authenticationkey, pack, sizeof(pack))) {
-		DropField();
-		return -1;
+	// the device read what it could without the key
+	if (hasAuthKey && !(fp.flags & MFU_FP_AUTH)) {
+		PrintAndLogEx(ERR, "Authentication Failed %s", (tagtype & UL_C) ? "UL-C" : "UL-EV1/NTAG");
 	}
 
-	// read pages 0,1,2,3 (should read 4pages)
-	uint8_t data[16];
-	len = ul_read(0, data, sizeof(data));
-	if (len == -1) {
-		DropField();
-		PrintAndLogEx(WARNING, "Error: tag didn't answer to READ");
-		return -1;
-	} else if (len == 16) {
-		ul_print_default(data);
-		ndef_print_CC(data+12);
+	// pages 0,1,2,3
+	if (fp.flags & MFU_FP_PAGES) {
+		ul_print_default(fp.pages);
+		ndef_print_CC(fp.pages + 12);
 	} else {
 		locked = true;
 	}
@@ -807,125 +743,52 @@ static int CmdHF14AMfUInfo(const char *Cmd) {
 	// UL_C Specific
 	if ((tagtype & UL_C)) {
 
-		// read pages 0x28, 0x29, 0x2A, 0x2B
-		uint8_t ulc_conf[16] = {0x00};
-		len = ul_read(0x28, ulc_conf, sizeof(ulc_conf));
-		if (len == -1) {
-			DropField();
-			PrintAndLogEx(WARNING, "Error: tag didn't answer to READ UL-C");
-			return -1;
-		}
-		if (len == 16) {
-			ulc_print_configuration(ulc_conf);
+		// pages 0x28, 0x29, 0x2A, 0x2B
+		if (fp.flags & MFU_FP_ULC_CONFIG) {
+			ulc_print_configuration(fp.ulc_config);
 		} else {
 			locked = true;
 		}
 
 		if ((tagtype & MAGIC)) {
 			//just read key
-			uint8_t ulc_deskey[16] = {0x00};
-			len = ul_read(0x2C, ulc_deskey, sizeof(ulc_deskey));
-			if (len == -1) {
-				DropField();
-				PrintAndLogEx(WARNING, "Error: tag didn't answer to READ magic");
-				return -1;
-			}
-			if (len == 16) ulc_print_3deskey(ulc_deskey);
+			if (fp.flags & MFU_FP_ULC_KEY) ulc_print_3deskey(fp.ulc_key);
 		} else {
 			// if we called info with key, just return
 			if (hasAuthKey) {
-				DropField();
 				return 1;
 			}
 
 			// also try to diversify default keys..  look into CmdHF14AMfuGenDiverseKeys
 			PrintAndLogEx(INFO, "Trying some default 3des keys");
-			for (uint8_t i = 0; i < KEYS_3DES_COUNT; ++i ) {
-				uint8_t *key = default_3des_keys[i];
-				if (ulc_authentication(key, true)) {
-					DropField();
-					PrintAndLogEx(SUCCESS, "Found default 3des key: ");
-					uint8_t keySwap[16];
-					memcpy(keySwap, SwapEndian64(key,16,8), 16);
-					ulc_print_3deskey(keySwap);
-					return 1;
-				}
+			size_t found;
+			if (ul_check_keys(MFU_KEY_3DES, default_3des_keys[0], KEYS_3DES_COUNT, &found, pack) == 1) {
+				PrintAndLogEx(SUCCESS, "Found default 3des key: ");
+				ulc_print_found_key(default_3des_keys[found]);
 			}
-			DropField();
 			return 1;
 		}
 	}
 
-	// do counters and signature first (don't neet auth)
-
 	// ul counters are different than ntag counters
 	if ((tagtype & (UL_EV1_48 | UL_EV1_128))) {
-		if (ulev1_print_counters() != 3) {
-			// failed - re-select
-			if (!ul_auth_select( &card, tagtype, hasAuthKey, authenticationkey, pack, sizeof(pack))) {
-				DropField();
-				return -1;
-			}
-		}
+		ulev1_print_counters(&fp);
 	}
 
 	if ((tagtype & (UL_EV1_48 | UL_EV1_128 | NTAG_213 | NTAG_215 | NTAG_216 | NTAG_I2C_1K | NTAG_I2C_2K ))) {
-		uint8_t ulev1_signature[32] = {0x00};
-		len = ulev1_readSignature(ulev1_signature, sizeof(ulev1_signature));
-		if (len == -1) {
-			DropField();
-			PrintAndLogEx(WARNING, "Error: tag didn't answer to READ SIGNATURE");
-			return -1;
-		}
-		if (len == 32) {
-			ulev1_print_signature( ulev1_signature, sizeof(ulev1_signature));
-		} else {
-			// re-select
-			if (!ul_auth_select( &card, tagtype, hasAuthKey, authenticationkey, pack, sizeof(pack))) {
-				DropField();
-				return -1;
-			}
+		if (fp.flags & MFU_FP_SIGNATURE) {
+			ulev1_print_signature(fp.signature, sizeof(fp.signature));
 		}
 	}
 
 	if ((tagtype & (UL_EV1_48 | UL_EV1_128 | NTAG_210 | NTAG_212 | NTAG_213 | NTAG_215 | NTAG_216 | NTAG_I2C_1K | NTAG_I2C_2K))) {
-		uint8_t version[10] = {0x00};
-		len = ulev1_getVersion(version, sizeof(version));
-		if (len == -1) {
-			DropField();
-			PrintAndLogEx(WARNING, "Error: tag didn't answer to GETVERSION");
-			return -1;
-		} else if (len == 10) {
-			ulev1_print_version(version);
-		} else {
-			locked = true;
-			if (!ul_auth_select( &card, tagtype, hasAuthKey, authenticationkey, pack, sizeof(pack))) {
-				DropField();
-				return -1;
-			}
-		}
+		ulev1_print_version(fp.version);
 
-		uint8_t startconfigblock = 0;
-		uint8_t ulev1_conf[16] = {0x00};
 		// config blocks always are last 4 pages
-		for (uint8_t idx = 0; idx < MAX_UL_TYPES; idx++) {
-			if (tagtype & UL_TYPES_ARRAY[idx]) {
-				startconfigblock = UL_MEMORY_ARRAY[idx]-3;
-				break;
-			}
-		}
-
-		if (startconfigblock) { // if we know where the config block is...
-			len = ul_read(startconfigblock, ulev1_conf, sizeof(ulev1_conf));
-			if (len == -1) {
-				DropField();
-				PrintAndLogEx(WARNING, "Error: tag didn't answer to READ EV1");
-				return -1;
-			} else if (len == 16) {
-				// save AUTHENTICATION LIMITS for later:
-				authlim = (ulev1_conf[4] & 0x07);
-				ulev1_print_configuration(ulev1_conf, startconfigblock);
-			}
+		if (fp.flags & MFU_FP_CONFIG) {
+			// save AUTHENTICATION LIMITS for later:
+			authlim = (fp.config[4] & 0x07);
+			ulev1_print_configuration(fp.config, fp.cfgpage);
 		}
 
 		// AUTHLIMIT, (number of failed authentications)
@@ -934,26 +797,14 @@ static int CmdHF14AMfUInfo(const char *Cmd) {
 		// hasAuthKey,  if we was called with key, skip test.
 		if (!authlim && !hasAuthKey) {
 			PrintAndLogEx(NORMAL, "\n--- Known EV1/NTAG passwords.");
-			len = 0;
-			for (uint8_t i = 0; i < KEYS_PWD_COUNT; ++i ) {
-				uint8_t *key = default_pwd_pack[i];
-				len = ulev1_requestAuthentication(key, pack, sizeof(pack));
-				if (len >= 1) {
-					PrintAndLogEx(SUCCESS, "Found a default password: %s || Pack: %02X %02X", sprint_hex(key, 4), pack[0], pack[1]);
-					break;
-				} else {
-					if (!ul_auth_select( &card, tagtype, hasAuthKey, authenticationkey, pack, sizeof(pack))) {
-						DropField();
-						return -1;
-					}
-				}
-			}
-			if (len < 1) PrintAndLogEx(WARNING, "password not known");
+			size_t found;
+			if (ul_check_keys(MFU_KEY_PWD, default_pwd_pack[0], KEYS_PWD_COUNT, &found, pack) == 1)
+				PrintAndLogEx(SUCCESS, "Found a default password: %s || Pack: %02X %02X", sprint_hex(default_pwd_pack[found], 4), pack[0], pack[1]);
+			else
+				PrintAndLogEx(WARNING, "password not known");
 		}
 	}
 
-	DropField();
-
 	if (locked) 
 		PrintAndLogEx(FAILED, "\nTag appears to be locked, try using the key to get more info");
 	PrintAndLogEx(NORMAL, "");
@@ -961,6 +812,170 @@ static int CmdHF14AMfUInfo(const char *Cmd) {
 	return 1;
 }
 
+//
+//  Check keys
+//
+static int usage_hf_mfu_chk(void) {
+	PrintAndLogEx(NORMAL, "Checks a dictionary of Ultralight-C 3des keys or EV1/NTAG passwords.");
+	PrintAndLogEx(NORMAL, "The keys are checked on the device, up to %d 3des keys or %d passwords per command.", MFU_CHK_3DES_KEYS, MFU_CHK_PWD_KEYS);
+	PrintAndLogEx(NORMAL, "Every wrong EV1/NTAG password counts towards the tag's AUTHLIM.\n");
+	PrintAndLogEx(NORMAL, "Usage:  hf mfu chk [d <dictionary>] [f]");
+	PrintAndLogEx(NORMAL, "  Options : ");
+	PrintAndLogEx(NORMAL, "  d <dic> : (optional) dictionary, 32 (UL-C) or 8 (EV1/NTAG) hex symbols per line, # comments");
+	PrintAndLogEx(NORMAL, "            without it the built-in default keys are checked");
+	PrintAndLogEx(NORMAL, "  f       : (optional) check passwords even if the tag limits failed attempts");
+	PrintAndLogEx(NORMAL, "");
+	PrintAndLogEx(NORMAL, "   sample : hf mfu chk");
+	PrintAndLogEx(NORMAL, "          : hf mfu chk d default_pwd.dic");
+	return 0;
+}
+
+
+// dictionary: keyLen*2 hex symbols at the start of a line, lines beginning with # are comments
+static int ul_load_dictionary(const char *filename, size_t keyLen, uint8_t **keys, size_t *keyCount) {
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		PrintAndLogEx(ERR, "File: %s: not found or locked.", filename);
+		return 1;
+	}
+
+	char buf[256];
+	size_t allocated = *keyCount;
+	while (fgets(buf, sizeof(buf), f)) {
+		if (buf[0] == '#' || strlen(buf) < keyLen * 2)
+			continue;
+
+		uint8_t key[16] = {0};
+		int len = 0;
+		buf[keyLen * 2] = 0x00;
+		if (param_gethex_to_eol(buf, 0, key, sizeof(key), &len) || len != keyLen) {
+			PrintAndLogEx(WARNING, "File content error. '%s' must include %u HEX symbols", buf, (unsigned int)keyLen * 2);
+			continue;
+		}
+
+		if (*keyCount == allocated) {
+			allocated += 256;
+			uint8_t *p = realloc(*keys, allocated * keyLen);
+			if (!p) {
+				PrintAndLogEx(ERR, "Cannot allocate memory for keys");
+				fclose(f);
+				return 2;
+			}
+			*keys = p;
+		}
+
+		memcpy(*keys + *keyCount * keyLen, key, keyLen);
+		(*keyCount)++;
+	}
+	fclose(f);
+
+	return 0;
+}
+
+
+static int CmdHF14AMfUChk(const char *Cmd) {
+
+	char filename[FILE_PATH_SIZE] = {0};
+	bool force = false;
+	bool errors = false;
+	uint8_t cmdp = 0;
+
+	while (param_getchar(Cmd, cmdp) != 0x00) {
+		switch (param_getchar(Cmd, cmdp)) {
+		case 'h':
+		case 'H':
+			return usage_hf_mfu_chk();
+		case 'd':
+		case 'D':
+			if (param_getstr(Cmd, cmdp+1, filename, sizeof(filename)) == 0) errors = true;
+			cmdp += 2;
+			break;
+		case 'f':
+		case 'F':
+			force = true;
+			cmdp++;
+			break;
+		default:
+			PrintAndLogEx(WARNING, "Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+			errors = true;
+			break;
+		}
+		if (errors) break;
+	}
+
+	if (errors)
+		return usage_hf_mfu_chk();
+
+	mfu_fingerprint_t fp;
+	if (!ul_fingerprint(MFU_KEY_NONE, NULL, &fp))
+		return 1;
+	TagTypeUL_t tagtype = ul_type_from_fingerprint(&fp);
+	if (tagtype == UL_ERROR)
+		return 1;
+	ul_print_type(tagtype, 0);
+
+	uint8_t keyType;
+	if (tagtype & UL_C) {
+		keyType = MFU_KEY_3DES;
+	} else if (tagtype & (UL_EV1_48 | UL_EV1_128 | NTAG_210 | NTAG_212 | NTAG_213 | NTAG_215 | NTAG_216)) {
+		keyType = MFU_KEY_PWD;
+		// AUTHLIM in cfg1, unknown if the config pages are read protected
+		if (!force) {
+			if (!(fp.flags & MFU_FP_CONFIG)) {
+				PrintAndLogEx(WARNING, "Can't read the password attempt limit. Use f to check anyway");
+				return 1;
+			}
+			if (fp.config[4] & 0x07) {
+				PrintAndLogEx(WARNING, "Tag allows %d failed password attempts. Use f to check anyway", fp.config[4] & 0x07);
+				return 1;
+			}
+		}
+	} else {
+		PrintAndLogEx(WARNING, "Tag has no key to check");
+		return 1;
+	}
+	size_t keyLen = (keyType == MFU_KEY_3DES) ? 16 : 4;
+
+	uint8_t *keys = NULL;
+	size_t keyCount = 0;
+	if (filename[0]) {
+		if (ul_load_dictionary(filename, keyLen, &keys, &keyCount)) {
+			free(keys);
+			return 1;
+		}
+		PrintAndLogEx(SUCCESS, "Loaded %u keys from %s", (unsigned int)keyCount, filename);
+	} else {
+		keyCount = (keyType == MFU_KEY_3DES) ? KEYS_3DES_COUNT : KEYS_PWD_COUNT;
+		keys = malloc(keyCount * keyLen);
+		if (!keys) {
+			PrintAndLogEx(ERR, "Cannot allocate memory for keys");
+			return 1;
+		}
+		memcpy(keys, (keyType == MFU_KEY_3DES) ? default_3des_keys[0] : default_pwd_pack[0], keyCount * keyLen);
+	}
+
+	uint64_t t1 = msclock();
+	size_t found = 0;
+	uint8_t pack[4] = {0};
+	int res = ul_check_keys(keyType, keys, keyCount, &found, pack);
+	t1 = msclock() - t1;
+
+	if (res == 1) {
+		if (keyType == MFU_KEY_3DES) {
+			PrintAndLogEx(SUCCESS, "Found 3des key: ");
+			ulc_print_found_key(keys + found * keyLen);
+		} else {
+			PrintAndLogEx(SUCCESS, "Found password: %s || Pack: %02X %02X", sprint_hex(keys + found * keyLen, keyLen), pack[0], pack[1]);
+		}
+	} else if (res == 0) {
+		PrintAndLogEx(FAILED, "No key found in %u keys", (unsigned int)keyCount);
+	}
+	PrintAndLogEx(INFO, "Time: %" PRIu64 " ms", t1);
+
+	free(keys);
+	return (res == 1) ? 0 : 1;
+}
+
 //
 //  Write Single Block
 //
@@ -1585,6 +1600,280 @@ static int CmdHF14AMfucAuth(const char *Cmd){
 }
 
 
+//
+// Ultralight C - check 3des keys offline against sniffed authentications
+//
+#define MFUC_MAX_HANDSHAKES 16
+
+typedef struct {
+	uint8_t ek_rndb[8];          // tag:    AF ek(RndB)
+	uint8_t ek_rnda_rndb[16];    // reader: AF ek(RndA || RndB')
+	bool found;
+	size_t key;                  // index of the key if found
+} mfuc_handshake_t;
+
+typedef struct {
+	uint8_t *keys;
+	size_t first;
+	size_t count;
+	mfuc_handshake_t *hs;
+	size_t hsCount;
+} mfuc_check_args_t;
+
+static pthread_mutex_t mfuc_check_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile size_t mfuc_unsolved;
+
+static int usage_hf_mfu_cchk(void) {
+	PrintAndLogEx(NORMAL, "Checks Ultralight-C 3des keys offline against sniffed authentications.");
+	PrintAndLogEx(NORMAL, "The handshakes (1A 00, AF ek(RndB), AF ek(RndA || RndB')) are taken from an");
+	PrintAndLogEx(NORMAL, "iso14443a trace or given as hex. The card is not needed.\n");
+	PrintAndLogEx(NORMAL, "Usage:  hf mfu cchk [l <trace file> | b <ek(RndB)> a <ek(RndA||RndB')>] [d <dictionary>]");
+	PrintAndLogEx(NORMAL, "  Options : ");
+	PrintAndLogEx(NORMAL, "  l <file> : (optional) trace file saved with 'hf list save', default is the trace buffer of the PM3");
+	PrintAndLogEx(NORMAL, "  b <hex>  : (optional) 8 bytes ek(RndB) sent by the tag after AF");
+	PrintAndLogEx(NORMAL, "  a <hex>  : (optional) 16 bytes ek(RndA || RndB') sent by the reader after AF");
+	PrintAndLogEx(NORMAL, "  d <dic>  : (optional) dictionary, 32 hex symbols per line, # comments");
+	PrintAndLogEx(NORMAL, "             the built-in default keys are always checked");
+	PrintAndLogEx(NORMAL, "");
+	PrintAndLogEx(NORMAL, "   sample : hf mfu cchk");
+	PrintAndLogEx(NORMAL, "          : hf mfu cchk l ulc.trc d ulc_keys.dic");
+	PrintAndLogEx(NORMAL, "          : hf mfu cchk b 5F5E5D5C5B5A5958 a 00112233445566778899AABBCCDDEEFF");
+	return 0;
+}
+
+// finds complete authentications in an iso14443a trace. Returns the number of handshakes
+static size_t ulc_handshakes_from_trace(uint8_t *trace, uint32_t traceLen, mfuc_handshake_t *hs, size_t maxCount) {
+	size_t count = 0;
+	int state = 0;           // 1: got 1A 00, 2: got AF ek(RndB)
+	uint32_t tracepos = 0;
+
+	while (count < maxCount && tracepos + 8 <= traceLen) {
+		uint16_t data_len = *((uint16_t *)(trace + tracepos + 6));
+		bool isResponse = data_len & 0x8000;
+		data_len &= 0x7fff;
+		tracepos += 8;
+		if (data_len == 0 || tracepos + data_len + (data_len - 1) / 8 + 1 > traceLen)
+			break;
+		uint8_t *frame = trace + tracepos;
+		tracepos += data_len + (data_len - 1) / 8 + 1;
+
+		bool crc = CheckCrc14443(CRC_14443_A, frame, data_len);
+		if (!isResponse && data_len == 4 && frame[0] == MIFARE_ULC_AUTH_1 && frame[1] == 0x00 && crc) {
+			state = 1;
+		} else if (state == 1 && isResponse && data_len == 11 && frame[0] == 0xAF && crc) {
+			memcpy(hs[count].ek_rndb, frame + 1, 8);
+			state = 2;
+		} else if (state == 2 && !isResponse && data_len == 19 && frame[0] == 0xAF && crc) {
+			memcpy(hs[count].ek_rnda_rndb, frame + 1, 16);
+			count++;
+			state = 0;
+		} else {
+			state = 0;
+		}
+	}
+	return count;
+}
+
+// Reader answer is CBC encrypted with ek(RndB) as IV, so RndB' = dk(C2) ^ C1
+// and only two block decryptions per key are needed.
+static bool ulc_check_handshake(mbedtls_des3_context *ctx, mfuc_handshake_t *hs) {
+	uint8_t rnd_b[8], rnd_b_rot[8];
+
+	mbedtls_des3_crypt_ecb(ctx, hs->ek_rndb, rnd_b);
+	mbedtls_des3_crypt_ecb(ctx, hs->ek_rnda_rndb + 8, rnd_b_rot);
+	for (int i = 0; i < 8; i++) {
+		if ((rnd_b_rot[i] ^ hs->ek_rnda_rndb[i]) != rnd_b[(i + 1) % 8])
+			return false;
+	}
+	return true;
+}
+
+static void *ulc_check_keys_thread(void *arg) {
+	mfuc_check_args_t *a = (mfuc_check_args_t *)arg;
+	mbedtls_des3_context ctx;
+
+	mbedtls_des3_init(&ctx);
+	for (size_t k = a->first; k < a->first + a->count && mfuc_unsolved; k++) {
+		// one key schedule for all handshakes
+		mbedtls_des3_set2key_dec(&ctx, a->keys + k * 16);
+		for (size_t i = 0; i < a->hsCount; i++) {
+			if (a->hs[i].found || !ulc_check_handshake(&ctx, &a->hs[i]))
+				continue;
+			pthread_mutex_lock(&mfuc_check_lock);
+			if (!a->hs[i].found) {
+				a->hs[i].found = true;
+				a->hs[i].key = k;
+				mfuc_unsolved--;
+			}
+			pthread_mutex_unlock(&mfuc_check_lock);
+		}
+	}
+	mbedtls_des3_free(&ctx);
+	return NULL;
+}
+
+static void ulc_check_keys_offline(uint8_t *keys, size_t keyCount, mfuc_handshake_t *hs, size_t hsCount) {
+	size_t threads = num_CPUs();
+	if (threads < 1) threads = 1;
+	if (threads > keyCount) threads = keyCount;
+
+	pthread_t thread_id[threads];
+	mfuc_check_args_t args[threads];
+	mfuc_unsolved = hsCount;
+	size_t first = 0;
+	for (size_t i = 0; i < threads; i++) {
+		args[i].keys = keys;
+		args[i].first = first;
+		args[i].count = keyCount / threads + (i < keyCount % threads ? 1 : 0);
+		args[i].hs = hs;
+		args[i].hsCount = hsCount;
+		first += args[i].count;
+		pthread_create(&thread_id[i], NULL, ulc_check_keys_thread, &args[i]);
+	}
+	for (size_t i = 0; i < threads; i++)
+		pthread_join(thread_id[i], NULL);
+}
+
+static int CmdHF14AMfucCheckOffline(const char *Cmd) {
+
+	char filename[FILE_PATH_SIZE] = {0};
+	char tracename[FILE_PATH_SIZE] = {0};
+	mfuc_handshake_t hs[MFUC_MAX_HANDSHAKES];
+	bool hasB = false, hasA = false;
+	int hexlen;
+	bool errors = false;
+	uint8_t cmdp = 0;
+
+	memset(hs, 0, sizeof(hs));
+	while (param_getchar(Cmd, cmdp) != 0x00) {
+		switch (param_getchar(Cmd, cmdp)) {
+		case 'h':
+		case 'H':
+			return usage_hf_mfu_cchk();
+		case 'd':
+		case 'D':
+			if (param_getstr(Cmd, cmdp+1, filename, sizeof(filename)) == 0) errors = true;
+			cmdp += 2;
+			break;
+		case 'l':
+		case 'L':
+			if (param_getstr(Cmd, cmdp+1, tracename, sizeof(tracename)) == 0) errors = true;
+			cmdp += 2;
+			break;
+		case 'b':
+		case 'B':
+			hexlen = 16;
+			if (param_gethex_ex(Cmd, cmdp+1, hs[0].ek_rndb, &hexlen) || hexlen != 16) errors = true;
+			hasB = true;
+			cmdp += 2;
+			break;
+		case 'a':
+		case 'A':
+			hexlen = 32;
+			if (param_gethex_ex(Cmd, cmdp+1, hs[0].ek_rnda_rndb, &hexlen) || hexlen != 32) errors = true;
+			hasA = true;
+			cmdp += 2;
+			break;
+		default:
+			PrintAndLogEx(WARNING, "Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+			errors = true;
+			break;
+		}
+		if (errors) break;
+	}
+
+	if (errors || hasB != hasA || (hasB && tracename[0]))
+		return usage_hf_mfu_cchk();
+
+	size_t hsCount = 0;
+	if (hasB) {
+		hsCount = 1;
+	} else {
+		uint8_t *trace = NULL;
+		uint32_t traceLen = 0;
+		if (tracename[0]) {
+			FILE *f = fopen(tracename, "rb");
+			if (!f) {
+				PrintAndLogEx(ERR, "File: %s: not found or locked.", tracename);
+				return 1;
+			}
+			fseek(f, 0, SEEK_END);
+			long fsize = ftell(f);
+			fseek(f, 0, SEEK_SET);
+			trace = malloc(fsize > 0 ? fsize : 1);
+			if (trace)
+				traceLen = fread(trace, 1, fsize > 0 ? fsize : 0, f);
+			fclose(f);
+		} else {
+			if (IsOffline()) {
+				PrintAndLogEx(WARNING, "Offline, use l <trace file> or b/a");
+				return 1;
+			}
+			UsbCommand response;
+			trace = malloc(USB_CMD_DATA_SIZE);
+			if (trace && GetFromBigBuf(trace, USB_CMD_DATA_SIZE, 0, &response, -1, false)) {
+				traceLen = response.arg[2];
+				if (traceLen > USB_CMD_DATA_SIZE) {
+					uint8_t *p = realloc(trace, traceLen);
+					if (p) {
+						trace = p;
+						GetFromBigBuf(trace, traceLen, 0, NULL, -1, false);
+					} else {
+						traceLen = 0;
+					}
+				}
+			}
+		}
+		if (!trace) {
+			PrintAndLogEx(ERR, "Cannot allocate memory for trace");
+			return 1;
+		}
+		hsCount = ulc_handshakes_from_trace(trace, traceLen, hs, MFUC_MAX_HANDSHAKES);
+		free(trace);
+		if (hsCount == 0) {
+			PrintAndLogEx(FAILED, "No Ultralight-C authentication in the trace (%u bytes)", traceLen);
+			return 1;
+		}
+	}
+
+	for (size_t i = 0; i < hsCount; i++)
+		PrintAndLogEx(INFO, "Handshake %u: ek(RndB) %s ek(RndA||RndB') %s", (unsigned int)i + 1,
+			sprint_hex(hs[i].ek_rndb, 8), sprint_hex_inrow(hs[i].ek_rnda_rndb, 16));
+
+	size_t keyCount = KEYS_3DES_COUNT;
+	uint8_t *keys = malloc(keyCount * 16);
+	if (!keys) {
+		PrintAndLogEx(ERR, "Cannot allocate memory for keys");
+		return 1;
+	}
+	memcpy(keys, default_3des_keys[0], keyCount * 16);
+	if (filename[0]) {
+		if (ul_load_dictionary(filename, 16, &keys, &keyCount)) {
+			free(keys);
+			return 1;
+		}
+		PrintAndLogEx(SUCCESS, "Loaded %u keys from %s", (unsigned int)(keyCount - KEYS_3DES_COUNT), filename);
+	}
+
+	uint64_t t1 = msclock();
+	ulc_check_keys_offline(keys, keyCount, hs, hsCount);
+	t1 = msclock() - t1;
+
+	size_t found = 0;
+	for (size_t i = 0; i < hsCount; i++) {
+		if (hs[i].found) {
+			PrintAndLogEx(SUCCESS, "Handshake %u: found 3des key: %s", (unsigned int)i + 1, sprint_hex(keys + hs[i].key * 16, 16));
+			found++;
+		} else {
+			PrintAndLogEx(FAILED, "Handshake %u: no key found", (unsigned int)i + 1);
+		}
+	}
+	PrintAndLogEx(INFO, "Checked %u keys in %" PRIu64 " ms", (unsigned int)keyCount, t1);
+
+	free(keys);
+	return (found == hsCount) ? 0 : 1;
+}
+
 //
 // Mifare Ultralight C - Set password
 //
@@ -1829,11 +2118,13 @@ static command_t CommandTable[] =
 	{"help",    CmdHelp,                   1, "This help"},
 	{"dbg",     CmdHF14AMfDbg,             0, "Set default debug mode"},
 	{"info",    CmdHF14AMfUInfo,           0, "Tag information"},
+	{"chk",     CmdHF14AMfUChk,            0, "Check UL-C 3des keys or EV1/NTAG passwords from a dictionary"},
 	{"dump",    CmdHF14AMfUDump,           0, "Dump Ultralight / Ultralight-C / NTAG tag to binary file"},
 	// {"restore", CmdHF14AMfURestore,        0, "Restore a dump onto a MFU MAGIC tag"},
 	{"rdbl",    CmdHF14AMfURdBl,           0, "Read block"},
 	{"wrbl",    CmdHF14AMfUWrBl,           0, "Write block"},
 	{"cauth",   CmdHF14AMfucAuth,          0, "Authentication    - Ultralight C"},
+	{"cchk",    CmdHF14AMfucCheckOffline,  1, "Check 3des keys offline against sniffed authentications - Ultralight C"},
 	{"setpwd",  CmdHF14AMfucSetPwd,        0, "Set 3des password - Ultralight-C"},
 	{"setuid",  CmdHF14AMfucSetUid,        0, "Set UID - MAGIC tags only"},
 	{"gen",     CmdHF14AMfuGenDiverseKeys, 1, "Generate 3des mifare diversified keys"},
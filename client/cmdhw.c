@@ -14,11 +14,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <inttypes.h>
 #include "ui.h"
 #include "comms.h"
 #include "cmdparser.h"
 #include "cmdmain.h"
 #include "cmddata.h"
+#include "util.h"
+#include "usb_txq.h"
+#include "usb_compact.h"
 
 
 static uint32_t hw_capabilities = 0;
@@ -421,6 +425,7 @@ int CmdVersion(const char *Cmd)
 		PrintAndLog((char*)resp.d.asBytes);
 		lookupChipID(resp.arg[0], resp.arg[1]);
 		hw_capabilities = resp.arg[2];
+		SetCompactFrames(hw_capabilities & HAS_COMPACT_FRAMES);
 	}
 	return 0;
 }
@@ -451,6 +456,213 @@ int CmdPing(const char *Cmd)
 	return 0;
 }
 
+static uint32_t txq_rand(uint32_t *state)
+{
+	// xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+#define TXQ_TEST_SIZE    2048                   // USB_TX_QUEUE_SIZE of the device
+#define TXQ_TEST_PACKET  64                     // IN endpoint size
+#define TXQ_TEST_FRAME   sizeof(UsbCommand)
+
+// one packet goes to the host per tick if the host is reading (hostload % of the ticks).
+// the device has a frame ready every interval ticks of its own work. With blocking it
+// waits until the host has the frame, queued it only waits while the queue is full.
+// returns % of the ticks the device waited
+static double txq_stall(bool blocking, int interval, int hostload, int ticks, uint32_t *rnd)
+{
+	uint8_t buf[TXQ_TEST_SIZE], frame[TXQ_TEST_FRAME], packet[TXQ_TEST_PACKET];
+	usb_txq_t q;
+	usb_txq_init(&q, buf, sizeof(buf));
+	memset(frame, 0, sizeof(frame));
+
+	int next = interval, stalled = 0;
+	bool waitEmpty = false;
+	for (int t = 0; t < ticks; t++) {
+		if (waitEmpty && usb_txq_used(&q)) {
+			stalled++;
+		} else if (waitEmpty) {
+			waitEmpty = false;
+			next = interval;
+		} else if (next > 0) {
+			next--;
+		} else if (usb_txq_push(&q, frame, sizeof(frame))) {
+			waitEmpty = blocking;
+			next = interval;
+		} else {
+			stalled++;
+		}
+
+		if (txq_rand(rnd) % 100 < hostload)
+			usb_txq_pop(&q, packet, sizeof(packet));
+	}
+	return stalled * 100.0 / ticks;
+}
+
+int CmdTxqTest(const char *Cmd)
+{
+	char cmdp = param_getchar(Cmd, 0);
+	if (cmdp == 'h' || cmdp == 'H') {
+		PrintAndLog("Usage:  hw txqtest [<rounds> [<seed>]]");
+		PrintAndLog("        checks the device USB transmit queue (common/usb_txq.c) against random frames and reads");
+		PrintAndLog("        and compares the time the device waits for the host with blocking and queued sends");
+		PrintAndLog("        defaults: 100000 rounds");
+		return 0;
+	}
+
+	int rounds = param_get32ex(Cmd, 0, 100000, 10);
+	uint32_t rnd = param_get32ex(Cmd, 1, 1, 10);
+	if (rnd == 0) rnd = 1;
+
+	// every byte is the next value of a counter, the reader checks the sequence
+	uint8_t buf[TXQ_TEST_SIZE], data[TXQ_TEST_FRAME], packet[TXQ_TEST_PACKET];
+	usb_txq_t q;
+	usb_txq_init(&q, buf, sizeof(buf));
+	uint8_t sent = 0, received = 0;
+	uint64_t accepted = 0, refused = 0, bytes = 0;
+	int errors = 0;
+
+	for (int r = 0; r < rounds && errors < 10; r++) {
+		size_t len = 1 + txq_rand(&rnd) % TXQ_TEST_FRAME;
+		for (size_t i = 0; i < len; i++)
+			data[i] = sent + i;
+		size_t used = usb_txq_used(&q);
+		if (usb_txq_push(&q, data, len)) {
+			sent += len;
+			accepted++;
+			if (usb_txq_used(&q) != used + len) errors++;
+		} else {
+			refused++;
+			if (usb_txq_used(&q) != used || len <= usb_txq_free(&q)) errors++;
+		}
+
+		// the host reads a few packets, some of them short
+		int reads = txq_rand(&rnd) % 12;
+		for (int i = 0; i < reads; i++) {
+			size_t n = usb_txq_pop(&q, packet, 1 + txq_rand(&rnd) % TXQ_TEST_PACKET);
+			for (size_t j = 0; j < n; j++) {
+				if (packet[j] != received++) errors++;
+			}
+			bytes += n;
+		}
+		if (usb_txq_used(&q) + usb_txq_free(&q) != TXQ_TEST_SIZE) errors++;
+	}
+	size_t n;
+	while ((n = usb_txq_pop(&q, packet, sizeof(packet))) > 0) {
+		for (size_t j = 0; j < n; j++) {
+			if (packet[j] != received++) errors++;
+		}
+		bytes += n;
+	}
+	if (received != sent) errors++;
+
+	PrintAndLog("queue: %" PRIu64 " frames queued, %" PRIu64 " refused while full, %" PRIu64 " bytes read, %d errors",
+		accepted, refused, bytes, errors);
+
+	// frame every <interval> packet times, host reading 80% of the time
+	int slower = 0;
+	PrintAndLog("frame every | blocking wait | queued wait");
+	for (int interval = 4; interval <= 24; interval += 4) {
+		double blocking = txq_stall(true, interval, 80, 100000, &rnd);
+		double queued = txq_stall(false, interval, 80, 100000, &rnd);
+		PrintAndLog("%8d pkt | %12.1f%% | %10.1f%%", interval, blocking, queued);
+		if (queued > blocking) slower++;
+	}
+
+	if (errors || slower)
+		PrintAndLog("Test(s) [ ERROR ] %d queue error(s), queued slower %d time(s)", errors, slower);
+	else
+		PrintAndLog("Test(s) [ OK ]");
+	return errors + slower;
+}
+
+// random arg: 0, 32 bit or 64 bit, the encoder picks the width from the largest
+static uint64_t frame_rand_arg(uint32_t *rnd)
+{
+	switch (txq_rand(rnd) % 4) {
+		case 0:  return 0;
+		case 1:  return txq_rand(rnd) % 0x100;
+		case 2:  return txq_rand(rnd);
+		default: return ((uint64_t)txq_rand(rnd) << 32) | txq_rand(rnd);
+	}
+}
+
+int CmdFrameTest(const char *Cmd)
+{
+	char cmdp = param_getchar(Cmd, 0);
+	if (cmdp == 'h' || cmdp == 'H') {
+		PrintAndLog("Usage:  hw frametest [<rounds> [<seed>]]");
+		PrintAndLog("        encodes random commands as compact USB frames (common/usb_compact.c), decodes them");
+		PrintAndLog("        and compares, and checks that broken frame headers are refused");
+		PrintAndLog("        defaults: 200000 rounds");
+		return 0;
+	}
+
+	int rounds = param_get32ex(Cmd, 0, 200000, 10);
+	uint32_t rnd = param_get32ex(Cmd, 1, 1, 10);
+	if (rnd == 0) rnd = 1;
+
+	uint8_t frame[USB_COMPACT_MAX_SIZE];
+	uint64_t bytes = 0, broken = 0;
+	int errors = 0;
+
+	for (int r = 0; r < rounds && errors < 10; r++) {
+		UsbCommand c, d;
+		memset(&c, 0, sizeof(c));
+		c.cmd = txq_rand(&rnd) & 0xFFFF;
+		for (int i = 0; i < 3; i++)
+			c.arg[i] = frame_rand_arg(&rnd);
+		size_t len = txq_rand(&rnd) % (USB_CMD_DATA_SIZE + 1);
+		for (size_t i = 0; i < len; i++)
+			c.d.asBytes[i] = txq_rand(&rnd);
+
+		size_t size = usb_compact_from_command(frame, &c);
+		if (size == 0 || size > USB_COMPACT_MAX_SIZE || !usb_compact_is_frame(frame) || usb_compact_frame_size(frame) != size) {
+			errors++;
+			continue;
+		}
+		if (!usb_compact_decode(frame, size, &d) || memcmp(&c, &d, sizeof(UsbCommand))) {
+			PrintAndLog("round %d: cmd %04" PRIx64 " args %" PRIx64 " %" PRIx64 " %" PRIx64 ", %zu data bytes don't match", r, c.cmd, c.arg[0], c.arg[1], c.arg[2], len);
+			errors++;
+		}
+		// a frame cut short or too long is refused
+		if (usb_compact_decode(frame, size - 1, &d) || usb_compact_decode(frame, size + 1, &d))
+			errors++;
+		bytes += size;
+
+		// broken header: magic, args byte or length. The reader has to drop it
+		frame[txq_rand(&rnd) % 4] ^= 1 << (txq_rand(&rnd) % 8);
+		if (usb_compact_is_frame(frame) || usb_compact_frame_size(frame) != 0)
+			errors++;
+		frame[0] = USB_COMPACT_MAGIC & 0xFF;
+		frame[1] = (USB_COMPACT_MAGIC >> 8) & 0xFF;
+		frame[2] = (USB_COMPACT_MAGIC >> 16) & 0xFF;
+		frame[3] = (USB_COMPACT_MAGIC >> 24) & 0xFF;
+		if (txq_rand(&rnd) & 1)
+			frame[6] |= 0x04 << (txq_rand(&rnd) % 5);
+		else
+			frame[8] |= 0x04 << (txq_rand(&rnd) % 6);
+		if (usb_compact_frame_size(frame) != 0)
+			errors++;
+		broken++;
+	}
+
+	PrintAndLog("%d frames, %" PRIu64 " bytes (%.1f per frame, UsbCommand %zu), %" PRIu64 " broken headers, %d errors",
+		rounds, bytes, rounds ? (double)bytes / rounds : 0.0, sizeof(UsbCommand), broken, errors);
+
+	if (errors)
+		PrintAndLog("Test(s) [ ERROR ] %d frame error(s)", errors);
+	else
+		PrintAndLog("Test(s) [ OK ]");
+	return errors;
+}
+
 static command_t CommandTable[] = 
 {
 	{"help",          CmdHelp,        1, "This help"},
@@ -466,6 +678,8 @@ static command_t CommandTable[] =
 	{"version",       CmdVersion,     0, "Show version information about the connected Proxmark"},
 	{"status",        CmdStatus,      0, "Show runtime status information about the connected Proxmark"},
 	{"ping",          CmdPing,        0, "Test if the pm3 is responsive"},
+	{"txqtest",       CmdTxqTest,     1, "Test the device USB transmit queue offline"},
+	{"frametest",     CmdFrameTest,   1, "Test the compact USB frame encoding offline"},
 	{NULL, NULL, 0, NULL}
 };
 
@@ -25,6 +25,8 @@ int CmdSetDivisor(const char *Cmd);
 int CmdSetMux(const char *Cmd);
 int CmdTune(const char *Cmd);
 int CmdVersion(const char *Cmd);
+int CmdTxqTest(const char *Cmd);
+int CmdFrameTest(const char *Cmd);
 bool PM3hasSmartcardSlot(void);
 
 #endif
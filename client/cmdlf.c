@@ -14,11 +14,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <ctype.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include "comms.h"
 #include "lfdemod.h"     // for psk2TOpsk1
 #include "util.h"        // for parsing cli command utils
+#include "util_posix.h"  // for msclock
 #include "ui.h"          // for show graph controls
 #include "graph.h"       // for graph data
 #include "cmdparser.h"   // for getting cli commands included in cmdmain.h
@@ -46,6 +49,10 @@
 #include "cmdlfnoralsy.h"// for noralsy menu
 #include "cmdlfsecurakey.h"//for securakey menu
 #include "cmdlfpac.h"    // for pac menu
+#include "lfsynth.h"     // for synthetic captures
+#include "lfsim.h"       // for compact sim descriptions
+#include "lfwatch.h"     // for `lf watch`
+#include "lfcompress.h"  // for `lf stream`
 
 bool g_lf_threshold_set = false;
 static int CmdHelp(const char *Cmd);
@@ -206,7 +213,7 @@ int usage_lf_read(void)
 	PrintAndLog("Options:        ");
 	PrintAndLog("       h            This help");
 	PrintAndLog("       s            silent run no printout");
-	PrintAndLog("       [# samples]  # samples to collect (optional)");	
+	PrintAndLog("       [# samples]  # samples to collect (optional). With 'lf config c 1' up to 320000");	
 	PrintAndLog("Use 'lf config' to set parameters.");
 	return 0;
 }
@@ -220,9 +227,27 @@ int usage_lf_snoop(void)
 	return 0;
 }
 
+int usage_lf_stream(void)
+{
+	PrintAndLog("Usage: lf stream [s] [n <samples>] [f <filename>]");
+	PrintAndLog("Options:        ");
+	PrintAndLog("       h            This help");
+	PrintAndLog("       s            snoop - no active field");
+	PrintAndLog("       n <samples>  stop after this many samples. Default: until a key or the button is pressed");
+	PrintAndLog("       f <filename> append all samples to a file (same format as `data save`)");
+	PrintAndLog("Samples are sent while sampling, the capture is not limited by the device memory.");
+	PrintAndLog("The last %d samples end up in the graph buffer.", MAX_GRAPH_TRACE_LEN);
+	PrintAndLog("Uses the 'lf config' divisor (sample rate) and compress setting, decimation and bits/sample are ignored.");
+	PrintAndLog("Lower the sample rate or turn compression on if samples are dropped.");
+	PrintAndLog("Examples:");
+	PrintAndLog("      lf stream f reader.pm3");
+	PrintAndLog("      lf stream s n 1000000");
+	return 0;
+}
+
 int usage_lf_config(void)
 {
-	PrintAndLog("Usage: lf config [H|<divisor>] [b <bps>] [d <decim>] [a 0|1]");
+	PrintAndLog("Usage: lf config [H|<divisor>] [b <bps>] [d <decim>] [a 0|1] [c 0|1]");
 	PrintAndLog("Options:        ");
 	PrintAndLog("       h               This help");
 	PrintAndLog("       L               Low frequency (125 KHz)");
@@ -233,12 +258,16 @@ int usage_lf_config(void)
 	PrintAndLog("       a [0|1]         Averaging - if set, will average the stored sample value when decimating. Default: 1");
 	PrintAndLog("       t <threshold>   Sets trigger threshold. 0 means no threshold (range: 0-128)");
 	PrintAndLog("       s <smplstoskip> Sets a number of samples to skip before capture. Default: 0");
+	PrintAndLog("       c [0|1]         Compress - 8 bps captures are compressed on the device (lossless),");
+	PrintAndLog("                       longer captures fit into the device memory and download faster. Default: 0");
 	PrintAndLog("Examples:");
 	PrintAndLog("      lf config b 8 L");
 	PrintAndLog("                       Samples at 125KHz, 8bps.");
 	PrintAndLog("      lf config H b 4 d 3");
 	PrintAndLog("                       Samples at 134KHz, averages three samples into one, stored with ");
 	PrintAndLog("                       a resolution of 4 bits per sample.");
+	PrintAndLog("      lf config c 1");
+	PrintAndLog("                       Compresses the samples. `lf read 100000` reads 100000 samples.");
 	PrintAndLog("      lf read");
 	PrintAndLog("                       Performs a read (active field)");
 	PrintAndLog("      lf snoop");
@@ -257,6 +286,7 @@ int CmdLFSetConfig(const char *Cmd)
 	int trigger_threshold =-1;//Means no change
 	uint8_t unsigned_trigg = 0;
 	int samples_to_skip = -1;
+	int compress = -1;
 
 	uint8_t cmdp =0;
 	while(param_getchar(Cmd, cmdp) != 0x00)
@@ -301,6 +331,10 @@ int CmdLFSetConfig(const char *Cmd)
 			samples_to_skip = param_get32ex(Cmd,cmdp+1,0,10);
 			cmdp+=2;
 			break;
+		case 'c':
+			compress = param_getchar(Cmd,cmdp+1) == '1';
+			cmdp+=2;
+			break;
 		default:
 			PrintAndLog("Unknown parameter '%c'", param_getchar(Cmd, cmdp));
 			errors = 1;
@@ -322,7 +356,7 @@ int CmdLFSetConfig(const char *Cmd)
 	if(bps >> 4) bps = 8;
 
 	sample_config config = {
-		decimation,bps,averaging,divisor,trigger_threshold,samples_to_skip
+		decimation,bps,averaging,divisor,trigger_threshold,samples_to_skip,compress
 	};
 	//Averaging is a flag on high-bit of arg[1]
 	UsbCommand c = {CMD_SET_LF_SAMPLING_CONFIG};
@@ -343,7 +377,8 @@ bool lf_read(bool silent, uint32_t samples) {
 	if (g_lf_threshold_set) {
 		WaitForResponse(CMD_ACK,&resp);
 	} else {
-		if ( !WaitForResponseTimeout(CMD_ACK,&resp,2500) ) {
+		// compressed captures can be longer than the sample buffer, 125 samples per ms
+		if ( !WaitForResponseTimeout(CMD_ACK,&resp,2500 + samples/125) ) {
 			PrintAndLog("command execution time out");
 			return false;
 		}
@@ -381,9 +416,354 @@ int CmdLFSnoop(const char *Cmd)
 	UsbCommand c = {CMD_LF_SNOOP_RAW_ADC_SAMPLES};
 	clearCommandBuffer();
 	SendCommand(&c);
-	WaitForResponse(CMD_ACK,NULL);
-	getSamples(0, true);
+	UsbCommand resp;
+	WaitForResponse(CMD_ACK,&resp);
+	// resp.arg[0] is bits read not bytes read.
+	getSamples(resp.arg[0]/8, true);
+
+	return 0;
+}
+
+typedef struct {
+	FILE *f;
+	int *ring;
+	size_t ringPos;
+	int frame[USB_CMD_DATA_SIZE];
+	uint64_t received, packedBytes;
+	uint64_t expected, gaps, gapSamples;
+	volatile uint32_t frames;
+} lfstream_t;
+
+// one CMD_LF_STREAMED_ADC_SAMPLES frame, called on the communication thread
+static void lfStreamFrame(UsbCommand *resp, void *ctx)
+{
+	lfstream_t *st = (lfstream_t *)ctx;
+	uint32_t index = resp->arg[0];
+	int n = MIN(resp->arg[1], USB_CMD_DATA_SIZE);
+	uint32_t packed = resp->arg[2];
+	if (packed) {
+		n = lfDecompress(resp->d.asBytes, MIN(packed, USB_CMD_DATA_SIZE), st->frame, n);
+		if (n < 0) {
+			PrintAndLog("\nCorrupt frame at sample %u", index);
+			n = 0;
+		}
+		st->packedBytes += packed;
+	} else {
+		for (int i = 0; i < n; i++)
+			st->frame[i] = (int)resp->d.asBytes[i] - 128;
+		st->packedBytes += n;
+	}
+
+	if (index != st->expected) {
+		st->gaps++;
+		st->gapSamples += index - st->expected;
+		PrintAndLog("\nDevice dropped %u samples at %" PRIu64 " (%" PRIu64 " received)", index - (uint32_t)st->expected, st->expected, st->received);
+	}
+	st->expected = (uint64_t)index + resp->arg[1];
+
+	for (int i = 0; i < n; i++) {
+		st->ring[st->ringPos] = st->frame[i];
+		st->ringPos = (st->ringPos + 1) % MAX_GRAPH_TRACE_LEN;
+		if (st->f) fprintf(st->f, "%d\n", st->frame[i]);
+	}
+	st->received += n;
+	if ((st->received & 0x7FFF) < (uint64_t)n) {
+		printf("\r%" PRIu64 " samples", st->received);
+		fflush(stdout);
+	}
+	st->frames++;
+}
+
+int CmdLFStream(const char *Cmd)
+{
+	bool snoop = false;
+	uint32_t maxSamples = 0;
+	char filename[FILE_PATH_SIZE] = {0};
+	bool errors = false;
+	uint8_t cmdp = 0;
+	while (param_getchar(Cmd, cmdp) != 0x00 && !errors) {
+		switch (param_getchar(Cmd, cmdp)) {
+			case 'h':
+			case 'H':
+				return usage_lf_stream();
+			case 's':
+			case 'S':
+				snoop = true;
+				cmdp++;
+				break;
+			case 'n':
+			case 'N':
+				maxSamples = param_get32ex(Cmd, cmdp+1, 0, 10);
+				cmdp += 2;
+				break;
+			case 'f':
+			case 'F':
+				if (param_getstr(Cmd, cmdp+1, filename, sizeof(filename)) == 0) errors = true;
+				cmdp += 2;
+				break;
+			default:
+				PrintAndLog("Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+				errors = true;
+				break;
+		}
+	}
+	if (errors) return usage_lf_stream();
+
+	FILE *f = NULL;
+	if (filename[0]) {
+		f = fopen(filename, "a");
+		if (!f) {
+			PrintAndLog("Cannot open file %s", filename);
+			return 1;
+		}
+	}
+
+	// the last MAX_GRAPH_TRACE_LEN samples, for the graph
+	lfstream_t st = {0};
+	st.f = f;
+	st.ring = calloc(MAX_GRAPH_TRACE_LEN, sizeof(int));
+	if (!st.ring) {
+		PrintAndLog("Cannot allocate memory");
+		if (f) fclose(f);
+		return 1;
+	}
+
+	// frames are handled on the communication thread, so none are lost in the
+	// response buffer while this thread is busy
+	uint32_t overflows = GetCommandOverflows();
+	SetFrameHandler(CMD_LF_STREAMED_ADC_SAMPLES, lfStreamFrame, &st);
+
+	UsbCommand c = {CMD_LF_STREAM_ADC_SAMPLES, {!snoop, maxSamples, 0}};
+	clearCommandBuffer();
+	SendCommand(&c);
+	PrintAndLog("Streaming%s... press a key or the button to stop", snoop ? " (snoop)" : "");
+
+	bool aborted = false;
+	uint32_t lastFrames = 0;
+	uint64_t lastFrame = msclock();
+	UsbCommand resp;
+	while (true) {
+		if (!aborted && ukbhit()) {
+			getchar();
+			// any command ends the stream on the device
+			UsbCommand off = {CMD_FPGA_MAJOR_MODE_OFF};
+			SendCommand(&off);
+			aborted = true;
+		}
+
+		if (WaitForResponseTimeout(CMD_ACK, &resp, 100)) {
+			printf("\n");
+			PrintAndLog("Device sent %" PRIu64 " samples, dropped %" PRIu64, resp.arg[0], resp.arg[1]);
+			if (resp.arg[2])
+				PrintAndLog("Device restarted sampling %" PRIu64 " times, samples lost at these points are not counted", resp.arg[2]);
+			break;
+		}
+		if (st.frames != lastFrames) {
+			lastFrames = st.frames;
+			lastFrame = msclock();
+		} else if (msclock() - lastFrame > 2500) {
+			PrintAndLog("\nNo response from the device");
+			break;
+		}
+	}
+	SetFrameHandler(0, NULL, NULL);
+	if (f) fclose(f);
+
+	PrintAndLog("Received %" PRIu64 " samples in %" PRIu64 " bytes, %" PRIu64 " gaps (%" PRIu64 " samples)", st.received, st.packedBytes, st.gaps, st.gapSamples);
+	overflows = GetCommandOverflows() - overflows;
+	if (overflows)
+		PrintAndLog("The client lost %u answers in its receive buffer", overflows);
+	if (f) PrintAndLog("Appended to %s", filename);
+
+	// oldest first
+	size_t len = st.received < MAX_GRAPH_TRACE_LEN ? st.received : MAX_GRAPH_TRACE_LEN;
+	size_t start = st.received < MAX_GRAPH_TRACE_LEN ? 0 : st.ringPos;
+	for (size_t i = 0; i < len; i++)
+		GraphBuffer[i] = st.ring[(start + i) % MAX_GRAPH_TRACE_LEN];
+	GraphTraceLen = len;
+	free(st.ring);
+
+	setClockGrid(0,0);
+	DemodBufferLen = 0;
+	RepaintGraphWindow();
+	return 0;
+}
+
+static int usage_lf_watch(void)
+{
+	PrintAndLog("Usage: lf watch [1] [p <protocols>] [g]");
+	PrintAndLog("Options:        ");
+	PrintAndLog("       h              This help");
+	PrintAndLog("       1              stop after the first credential");
+	PrintAndLog("       p <protocols>  any of h (HID), a (AWID), i (ioProx), e (EM410x) - default: all");
+	PrintAndLog("       g              watch the graph buffer offline, chunk by chunk as the device would");
+	PrintAndLog("The device samples without pause. Each time %d new samples are in, the next protocol demodulates",
+		LFWATCH_CHUNK_SIZE);
+	PrintAndLog("the last %d (HID, AWID, ioProx) or %d (EM410x) samples.",
+		LFWATCH_FSK_CHUNKS * LFWATCH_CHUNK_SIZE, LFWATCH_WINDOW_CHUNKS * LFWATCH_CHUNK_SIZE);
+	PrintAndLog("A credential is listed when it shows up, again after it was gone for a second.");
+	PrintAndLog("Examples:");
+	PrintAndLog("      lf watch");
+	PrintAndLog("      lf watch 1 p he");
+	return 0;
+}
+
+static void lfWatchPrint(const lfwatch_record_t *rec)
+{
+	// samples at 125kHz
+	double ms = rec->sample * 0.008;
+	switch (rec->protocol) {
+		case LFWATCH_HID:
+			if (rec->raw[0])
+				PrintAndLog("HID Prox  %3d bit  FC: %-5u CN: %-8u raw: %x%08x%08x  (%.1f ms)", rec->bits, rec->fc, rec->cn, rec->raw[0], rec->raw[1], rec->raw[2], ms);
+			else
+				PrintAndLog("HID Prox  %3d bit  FC: %-5u CN: %-8u raw: %x%08x  (%.1f ms)", rec->bits, rec->fc, rec->cn, rec->raw[1], rec->raw[2], ms);
+			break;
+		case LFWATCH_AWID:
+			PrintAndLog("AWID      %3d bit  FC: %-5u CN: %-8u raw: %08x%08x%08x  (%.1f ms)", rec->bits, rec->fc, rec->cn, rec->raw[0], rec->raw[1], rec->raw[2], ms);
+			break;
+		case LFWATCH_IO:
+			PrintAndLog("ioProx    XSF(%02d)%02x:%05d          raw: %08x%08x  (%.1f ms)", rec->version, rec->fc, rec->cn, rec->raw[1], rec->raw[2], ms);
+			break;
+		case LFWATCH_EM410X:
+			if (rec->bits > 40)
+				PrintAndLog("EM410x XL          ID: %06x%08x%08x  (%.1f ms)", rec->raw[0], rec->raw[1], rec->raw[2], ms);
+			else
+				PrintAndLog("EM410x    %03u_%05u        ID: %02x%08x  (%.1f ms)", rec->fc, rec->cn, rec->raw[1], rec->raw[2], ms);
+			break;
+	}
+}
+
+// the device watch loop over the graph buffer
+static int lfWatchGraph(uint32_t protocols, bool findone)
+{
+	size_t chunks = GraphTraceLen / LFWATCH_CHUNK_SIZE;
+	if (chunks < LFWATCH_MIN_CHUNKS) {
+		PrintAndLog("Need at least %d samples in the graph buffer", LFWATCH_MIN_CHUNKS * LFWATCH_CHUNK_SIZE);
+		return 1;
+	}
+	uint8_t *samples = malloc(chunks * LFWATCH_CHUNK_SIZE);
+	uint8_t *work = malloc(LFWATCH_WINDOW_CHUNKS * LFWATCH_CHUNK_SIZE);
+	if (!samples || !work) {
+		PrintAndLog("Cannot allocate memory");
+		free(samples);
+		free(work);
+		return 1;
+	}
+	for (size_t i = 0; i < chunks * LFWATCH_CHUNK_SIZE; i++)
+		samples[i] = MAX(0, MIN(255, GraphBuffer[i] + 128));
+
+	lfwatch_t watch;
+	lfwatch_record_t rec[LFWATCH_MAX_RECORDS];
+	lfWatchInit(&watch, protocols);
+	int found = 0, demods = 0;
+	uint64_t t = msclock();
+	for (size_t head = LFWATCH_MIN_CHUNKS; head <= chunks; head++) {
+		size_t contiguous = MIN(head, LFWATCH_WINDOW_CHUNKS);
+		int n = lfWatchDemod(&watch, samples, chunks * LFWATCH_CHUNK_SIZE, (head % chunks) * LFWATCH_CHUNK_SIZE,
+			contiguous * LFWATCH_CHUNK_SIZE, work, head * LFWATCH_CHUNK_SIZE, rec, LFWATCH_MAX_RECORDS);
+		if (n < 0) continue;
+		demods++;
+		for (int i = 0; i < n; i++)
+			lfWatchPrint(&rec[i]);
+		found += n;
+		if (findone && found) break;
+	}
+	t = msclock() - t;
+	PrintAndLog("%d credential(s), %d demod runs over %d samples, %.2f ms per run", found, demods, chunks * LFWATCH_CHUNK_SIZE, (double)t / demods);
+	free(samples);
+	free(work);
+	return 0;
+}
 
+// multi protocol reader on the device (common/lfwatch.c)
+int CmdLFWatch(const char *Cmd)
+{
+	uint32_t protocols = 0;
+	bool findone = false, graph = false, errors = false;
+	char names[8];
+	uint8_t cmdp = 0;
+	while (param_getchar(Cmd, cmdp) != 0x00 && !errors) {
+		switch (param_getchar(Cmd, cmdp)) {
+			case 'h':
+			case 'H':
+				return usage_lf_watch();
+			case '1':
+				findone = true;
+				cmdp++;
+				break;
+			case 'g':
+			case 'G':
+				graph = true;
+				cmdp++;
+				break;
+			case 'p':
+			case 'P':
+				if (param_getstr(Cmd, cmdp+1, names, sizeof(names)) == 0) errors = true;
+				for (char *p = names; *p && !errors; p++) {
+					switch (tolower(*p)) {
+						case 'h': protocols |= 1 << LFWATCH_HID; break;
+						case 'a': protocols |= 1 << LFWATCH_AWID; break;
+						case 'i': protocols |= 1 << LFWATCH_IO; break;
+						case 'e': protocols |= 1 << LFWATCH_EM410X; break;
+						default:
+							PrintAndLog("Unknown protocol '%c'", *p);
+							errors = true;
+					}
+				}
+				cmdp += 2;
+				break;
+			default:
+				PrintAndLog("Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+				errors = true;
+				break;
+		}
+	}
+	if (errors) return usage_lf_watch();
+	if (protocols == 0) protocols = LFWATCH_ALL;
+
+	if (graph)
+		return lfWatchGraph(protocols, findone);
+
+	if (IsOffline()) {
+		PrintAndLog("Offline - use 'g' to watch the graph buffer");
+		return 1;
+	}
+
+	UsbCommand c = {CMD_LF_WATCH, {protocols, findone, 0}};
+	clearCommandBuffer();
+	SendCommand(&c);
+	PrintAndLog("Watching... press a key or the button to stop");
+
+	bool aborted = false;
+	int found = 0;
+	UsbCommand resp;
+	for (;;) {
+		if (!aborted && ukbhit()) {
+			getchar();
+			// any command ends the watch on the device
+			UsbCommand off = {CMD_FPGA_MAJOR_MODE_OFF};
+			SendCommand(&off);
+			aborted = true;
+		}
+
+		if (!WaitForResponseTimeout(CMD_UNKNOWN, &resp, 100)) continue;
+
+		if (resp.cmd == CMD_LF_WATCH_RECORDS) {
+			size_t n = MIN(resp.arg[0], USB_CMD_DATA_SIZE / sizeof(lfwatch_record_t));
+			lfwatch_record_t *rec = (lfwatch_record_t *)resp.d.asBytes;
+			for (size_t i = 0; i < n; i++)
+				lfWatchPrint(&rec[i]);
+			found += n;
+		} else if (resp.cmd == CMD_ACK) {
+			lfwatch_stats_t *stats = (lfwatch_stats_t *)resp.d.asBytes;
+			PrintAndLog("Stopped - %d credential(s), %" PRIu64 " samples, %" PRIu64 " demod runs",
+				found, resp.arg[0], resp.arg[1]);
+			PrintAndLog("%" PRIu64 " sampling restarts, about %u samples lost, longest demod %.1f ms",
+				resp.arg[2], stats->lost, stats->maxDemod / 1000.0);
+			break;
+		}
+	}
 	return 0;
 }
 
@@ -411,6 +791,24 @@ int CmdLFSim(const char *Cmd)
 	// convert to bitstream if necessary
 	ChkBitstream(Cmd);
 
+	// run length encoded it usually fits a single frame
+	uint8_t *samples = malloc(GraphTraceLen + 1);
+	if (samples) {
+		for (i = 0; i < GraphTraceLen; i++)
+			samples[i] = GraphBuffer[i] > 0;
+		UsbCommand c = {CMD_SIMULATE_TAG_125K_COMPACT, {0, gap, 0}};
+		size_t len = lfsimDescRle((lfsim_desc_t *)c.d.asBytes, USB_CMD_DATA_SIZE, samples, GraphTraceLen);
+		free(samples);
+		if (len) {
+			c.arg[0] = len;
+			PrintAndLog("Sending [%d samples in %d bytes]", GraphTraceLen, len);
+			PrintAndLog("Starting to simulate");
+			clearCommandBuffer();
+			SendCommand(&c);
+			return 0;
+		}
+	}
+
 	//can send only 512 bits at a time (1 byte sent per bit...)
 	printf("Sending [%d bytes]", GraphTraceLen);
 	for (i = 0; i < GraphTraceLen; i += USB_CMD_DATA_SIZE) {
@@ -480,6 +878,27 @@ int usage_lf_simpsk(void)
 	return 0;
 }
 
+// sends the bits with the modulation set in the description in c,
+// the device expands them while it simulates
+static int lfSimBits(UsbCommand *c, const uint8_t *bits, size_t size)
+{
+	size_t max = (USB_CMD_DATA_SIZE - sizeof(lfsim_desc_t)) * 8;
+	if (size > max) {
+		PrintAndLog("DemodBuffer too long for current implementation - length: %d - max: %d", size, max);
+		size = max;
+	}
+	size_t len = lfsimDescBits((lfsim_desc_t *)c->d.asBytes, USB_CMD_DATA_SIZE, bits, size);
+	if (len == 0) {
+		PrintAndLog("Nothing to sim");
+		return 1;
+	}
+	c->cmd = CMD_SIMULATE_TAG_125K_COMPACT;
+	c->arg[0] = len;
+	clearCommandBuffer();
+	SendCommand(c);
+	return 0;
+}
+
 // by marshmellow - sim fsk data given clock, fcHigh, fcLow, invert 
 // - allow pull data from DemodBuffer
 int CmdLFfskSim(const char *Cmd)
@@ -566,20 +985,14 @@ int CmdLFfskSim(const char *Cmd)
 	if (fcHigh == 0) fcHigh = 10;
 	if (fcLow == 0) fcLow = 8;
 
-	uint16_t arg1, arg2;
-	arg1 = fcHigh << 8 | fcLow;
-	arg2 = invert << 8 | clk;
-	size_t size = DemodBufferLen;
-	if (size > USB_CMD_DATA_SIZE) {
-		PrintAndLog("DemodBuffer too long for current implementation - length: %d - max: %d", size, USB_CMD_DATA_SIZE);
-		size = USB_CMD_DATA_SIZE;
-	} 
-	UsbCommand c = {CMD_FSK_SIM_TAG, {arg1, arg2, size}};
-
-	memcpy(c.d.asBytes, DemodBuffer, size);
-	clearCommandBuffer();
-	SendCommand(&c);
-	return 0;
+	UsbCommand c = {CMD_SIMULATE_TAG_125K_COMPACT, {0, 0, 0}};
+	lfsim_desc_t *desc = (lfsim_desc_t *)c.d.asBytes;
+	desc->type = LFSIM_DESC_FSK;
+	desc->clk = clk;
+	desc->fcHigh = fcHigh;
+	desc->fcLow = fcLow;
+	desc->invert = invert;
+	return lfSimBits(&c, DemodBuffer, DemodBufferLen);
 }
 
 // by marshmellow - sim ask data given clock, invert, manchester or raw, separator 
@@ -660,20 +1073,17 @@ int CmdLFaskSim(const char *Cmd)
 	}
 	if (clk == 0) clk = 64;
 	if (encoding == 0) clk = clk/2; //askraw needs to double the clock speed
-	uint16_t arg1, arg2;
-	size_t size=DemodBufferLen;
-	arg1 = clk << 8 | encoding;
-	arg2 = invert << 8 | separator;
-	if (size > USB_CMD_DATA_SIZE) {
-		PrintAndLog("DemodBuffer too long for current implementation - length: %d - max: %d", size, USB_CMD_DATA_SIZE);
-		size = USB_CMD_DATA_SIZE;
-	}
-	UsbCommand c = {CMD_ASK_SIM_TAG, {arg1, arg2, size}};
-	PrintAndLog("preparing to sim ask data: %d bits", size);
-	memcpy(c.d.asBytes, DemodBuffer, size);
-	clearCommandBuffer();
-	SendCommand(&c);
-	return 0;
+	if (separator == 1 && encoding != LFSIM_ASK_MANCHESTER)
+		PrintAndLog("sorry but separator option not yet available");
+	UsbCommand c = {CMD_SIMULATE_TAG_125K_COMPACT, {0, 0, 0}};
+	lfsim_desc_t *desc = (lfsim_desc_t *)c.d.asBytes;
+	desc->type = LFSIM_DESC_ASK;
+	desc->clk = clk;
+	desc->encoding = encoding;
+	desc->invert = invert;
+	desc->separator = separator;
+	PrintAndLog("preparing to sim ask data: %d bits", DemodBufferLen);
+	return lfSimBits(&c, DemodBuffer, DemodBufferLen);
 }
 
 // by marshmellow - sim psk data given carrier, clock, invert 
@@ -768,23 +1178,398 @@ int CmdLFpskSim(const char *Cmd)
 			PrintAndLog("Sorry, PSK3 not yet available");
 		}
 	}
-	uint16_t arg1, arg2;
-	arg1 = clk << 8 | carrier;
-	arg2 = invert;
-	size_t size=DemodBufferLen;
-	if (size > USB_CMD_DATA_SIZE) {
-		PrintAndLog("DemodBuffer too long for current implementation - length: %d - max: %d", size, USB_CMD_DATA_SIZE);
-		size=USB_CMD_DATA_SIZE;
-	}
-	UsbCommand c = {CMD_PSK_SIM_TAG, {arg1, arg2, size}};
-	PrintAndLog("DEBUG: Sending DemodBuffer Length: %d", size);
-	memcpy(c.d.asBytes, DemodBuffer, size);
-	clearCommandBuffer();
-	SendCommand(&c);
-	
+	UsbCommand c = {CMD_SIMULATE_TAG_125K_COMPACT, {0, 0, 0}};
+	lfsim_desc_t *desc = (lfsim_desc_t *)c.d.asBytes;
+	desc->type = LFSIM_DESC_PSK;
+	desc->clk = clk;
+	desc->fcHigh = carrier;
+	desc->invert = invert;
+	PrintAndLog("DEBUG: Sending DemodBuffer Length: %d", DemodBufferLen);
+	return lfSimBits(&c, DemodBuffer, DemodBufferLen);
+}
+
+int usage_lf_synth(void)
+{
+	PrintAndLog("Usage: lf synth <ask|biphase|nrz|fsk|psk1|psk2> [c <clock>] [i] [H <fcHigh>] [L <fcLow>] [r <carrier>] [s]");
+	PrintAndLog("                [R <repeat>] [n <noise %%>] [D <drift %%>] [P <drift period>] [a <amplitude>] [C <clip>] [f <smooth>] [S <seed>] [d <hexdata>]");
+	PrintAndLog("Generates a LF capture into the graph buffer with the lf sim waveforms. Nothing is sent to the device.");
+	PrintAndLog("Options:        ");
+	PrintAndLog("       h              This help");
+	PrintAndLog("       c <clock>      Bit clock - default: 64 (fsk: 50, psk: 32)");
+	PrintAndLog("       i              invert data");
+	PrintAndLog("       H <fcHigh>     FSK larger field clock - default: 10");
+	PrintAndLog("       L <fcLow>      FSK smaller field clock - default: 8");
+	PrintAndLog("       r <carrier>    PSK carrier 2|4|8 - default: 2");
+	PrintAndLog("       s              add t55xx Sequence Terminator gap (ask)");
+	PrintAndLog("       R <repeat>     repeat data - default: fill the buffer with 40000 samples");
+	PrintAndLog("       n <noise>      peak noise, %% of amplitude - default: 0");
+	PrintAndLog("       D <drift>      peak DC drift, %% of amplitude - default: 0");
+	PrintAndLog("       P <period>     DC drift period, samples - default: 4096");
+	PrintAndLog("       a <amplitude>  signal amplitude, 1..127 - default: 100");
+	PrintAndLog("       C <clip>       clip level, 1..127 - default: no clipping");
+	PrintAndLog("       f <smooth>     antenna low pass, 0..7 - default: 1");
+	PrintAndLog("       S <seed>       noise seed - default: 1");
+	PrintAndLog("       d <hexdata>    Data as hex - omit to use DemodBuffer");
+	PrintAndLog("");
+	PrintAndLog("Samples:");
+	PrintAndLog("       lf synth ask c 32 d 1122334455 n 20");
+	PrintAndLog("       lf synth fsk c 50 H 10 L 8 d 0102030405 D 30 C 90");
 	return 0;
 }
 
+int usage_lf_synthbench(void)
+{
+	PrintAndLog("Usage: lf synthbench [t <trials>] [n <max noise %%>] [S <seed>]");
+	PrintAndLog("Demodulates synthetic captures for every modulation and clock at noise levels 0..max step 10%%.");
+	PrintAndLog("Prints the share of decoded frames and demod throughput.");
+	PrintAndLog("Options:        ");
+	PrintAndLog("       h              This help");
+	PrintAndLog("       t <trials>     frames per noise level - default: 20");
+	PrintAndLog("       n <noise>      max noise, %% of amplitude - default: 80");
+	PrintAndLog("       S <seed>       random seed - default: 1");
+	return 0;
+}
+
+// host side signal synthesizer with the device sim waveforms (common/lfsim.c)
+int CmdLFSynth(const char *Cmd)
+{
+	char modname[16] = {0};
+	lfsynth_mod_t modulation;
+	if (param_getchar(Cmd, 0) == 'h' || param_getstr(Cmd, 0, modname, sizeof(modname)) == 0 || !lfsynth_mod_from_name(modname, &modulation))
+		return usage_lf_synth();
+
+	lfsynth_t synth;
+	lfsynth_init(&synth, modulation);
+	uint32_t repeat = 0;
+	bool errors = false;
+	char hexData[64] = {0x00};
+	uint8_t data[255] = {0x00};
+	int dataLen = 0;
+	uint8_t cmdp = 1;
+	while(param_getchar(Cmd, cmdp) != 0x00 && !errors)
+	{
+		switch(param_getchar(Cmd, cmdp))
+		{
+		case 'h':
+			return usage_lf_synth();
+		case 'i':
+			synth.invert = 1;
+			cmdp++;
+			break;
+		case 's':
+			synth.separator = 1;
+			cmdp++;
+			break;
+		case 'c':
+			errors |= param_getdec(Cmd, cmdp+1, &synth.clk);
+			cmdp+=2;
+			break;
+		case 'H':
+			errors |= param_getdec(Cmd, cmdp+1, &synth.fcHigh);
+			cmdp+=2;
+			break;
+		case 'L':
+			errors |= param_getdec(Cmd, cmdp+1, &synth.fcLow);
+			cmdp+=2;
+			break;
+		case 'r':
+			errors |= param_getdec(Cmd, cmdp+1, &synth.carrier);
+			cmdp+=2;
+			break;
+		case 'f':
+			errors |= param_getdec(Cmd, cmdp+1, &synth.smooth);
+			cmdp+=2;
+			break;
+		case 'R':
+			repeat = param_get32ex(Cmd, cmdp+1, 0, 10);
+			cmdp+=2;
+			break;
+		case 'n':
+			synth.noise = param_get32ex(Cmd, cmdp+1, 0, 10);
+			cmdp+=2;
+			break;
+		case 'D':
+			synth.drift = param_get32ex(Cmd, cmdp+1, 0, 10);
+			cmdp+=2;
+			break;
+		case 'P':
+			synth.driftPeriod = param_get32ex(Cmd, cmdp+1, 4096, 10);
+			cmdp+=2;
+			break;
+		case 'a':
+			synth.amplitude = param_get32ex(Cmd, cmdp+1, 100, 10);
+			cmdp+=2;
+			break;
+		case 'C':
+			synth.clip = param_get32ex(Cmd, cmdp+1, 0, 10);
+			cmdp+=2;
+			break;
+		case 'S':
+			synth.seed = param_get32ex(Cmd, cmdp+1, 1, 10);
+			cmdp+=2;
+			break;
+		case 'd':
+			dataLen = param_getstr(Cmd, cmdp+1, hexData, sizeof(hexData));
+			if (dataLen==0) {
+				errors=true;
+			} else {
+				dataLen = hextobinarray((char *)data, hexData);
+			}
+			if (dataLen==0) errors=true;
+			if (errors) PrintAndLog ("Error getting hex data");
+			cmdp+=2;
+			break;
+		default:
+			PrintAndLog("Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+			errors = true;
+			break;
+		}
+	}
+
+	if (synth.clk == 0 || synth.fcHigh == 0 || synth.fcLow == 0 || synth.carrier == 0 || synth.smooth > 7 || synth.amplitude < 1 || synth.amplitude > 127)
+		errors = true;
+	if (dataLen == 0 && DemodBufferLen == 0) {
+		PrintAndLog("No data. Use d <hexdata> or demodulate something first");
+		errors = true;
+	}
+	if (errors)
+		return usage_lf_synth();
+
+	if (dataLen == 0) {
+		dataLen = DemodBufferLen > sizeof(data) ? sizeof(data) : DemodBufferLen;
+		memcpy(data, DemodBuffer, dataLen);
+	}
+
+	// default: as much as lf read gets. bits not fitting the graph buffer are dropped by the generator
+	uint32_t maxRepeat = MAX_GRAPH_TRACE_LEN / (dataLen * synth.clk) + 1;
+	if (repeat == 0)
+		repeat = 40000 / (dataLen * synth.clk);
+	if (repeat == 0)
+		repeat = 1;
+	if (repeat > maxRepeat)
+		repeat = maxRepeat;
+
+	uint8_t *bits = malloc(repeat * dataLen);
+	if (!bits) {
+		PrintAndLog("Cannot allocate memory");
+		return 1;
+	}
+	for (size_t i = 0; i < repeat; i++)
+		memcpy(&bits[i * dataLen], data, dataLen);
+
+	GraphTraceLen = lfsynth_generate(&synth, bits, repeat * dataLen, GraphBuffer, MAX_GRAPH_TRACE_LEN);
+	free(bits);
+
+	PrintAndLog("Generated %s, clk %d, %d bits x %u: %d samples", lfsynth_mod_name(modulation), synth.clk, dataLen, repeat, GraphTraceLen);
+	setClockGrid(0, 0);
+	DemodBufferLen = 0;
+	RepaintGraphWindow();
+	return 0;
+}
+
+int CmdLFSynthBench(const char *Cmd)
+{
+	int trials = 20, maxNoise = 80;
+	uint32_t seed = 1;
+	bool errors = false;
+	uint8_t cmdp = 0;
+	while(param_getchar(Cmd, cmdp) != 0x00 && !errors)
+	{
+		switch(param_getchar(Cmd, cmdp))
+		{
+		case 'h':
+			return usage_lf_synthbench();
+		case 't':
+			trials = param_get32ex(Cmd, cmdp+1, 20, 10);
+			cmdp+=2;
+			break;
+		case 'n':
+			maxNoise = param_get32ex(Cmd, cmdp+1, 80, 10);
+			cmdp+=2;
+			break;
+		case 'S':
+			seed = param_get32ex(Cmd, cmdp+1, 1, 10);
+			cmdp+=2;
+			break;
+		default:
+			PrintAndLog("Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+			errors = true;
+			break;
+		}
+	}
+	if (errors || trials < 1 || maxNoise < 0 || maxNoise > 200)
+		return usage_lf_synthbench();
+
+	int res = lfsynth_bench(trials, maxNoise, seed);
+	if (res > 0)
+		PrintAndLog("%d configurations fail on a clean signal", res);
+	return 0;
+}
+
+int usage_lf_simtest(void)
+{
+	PrintAndLog("Usage: lf simtest [t <trials>] [S <seed>]");
+	PrintAndLog("Checks the compact sim descriptions the device expands (common/lfsim.c) against the");
+	PrintAndLog("whole ASK/FSK/PSK sim waveforms and run length encoded captures. Nothing is sent to the device.");
+	PrintAndLog("Options:        ");
+	PrintAndLog("       h              This help");
+	PrintAndLog("       t <trials>     random sequences - default: 2000");
+	PrintAndLog("       S <seed>       random seed - default: 1");
+	return 0;
+}
+
+static uint32_t simtest_rand(uint32_t *state)
+{
+	// xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// two periods sample by sample, the end is flagged on the last sample of each
+static bool simtest_periods(const lfsim_desc_t *desc, size_t len, const uint8_t *wave, size_t n)
+{
+	static lfsim_expander_t e;
+	if (!lfsimExpanderInit(&e, desc, len))
+		return false;
+	for (size_t i = 0; i < 2 * n; i++) {
+		uint8_t sample = lfsimExpanderNext(&e);
+		if ((sample & 1) != wave[i % n] || !(sample & LFSIM_PERIOD_END) != (i % n != n - 1))
+			return false;
+	}
+	return true;
+}
+
+int CmdLFSimTest(const char *Cmd)
+{
+	static const uint8_t askClocks[] = {8, 16, 32, 40, 50, 64, 100, 128};
+	static const uint8_t fskModes[][3] = {{50, 10, 8}, {40, 10, 8}, {64, 10, 8}, {50, 8, 5}, {100, 10, 8}};
+	static const uint8_t pskClocks[] = {16, 32, 64};
+	static const uint8_t carriers[] = {2, 4, 8};
+	const size_t maxlen = 1 << 18;
+	int trials = 2000, errors = 0;
+	uint32_t seed = 1;
+	uint8_t cmdp = 0;
+	while(param_getchar(Cmd, cmdp) != 0x00)
+	{
+		switch(param_getchar(Cmd, cmdp))
+		{
+		case 'h':
+			return usage_lf_simtest();
+		case 't':
+			trials = param_get32ex(Cmd, cmdp+1, 2000, 10);
+			cmdp+=2;
+			break;
+		case 'S':
+			seed = param_get32ex(Cmd, cmdp+1, 1, 10);
+			cmdp+=2;
+			break;
+		default:
+			PrintAndLog("Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+			return usage_lf_simtest();
+		}
+	}
+	if (seed == 0) seed = 1;
+
+	uint8_t *bits = malloc(maxlen);
+	uint8_t *ref = malloc(maxlen);
+	uint8_t *got = malloc(maxlen);
+	uint8_t *frame = malloc(maxlen);
+	if (!bits || !ref || !got || !frame) {
+		PrintAndLog("Failed to allocate memory");
+		free(bits); free(ref); free(got); free(frame);
+		return 1;
+	}
+
+	// bit descriptions against the waveforms the sim commands used to upload
+	uint64_t samples = 0, bytes = 0;
+	lfsim_desc_t *desc = (lfsim_desc_t *)frame;
+	for (int t = 0; t < trials && errors < 10; t++) {
+		size_t size = 1 + simtest_rand(&seed) % 300;
+		for (size_t i = 0; i < size; i++)
+			bits[i] = simtest_rand(&seed) & 1;
+		memset(desc, 0, sizeof(lfsim_desc_t));
+		desc->type = t % 3;
+		desc->invert = simtest_rand(&seed) & 1;
+		size_t n = 0;
+		switch (desc->type) {
+			case LFSIM_DESC_ASK:
+				desc->clk = askClocks[simtest_rand(&seed) % sizeof(askClocks)];
+				desc->encoding = simtest_rand(&seed) % 4;
+				desc->separator = simtest_rand(&seed) & 1;
+				n = askSimWave(ref, maxlen, bits, size, desc->clk, desc->encoding, desc->invert, desc->separator);
+				break;
+			case LFSIM_DESC_FSK: {
+				const uint8_t *mode = fskModes[simtest_rand(&seed) % (sizeof(fskModes) / sizeof(fskModes[0]))];
+				desc->clk = mode[0];
+				desc->fcHigh = mode[1];
+				desc->fcLow = mode[2];
+				n = fskSimWave(ref, maxlen, bits, size, desc->fcHigh, desc->fcLow, desc->clk, desc->invert);
+				break;
+			}
+			case LFSIM_DESC_PSK:
+				desc->clk = pskClocks[simtest_rand(&seed) % sizeof(pskClocks)];
+				desc->fcHigh = carriers[simtest_rand(&seed) % sizeof(carriers)];
+				n = pskSimWave(ref, maxlen, bits, size, desc->fcHigh, desc->clk, desc->invert);
+				break;
+		}
+		size_t len = lfsimDescBits(desc, USB_CMD_DATA_SIZE, bits, size);
+		size_t m = lfsimExpand(desc, len, got, maxlen);
+		if (len == 0 || m != n || memcmp(ref, got, n) || !simtest_periods(desc, len, ref, n)) {
+			PrintAndLog("type %d clk %d encoding %d invert %d: %d bits, %d samples expected, %d expanded",
+				desc->type, desc->clk, desc->encoding, desc->invert, size, n, m);
+			errors++;
+		}
+		samples += n;
+		bytes += len;
+	}
+	PrintAndLog("bits: %d sequences, %" PRIu64 " samples in %" PRIu64 " bytes of descriptions", trials, samples, bytes);
+
+	// run length encoded captures, some runs longer than one run byte pair
+	samples = 0;
+	bytes = 0;
+	for (int t = 0; t < trials / 10 && errors < 10; t++) {
+		size_t n = 0;
+		uint8_t level = simtest_rand(&seed) & 1;
+		size_t size = 1 + simtest_rand(&seed) % (maxlen / 4);
+		while (n < size) {
+			size_t run = (simtest_rand(&seed) % 16) ? 1 + simtest_rand(&seed) % 300 : 1 + simtest_rand(&seed) % 70000;
+			for (size_t i = 0; i < run && n < size; i++)
+				ref[n++] = level;
+			level ^= 1;
+		}
+		size_t len = lfsimDescRle(desc, maxlen, ref, n);
+		size_t m = lfsimExpand(desc, len, got, maxlen);
+		if (len == 0 || m != n || memcmp(ref, got, n) || !simtest_periods(desc, len, ref, n)) {
+			PrintAndLog("rle: %d samples in %d bytes, %d expanded", n, len, m);
+			errors++;
+		}
+		samples += n;
+		bytes += len;
+	}
+	PrintAndLog("rle: %d captures, %" PRIu64 " samples in %" PRIu64 " bytes", trials / 10, samples, bytes);
+
+	// what fits a frame: an EM410x as lf sim sends it
+	memset(bits, 0, 64);
+	memset(bits, 1, 9);
+	size_t n = askSimWave(ref, maxlen, bits, 64, 64, LFSIM_ASK_MANCHESTER, 0, 0);
+	size_t len = lfsimDescRle(desc, USB_CMD_DATA_SIZE, ref, n);
+	PrintAndLog("em410x: %d samples in %d bytes run length encoded, %d bytes as bits", n, len, sizeof(lfsim_desc_t) + 8);
+
+	free(bits);
+	free(ref);
+	free(got);
+	free(frame);
+	if (errors)
+		PrintAndLog("Test(s) [ ERROR ] %d mismatch(es)", errors);
+	else
+		PrintAndLog("Test(s) [ OK ]");
+	return errors;
+}
+
 int CmdLFSimBidir(const char *Cmd)
 {
 	// Set ADC to twice the carrier for a slight supersampling
@@ -1131,8 +1916,13 @@ static command_t CommandTable[] =
 	{"simfsk",      CmdLFfskSim,        0, "[c <clock>] [i] [H <fcHigh>] [L <fcLow>] [d <hexdata>] -- Simulate LF FSK tag from demodbuffer or input"},
 	{"simpsk",      CmdLFpskSim,        0, "[1|2|3] [c <clock>] [i] [r <carrier>] [d <raw hex to sim>] -- Simulate LF PSK tag from demodbuffer or input"},
 	{"simbidir",    CmdLFSimBidir,      0, "Simulate LF tag (with bidirectional data transmission between reader and tag)"},
+	{"synth",       CmdLFSynth,         1, "<ask|biphase|nrz|fsk|psk1|psk2> [c <clock>] [n <noise>] [d <hexdata>] -- Generate a capture with the sim waveforms and a noise model"},
+	{"synthbench",  CmdLFSynthBench,    1, "[t <trials>] [n <max noise>] -- Demod success rate and throughput on synthetic captures"},
+	{"simtest",     CmdLFSimTest,       1, "[t <trials>] -- Test the compact sim descriptions offline"},
 	{"snoop",       CmdLFSnoop,         0, "['l'|'h'|<divisor>] [trigger threshold]-- Snoop LF (l:125khz, h:134khz)"},
+	{"stream",      CmdLFStream,        0, "['s' snoop] [n <samples>] [f <file>] -- Stream LF samples without the device memory limit"},
 	{"vchdemod",    CmdVchDemod,        1, "['clone'] -- Demodulate samples for VeriChip"},
+	{"watch",       CmdLFWatch,         1, "[1] [p <protocols>] ['g' graph] -- Watch for HID, AWID, ioProx and EM410x tags at once"},
 	{NULL, NULL, 0, NULL}
 };
 
@@ -26,7 +26,12 @@ extern int CmdLFaskSim(const char *Cmd);
 extern int CmdLFfskSim(const char *Cmd);
 extern int CmdLFpskSim(const char *Cmd);
 extern int CmdLFSimBidir(const char *Cmd);
+extern int CmdLFSynth(const char *Cmd);
+extern int CmdLFSynthBench(const char *Cmd);
+extern int CmdLFSimTest(const char *Cmd);
 extern int CmdLFSnoop(const char *Cmd);
+extern int CmdLFStream(const char *Cmd);
+extern int CmdLFWatch(const char *Cmd);
 extern int CmdVchDemod(const char *Cmd);
 extern int CmdLFfind(const char *Cmd);
 extern bool lf_read(bool silent, uint32_t samples);
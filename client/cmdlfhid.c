@@ -22,6 +22,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
 #include "comms.h"
 #include "ui.h"
 #include "graph.h"
@@ -31,6 +33,7 @@
 #include "hidcardformats.h"
 #include "hidcardformatutils.h"
 #include "util.h" // for param_get8,32,64
+#include "cmdlft55xx.h" // for bulk cloning
 
 
 /**
@@ -270,6 +273,91 @@ int CmdHIDWrite(const char *Cmd) {
   return 0;
 }
 
+static void usage_bulk(){
+  PrintAndLog("Usage:  lf hid bulk <format> [f <facility>] c <first card number> n <count> [w]");
+  PrintAndLog("   Programs T55x7 cards with consecutive card numbers, one after the other.");
+  PrintAndLog("   The device waits for every card, writes it and reads it back (see lf t55xx bulk).");
+  PrintAndLog("   w: write only, no read back");
+  PrintAndLog("   example: lf hid bulk H10301 f 1 c 1000 n 10");
+}
+
+// the same blocks CopyHIDtoT55x7 writes on the device
+static bool HIDCloneBlocks(hidproxmessage_t *packed, t55xx_clone_card_t *card){
+  bool longFMT = (packed->top != 0 && ((packed->mid & 0xFFFFFFC0) != 0));
+  memset(card, 0, sizeof(t55xx_clone_card_t));
+  card->numblocks = HIDtoT55x7Blocks(packed->top & 0x000FFFFF, packed->mid, packed->bot, longFMT, 0x1D, card->blocks);
+  return card->numblocks != 0;
+}
+
+int CmdHIDBulk(const char *Cmd){
+  char format[16];
+  memset(format, 0, sizeof(format));
+  param_getstr(Cmd, 0, format, sizeof(format));
+  int formatIndex = HIDFindCardFormat(format);
+  if (formatIndex == -1) {
+    usage_bulk();
+    return 0;
+  }
+
+  hidproxcard_t data;
+  memset(&data, 0, sizeof(hidproxcard_t));
+  uint32_t count = 0;
+  uint8_t flags = 0;
+  uint8_t cmdp = 1;
+  while(param_getchar(Cmd, cmdp) != 0x00) {
+    switch(param_getchar(Cmd, cmdp)) {
+      case 'F':
+      case 'f':
+        data.FacilityCode = param_get32ex(Cmd, cmdp+1, 0, 10);
+        cmdp += 2;
+        break;
+      case 'C':
+      case 'c':
+        data.CardNumber = param_get64ex(Cmd, cmdp+1, 0, 10);
+        cmdp += 2;
+        break;
+      case 'N':
+      case 'n':
+        count = param_get32ex(Cmd, cmdp+1, 0, 10);
+        cmdp += 2;
+        break;
+      case 'W':
+      case 'w':
+        flags |= T55XX_CLONE_NOVERIFY;
+        cmdp++;
+        break;
+      default:
+        PrintAndLog("Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+        usage_bulk();
+        return 0;
+    }
+  }
+  if (count == 0) {
+    usage_bulk();
+    return 0;
+  }
+
+  t55xx_clone_card_t *cards = calloc(count, sizeof(t55xx_clone_card_t));
+  if (!cards) {
+    PrintAndLog("Cannot allocate memory for the cards");
+    return 0;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    hidproxmessage_t packed;
+    memset(&packed, 0, sizeof(hidproxmessage_t));
+    if (!HIDPack(formatIndex, &data, &packed) || !HIDCloneBlocks(&packed, &cards[i])) {
+      PrintAndLog("Card number %" PRIu64 " could not be encoded in the selected format.", data.CardNumber);
+      free(cards);
+      return 0;
+    }
+    data.CardNumber++;
+  }
+  PrintAndLog("Cards %" PRIu64 " to %" PRIu64 ", facility %u", data.CardNumber - count, data.CardNumber - 1, data.FacilityCode);
+  t55xxCloneCards(cards, count, flags);
+  free(cards);
+  return 0;
+}
+
 int CmdHIDFormats(){
   HIDListFormats();
   return 0;
@@ -286,6 +374,7 @@ static command_t CommandTable[] =
   {"encode",    CmdHIDEncode,   1, "<format> <fields> -- Encode an HID ID with the specified format and fields"},
   {"formats",   CmdHIDFormats,  1, "List supported card formats"},
   {"write",     CmdHIDWrite,    0, "<format> <fields> -- Encode and write to a T55x7 tag (tag must be in antenna)"},
+  {"bulk",      CmdHIDBulk,     0, "<format> f <facility> c <first card> n <count> -- Write consecutive card numbers to T55x7 tags, read back on the device"},
   {NULL, NULL, 0, NULL}
 };
 
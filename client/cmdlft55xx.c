@@ -10,6 +10,7 @@
 #include "cmdlft55xx.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include <ctype.h>
@@ -195,6 +196,25 @@ int usage_t55xx_wipe(){
 	return 0;
 }
 
+int usage_t55xx_bulk(){
+	PrintAndLog("Usage:  lf t55xx bulk [h] f <filename> [n]");
+	PrintAndLog("Programs a batch of cards. The device waits for every card, writes it and reads it back.");
+	PrintAndLog("Take the card off the antenna after its result, then place the next one.");
+	PrintAndLog("Options:");
+	PrintAndLog("     h            - this help");
+	PrintAndLog("     f <filename> - one card per line, block 0 first: <block0> <block1> ... (hex, up to 8 blocks)");
+	PrintAndLog("                    lines starting with # are comments");
+	PrintAndLog("     n            - no read back");
+	PrintAndLog("");
+	PrintAndLog("The read back compares blocks 1..max block with the stream the card sends in the new configuration.");
+	PrintAndLog("Cards with AOR, sequence terminator, extended mode, PSK3 or biphase a are written without it.");
+	PrintAndLog("");
+	PrintAndLog("Examples:");
+	PrintAndLog("      lf t55xx bulk f hid.txt  - hid.txt line: 00107060 1D555955 55695559 556AA656");
+	PrintAndLog("      lf hid bulk H10301 f 1 c 1000 n 10   - generates the cards");
+	return 0;
+}
+
 
 static int CmdHelp(const char *Cmd);
 
@@ -502,162 +522,185 @@ int CmdT55xxDetect(const char *Cmd){
 }
 
 // detect configuration?
-bool tryDetectModulation(){
+// Every modulation family is demodulated once from a copy of the samples and the inverted
+// hypotheses are scored on the complement of the same bits. GraphBuffer is not modified.
+#define T55XX_DETECT_STREAMS    11    // fsk, ask, biphase, nrz, psk1 (+ inverted), psk2
+#define T55XX_PSK_SETTLE        160   // skip first samples to allow antenna to settle in (psk gets inverted occasionally otherwise)
+#define T55XX_SCORE_REPEAT      16    // per block0 seen in the capture
+#define T55XX_SCORE_ERROR       1     // per demod error
+
+// how often the block0 pattern shows up. Bits marked as demod errors (7) never match.
+static uint8_t countBlock0(uint8_t *bits, size_t len, uint32_t block0) {
+	uint32_t word = 0;
+	uint8_t valid = 0, cnt = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (bits[i] > 1) {
+			valid = 0;
+			continue;
+		}
+		word = (word << 1) | bits[i];
+		if (valid < 32) valid++;
+		if (valid == 32 && word == block0 && cnt < 0xFF) cnt++;
+	}
+	return cnt;
+}
+
+static void addCandidate(t55xx_detect_t *cands, uint8_t *hits, uint8_t *bits, size_t len, int errCnt, uint8_t mode, uint8_t modulation, bool inverted, bool st, uint8_t clk) {
+	if (*hits >= T55XX_DETECT_MAX) return;
+
+	t55xx_detect_t *c = &cands[*hits];
+	memset(c, 0, sizeof(t55xx_detect_t));
+	int bitRate = 0;
+	if (!testBits(bits, len, mode, &c->conf.offset, &bitRate, clk, &c->conf.Q5)) return;
+
+	c->conf.modulation = modulation;
+	c->conf.bitrate = bitRate;
+	c->conf.inverted = inverted;
+	c->conf.block0 = PackBits(c->conf.offset, 32, bits);
+	c->conf.ST = st;
+	c->repeats = countBlock0(bits, len, c->conf.block0);
+	c->errCnt = errCnt;
+	c->score = c->repeats * T55XX_SCORE_REPEAT - errCnt * T55XX_SCORE_ERROR;
+	c->stream = bits;
+	c->len = len;
+	++*hits;
+}
+
+// scores bits and their complement (written to inv). Demod errors are kept as they are.
+static void addCandidatePair(t55xx_detect_t *cands, uint8_t *hits, uint8_t *bits, uint8_t *inv, size_t len, int errCnt, bool st, uint8_t clk, uint8_t mode, uint8_t modulation, uint8_t modeInv, uint8_t modulationInv) {
+	for (size_t i = 0; i < len; i++)
+		inv[i] = (bits[i] > 1) ? bits[i] : bits[i] ^ 1;
+
+	addCandidate(cands, hits, bits, len, errCnt, mode, modulation, false, st, clk);
+	addCandidate(cands, hits, inv, len, errCnt, modeInv, modulationInv, true, st, clk);
+}
+
+static int compareCandidates(const void *a, const void *b) {
+	const t55xx_detect_t *ca = a, *cb = b;
+	return cb->score - ca->score;
+}
+
+// Fills cands (T55XX_DETECT_MAX entries) with every (modulation, bitrate, inverted, offset, Q5/ST)
+// hypothesis that decodes to a valid block0, best first. The bits of the best one go to DemodBuffer.
+// returns number of candidates
+uint8_t tryDetectModulationRanked(t55xx_detect_t *cands) {
 	uint8_t hits = 0;
-	t55xx_conf_block_t tests[15];
-	int bitRate=0;
-	uint8_t fc1 = 0, fc2 = 0, ans = 0;
-	int clk = 0, firstClockEdge = 0;
-	ans = fskClocks(&fc1, &fc2, (uint8_t *)&clk, false, &firstClockEdge);
+	size_t size = GraphTraceLen;
+	if (size < 255) return 0;
+
+	uint8_t *samples = calloc(size * (T55XX_DETECT_STREAMS + 1), sizeof(uint8_t));
+	if (!samples) {
+		PrintAndLog("Cannot allocate memory for the demodulation");
+		return 0;
+	}
+	uint8_t *streams[T55XX_DETECT_STREAMS];
+	for (int i = 0; i < T55XX_DETECT_STREAMS; i++)
+		streams[i] = samples + size * (i + 1);
+	size = getFromGraphBuf(samples);
+
+	size_t len;
+	int errCnt, invert, startIdx;
+	uint8_t fc1 = 0, fc2 = 0, rf = 0;
+	int firstClockEdge = 0;
+	uint8_t ans = fskClocks(&fc1, &fc2, &rf, false, &firstClockEdge);
 	if (ans && ((fc1==10 && fc2==8) || (fc1==8 && fc2==5))) {
-		if ( FSKrawDemod("0 0", false) && test(DEMOD_FSK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-			tests[hits].modulation = DEMOD_FSK;
-			if (fc1==8 && fc2 == 5)
-				tests[hits].modulation = DEMOD_FSK1a;
- 			else if (fc1==10 && fc2 == 8)
-				tests[hits].modulation = DEMOD_FSK2;
-			tests[hits].bitrate = bitRate;
-			tests[hits].inverted = false;
-			tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-			tests[hits].ST = false;
-			++hits;
-		}
-		if ( FSKrawDemod("0 1", false) && test(DEMOD_FSK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-			tests[hits].modulation = DEMOD_FSK;
-			if (fc1 == 8 && fc2 == 5)
-				tests[hits].modulation = DEMOD_FSK1;
-			else if (fc1 == 10 && fc2 == 8)
-				tests[hits].modulation = DEMOD_FSK2a;
-			tests[hits].bitrate = bitRate;
-			tests[hits].inverted = true;
-			tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-			tests[hits].ST = false;
-			++hits;
+		memcpy(streams[0], samples, size);
+		int n = fskdemod(streams[0], size, rf, 0, fc1, fc2, &startIdx);
+		if (n > 0) {
+			bool fsk1 = (fc1 == 8 && fc2 == 5);
+			addCandidatePair(cands, &hits, streams[0], streams[1], n, 0, false, rf,
+				DEMOD_FSK, fsk1 ? DEMOD_FSK1a : DEMOD_FSK2,
+				DEMOD_FSK, fsk1 ? DEMOD_FSK1 : DEMOD_FSK2a);
 		}
 	} else {
-		clk = GetAskClock("", false, false);
-		if (clk>0) {
-			tests[hits].ST = true;
-			if ( ASKDemod_ext("0 0 1", false, false, 1, &tests[hits].ST) && test(DEMOD_ASK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-				tests[hits].modulation = DEMOD_ASK;
-				tests[hits].bitrate = bitRate;
-				tests[hits].inverted = false;
-				tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-				++hits;
-			}
-			tests[hits].ST = true;
-			if ( ASKDemod_ext("0 1 1", false, false, 1, &tests[hits].ST)  && test(DEMOD_ASK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-				tests[hits].modulation = DEMOD_ASK;
-				tests[hits].bitrate = bitRate;
-				tests[hits].inverted = true;
-				tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-				++hits;
-			}
-			if ( ASKbiphaseDemod("0 0 0 2", false) && test(DEMOD_BI, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5) ) {
-				tests[hits].modulation = DEMOD_BI;
-				tests[hits].bitrate = bitRate;
-				tests[hits].inverted = false;
-				tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-				tests[hits].ST = false;
-				++hits;
-			}
-			if ( ASKbiphaseDemod("0 0 1 2", false) && test(DEMOD_BIa, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5) ) {
-				tests[hits].modulation = DEMOD_BIa;
-				tests[hits].bitrate = bitRate;
-				tests[hits].inverted = true;
-				tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-				tests[hits].ST = false;
-				++hits;
+		int clk = GetAskClock("", false, false);
+		if (clk > 0) {
+			// manchester. The sequence terminator is cut from the samples first.
+			len = size;
+			memcpy(streams[2], samples, len);
+			int stClk = 0;
+			size_t ststart = 0, stend = 0;
+			bool st = DetectST(streams[2], &len, &stClk, &ststart, &stend);
+			int askClk = st ? stClk : clk;
+			invert = 0;
+			errCnt = askdemod_ext(streams[2], &len, &askClk, &invert, 1, 0, 1, &startIdx);
+			if (errCnt >= 0 && errCnt <= 1 && len >= 16)
+				addCandidatePair(cands, &hits, streams[2], streams[3], len, errCnt, st, clk, DEMOD_ASK, DEMOD_ASK, DEMOD_ASK, DEMOD_ASK);
+
+			// biphase, decoded from the raw ask bits
+			len = size;
+			memcpy(streams[4], samples, len);
+			askClk = clk;
+			invert = 0;
+			errCnt = askdemod_ext(streams[4], &len, &askClk, &invert, 2, 0, 0, &startIdx);
+			if (errCnt >= 0 && errCnt <= 2) {
+				int offset = 0;
+				int biErrCnt = BiphaseRawDecode(streams[4], &len, &offset, 0);
+				if (biErrCnt >= 0 && biErrCnt <= 2)
+					addCandidatePair(cands, &hits, streams[4], streams[5], len, errCnt + biErrCnt, false, clk, DEMOD_BI, DEMOD_BI, DEMOD_BIa, DEMOD_BIa);
 			}
 		}
-		clk = GetNrzClock("", false, false);
-		if (clk>8) { //clock of rf/8 is likely a false positive, so don't use it.
-			if ( NRZrawDemod("0 0 1", false)  && test(DEMOD_NRZ, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-				tests[hits].modulation = DEMOD_NRZ;
-				tests[hits].bitrate = bitRate;
-				tests[hits].inverted = false;
-				tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-				tests[hits].ST = false;
-				++hits;
-			}
 
-			if ( NRZrawDemod("0 1 1", false)  && test(DEMOD_NRZ, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-				tests[hits].modulation = DEMOD_NRZ;
-				tests[hits].bitrate = bitRate;
-				tests[hits].inverted = true;
-				tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-				tests[hits].ST = false;
-				++hits;
-			}
+		clk = GetNrzClock("", false, false);
+		if (clk > 8) { //clock of rf/8 is likely a false positive, so don't use it.
+			len = size;
+			memcpy(streams[6], samples, len);
+			int nrzClk = clk;
+			invert = 0;
+			errCnt = nrzRawDemod(streams[6], &len, &nrzClk, &invert, &startIdx);
+			if (errCnt >= 0 && errCnt <= 1 && len >= 16)
+				addCandidatePair(cands, &hits, streams[6], streams[7], len, errCnt, false, clk, DEMOD_NRZ, DEMOD_NRZ, DEMOD_NRZ, DEMOD_NRZ);
 		}
-		
+
 		clk = GetPskClock("", false, false);
-		if (clk>0) {
-			// allow undo
-			save_restoreGB(GRAPH_SAVE);
-			// skip first 160 samples to allow antenna to settle in (psk gets inverted occasionally otherwise)
-			CmdLtrim("160");
-			if ( PSKDemod("0 0 6", false) && test(DEMOD_PSK1, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-				tests[hits].modulation = DEMOD_PSK1;
-				tests[hits].bitrate = bitRate;
-				tests[hits].inverted = false;
-				tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-				tests[hits].ST = false;
-				++hits;
+		if (clk > 0 && size > T55XX_PSK_SETTLE) {
+			len = size - T55XX_PSK_SETTLE;
+			memcpy(streams[8], samples + T55XX_PSK_SETTLE, len);
+			int pskClk = clk;
+			invert = 0;
+			errCnt = pskRawDemod_ext(streams[8], &len, &pskClk, &invert, &startIdx);
+			if (errCnt >= 0 && errCnt <= 6 && len >= 16) {
+				addCandidatePair(cands, &hits, streams[8], streams[9], len, errCnt, false, clk, DEMOD_PSK1, DEMOD_PSK1, DEMOD_PSK1, DEMOD_PSK1);
+				// PSK2 and PSK3 are the same bits. Inverse waves does not affect this demod.
+				memcpy(streams[10], streams[8], len);
+				psk1TOpsk2(streams[10], len);
+				addCandidate(cands, &hits, streams[10], len, errCnt, DEMOD_PSK2, DEMOD_PSK2, false, false, clk);
+				addCandidate(cands, &hits, streams[10], len, errCnt, DEMOD_PSK3, DEMOD_PSK3, false, false, clk);
 			}
-			if ( PSKDemod("0 1 6", false) && test(DEMOD_PSK1, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-				tests[hits].modulation = DEMOD_PSK1;
-				tests[hits].bitrate = bitRate;
-				tests[hits].inverted = true;
-				tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-				tests[hits].ST = false;
-				++hits;
-			}
-			// PSK2 - needs a call to psk1TOpsk2.
-			if ( PSKDemod("0 0 6", false)) {
-				psk1TOpsk2(DemodBuffer, DemodBufferLen);
-				if (test(DEMOD_PSK2, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)){
-					tests[hits].modulation = DEMOD_PSK2;
-					tests[hits].bitrate = bitRate;
-					tests[hits].inverted = false;
-					tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-					tests[hits].ST = false;
-					++hits;
-				}
-			} // inverse waves does not affect this demod
-			// PSK3 - needs a call to psk1TOpsk2.
-			if ( PSKDemod("0 0 6", false)) {
-				psk1TOpsk2(DemodBuffer, DemodBufferLen);
-				if (test(DEMOD_PSK3, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)){
-					tests[hits].modulation = DEMOD_PSK3;
-					tests[hits].bitrate = bitRate;
-					tests[hits].inverted = false;
-					tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-					tests[hits].ST = false;
-					++hits;
-				}
-			} // inverse waves does not affect this demod
-			//undo trim samples
-			save_restoreGB(GRAPH_RESTORE);
 		}
-	}	
-	if ( hits == 1) {
-		config.modulation = tests[0].modulation;
-		config.bitrate = tests[0].bitrate;
-		config.inverted = tests[0].inverted;
-		config.offset = tests[0].offset;
-		config.block0 = tests[0].block0;
-		config.Q5 = tests[0].Q5;
-		config.ST = tests[0].ST;
+	}
+
+	qsort(cands, hits, sizeof(t55xx_detect_t), compareCandidates);
+	if (hits)
+		setDemodBuf(cands[0].stream, cands[0].len, 0);
+	for (int i = 0; i < hits; i++) {
+		cands[i].stream = NULL;
+		cands[i].len = 0;
+	}
+
+	free(samples);
+	return hits;
+}
+
+bool tryDetectModulation(){
+	t55xx_detect_t cands[T55XX_DETECT_MAX];
+	uint8_t hits = tryDetectModulationRanked(cands);
+
+	// more than one hit - take the best if it is clearly ahead and seen more than once
+	bool confident = (hits == 1) || (hits > 1 && cands[0].repeats > 1 && cands[0].score > cands[1].score);
+	if (confident) {
+		config = cands[0].conf;
 		printConfiguration( config );
+		if (hits > 1)
+			PrintAndLog("Picked from [%d] possible matches (score %d, next best %d).", hits, cands[0].score, cands[1].score);
 		return true;
 	}
-	
+
 	if ( hits > 1) {
 		PrintAndLog("Found [%d] possible matches for modulation.",hits);
 		for(int i=0; i<hits; ++i){
-			PrintAndLog("--[%d]---------------", i+1);
-			printConfiguration( tests[i] );
+			PrintAndLog("--[%d]--- score %d, block0 seen %d times, %d demod errors", i+1, cands[i].score, cands[i].repeats, cands[i].errCnt);
+			printConfiguration( cands[i].conf );
 		}
 	}
 	return false;
@@ -733,33 +776,33 @@ int convertQ5bitRate(uint8_t bitRateRead) {
 	return -1;
 }
 
-bool testQ5(uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t	clk){
+bool testQ5(uint8_t *bits, size_t len, uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t	clk){
 
-	if ( DemodBufferLen < 64 ) return false;
+	if ( len < 64 ) return false;
 	uint8_t si = 0;
 	for (uint8_t idx = 28; idx < 64; idx++){
 		si = idx;
-		if ( PackBits(si, 28, DemodBuffer) == 0x00 ) continue;
+		if ( PackBits(si, 28, bits) == 0x00 ) continue;
 
-		uint8_t safer     = PackBits(si, 4, DemodBuffer); si += 4;     //master key
-		uint8_t resv      = PackBits(si, 8, DemodBuffer); si += 8;
+		uint8_t safer     = PackBits(si, 4, bits); si += 4;     //master key
+		uint8_t resv      = PackBits(si, 8, bits); si += 8;
 		// 2nibble must be zeroed.
 		if (safer != 0x6 && safer != 0x9) continue;
 		if ( resv > 0x00) continue;
-		//uint8_t	pageSel   = PackBits(si, 1, DemodBuffer); si += 1;
-		//uint8_t fastWrite = PackBits(si, 1, DemodBuffer); si += 1;
+		//uint8_t	pageSel   = PackBits(si, 1, bits); si += 1;
+		//uint8_t fastWrite = PackBits(si, 1, bits); si += 1;
 		si += 1+1;
-		int bitRate       = PackBits(si, 6, DemodBuffer)*2 + 2; si += 6;     //bit rate
+		int bitRate       = PackBits(si, 6, bits)*2 + 2; si += 6;     //bit rate
 		if (bitRate > 128 || bitRate < 8) continue;
 
-		//uint8_t AOR       = PackBits(si, 1, DemodBuffer); si += 1;   
-		//uint8_t PWD       = PackBits(si, 1, DemodBuffer); si += 1; 
-		//uint8_t pskcr     = PackBits(si, 2, DemodBuffer); si += 2;  //could check psk cr
-		//uint8_t inverse   = PackBits(si, 1, DemodBuffer); si += 1;
+		//uint8_t AOR       = PackBits(si, 1, bits); si += 1;   
+		//uint8_t PWD       = PackBits(si, 1, bits); si += 1; 
+		//uint8_t pskcr     = PackBits(si, 2, bits); si += 2;  //could check psk cr
+		//uint8_t inverse   = PackBits(si, 1, bits); si += 1;
 		si += 1+1+2+1;
-		uint8_t modread   = PackBits(si, 3, DemodBuffer); si += 3;
-		uint8_t maxBlk    = PackBits(si, 3, DemodBuffer); si += 3;
-		//uint8_t ST        = PackBits(si, 1, DemodBuffer); si += 1;
+		uint8_t modread   = PackBits(si, 3, bits); si += 3;
+		uint8_t maxBlk    = PackBits(si, 3, bits); si += 3;
+		//uint8_t ST        = PackBits(si, 1, bits); si += 1;
 		if (maxBlk == 0) continue;
 		//test modulation
 		if (!testQ5Modulation(mode, modread)) continue;
@@ -781,26 +824,27 @@ bool testBitRate(uint8_t readRate, uint8_t clk){
 	return false;
 }
 
-bool test(uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5){
+// block0 test on a demodulated bit stream
+bool testBits(uint8_t *bits, size_t len, uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5){
 
-	if ( DemodBufferLen < 64 ) return false;
+	if ( len < 64 ) return false;
 	uint8_t si = 0;
 	for (uint8_t idx = 28; idx < 64; idx++){
 		si = idx;
-		if ( PackBits(si, 28, DemodBuffer) == 0x00 ) continue;
+		if ( PackBits(si, 28, bits) == 0x00 ) continue;
 
-		uint8_t safer    = PackBits(si, 4, DemodBuffer); si += 4;     //master key
-		uint8_t resv     = PackBits(si, 4, DemodBuffer); si += 4;     //was 7 & +=7+3 //should be only 4 bits if extended mode
+		uint8_t safer    = PackBits(si, 4, bits); si += 4;     //master key
+		uint8_t resv     = PackBits(si, 4, bits); si += 4;     //was 7 & +=7+3 //should be only 4 bits if extended mode
 		// 2nibble must be zeroed.
 		// moved test to here, since this gets most faults first.
 		if ( resv > 0x00) continue;
 
-		int bitRate      = PackBits(si, 6, DemodBuffer); si += 6;     //bit rate (includes extended mode part of rate)
-		uint8_t extend   = PackBits(si, 1, DemodBuffer); si += 1;     //bit 15 extended mode
-		uint8_t modread  = PackBits(si, 5, DemodBuffer); si += 5+2+1; 
-		//uint8_t pskcr   = PackBits(si, 2, DemodBuffer); si += 2+1;  //could check psk cr
-		//uint8_t nml01    = PackBits(si, 1, DemodBuffer); si += 1+5;   //bit 24, 30, 31 could be tested for 0 if not extended mode
-		//uint8_t nml02    = PackBits(si, 2, DemodBuffer); si += 2;
+		int bitRate      = PackBits(si, 6, bits); si += 6;     //bit rate (includes extended mode part of rate)
+		uint8_t extend   = PackBits(si, 1, bits); si += 1;     //bit 15 extended mode
+		uint8_t modread  = PackBits(si, 5, bits); si += 5+2+1; 
+		//uint8_t pskcr   = PackBits(si, 2, bits); si += 2+1;  //could check psk cr
+		//uint8_t nml01    = PackBits(si, 1, bits); si += 1+5;   //bit 24, 30, 31 could be tested for 0 if not extended mode
+		//uint8_t nml02    = PackBits(si, 2, bits); si += 2;
 		
 		//if extended mode
 		bool extMode =( (safer == 0x6 || safer == 0x9) && extend) ? true : false;
@@ -819,13 +863,17 @@ bool test(uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5)
 		*Q5 = false;
 		return true;
 	}
-	if (testQ5(mode, offset, fndBitRate, clk)) {
+	if (testQ5(bits, len, mode, offset, fndBitRate, clk)) {
 		*Q5 = true;
 		return true;
 	}
 	return false;
 }
 
+bool test(uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5){
+	return testBits(DemodBuffer, DemodBufferLen, mode, offset, fndBitRate, clk, Q5);
+}
+
 void printT55xxBlock(const char *blockNum){
 	
 	uint8_t i = config.offset;
@@ -1391,6 +1439,181 @@ int CmdT55xxWipe(const char *Cmd) {
 	return 0;
 }
 
+static const char *t55xxCloneStatusStr(uint8_t status) {
+	switch (status) {
+		case T55XX_CLONE_OK:         return "ok";
+		case T55XX_CLONE_UNVERIFIED: return "written, not read back";
+		case T55XX_CLONE_MISMATCH:   return "FAILED, read back differs";
+		case T55XX_CLONE_NO_SIGNAL:  return "FAILED, no data after write";
+		case T55XX_CLONE_BAD_RECORD: return "FAILED, broken job";
+		default:                     return "?";
+	}
+}
+
+// packs the cards into jobs that fit the device buffer and runs them one after the other.
+// returns number of cards written and read back (or written with T55XX_CLONE_NOVERIFY)
+int t55xxCloneCards(t55xx_clone_card_t *cards, int count, uint8_t flags) {
+	uint8_t job[T55XX_CLONE_JOB_SIZE];
+	int done = 0, good = 0;
+	bool aborted = false;
+
+	while (done < count && !aborted) {
+		// pack as many records as fit
+		size_t len = 0;
+		int n = 0;
+		while (done + n < count) {
+			t55xx_clone_card_t *card = &cards[done + n];
+			if (len + 1 + card->numblocks * 4 > sizeof(job)) break;
+			job[len++] = card->numblocks;
+			for (int i = 0; i < card->numblocks; i++) {
+				memcpy(job + len, &card->blocks[i], 4);   // little endian on both sides
+				len += 4;
+			}
+			n++;
+		}
+
+		UsbCommand resp;
+		clearCommandBuffer();
+		for (size_t i = 0; i < len; i += USB_CMD_DATA_SIZE) {
+			UsbCommand c = {CMD_DOWNLOADED_SIM_SAMPLES_125K, {i, 0, 0}};
+			memcpy(c.d.asBytes, job + i, MIN(len - i, USB_CMD_DATA_SIZE));
+			SendCommand(&c);
+			if (!WaitForResponseTimeout(CMD_ACK, NULL, 1500)) {
+				PrintAndLog("No response from the device while uploading the job");
+				return good;
+			}
+		}
+
+		UsbCommand c = {CMD_T55XX_CLONE_BATCH, {n, flags, 0}};
+		SendCommand(&c);
+		PrintAndLog("Place card %d on the antenna (press a key to stop)", done + 1);
+
+		int written = 0;
+		while (true) {
+			if (!aborted && ukbhit()) {
+				getchar();
+				// any command ends the job on the device
+				UsbCommand off = {CMD_FPGA_MAJOR_MODE_OFF};
+				SendCommand(&off);
+				aborted = true;
+			}
+			if (!WaitForResponseTimeout(CMD_ACK, &resp, 100)) continue;
+			if (resp.arg[0] != 1) {
+				if (resp.arg[0] == 0xFF) aborted = true;
+				break;
+			}
+
+			t55xx_clone_result_t *r = (t55xx_clone_result_t *)resp.d.asBytes;
+			int index = done + r->card;
+			bool ok = (r->status == T55XX_CLONE_OK || (r->status == T55XX_CLONE_UNVERIFIED && (flags & T55XX_CLONE_NOVERIFY)));
+			if (ok) good++;
+			PrintAndLog("Card %4d  block0 %08X  %-28s  writes %d  bits %3d  %5d ms", index + 1, r->block0,
+			            t55xxCloneStatusStr(r->status), r->attempts, r->bits, r->time);
+			if (r->status == T55XX_CLONE_BAD_RECORD) {
+				aborted = true;
+				break;
+			}
+			written = r->card + 1;
+			if (index + 1 < count)
+				PrintAndLog("Place card %d on the antenna", index + 2);
+		}
+		done += written;
+		if (written < n) break;
+	}
+
+	PrintAndLog("%d of %d cards programmed%s", good, count, aborted ? " (stopped)" : "");
+	return good;
+}
+
+int CmdT55xxBulk(const char *Cmd) {
+	char filename[FILE_PATH_SIZE] = {0};
+	uint8_t flags = 0;
+	bool errors = false;
+	uint8_t cmdp = 0;
+	while (param_getchar(Cmd, cmdp) != 0x00 && !errors) {
+		switch (param_getchar(Cmd, cmdp)) {
+		case 'h':
+		case 'H':
+			return usage_t55xx_bulk();
+		case 'f':
+		case 'F':
+			if (param_getstr(Cmd, cmdp+1, filename, sizeof(filename)) == 0) errors = true;
+			cmdp += 2;
+			break;
+		case 'n':
+		case 'N':
+			flags |= T55XX_CLONE_NOVERIFY;
+			cmdp++;
+			break;
+		default:
+			PrintAndLog("Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+			errors = true;
+			break;
+		}
+	}
+	if (errors || !filename[0]) return usage_t55xx_bulk();
+
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		PrintAndLog("File: %s: not found or locked.", filename);
+		return 1;
+	}
+
+	int count = 0, size = 64;
+	t55xx_clone_card_t *cards = calloc(size, sizeof(t55xx_clone_card_t));
+	char line[256];
+	int lineNo = 0;
+	while (cards && fgets(line, sizeof(line), f)) {
+		lineNo++;
+		char *p = line;
+		while (isspace((unsigned char)*p)) p++;
+		//The line start with # is comment, skip
+		if (*p == '#' || *p == 0) continue;
+
+		t55xx_clone_card_t card = {0};
+		while (*p && card.numblocks < T55XX_CLONE_MAX_BLOCKS) {
+			char *end;
+			card.blocks[card.numblocks++] = strtoul(p, &end, 16);
+			if (end == p || (end - p) > 8 || (*end && !isspace((unsigned char)*end))) {
+				errors = true;
+				break;
+			}
+			p = end;
+			while (isspace((unsigned char)*p)) p++;
+		}
+		if (errors || *p) {
+			PrintAndLog("Line %d: expected up to %d blocks of 8 hex symbols", lineNo, T55XX_CLONE_MAX_BLOCKS);
+			errors = true;
+			break;
+		}
+
+		if (count == size) {
+			t55xx_clone_card_t *q = realloc(cards, (size *= 2) * sizeof(t55xx_clone_card_t));
+			if (!q) {
+				free(cards);
+				cards = NULL;
+				break;
+			}
+			cards = q;
+		}
+		cards[count++] = card;
+	}
+	fclose(f);
+
+	if (!cards) {
+		PrintAndLog("Cannot allocate memory for the cards");
+		return 2;
+	}
+	if (!errors && count == 0)
+		PrintAndLog("No cards found in file");
+	if (!errors && count) {
+		PrintAndLog("Loaded %d cards", count);
+		t55xxCloneCards(cards, count, flags);
+	}
+	free(cards);
+	return 0;
+}
+
 int CmdT55xxBruteForce(const char *Cmd) {
 
 	// load a default pwd file.
@@ -1698,6 +1921,7 @@ int CmdT55xxDetectPage1(const char *Cmd){
 static command_t CommandTable[] = {
   {"help",      CmdHelp,           1, "This help"},
 	{"bruteforce",CmdT55xxBruteForce,0, "<start password> <end password> [i <*.dic>] Simple bruteforce attack to find password"},
+  {"bulk",      CmdT55xxBulk,      0, "f <file> [n] -- Program a batch of cards, each one read back on the device"},
   {"config",    CmdT55xxSetConfig, 1, "Set/Get T55XX configuration (modulation, inverted, offset, rate)"},
   {"detect",    CmdT55xxDetect,    1, "[1] Try detecting the tag modulation from reading the configuration block."},
   {"p1detect",  CmdT55xxDetectPage1,1, "[1] Try detecting if this is a t55xx tag by reading page 1"},
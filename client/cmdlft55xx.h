@@ -12,6 +12,8 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "t55xxclone.h"
 
 typedef struct {
 	uint32_t bl1;
@@ -69,6 +71,24 @@ typedef struct {
 	bool ST;
 } t55xx_conf_block_t;
 
+#define T55XX_DETECT_MAX 16
+
+// one hypothesis of tryDetectModulationRanked
+typedef struct {
+	t55xx_conf_block_t conf;
+	int score;              // higher is better
+	uint8_t repeats;        // times block0 was seen in the capture
+	int errCnt;             // demod errors
+	uint8_t *stream;        // internal
+	size_t len;
+} t55xx_detect_t;
+
+// one card of a bulk clone job, block 0 first
+typedef struct {
+	uint8_t numblocks;
+	uint32_t blocks[T55XX_CLONE_MAX_BLOCKS];
+} t55xx_clone_card_t;
+
 t55xx_conf_block_t Get_t55xx_Config(void);
 void Set_t55xx_Config(t55xx_conf_block_t conf);
 
@@ -82,6 +102,7 @@ extern int CmdT55xxInfo(const char *Cmd);
 extern int CmdT55xxDetect(const char *Cmd);
 extern int CmdResetRead(const char *Cmd);
 extern int CmdT55xxWipe(const char *Cmd);
+extern int CmdT55xxBulk(const char *Cmd);
 
 char * GetBitRateStr(uint32_t id, bool xmode);
 char * GetSaferStr(uint32_t id);
@@ -95,10 +116,13 @@ int printConfiguration( t55xx_conf_block_t b);
 
 bool DecodeT55xxBlock(void);
 bool tryDetectModulation(void);
+uint8_t tryDetectModulationRanked(t55xx_detect_t *cands);
 extern bool tryDetectP1(bool getData);
 bool test(uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5);
+bool testBits(uint8_t *bits, size_t len, uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5);
 int special(const char *Cmd);
 int AquireData( uint8_t page, uint8_t block, bool pwdmode, uint32_t password );
+int t55xxCloneCards(t55xx_clone_card_t *cards, int count, uint8_t flags);
 
 void printT55x7Trace( t55x7_tracedata_t data, uint8_t repeat );
 void printT5555Trace( t5555_tracedata_t data, uint8_t repeat );
@@ -25,6 +25,8 @@
 #include "crypto/libpcrypto.h"	// sha512hash
 #include "emv/dump.h"			// dump_buffer
 #include "pcsc.h"
+#include "sctrace.h"
+#include "sc_wait.h"
 
 #define SC_UPGRADE_FILES_DIRECTORY          "sc_upgrade_firmware/"
 
@@ -99,6 +101,21 @@ static int usage_sm_setclock(void) {
 	return 0;
 }
 
+static int usage_sm_trace(void) {
+	PrintAndLogEx(NORMAL, "Record smartcard exchanges to a file or answer them from a recorded file");
+	PrintAndLogEx(NORMAL, "Usage: sc trace [h] [r <file name>] [p <file name>] [s]");
+	PrintAndLogEx(NORMAL, "       h               :  this help");
+	PrintAndLogEx(NORMAL, "       r <file name>   :  record all exchanges with the selected reader to file");
+	PrintAndLogEx(NORMAL, "       p <file name>   :  replay: answer all exchanges from a recorded file instead of a reader");
+	PrintAndLogEx(NORMAL, "       s               :  stop recording and replaying");
+	PrintAndLogEx(NORMAL, "       without parameters shows the recording/replay status");
+	PrintAndLogEx(NORMAL, "");
+	PrintAndLogEx(NORMAL, "Examples:");
+	PrintAndLogEx(NORMAL, "        sc trace r visa.sctrace");
+	PrintAndLogEx(NORMAL, "        sc trace p visa.sctrace");
+	return 0;
+}
+
 static int usage_sm_brute(void) {
 	PrintAndLogEx(NORMAL, "Tries to bruteforce SFI, ");
 	PrintAndLogEx(NORMAL, "Usage: sc brute [h]");
@@ -109,6 +126,18 @@ static int usage_sm_brute(void) {
 	return 0;
 }
 
+static int usage_sm_waittest(void) {
+	PrintAndLogEx(NORMAL, "Checks how the device waits for the answer of the smart card module (common/sc_wait.c)");
+	PrintAndLogEx(NORMAL, "against a model of the module, and compares it with the old 1ms SCL polling. Runs offline.");
+	PrintAndLogEx(NORMAL, "Usage: sc waittest [h] [<rounds> [<seed>]]");
+	PrintAndLogEx(NORMAL, "       h          :  this help");
+	PrintAndLogEx(NORMAL, "       rounds     :  answers to wait for, default 2000");
+	PrintAndLogEx(NORMAL, "");
+	PrintAndLogEx(NORMAL, "Examples:");
+	PrintAndLogEx(NORMAL, "        sc waittest");
+	return 0;
+}
+
 uint8_t GetATRTA1(uint8_t *atr, size_t atrlen) {
 	if (atrlen > 2) {
 		uint8_t T0 = atr[1];
@@ -311,7 +340,7 @@ static int PrintATR(uint8_t *atr, size_t atrlen) {
 	return 0;
 }
 
-bool smart_getATR(smart_card_atr_t *card)
+static bool smart_getATR_reader(smart_card_atr_t *card)
 {
 	if (UseAlternativeSmartcardReader) {
 		return pcscGetATR(card);
@@ -334,6 +363,19 @@ bool smart_getATR(smart_card_atr_t *card)
 	}
 }
 
+bool smart_getATR(smart_card_atr_t *card)
+{
+	if (sctrace_is_replaying()) {
+		return sctrace_replay_atr(card);
+	}
+
+	bool res = smart_getATR_reader(card);
+	if (res && sctrace_is_recording()) {
+		sctrace_record(SCTRACE_ATR, NULL, 0, card->atr, card->atr_len);
+	}
+	return res;
+}
+
 static bool smart_select(bool silent) {
 
 	smart_card_atr_t card;
@@ -353,7 +395,9 @@ static bool smart_select(bool silent) {
 static void smart_transmit(uint8_t *data, uint32_t data_len, uint32_t flags, uint8_t *response, int *response_len, uint32_t max_response_len)
 {
 	// PrintAndLogEx(SUCCESS, "C-TPDU>>>> %s", sprint_hex(data, data_len));
-	if (UseAlternativeSmartcardReader) {
+	if (sctrace_is_replaying()) {
+		sctrace_replay(flags, data, data_len, response, response_len, max_response_len);
+	} else if (UseAlternativeSmartcardReader) {
 		*response_len = max_response_len;
 		pcscTransmit(data, data_len, flags, response, response_len);
 	} else {
@@ -364,6 +408,10 @@ static void smart_transmit(uint8_t *data, uint32_t data_len, uint32_t flags, uin
 		if (!WaitForResponseTimeout(CMD_ACK, &c, 2500)) {
 			PrintAndLogEx(WARNING, "smart card response timeout");
 			*response_len = -1;
+			// record the failed exchange as well, a replay has to see the same sequence
+			if (sctrace_is_recording()) {
+				sctrace_record(flags, data, data_len, NULL, -1);
+			}
 			return;
 		}
 
@@ -373,6 +421,10 @@ static void smart_transmit(uint8_t *data, uint32_t data_len, uint32_t flags, uin
 		}
 	}
 
+	if (sctrace_is_recording()) {
+		sctrace_record(flags, data, data_len, response, *response_len);
+	}
+
 	if (*response_len <= 0) {
 		PrintAndLogEx(WARNING, "smart card response failed");
 		*response_len = -2;
@@ -943,6 +995,57 @@ static int CmdSmartList(const char *Cmd) {
 }
 
 
+static int CmdSmartTrace(const char *Cmd) {
+	uint8_t cmdp = 0;
+	bool errors = false;
+	char filename[FILE_PATH_SIZE] = {0};
+
+	if (param_getchar(Cmd, 0) == 0x00) {
+		sctrace_print_stats();
+		return 0;
+	}
+
+	while (param_getchar(Cmd, cmdp) != 0x00 && !errors) {
+		switch (tolower(param_getchar(Cmd, cmdp))) {
+		case 'h': return usage_sm_trace();
+		case 'r':
+		case 'p': {
+			bool record = tolower(param_getchar(Cmd, cmdp)) == 'r';
+			if (param_getstr(Cmd, cmdp+1, filename, FILE_PATH_SIZE) == 0) {
+				PrintAndLogEx(WARNING, "Missing file name");
+				errors = true;
+				break;
+			}
+			sctrace_stop_record();
+			sctrace_stop_replay();
+			if (record) {
+				if (sctrace_start_record(filename))
+					PrintAndLogEx(SUCCESS, "Recording smartcard exchanges to %s", filename);
+			} else {
+				sctrace_start_replay(filename);
+			}
+			cmdp += 2;
+			break;
+		}
+		case 's':
+			sctrace_stop_record();
+			sctrace_stop_replay();
+			cmdp++;
+			break;
+		default:
+			PrintAndLogEx(WARNING, "Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+			errors = true;
+			break;
+		}
+	}
+
+	//Validations
+	if (errors) return usage_sm_trace();
+
+	return 0;
+}
+
+
 static int CmdSmartBruteforceSFI(const char *Cmd) {
 
 	char ctmp = tolower(param_getchar(Cmd, 0));
@@ -992,6 +1095,100 @@ static int CmdSmartBruteforceSFI(const char *Cmd) {
 	return 0;
 }
 
+static uint32_t sc_wait_rand(uint32_t *state) {
+	// xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// model of the module: SCL low in [low, high), the answer can be read from high + settle.
+// start is the timer value at the request, relative times in ticks
+static bool sc_wait_scl(uint32_t t, uint32_t low, uint32_t high) {
+	return !(t >= low && t < high);
+}
+
+// the device samples SCL back to back, 1-3 ticks apart, so it reads at most 6 ticks late.
+// Returns the tick of the read
+static uint32_t sc_wait_run(uint32_t start, uint32_t low, uint32_t high, uint32_t settle, bool *timeout, uint32_t *rnd) {
+	sc_wait_t w;
+	uint32_t t = 0;
+	sc_wait_start(&w, start, settle);
+	while (sc_wait_poll(&w, sc_wait_scl(t, low, high), start + t) != SC_WAIT_DONE)
+		t += 1 + sc_wait_rand(rnd) % 3;
+	*timeout = w.timeout;
+	return t;
+}
+
+// before: SCL sampled every WaitMS(1) until low, then every 3.07us until high, then WaitUS(600)
+static uint32_t sc_wait_old(uint32_t low, uint32_t high) {
+	uint32_t t = 0;
+	int delay = 1800;
+	while (delay-- && sc_wait_scl(t, low, high))
+		t += SC_WAIT_MS(1) + 2;
+	if (delay >= 0) {
+		while (!sc_wait_scl(t, low, high))
+			t += 5;
+	}
+	return t + SC_WAIT_US(600);
+}
+
+static int CmdSmartWaitTest(const char *Cmd) {
+
+	char ctmp = tolower(param_getchar(Cmd, 0));
+	if (ctmp == 'h') return usage_sm_waittest();
+
+	int rounds = param_get32ex(Cmd, 0, 2000, 10);
+	uint32_t rnd = param_get32ex(Cmd, 1, 1, 10);
+	if (rnd == 0) rnd = 1;
+
+	int errors = 0;
+	bool timeout;
+
+	// edge cases: no settle, module never answers, card never answers, timer wrapping
+	if (sc_wait_run(0, 100, 200, 0, &timeout, &rnd) > 203 || timeout) errors++;
+	if (sc_wait_run(0, UINT32_MAX, UINT32_MAX, 0, &timeout, &rnd) < SC_WAIT_BUSY_TIMEOUT || !timeout) errors++;
+	uint32_t t = sc_wait_run(0, 100, UINT32_MAX, SC_WAIT_SETTLE_TIME, &timeout, &rnd);
+	if (t < 100 + SC_WAIT_CARD_TIMEOUT + SC_WAIT_SETTLE_TIME || !timeout) errors++;
+	t = sc_wait_run(UINT32_MAX - 1000, 100, 3000, SC_WAIT_SETTLE_TIME, &timeout, &rnd);
+	if (t < 3000 + SC_WAIT_SETTLE_TIME || t > 3006 + SC_WAIT_SETTLE_TIME || timeout) errors++;
+
+	// the module takes 20-500us to pull SCL, a quarter of the answers come within 1ms
+	uint64_t lateOld = 0, lateOldSeen = 0, lateNew = 0;
+	int stalls = 0;
+	for (int i = 0; i < rounds && errors < 10; i++) {
+		uint32_t low = SC_WAIT_US(20 + sc_wait_rand(&rnd) % 480);
+		uint32_t len = (sc_wait_rand(&rnd) % 4) ? SC_WAIT_US(1000 + sc_wait_rand(&rnd) % 30000) : SC_WAIT_US(50 + sc_wait_rand(&rnd) % 950);
+		uint32_t ready = low + len + SC_WAIT_SETTLE_TIME;
+
+		t = sc_wait_run(sc_wait_rand(&rnd), low, low + len, SC_WAIT_SETTLE_TIME, &timeout, &rnd);
+		// never read before the module is ready, never miss it
+		if (t < ready || t > ready + 6 || timeout) errors++;
+		lateNew += t - ready;
+
+		uint32_t old = sc_wait_old(low, low + len);
+		if (old >= SC_WAIT_BUSY_TIMEOUT)
+			stalls++;
+		else
+			lateOldSeen += old - ready;
+		lateOld += old - ready;
+	}
+
+	PrintAndLogEx(NORMAL, "%d answers, read after the module was ready: old %.1f us, now %.1f us on average",
+		rounds, lateOld * 2.0 / 3 / rounds, lateNew * 2.0 / 3 / rounds);
+	PrintAndLogEx(NORMAL, "old polling missed SCL low %d times (1.8s each), %.1f us on average without them",
+		stalls, stalls < rounds ? lateOldSeen * 2.0 / 3 / (rounds - stalls) : 0.0);
+
+	if (errors)
+		PrintAndLogEx(NORMAL, "Test(s) [ ERROR ] %d error(s)", errors);
+	else
+		PrintAndLogEx(NORMAL, "Test(s) [ OK ]");
+	return errors;
+}
+
 static command_t CommandTable[] = {
 	{"help",     CmdHelp,               1, "This help"},
 	{"select",   CmdSmartSelect,        1, "Select the Smartcard Reader to use"},
@@ -1001,7 +1198,9 @@ static command_t CommandTable[] = {
 	{"raw",      CmdSmartRaw,           1, "Send raw hex data to tag"},
 	{"upgrade",  CmdSmartUpgrade,       0, "Upgrade firmware"},
 	{"setclock", CmdSmartSetClock,      1, "Set clock speed"},
+	{"trace",    CmdSmartTrace,         1, "Record exchanges to file or replay them"},
 	{"brute",    CmdSmartBruteforceSFI, 1, "Bruteforce SFI"},
+	{"waittest", CmdSmartWaitTest,      1, "Test waiting for the module answer offline"},
 	{NULL,       NULL,                  0, NULL}
 };
 
@@ -20,6 +20,7 @@
 #include "common.h"
 #include "util_darwin.h"
 #include "util_posix.h"
+#include "usb_compact.h"
 
 
 // Serial port that we are communicating with the PM3 on.
@@ -29,6 +30,9 @@ static char *serial_port_name = NULL;
 // If TRUE, then there is no active connection to the PM3, and we will drop commands sent.
 static bool offline;
 
+// If TRUE, commands are sent as compact frames. Answers are read in both layouts.
+static bool compact_frames = false;
+
 typedef struct {
 	bool run; // If TRUE, continue running the uart_communication thread
 	bool block_after_ACK; // if true, block after receiving an ACK package
@@ -53,9 +57,19 @@ static int cmd_head = 0;
 // Points to the position of the last unread command
 static int cmd_tail = 0;
 
+// Number of commands overwritten in rxBuffer before they were read
+static uint32_t cmd_overflows = 0;
+
 // to lock rxBuffer operations from different threads
 static pthread_mutex_t rxBufferMutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Commands of frameHandlerCmd are passed to frameHandler on the communication
+// thread instead of being stored in rxBuffer. The mutex is held while it runs.
+static pthread_mutex_t frameHandlerMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t frameHandlerCmd = 0;
+static frame_handler_t frameHandler = NULL;
+static void *frameHandlerCtx = NULL;
+
 // These wrappers are required because it is not possible to access a static
 // global variable outside of the context of a single file.
 
@@ -67,6 +81,10 @@ bool IsOffline() {
 	return offline;
 }
 
+void SetCompactFrames(bool new_compact_frames) {
+	compact_frames = new_compact_frames;
+}
+
 void SendCommand(UsbCommand *c) {
 	#ifdef COMMS_DEBUG
 	printf("Sending %04x cmd\n", c->cmd);
@@ -121,6 +139,7 @@ static void storeCommand(UsbCommand *command)
 		// If these two are equal, we're about to overwrite in the
 		// circular buffer.
 		PrintAndLog("WARNING: Command buffer about to overwrite command! This needs to be fixed!");
+		cmd_overflows++;
 	}
 
 	// Store the command at the 'head' location
@@ -157,12 +176,49 @@ static int getCommand(UsbCommand* response)
 }
 
 
+/**
+ * @brief number of commands overwritten in the receive buffer before they were read
+ */
+uint32_t GetCommandOverflows()
+{
+	pthread_mutex_lock(&rxBufferMutex);
+	uint32_t n = cmd_overflows;
+	pthread_mutex_unlock(&rxBufferMutex);
+	return n;
+}
+
+
+/**
+ * @brief Passes every received command cmd to handler, on the communication thread,
+ *  instead of storing it for WaitForResponse. The communication thread waits for the
+ *  handler, so a long stream of frames can't overrun the receive buffer.
+ *  A NULL handler stores the commands again.
+ */
+void SetFrameHandler(uint64_t cmd, frame_handler_t handler, void *ctx)
+{
+	// waits for a running handler, ctx can be freed on return
+	pthread_mutex_lock(&frameHandlerMutex);
+	frameHandlerCmd = cmd;
+	frameHandler = handler;
+	frameHandlerCtx = ctx;
+	pthread_mutex_unlock(&frameHandlerMutex);
+}
+
+
 //----------------------------------------------------------------------------------
 // Entry point into our code: called whenever we received a packet over USB.
 // Handle debug commands directly, store all other commands in circular buffer.
 //----------------------------------------------------------------------------------
 static void UsbCommandReceived(UsbCommand *UC)
 {
+	pthread_mutex_lock(&frameHandlerMutex);
+	if (frameHandler && UC->cmd == frameHandlerCmd) {
+		frameHandler(UC, frameHandlerCtx);
+		pthread_mutex_unlock(&frameHandlerMutex);
+		return;
+	}
+	pthread_mutex_unlock(&frameHandlerMutex);
+
 	switch(UC->cmd) {
 		// First check if we are handling a debug message
 		case CMD_DEBUG_PRINT_STRING: {
@@ -187,6 +243,19 @@ static void UsbCommandReceived(UsbCommand *UC)
 }
 
 
+// Size of the frame starting in rx, as far as its first len bytes tell. 0 - broken
+static size_t FrameSize(const uint8_t *rx, size_t len)
+{
+	if (len < sizeof(uint32_t))
+		return sizeof(uint32_t);
+	if (!usb_compact_is_frame(rx))
+		return sizeof(UsbCommand);
+	if (len < sizeof(UsbCompactHeader))
+		return sizeof(UsbCompactHeader);
+	return usb_compact_frame_size(rx);
+}
+
+
 static void
 #ifdef __has_attribute
 #if __has_attribute(force_align_arg_pointer)
@@ -195,28 +264,41 @@ __attribute__((force_align_arg_pointer))
 #endif
 *uart_communication(void *targ) {
 	communication_arg_t *conn = (communication_arg_t*)targ;
-	size_t rxlen;
-	UsbCommand rx;
-	UsbCommand *prx = &rx;
+	uint8_t rx[MAX(sizeof(UsbCommand), USB_COMPACT_MAX_SIZE)];
+	size_t rxlen = 0;
+	uint8_t tx[USB_COMPACT_MAX_SIZE];
 
 #if defined(__MACH__) && defined(__APPLE__)
 	disableAppNap("Proxmark3 polling UART");
 #endif
 
 	while (conn->run) {
-		rxlen = 0;
 		bool ACK_received = false;
-		if (uart_receive(sp, (uint8_t *)prx, sizeof(UsbCommand) - (prx-&rx), &rxlen) && rxlen) {
-			prx += rxlen;
-			if (prx-&rx < sizeof(UsbCommand)) {
+		size_t want = FrameSize(rx, rxlen);
+		size_t received = 0;
+		if (want == 0) {
+			// broken compact frame header. Look for the next frame
+			memmove(rx, rx + 1, --rxlen);
+			continue;
+		}
+		if (uart_receive(sp, rx + rxlen, want - rxlen, &received) && received) {
+			rxlen += received;
+			want = FrameSize(rx, rxlen);
+			if (want == 0 || rxlen < want) {
 				continue;
 			}
-			UsbCommandReceived(&rx);
-			if (rx.cmd == CMD_ACK) {
+			UsbCommand cmd;
+			if (usb_compact_is_frame(rx)) {
+				usb_compact_decode(rx, rxlen, &cmd);
+			} else {
+				memcpy(&cmd, rx, sizeof(UsbCommand));
+			}
+			UsbCommandReceived(&cmd);
+			if (cmd.cmd == CMD_ACK) {
 				ACK_received = true;
 			}
 		}
-		prx = &rx;
+		rxlen = 0;
 
 		
 		pthread_mutex_lock(&txBufferMutex);
@@ -231,7 +313,9 @@ __attribute__((force_align_arg_pointer))
 		}
 				
 		if(txBuffer_pending) {
-			if (!uart_send(sp, (uint8_t*) &txBuffer, sizeof(UsbCommand))) {
+			size_t txlen = compact_frames ? usb_compact_from_command(tx, &txBuffer) : 0;
+			bool sent = txlen ? uart_send(sp, tx, txlen) : uart_send(sp, (uint8_t*) &txBuffer, sizeof(UsbCommand));
+			if (!sent) {
 				PrintAndLog("Sending bytes to proxmark failed");
 			}
 			txBuffer_pending = false;
@@ -363,8 +447,9 @@ bool OpenProxmark(void *port, bool wait_for_port, int timeout, bool flash_mode)
 		serial_port_name = NULL;
 		return false;
 	} else {
-		// start the USB communication thread
+		// start the USB communication thread. Compact frames only after CMD_VERSION said so
 		serial_port_name = portname;
+		compact_frames = false;
 		conn.run = true;
 		conn.block_after_ACK = flash_mode;
 		pthread_create(&USB_communication_thread, NULL, &uart_communication, &conn);
@@ -24,13 +24,18 @@
 
 void SetOffline(bool new_offline);
 bool IsOffline();
+void SetCompactFrames(bool new_compact_frames);
 
 bool OpenProxmark(void *port, bool wait_for_port, int timeout, bool flash_mode);
 void CloseProxmark(void);
 
 void SendCommand(UsbCommand *c);
 
+typedef void (*frame_handler_t)(UsbCommand *c, void *ctx);
+void SetFrameHandler(uint64_t cmd, frame_handler_t handler, void *ctx);
+
 void clearCommandBuffer();
+uint32_t GetCommandOverflows();
 bool WaitForResponseTimeoutW(uint32_t cmd, UsbCommand* response, size_t ms_timeout, bool show_warning);
 bool WaitForResponseTimeout(uint32_t cmd, UsbCommand* response, size_t ms_timeout);
 bool WaitForResponse(uint32_t cmd, UsbCommand* response);
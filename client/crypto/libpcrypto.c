@@ -82,6 +82,123 @@ int aes_cmac8(uint8_t *iv, uint8_t *key, uint8_t *input, uint8_t *mac, int lengt
 	return 0;
 }
 
+int aes_key_init(aes_key_context *ctx, uint8_t *key) {
+	mbedtls_aes_init(&ctx->enc);
+	mbedtls_aes_init(&ctx->dec);
+	if (mbedtls_aes_setkey_enc(&ctx->enc, key, 128) || mbedtls_aes_setkey_dec(&ctx->dec, key, 128)) {
+		aes_key_free(ctx);
+		return 1;
+	}
+
+	return 0;
+}
+
+void aes_key_free(aes_key_context *ctx) {
+	mbedtls_aes_free(&ctx->enc);
+	mbedtls_aes_free(&ctx->dec);
+}
+
+int aes_encode_ctx(aes_key_context *ctx, uint8_t *iv, uint8_t *input, uint8_t *output, int length) {
+	uint8_t iiv[16] = {0};
+	if (iv)
+		memcpy(iiv, iv, 16);
+
+	if (mbedtls_aes_crypt_cbc(&ctx->enc, MBEDTLS_AES_ENCRYPT, length, iiv, input, output))
+		return 2;
+
+	return 0;
+}
+
+int aes_decode_ctx(aes_key_context *ctx, uint8_t *iv, uint8_t *input, uint8_t *output, int length) {
+	uint8_t iiv[16] = {0};
+	if (iv)
+		memcpy(iiv, iv, 16);
+
+	if (mbedtls_aes_crypt_cbc(&ctx->dec, MBEDTLS_AES_DECRYPT, length, iiv, input, output))
+		return 2;
+
+	return 0;
+}
+
+// subkey generation. NIST 800-38B 6.1
+static void aes_cmac_subkey(uint8_t *in, uint8_t *out) {
+	uint8_t carry = in[0] >> 7;
+	for (int i = 0; i < 15; i++)
+		out[i] = (in[i] << 1) | (in[i + 1] >> 7);
+	out[15] = (in[15] << 1) ^ (carry ? 0x87 : 0x00);
+}
+
+int aes_cmac_init(aes_cmac_context *ctx, uint8_t *key) {
+	uint8_t L[16] = {0};
+
+	mbedtls_aes_init(&ctx->aes);
+	if (mbedtls_aes_setkey_enc(&ctx->aes, key, 128) || mbedtls_aes_crypt_ecb(&ctx->aes, MBEDTLS_AES_ENCRYPT, L, L)) {
+		aes_cmac_free(ctx);
+		return 1;
+	}
+
+	aes_cmac_subkey(L, ctx->K1);
+	aes_cmac_subkey(ctx->K1, ctx->K2);
+	memset(L, 0x00, sizeof(L));
+
+	return 0;
+}
+
+void aes_cmac_free(aes_cmac_context *ctx) {
+	mbedtls_aes_free(&ctx->aes);
+	memset(ctx->K1, 0x00, sizeof(ctx->K1));
+	memset(ctx->K2, 0x00, sizeof(ctx->K2));
+}
+
+// same as aes_cmac but without the key schedule and subkey generation on every call. NIST 800-38B 6.2
+int aes_cmac_ctx(aes_cmac_context *ctx, uint8_t *input, uint8_t *mac, int length) {
+	uint8_t x[16] = {0};
+	uint8_t last[16] = {0};
+
+	if (length < 0)
+		return 1;
+
+	int blocks = (length + 15) / 16;
+	bool complete = length && (length % 16 == 0);
+	if (blocks == 0)
+		blocks = 1;
+
+	for (int n = 0; n < blocks - 1; n++) {
+		for (int i = 0; i < 16; i++)
+			x[i] ^= input[n * 16 + i];
+		if (mbedtls_aes_crypt_ecb(&ctx->aes, MBEDTLS_AES_ENCRYPT, x, x))
+			return 2;
+	}
+
+	int lastlen = length - (blocks - 1) * 16;
+	if (lastlen)
+		memcpy(last, &input[(blocks - 1) * 16], lastlen);
+	if (!complete)
+		last[lastlen] = 0x80;
+
+	for (int i = 0; i < 16; i++)
+		x[i] ^= last[i] ^ (complete ? ctx->K1[i] : ctx->K2[i]);
+
+	if (mbedtls_aes_crypt_ecb(&ctx->aes, MBEDTLS_AES_ENCRYPT, x, mac))
+		return 2;
+
+	return 0;
+}
+
+int aes_cmac8_ctx(aes_cmac_context *ctx, uint8_t *input, uint8_t *mac, int length) {
+	uint8_t cmac[16] = {0};
+	memset(mac, 0x00, 8);
+
+	int res = aes_cmac_ctx(ctx, input, cmac, length);
+	if (res)
+		return res;
+
+	for(int i = 0; i < 8; i++)
+		mac[i] = cmac[i * 2 + 1];
+
+	return 0;
+}
+
 static uint8_t fixed_rand_value[250] = {0};
 static int fixed_rand(void *rng_state, unsigned char *output, size_t len) {
 	if (len <= 250) {
@@ -420,3 +537,57 @@ exit:
 		printf("failed\n\n");
 	return res;
 }
+
+// NIST 800-38B D.1 AES-128 examples
+int aes_cmac_nist_test(bool verbose) {
+	uint8_t key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+	uint8_t msg[64] = {
+		0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+		0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+		0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+		0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+	int msglen[4] = {0, 16, 40, 64};
+	uint8_t tag[4][16] = {
+		{0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28, 0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46},
+		{0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44, 0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c},
+		{0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30, 0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27},
+		{0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92, 0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe}};
+	uint8_t mac[16] = {0};
+	uint8_t refmac[16] = {0};
+	int res = 0;
+
+	if (verbose)
+		printf("  AES CMAC context test: ");
+
+	aes_cmac_context ctx;
+	if (aes_cmac_init(&ctx, key)) {
+		res = 1;
+		goto exit;
+	}
+
+	for (int i = 0; i < 4; i++) {
+		if (aes_cmac_ctx(&ctx, msg, mac, msglen[i]) || memcmp(mac, tag[i], 16)) {
+			res = 2;
+			goto exit;
+		}
+	}
+
+	// every length against the one-shot implementation
+	for (int i = 0; i <= 64; i++) {
+		if (aes_cmac_ctx(&ctx, msg, mac, i) || aes_cmac(NULL, key, msg, refmac, i) || memcmp(mac, refmac, 16)) {
+			res = 3;
+			goto exit;
+		}
+	}
+
+	aes_cmac_free(&ctx);
+	if (verbose)
+		printf("passed\n\n");
+
+	return 0;
+exit:
+	aes_cmac_free(&ctx);
+	if (verbose)
+		printf("failed\n\n");
+	return res;
+}
@@ -15,12 +15,37 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <mbedtls/pk.h>
+#include <mbedtls/aes.h>
+
+// expanded AES key for repeated operations with the same key.
+// mbedtls contexts point into themselves: do not copy them, init them in place.
+typedef struct {
+	mbedtls_aes_context enc;
+	mbedtls_aes_context dec;
+} aes_key_context;
+
+// expanded AES key and precomputed CMAC subkeys K1, K2 (NIST 800-38B)
+typedef struct {
+	mbedtls_aes_context aes;
+	uint8_t K1[16];
+	uint8_t K2[16];
+} aes_cmac_context;
 
 extern int aes_encode(uint8_t *iv, uint8_t *key, uint8_t *input, uint8_t *output, int length);
 extern int aes_decode(uint8_t *iv, uint8_t *key, uint8_t *input, uint8_t *output, int length);
 extern int aes_cmac(uint8_t *iv, uint8_t *key, uint8_t *input, uint8_t *mac, int length);
 extern int aes_cmac8(uint8_t *iv, uint8_t *key, uint8_t *input, uint8_t *mac, int length);
 
+extern int aes_key_init(aes_key_context *ctx, uint8_t *key);
+extern void aes_key_free(aes_key_context *ctx);
+extern int aes_encode_ctx(aes_key_context *ctx, uint8_t *iv, uint8_t *input, uint8_t *output, int length);
+extern int aes_decode_ctx(aes_key_context *ctx, uint8_t *iv, uint8_t *input, uint8_t *output, int length);
+
+extern int aes_cmac_init(aes_cmac_context *ctx, uint8_t *key);
+extern void aes_cmac_free(aes_cmac_context *ctx);
+extern int aes_cmac_ctx(aes_cmac_context *ctx, uint8_t *input, uint8_t *mac, int length);
+extern int aes_cmac8_ctx(aes_cmac_context *ctx, uint8_t *input, uint8_t *mac, int length);
+
 extern int sha256hash(uint8_t *input, int length, uint8_t *hash);
 extern int sha512hash(uint8_t *input, int length, uint8_t *hash);
 
@@ -31,5 +56,6 @@ extern int ecdsa_signature_verify(uint8_t *key_xy, uint8_t *input, int length, u
 extern char *ecdsa_get_error(int ret);
 
 extern int ecdsa_nist_test(bool verbose);
+extern int aes_cmac_nist_test(bool verbose);
 
 #endif /* libpcrypto.h */
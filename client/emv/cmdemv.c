@@ -12,14 +12,17 @@
 
 #include <ctype.h>
 #include <string.h>
+#include <inttypes.h>
 #include "proxmark3.h"
 #include "cmdparser.h"
 #include "ui.h"
 #include "util.h"
+#include "util_posix.h"
 #include "mifare.h"
 #include "emvjson.h"
 #include "emv_pki.h"
 #include "emvcore.h"
+#include "emv_oda.h"
 #include "test/cryptotest.h"
 #include "cliparser/cliparser.h"
 #include "jansson.h"
@@ -675,7 +678,7 @@ int CmdEMVInternalAuthenticate(const char *cmd) {
 	return 0;
 }
 
-#define dreturn(n) {free(pdol_data_tlv); tlvdb_free(tlvSelect); tlvdb_free(tlvRoot); DropFieldEx( channel ); return n;}
+#define dreturn(n) {emv_oda_job_free(&odajob); free(pdol_data_tlv); tlvdb_free(tlvSelect); tlvdb_free(tlvRoot); DropFieldEx( channel ); return n;}
 
 void InitTransactionParameters(struct tlvdb *tlvRoot, bool paramLoadJSON, enum TransactionType TrType, bool GenACGPO) {
 
@@ -798,12 +801,15 @@ int CmdEMVExec(const char *cmd) {
 	struct tlvdb *tlvSelect = NULL;
 	struct tlvdb *tlvRoot = NULL;
 	struct tlv *pdol_data_tlv = NULL;
+	emv_oda_job_t odajob;
+	emv_oda_job_init(&odajob, NULL, NULL, false);
 
 	CLIParserInit("emv exec",
 		"Executes EMV contactless transaction",
 		"Usage:\n"
 			"\temv exec -sat -> select card, execute MSD transaction, show APDU and TLV\n"
-			"\temv exec -satc -> select card, execute CDA transaction, show APDU and TLV\n");
+			"\temv exec -satc -> select card, execute CDA transaction, show APDU and TLV\n"
+			"\temv exec -satcd -> select card, execute CDA transaction, verify SDA/DDA/CDA after the field is off\n");
 
 	void* argtable[] = {
 		arg_param_begin,
@@ -818,6 +824,7 @@ int CmdEMVExec(const char *cmd) {
 		arg_lit0("xX",  "vsdc",     "Transaction type - VSDC. For test only. Not a standart behavior."),
 		arg_lit0("gG",  "acgpo",    "VISA. generate AC from GPO."),
 		arg_lit0("wW",  "wired",   "Send data via contact (iso7816) interface. Contactless interface set by default."),
+		arg_lit0("dD",  "defer",    "Defer offline data authentication (SDA/DDA/CDA) until the card exchange is finished."),
 		arg_param_end
 	};
 	CLIExecWithReturn(cmd, argtable, true);
@@ -842,6 +849,7 @@ int CmdEMVExec(const char *cmd) {
 	if (arg_get_lit(11))
 		channel = ECC_CONTACT;
 #endif
+	bool deferODA = arg_get_lit(12);
 	PrintChannel(channel);
 	uint8_t psenum = (channel == ECC_CONTACT) ? 1 : 2;
 	char *PSE_or_PPSE = psenum == 1 ? "PSE" : "PPSE";
@@ -1038,14 +1046,25 @@ int CmdEMVExec(const char *cmd) {
 
 	// SDA
 	if (AIP & 0x0040) {
-		PrintAndLogEx(NORMAL, "\n* SDA");
-		trSDA(tlvRoot);
+		if (deferODA) {
+			odajob.methods |= ODA_SDA;
+		} else {
+			PrintAndLogEx(NORMAL, "\n* SDA");
+			trSDA(tlvRoot);
+		}
 	}
 
 	// DDA
 	if (AIP & 0x0020) {
-		PrintAndLogEx(NORMAL, "\n* DDA");
-		trDDA(channel, decodeTLV, tlvRoot);
+		if (deferODA) {
+			// only the card exchange here. fDDA doesn't need it. "* DDA" is printed with the results.
+			odajob.methods |= ODA_DDA;
+			if (!tlvdb_get(tlvRoot, 0x9f4b, NULL))
+				trDDAInternalAuthenticate(channel, decodeTLV, tlvRoot, &odajob.ddol_data_tlv, &odajob.dda_db);
+		} else {
+			PrintAndLogEx(NORMAL, "\n* DDA");
+			trDDA(channel, decodeTLV, tlvRoot);
+		}
 	}
 
 	// transaction check
@@ -1134,14 +1153,21 @@ int CmdEMVExec(const char *cmd) {
 				TLVPrintFromBuffer(buf, len);
 
 			// CDA
-			PrintAndLogEx(NORMAL, "\n* CDA:");
 			struct tlvdb *ac_tlv = tlvdb_parse_multi(buf, len);
-			res = trCDA(tlvRoot, ac_tlv, pdol_data_tlv, cdol_data_tlv);
-			if (res) {
-				PrintAndLogEx(NORMAL, "CDA error (%d)", res);
+			if (deferODA) {
+				odajob.methods |= ODA_CDA;
+				odajob.ac_tlv = ac_tlv;
+				odajob.pdol_data_tlv = pdol_data_tlv;
+				odajob.cdol_data_tlv = cdol_data_tlv;
+			} else {
+				PrintAndLogEx(NORMAL, "\n* CDA:");
+				res = trCDA(tlvRoot, ac_tlv, pdol_data_tlv, cdol_data_tlv);
+				if (res) {
+					PrintAndLogEx(NORMAL, "CDA error (%d)", res);
+				}
+				free(ac_tlv);
+				free(cdol_data_tlv);
 			}
-			free(ac_tlv);
-			free(cdol_data_tlv);
 
 			PrintAndLogEx(NORMAL, "\n* M/Chip transaction result:");
 			// 9F27: Cryptogram Information Data (CID)
@@ -1365,7 +1391,16 @@ int CmdEMVExec(const char *cmd) {
 	
 	DropFieldEx( channel );
 
+	// deferred offline data authentication. card is not needed anymore.
+	if (odajob.methods) {
+		PrintAndLogEx(NORMAL, "\n* Offline data authentication");
+		odajob.tlv = tlvRoot;
+		emv_oda_verify_batch(&odajob, 1, 1);
+		emv_oda_print_result(&odajob);
+	}
+
 	// Destroy TLV's
+	emv_oda_job_free(&odajob);
 	free(pdol_data_tlv);
 	tlvdb_free(tlvSelect);
 	tlvdb_free(tlvRoot);
@@ -1731,6 +1766,54 @@ int CmdEMVScan(const char *cmd) {
 	return 0;
 }
 
+int CmdEMVVerify(const char *cmd) {
+	CLIParserInit("emv verify",
+		"Offline data authentication of cards saved by `emv scan`. Checks SDA, fDDA and recovers issuer and ICC certificates "
+		"on a pool of threads. DDA and CDA need data from a live transaction (`emv exec`).",
+		"Usage:\n"
+			"\temv verify card1.json card2.json -> verify two cards\n"
+			"\temv verify -t 4 card1.json card2.json card3.json -> verify three cards with 4 threads\n");
+
+	void* argtable[] = {
+		arg_param_begin,
+		arg_int0("tT",  "threads",  "number of threads (by default - number of CPUs).", NULL),
+		arg_strx1(NULL, NULL,       "<json file>", "JSON files saved by `emv scan`"),
+		arg_param_end
+	};
+	CLIExecWithReturn(cmd, argtable, false);
+
+	int threads = arg_get_int_def(1, 0);
+	struct arg_str *files = arg_get_str(2);
+
+	emv_oda_job_t *jobs = calloc(files->count, sizeof(emv_oda_job_t));
+	if (!jobs) {
+		PrintAndLogEx(ERR, "Cannot allocate memory");
+		CLIParserFree();
+		return 1;
+	}
+
+	size_t count = 0;
+	for (int i = 0; i < files->count; i++) {
+		if (!emv_oda_load_json(&jobs[count], files->sval[i]))
+			count++;
+	}
+	CLIParserFree();
+
+	uint64_t t1 = msclock();
+	int failed = emv_oda_verify_batch(jobs, count, threads);
+	t1 = msclock() - t1;
+
+	for (size_t i = 0; i < count; i++) {
+		emv_oda_print_result(&jobs[i]);
+		emv_oda_job_free(&jobs[i]);
+	}
+	free(jobs);
+
+	PrintAndLogEx(NORMAL, "");
+	PrintAndLogEx(failed ? WARNING : SUCCESS, "Verified %zu card(s) in %" PRIu64 " ms. Failed: %d", count, t1, failed);
+	return 0;
+}
+
 int CmdEMVTest(const char *cmd) {
 	return ExecuteCryptoTests(true);
 }
@@ -2009,6 +2092,7 @@ static command_t CommandTable[] =  {
 	{"challenge",   CmdEMVGenerateChallenge,    1,  "Generate challenge."},
 	{"intauth",     CmdEMVInternalAuthenticate, 1,  "Internal authentication."},
 	{"scan",        CmdEMVScan,                 1,  "Scan EMV card and save it contents to json file for emulator."},
+	{"verify",      CmdEMVVerify,               1,  "Offline data authentication of `emv scan` json files."},
 	{"test",        CmdEMVTest,                 1,  "Crypto logic test."},
 	{"roca",        CmdEMVRoca,                 1,  "Extract public keys and run ROCA test"},
 	{NULL,          NULL,                       0,  NULL}
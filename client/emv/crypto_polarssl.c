@@ -32,6 +32,7 @@
 struct crypto_hash_polarssl {
 	struct crypto_hash ch;
 	mbedtls_sha1_context ctx;
+	unsigned char sha1sum[20];
 };
 
 static void crypto_hash_polarssl_close(struct crypto_hash *_ch)
@@ -52,9 +53,9 @@ static unsigned char *crypto_hash_polarssl_read(struct crypto_hash *_ch)
 {
 	struct crypto_hash_polarssl *ch = (struct crypto_hash_polarssl *)_ch;
 
-	static unsigned char sha1sum[20];
-	mbedtls_sha1_finish(&(ch->ctx), sha1sum);
-	return sha1sum;
+	// per context, so hashes can be computed from several threads
+	mbedtls_sha1_finish(&(ch->ctx), ch->sha1sum);
+	return ch->sha1sum;
 }
 
 static size_t crypto_hash_polarssl_get_size(const struct crypto_hash *ch)
@@ -0,0 +1,506 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// EMV offline data authentication (SDA/DDA/CDA) decoupled from the card
+// exchange. Jobs are filled while talking to the card (or from `emv scan`
+// json dumps) and verified later on a pool of worker threads.
+//-----------------------------------------------------------------------------
+
+#include "emv_oda.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <jansson.h>
+#include "emv_pki.h"
+#include "emvjson.h"
+#include "emvcore.h"
+#include "ui.h"
+#include "util.h"
+
+#define ODA_MAX_THREADS 64
+
+void emv_oda_job_init(emv_oda_job_t *job, const char *name, struct tlvdb *tlv, bool tlv_owned) {
+	memset(job, 0, sizeof(*job));
+	if (name)
+		strncpy(job->name, name, sizeof(job->name) - 1);
+	job->tlv = tlv;
+	job->tlv_owned = tlv_owned;
+	job->sda_res = -1;
+	job->dda_res = -1;
+	job->cda_res = -1;
+}
+
+void emv_oda_job_free(emv_oda_job_t *job) {
+	if (job->tlv_owned)
+		tlvdb_free(job->tlv);
+	free(job->ddol_data_tlv);
+	tlvdb_free(job->dda_db);
+	tlvdb_free(job->ac_tlv);
+	free(job->cdol_data_tlv);
+	tlvdb_free(job->result_db);
+	memset(job, 0, sizeof(*job));
+}
+
+static void oda_add_result(emv_oda_job_t *job, struct tlvdb *db) {
+	if (!job->result_db)
+		job->result_db = db;
+	else
+		tlvdb_add(job->result_db, db);
+}
+
+// SSAD check. SDA, DDA and CDA all start with it.
+static int oda_check_dac(emv_oda_job_t *job, struct emv_pk *issuer_pk, const struct tlv *sda_tlv) {
+	struct tlvdb *dac_db = emv_pki_recover_dac_ex(issuer_pk, job->tlv, sda_tlv, false);
+	if (!dac_db)
+		return 4;
+
+	oda_add_result(job, dac_db);
+	return 0;
+}
+
+static int oda_check_dda(emv_oda_job_t *job, struct emv_pk *icc_pk, int *dac_res, struct emv_pk *issuer_pk, const struct tlv *sda_tlv) {
+	// fDDA. 9F4B from GPO. EMV kernel3 v2.4, contactless book C-3, C.1., page 147
+	if (job->fdda) {
+		struct tlvdb *atc_db = emv_pki_recover_atc_ex(icc_pk, job->tlv, false);
+		if (!atc_db)
+			return 8;
+
+		oda_add_result(job, atc_db);
+		return tlvdb_get(atc_db, 0x9f36, NULL) ? 0 : 9;
+	}
+
+	if (*dac_res < 0)
+		*dac_res = oda_check_dac(job, issuer_pk, sda_tlv);
+	if (*dac_res)
+		return *dac_res;
+
+	if (!job->ddol_data_tlv || !job->dda_db)
+		return 6;
+
+	struct tlvdb *idn_db = emv_pki_recover_idn_ex(icc_pk, job->dda_db, job->ddol_data_tlv, false);
+	if (!idn_db)
+		return 8;
+
+	oda_add_result(job, idn_db);
+	return tlvdb_get(idn_db, 0x9f4c, NULL) ? 0 : 9;
+}
+
+static int oda_check_cda(emv_oda_job_t *job, struct emv_pk *icc_pk, int *dac_res, struct emv_pk *issuer_pk, const struct tlv *sda_tlv) {
+	if (!sda_tlv || sda_tlv->len < 1)
+		return 3;
+
+	if (*dac_res < 0)
+		*dac_res = oda_check_dac(job, issuer_pk, sda_tlv);
+	if (*dac_res)
+		return *dac_res;
+
+	if (!job->ac_tlv)
+		return 7;
+
+	struct tlvdb *idn_db = emv_pki_perform_cda_ex(icc_pk, job->tlv, job->ac_tlv,
+			job->pdol_data_tlv, // pdol
+			job->cdol_data_tlv, // cdol1
+			NULL,               // cdol2
+			false);
+	if (!idn_db)
+		return 9;
+
+	oda_add_result(job, idn_db);
+	return 0;
+}
+
+static int oda_verify(emv_oda_job_t *job) {
+	job->sda_res = (job->methods & ODA_SDA) ? 2 : -1;
+	job->dda_res = (job->methods & ODA_DDA) ? 2 : -1;
+	job->cda_res = (job->methods & ODA_CDA) ? 2 : -1;
+	job->issuer_pk_ok = false;
+	job->icc_pk_ok = false;
+	job->fdda = (job->methods & ODA_DDA) && !job->dda_db && tlvdb_get(job->tlv, 0x9f4b, NULL);
+	tlvdb_free(job->result_db);
+	job->result_db = NULL;
+
+	if (!job->ca_pk)
+		return 2;
+
+	struct emv_pk *issuer_pk = emv_pki_recover_issuer_cert(job->ca_pk, job->tlv);
+	if (!issuer_pk)
+		return 2;
+	job->issuer_pk_ok = true;
+
+	const struct tlv *sda_tlv = tlvdb_get(job->tlv, 0x21, NULL);
+	int dac_res = -1;
+
+	if (job->methods & ODA_SDA) {
+		if (!sda_tlv || sda_tlv->len < 1) {
+			job->sda_res = 3;
+		} else {
+			dac_res = oda_check_dac(job, issuer_pk, sda_tlv);
+			job->sda_res = dac_res;
+		}
+	}
+
+	if (job->methods & (ODA_DDA | ODA_CDA | ODA_ICC)) {
+		struct emv_pk *icc_pk = emv_pki_recover_icc_cert(issuer_pk, job->tlv, sda_tlv);
+		if (icc_pk) {
+			job->icc_pk_ok = true;
+			if (job->methods & ODA_DDA)
+				job->dda_res = oda_check_dda(job, icc_pk, &dac_res, issuer_pk, sda_tlv);
+			if (job->methods & ODA_CDA)
+				job->cda_res = oda_check_cda(job, icc_pk, &dac_res, issuer_pk, sda_tlv);
+			emv_pk_free(icc_pk);
+		}
+	}
+
+	emv_pk_free(issuer_pk);
+
+	if ((job->methods & ODA_ICC) && !job->icc_pk_ok)
+		return 2;
+	if (job->sda_res > 0)
+		return job->sda_res;
+	if (job->dda_res > 0)
+		return job->dda_res;
+	if (job->cda_res > 0)
+		return job->cda_res;
+	return 0;
+}
+
+// Verifies one card. Doesn't print anything: PKI errors are kept in job->pki_log, so it can run on a worker thread.
+// Returns 0 if all requested methods passed.
+int emv_oda_verify(emv_oda_job_t *job) {
+	PKISetLogBuffer(job->pki_log, sizeof(job->pki_log));
+	int res = oda_verify(job);
+	PKISetLogBuffer(NULL, 0);
+	return res;
+}
+
+typedef struct {
+	uint8_t rid[5];
+	uint8_t index;
+	struct emv_pk *pk;
+} oda_ca_key_t;
+
+// CA keys are read from file with logging, so they are resolved on the calling thread, once per RID and index.
+static struct emv_pk *oda_get_ca_pk(oda_ca_key_t *keys, size_t *keys_count, struct tlvdb *tlv) {
+	const struct tlv *df_tlv = tlvdb_get(tlv, 0x84, NULL);
+	const struct tlv *caidx_tlv = tlvdb_get(tlv, 0x8f, NULL);
+
+	if (!df_tlv || !caidx_tlv || df_tlv->len < 6 || caidx_tlv->len != 1)
+		return NULL;
+
+	for (size_t i = 0; i < *keys_count; i++)
+		if (!memcmp(keys[i].rid, df_tlv->value, 5) && keys[i].index == caidx_tlv->value[0])
+			return keys[i].pk;
+
+	oda_ca_key_t *key = &keys[(*keys_count)++];
+	memcpy(key->rid, df_tlv->value, 5);
+	key->index = caidx_tlv->value[0];
+	key->pk = emv_pk_get_ca_pk(df_tlv->value, caidx_tlv->value[0]);
+	return key->pk;
+}
+
+typedef struct {
+	emv_oda_job_t *jobs;
+	size_t count;
+	size_t next;
+	pthread_mutex_t lock;
+} oda_pool_t;
+
+static void *oda_worker(void *arg) {
+	oda_pool_t *pool = (oda_pool_t *)arg;
+
+	while (true) {
+		pthread_mutex_lock(&pool->lock);
+		size_t i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (i >= pool->count)
+			break;
+
+		emv_oda_verify(&pool->jobs[i]);
+	}
+
+	return NULL;
+}
+
+// Verifies `count` cards on `threads` workers (<= 0 - one per CPU). Returns the number of failed cards.
+int emv_oda_verify_batch(emv_oda_job_t *jobs, size_t count, int threads) {
+	if (!count)
+		return 0;
+
+	oda_ca_key_t *keys = calloc(count, sizeof(oda_ca_key_t));
+	bool *resolved = calloc(count, sizeof(bool));
+	if (!keys || !resolved) {
+		PrintAndLogEx(ERR, "Cannot allocate memory for CA keys");
+		free(keys);
+		free(resolved);
+		return count;
+	}
+
+	size_t keys_count = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (!jobs[i].ca_pk) {
+			jobs[i].ca_pk = oda_get_ca_pk(keys, &keys_count, jobs[i].tlv);
+			resolved[i] = true;
+		}
+	}
+
+	if (threads <= 0)
+		threads = num_CPUs();
+	if (threads > count)
+		threads = count;
+	if (threads > ODA_MAX_THREADS)
+		threads = ODA_MAX_THREADS;
+
+	oda_pool_t pool = {.jobs = jobs, .count = count, .next = 0};
+
+	if (threads <= 1) {
+		oda_worker(&pool);
+	} else {
+		pthread_t thread_id[ODA_MAX_THREADS];
+		pthread_mutex_init(&pool.lock, NULL);
+		for (int i = 0; i < threads; i++)
+			pthread_create(&thread_id[i], NULL, oda_worker, &pool);
+		for (int i = 0; i < threads; i++)
+			pthread_join(thread_id[i], NULL);
+		pthread_mutex_destroy(&pool.lock);
+	}
+
+	int failed = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (resolved[i])
+			jobs[i].ca_pk = NULL;
+		if (jobs[i].sda_res > 0 || jobs[i].dda_res > 0 || jobs[i].cda_res > 0 || !jobs[i].issuer_pk_ok || ((jobs[i].methods & ODA_ICC) && !jobs[i].icc_pk_ok))
+			failed++;
+	}
+
+	for (size_t i = 0; i < keys_count; i++)
+		emv_pk_free(keys[i].pk);
+	free(keys);
+	free(resolved);
+
+	return failed;
+}
+
+static const char *oda_res_str(int res) {
+	switch (res) {
+		case 0:
+			return "verified OK.";
+		case 2:
+			return "Error: certificate not found.";
+		case 3:
+			return "Error: Can't find input list for Offline Data Authentication.";
+		case 4:
+			return "Error: SSAD verify error.";
+		case 6:
+			return "Error: no Internal Authenticate data.";
+		case 7:
+			return "Error: no Generate AC data.";
+		case 8:
+			return "Error: Can't recover dynamic data.";
+		case 9:
+			return "Error: verify error.";
+		default:
+			return "Error.";
+	}
+}
+
+static void oda_print_pki_log(emv_oda_job_t *job) {
+	char *line = job->pki_log;
+	while (*line) {
+		char *end = strchr(line, '\n');
+		size_t len = end ? end - line : strlen(line);
+		if (len)
+			PrintAndLogEx(WARNING, "%.*s", (int)len, line);
+		line += len + (end ? 1 : 0);
+	}
+}
+
+void emv_oda_print_result(emv_oda_job_t *job) {
+	if (job->name[0])
+		PrintAndLogEx(NORMAL, "\n* %s", job->name);
+
+	oda_print_pki_log(job);
+
+	if (!job->issuer_pk_ok) {
+		PrintAndLogEx(WARNING, "Error: Key or issuer certificate not found.");
+		return;
+	}
+	PrintAndLogEx(SUCCESS, "Issuer PK recovered.");
+
+	if (job->methods & (ODA_DDA | ODA_CDA | ODA_ICC)) {
+		if (job->icc_pk_ok)
+			PrintAndLogEx(SUCCESS, "ICC PK recovered.");
+		else
+			PrintAndLogEx(WARNING, "Error: ICC certificate not found.");
+	}
+
+	const struct tlv *dac_tlv = tlvdb_get(job->result_db, 0x9f45, NULL);
+	const struct tlv *idn_tlv = tlvdb_get(job->result_db, 0x9f4c, NULL);
+	const struct tlv *atc_tlv = tlvdb_get(job->result_db, 0x9f36, NULL);
+
+	if (job->sda_res >= 0)
+		PrintAndLogEx(job->sda_res ? WARNING : SUCCESS, "SDA %s", oda_res_str(job->sda_res));
+	if (dac_tlv && dac_tlv->len >= 2)
+		PrintAndLogEx(NORMAL, "Data Authentication Code: %02hhx:%02hhx", dac_tlv->value[0], dac_tlv->value[1]);
+
+	if (job->dda_res >= 0 && job->icc_pk_ok) {
+		PrintAndLogEx(NORMAL, "\n* DDA");
+		PrintAndLogEx(job->dda_res ? WARNING : SUCCESS, "%s %s", job->fdda ? "fDDA (fast DDA)" : "DDA", oda_res_str(job->dda_res));
+	}
+	if (job->fdda && atc_tlv) {
+		PrintAndLogEx(NORMAL, "ATC (Application Transaction Counter) [%zu] %s", atc_tlv->len, sprint_hex_inrow(atc_tlv->value, atc_tlv->len));
+		if (!tlv_equal(tlvdb_get(job->tlv, 0x9f36, NULL), atc_tlv))
+			PrintAndLogEx(WARNING, "Error: fDDA verified, but ATC in the certificate and ATC in the record not the same.");
+	}
+
+	if (job->cda_res >= 0 && job->icc_pk_ok)
+		PrintAndLogEx(job->cda_res ? WARNING : SUCCESS, "CDA %s", oda_res_str(job->cda_res));
+
+	if (idn_tlv)
+		PrintAndLogEx(NORMAL, "IDN (ICC Dynamic Number) [%zu] %s", idn_tlv->len, sprint_hex_inrow(idn_tlv->value, idn_tlv->len));
+}
+
+static bool oda_record_offline(const struct tlv *afl, uint8_t sfi, uint8_t recnum) {
+	if (!afl)
+		return false;
+
+	for (int i = 0; i < afl->len / 4; i++) {
+		uint8_t SFIstart = afl->value[i * 4 + 1];
+		uint8_t SFIoffline = afl->value[i * 4 + 3];
+		if ((afl->value[i * 4 + 0] >> 3) == sfi && recnum >= SFIstart && recnum < SFIstart + SFIoffline)
+			return true;
+	}
+
+	return false;
+}
+
+// encodes a saved TLV tree (object or array of objects) back to a buffer
+static int oda_load_tlv_buf(json_t *root, json_t *elm, uint8_t *buf, size_t maxlen, size_t *len) {
+	*len = 0;
+	if (json_is_array(elm)) {
+		for (int i = 0; i < json_array_size(elm); i++)
+			if (JsonLoadTLVElm(root, json_array_get(elm, i), buf, maxlen, len))
+				return 1;
+		return 0;
+	}
+
+	return JsonLoadTLVElm(root, elm, buf, maxlen, len);
+}
+
+// Rebuilds card data from an `emv scan` dump: FCI, GPO and AFL records plus the input list for ODA.
+// A dump has no GENERATE AC and INTERNAL AUTHENTICATE data, so CDA and DDA (except fDDA) can't be checked.
+int emv_oda_load_json(emv_oda_job_t *job, const char *fname) {
+	json_error_t error;
+	uint8_t buf[4096];
+	size_t len = 0;
+	uint8_t ODAiList[4096];
+	size_t ODAiListLen = 0;
+
+	json_t *root = json_load_file(fname, 0, &error);
+	if (!root) {
+		PrintAndLogEx(ERR, "%s: json error on line %d: %s", fname, error.line, error.text);
+		return 1;
+	}
+
+	if (!json_is_object(root)) {
+		PrintAndLogEx(ERR, "%s: Invalid json format. root must be an object.", fname);
+		json_decref(root);
+		return 1;
+	}
+
+	struct tlvdb *tlv = tlvdb_fixed(1, strlen(fname), (const unsigned char *)fname);
+
+	json_t *fci = json_path_get(root, "$.Application.FCITemplate");
+	if (!fci || oda_load_tlv_buf(root, fci, buf, sizeof(buf), &len)) {
+		PrintAndLogEx(ERR, "%s: Can't load `$.Application.FCITemplate`.", fname);
+		tlvdb_free(tlv);
+		json_decref(root);
+		return 2;
+	}
+	tlvdb_add(tlv, tlvdb_parse_multi(buf, len));
+
+	json_t *gpo = json_path_get(root, "$.Application.GPO");
+	if (!gpo || oda_load_tlv_buf(root, gpo, buf, sizeof(buf), &len) || len < 2) {
+		PrintAndLogEx(ERR, "%s: Can't load `$.Application.GPO`.", fname);
+		tlvdb_free(tlv);
+		json_decref(root);
+		return 2;
+	}
+	if (buf[0] == 0x80) {
+		// format1: AIP + AFL
+		struct tlvdb *f1 = tlvdb_parse_multi(buf, len);
+		const struct tlv *f1tlv = tlvdb_get_tlv(f1);
+		if (f1tlv && f1tlv->len >= 2) {
+			tlvdb_add(tlv, tlvdb_fixed(0x82, 2, f1tlv->value));
+			tlvdb_add(tlv, tlvdb_fixed(0x94, f1tlv->len - 2, f1tlv->value + 2));
+		}
+		tlvdb_free(f1);
+	} else {
+		tlvdb_add(tlv, tlvdb_parse_multi(buf, len));
+	}
+
+	// Build Input list for Offline Data Authentication
+	// EMV 4.3 book3 10.3, page 96
+	const struct tlv *AFL = tlvdb_get(tlv, 0x94, NULL);
+	json_t *records = json_path_get(root, "$.Application.Records");
+	for (int i = 0; json_is_array(records) && i < json_array_size(records); i++) {
+		json_t *rec = json_array_get(records, i);
+		uint8_t SFI = 0, RecordNum = 0;
+		size_t vlen = 0;
+		if (JsonLoadBufAsHex(rec, "$.SFI", &SFI, 1, &vlen) || JsonLoadBufAsHex(rec, "$.RecordNum", &RecordNum, 1, &vlen) ||
+			oda_load_tlv_buf(root, json_object_get(rec, "Data"), buf, sizeof(buf), &len)) {
+			PrintAndLogEx(WARNING, "%s: Can't load record %d. Skipped.", fname, i);
+			continue;
+		}
+
+		tlvdb_add(tlv, tlvdb_parse_multi(buf, len));
+
+		if (!oda_record_offline(AFL, SFI, RecordNum))
+			continue;
+
+		if (SFI < 11) {
+			const unsigned char *abuf = buf;
+			size_t elmlen = len;
+			struct tlv e;
+			if (tlv_parse_tl(&abuf, &elmlen, &e) && ODAiListLen + elmlen <= sizeof(ODAiList)) {
+				memcpy(&ODAiList[ODAiListLen], &buf[len - elmlen], elmlen);
+				ODAiListLen += elmlen;
+			}
+		} else if (ODAiListLen + len <= sizeof(ODAiList)) {
+			memcpy(&ODAiList[ODAiListLen], buf, len);
+			ODAiListLen += len;
+		}
+	}
+
+	json_decref(root);
+
+	if (ODAiListLen)
+		tlvdb_add(tlv, tlvdb_fixed(0x21, ODAiListLen, ODAiList)); // not a standard tag
+
+	// extract PAN from track2
+	const struct tlv *track2 = tlvdb_get(tlv, 0x57, NULL);
+	if (!tlvdb_get(tlv, 0x5a, NULL) && track2 && track2->len >= 8) {
+		struct tlvdb *pan = GetPANFromTrack2(track2);
+		if (pan)
+			tlvdb_add(tlv, pan);
+	}
+
+	emv_oda_job_init(job, fname, tlv, true);
+
+	uint16_t AIP = 0;
+	const struct tlv *AIPtlv = tlvdb_get(tlv, 0x82, NULL);
+	if (AIPtlv && AIPtlv->len >= 2)
+		AIP = AIPtlv->value[0] + AIPtlv->value[1] * 0x100;
+
+	if (AIP & 0x0040)
+		job->methods |= ODA_SDA;
+	if (AIP & 0x0020)
+		job->methods |= tlvdb_get(tlv, 0x9f4b, NULL) ? ODA_DDA : ODA_ICC;
+	if (AIP & 0x0001)
+		job->methods |= ODA_ICC;
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// EMV offline data authentication (SDA/DDA/CDA) decoupled from the card
+// exchange. Jobs are filled while talking to the card (or from `emv scan`
+// json dumps) and verified later on a pool of worker threads.
+//-----------------------------------------------------------------------------
+
+#ifndef EMV_ODA_H__
+#define EMV_ODA_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tlv.h"
+#include "emv_pk.h"
+
+#define ODA_SDA   0x01
+#define ODA_DDA   0x02
+#define ODA_CDA   0x04
+#define ODA_ICC   0x08    // recover ICC certificate only
+
+// result codes are the same as trSDA/trDDA/trCDA return. -1 - not performed.
+typedef struct {
+	char name[128];
+	struct tlvdb *tlv;              // card data with the input list for ODA (tag 0x21). freed with the job if tlv_owned
+	bool tlv_owned;
+	uint8_t methods;                // ODA_SDA | ODA_DDA | ODA_CDA
+
+	// DDA. INTERNAL AUTHENTICATE data. Without it DDA checks fDDA data (9F4B from GPO)
+	struct tlv *ddol_data_tlv;
+	struct tlvdb *dda_db;
+
+	// CDA. GENERATE AC response and DOL data. pdol_data_tlv is not owned by the job
+	struct tlvdb *ac_tlv;
+	struct tlv *pdol_data_tlv;
+	struct tlv *cdol_data_tlv;
+
+	// results
+	struct emv_pk *ca_pk;           // resolved by emv_oda_verify_batch, not owned
+	bool issuer_pk_ok;
+	bool icc_pk_ok;
+	bool fdda;
+	int sda_res;
+	int dda_res;
+	int cda_res;
+	struct tlvdb *result_db;        // recovered 9F45 DAC, 9F4C IDN, 9F36 ATC
+	char pki_log[1024];             // PKI errors, printed by emv_oda_print_result
+} emv_oda_job_t;
+
+extern void emv_oda_job_init(emv_oda_job_t *job, const char *name, struct tlvdb *tlv, bool tlv_owned);
+extern void emv_oda_job_free(emv_oda_job_t *job);
+extern int emv_oda_load_json(emv_oda_job_t *job, const char *fname);
+
+extern int emv_oda_verify(emv_oda_job_t *job);
+extern int emv_oda_verify_batch(emv_oda_job_t *jobs, size_t count, int threads);
+extern void emv_oda_print_result(emv_oda_job_t *job);
+
+#endif
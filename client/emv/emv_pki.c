@@ -22,6 +22,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <pthread.h>
 #include "crypto.h"
 #include "dump.h"
 #include "util.h"
@@ -32,6 +34,56 @@ void PKISetStrictExecution(bool se) {
 	strictExecution = se;
 }
 
+// Errors go to the log, or to the buffer set with PKISetLogBuffer() on the calling thread.
+typedef struct {
+	char *buf;
+	size_t size;
+} pki_log_t;
+
+static pthread_key_t pki_log_key;
+static pthread_once_t pki_log_once = PTHREAD_ONCE_INIT;
+
+static void pki_log_key_init(void) {
+	pthread_key_create(&pki_log_key, free);
+}
+
+void PKISetLogBuffer(char *buf, size_t size) {
+	pthread_once(&pki_log_once, pki_log_key_init);
+
+	pki_log_t *log = pthread_getspecific(pki_log_key);
+	if (!log) {
+		if (!buf)
+			return;
+		log = calloc(1, sizeof(pki_log_t));
+		if (!log)
+			return;
+		pthread_setspecific(pki_log_key, log);
+	}
+
+	log->buf = size ? buf : NULL;
+	log->size = size;
+	if (log->buf)
+		log->buf[0] = '\0';
+}
+
+static void pki_log(logLevel_t level, const char *fmt, ...) {
+	char line[256];
+	va_list va;
+	va_start(va, fmt);
+	vsnprintf(line, sizeof(line), fmt, va);
+	va_end(va);
+
+	pthread_once(&pki_log_once, pki_log_key_init);
+	pki_log_t *log = pthread_getspecific(pki_log_key);
+	if (!log || !log->buf) {
+		PrintAndLogEx(level, "%s", line);
+		return;
+	}
+
+	size_t len = strlen(log->buf);
+	snprintf(log->buf + len, log->size - len, "%s", line);
+}
+
 static const unsigned char empty_tlv_value[] = {};
 static const struct tlv empty_tlv = {.tag = 0x0, .len = 0, .value = empty_tlv_value};
 
@@ -54,12 +106,12 @@ static unsigned char *emv_pki_decode_message(const struct emv_pk *enc_pk,
 		return NULL;
 
 	if (!cert_tlv) {
-		PrintAndLogEx(ERR, "Can't find certificate\n");
+		pki_log(ERR, "Can't find certificate\n");
 		return NULL;
 	}
 
 	if (cert_tlv->len != enc_pk->mlen) {
-		PrintAndLogEx(ERR, "Certificate length (%zd) not equal key length (%zd)\n", cert_tlv->len, enc_pk->mlen);
+		pki_log(ERR, "Certificate length (%zd) not equal key length (%zd)\n", cert_tlv->len, enc_pk->mlen);
 		return NULL;
 	}
 	kcp = crypto_pk_open(enc_pk->pk_algo,
@@ -77,14 +129,14 @@ static unsigned char *emv_pki_decode_message(const struct emv_pk *enc_pk,
 	}*/
 
 	if (data[data_len-1] != 0xbc || data[0] != 0x6a || data[1] != msgtype) {
-		PrintAndLogEx(ERR, "Certificate format\n");
+		pki_log(ERR, "Certificate format\n");
 		free(data);
 		return NULL;
 	}
 
 	size_t hash_pos = emv_pki_hash_psn[msgtype];
 	if (hash_pos == 0 || hash_pos > data_len){
-		PrintAndLogEx(ERR, "Can't get hash position in the certificate\n");
+		pki_log(ERR, "Can't get hash position in the certificate\n");
 		free(data);
 		return NULL;
 	}
@@ -92,7 +144,7 @@ static unsigned char *emv_pki_decode_message(const struct emv_pk *enc_pk,
 	struct crypto_hash *ch;
 	ch = crypto_hash_open(data[hash_pos]);
 	if (!ch) {
-		PrintAndLogEx(ERR, "Can't do hash\n");
+		pki_log(ERR, "Can't do hash\n");
 		free(data);
 		return NULL;
 	}
@@ -114,9 +166,10 @@ static unsigned char *emv_pki_decode_message(const struct emv_pk *enc_pk,
 	memset(hash, 0, hash_len);
 	memcpy(hash, crypto_hash_read(ch), hash_len);
 	if (memcmp(data + data_len - 1 - hash_len, hash, hash_len)) {
-		PrintAndLogEx(ERR, "Calculated wrong hash\n");
-		PrintAndLogEx(INFO, "decoded:    %s\n",sprint_hex(data + data_len - 1 - hash_len, hash_len));
-		PrintAndLogEx(INFO, "calculated: %s\n",sprint_hex(hash, hash_len));
+		pki_log(ERR, "Calculated wrong hash\n");
+		char hex[SPRINT_HEX_SIZE(64)];
+		pki_log(INFO, "decoded:    %s\n", sprint_hex_r(hex, sizeof(hex), data + data_len - 1 - hash_len, hash_len));
+		pki_log(INFO, "calculated: %s\n", sprint_hex_r(hex, sizeof(hex), hash, hash_len));
 		
 		if (strictExecution) {
 			crypto_hash_close(ch);
@@ -189,7 +242,7 @@ static struct emv_pk *emv_pki_decode_key_ex(const struct emv_pk *enc_pk,
 	else if (msgtype == 4)
 		pan_length = 10;
 	else {
-		PrintAndLogEx(ERR, "Message type must be 2 or 4\n");
+		pki_log(ERR, "Message type must be 2 or 4\n");
 		return NULL;
 	}
 
@@ -202,7 +255,7 @@ static struct emv_pk *emv_pki_decode_key_ex(const struct emv_pk *enc_pk,
 			sdatl_tlv,
 			NULL);
 	if (!data || data_len < 11 + pan_length) {
-		PrintAndLogEx(ERR, "Can't decode message\n");
+		pki_log(ERR, "Can't decode message\n");
 		return NULL;
 	}
 
@@ -223,7 +276,7 @@ static struct emv_pk *emv_pki_decode_key_ex(const struct emv_pk *enc_pk,
 
 	if (((msgtype == 2) && (pan2_len < 4 || pan2_len > pan_len)) ||
 	    ((msgtype == 4) && (pan2_len != pan_len))) {
-		PrintAndLogEx(ERR, "Invalid PAN lengths\n");
+		pki_log(ERR, "Invalid PAN lengths\n");
 		free(data);
 
 		return NULL;
@@ -232,9 +285,10 @@ static struct emv_pk *emv_pki_decode_key_ex(const struct emv_pk *enc_pk,
 	unsigned i;
 	for (i = 0; i < pan2_len; i++)
 		if (emv_cn_get(pan_tlv, i) != emv_cn_get(&pan2_tlv, i)) {
-			PrintAndLogEx(ERR, "PAN data mismatch\n");
-			PrintAndLogEx(INFO, "tlv  pan=%s\n", sprint_hex(pan_tlv->value, pan_tlv->len));
-			PrintAndLogEx(INFO, "cert pan=%s\n", sprint_hex(pan2_tlv.value, pan2_tlv.len));
+			pki_log(ERR, "PAN data mismatch\n");
+			char hex[SPRINT_HEX_SIZE(32)];
+			pki_log(INFO, "tlv  pan=%s\n", sprint_hex_r(hex, sizeof(hex), pan_tlv->value, pan_tlv->len));
+			pki_log(INFO, "cert pan=%s\n", sprint_hex_r(hex, sizeof(hex), pan2_tlv.value, pan2_tlv.len));
 			free(data);
 
 			return NULL;
@@ -242,7 +296,7 @@ static struct emv_pk *emv_pki_decode_key_ex(const struct emv_pk *enc_pk,
 
 	pk_len = data[9 + pan_length];
 	if (pk_len > data_len - 11 - pan_length + rem_tlv->len) {
-		PrintAndLogEx(ERR, "Invalid pk length\n");
+		pki_log(ERR, "Invalid pk length\n");
 		free(data);
 		return NULL;
 	}
@@ -529,7 +583,7 @@ struct tlvdb *emv_pki_perform_cda_ex(const struct emv_pk *enc_pk, const struct t
 			un_tlv,
 			NULL);
 	if (!data || data_len < 3) {
-		PrintAndLogEx(ERR, "can't decode message. len %zd\n", data_len);
+		pki_log(ERR, "can't decode message. len %zd\n", data_len);
 		return NULL;
 	}
 
@@ -539,13 +593,13 @@ struct tlvdb *emv_pki_perform_cda_ex(const struct emv_pk *enc_pk, const struct t
 	}
 
 	if (data[3] < 30 || data[3] > data_len - 4) {
-		PrintAndLogEx(ERR, "Invalid data length\n");
+		pki_log(ERR, "Invalid data length\n");
 		free(data);
 		return NULL;
 	}
 
 	if (!cid_tlv || cid_tlv->len != 1 || cid_tlv->value[0] != data[5 + data[4]]) {
-		PrintAndLogEx(ERR, "CID mismatch\n");
+		pki_log(ERR, "CID mismatch\n");
 		free(data);
 		return NULL;
 	}
@@ -553,7 +607,7 @@ struct tlvdb *emv_pki_perform_cda_ex(const struct emv_pk *enc_pk, const struct t
 	struct crypto_hash *ch;
 	ch = crypto_hash_open(enc_pk->hash_algo);
 	if (!ch) {
-		PrintAndLogEx(ERR, "Can't create hash\n");
+		pki_log(ERR, "Can't create hash\n");
 		free(data);
 		return NULL;
 	}
@@ -568,7 +622,7 @@ struct tlvdb *emv_pki_perform_cda_ex(const struct emv_pk *enc_pk, const struct t
 	tlvdb_visit(this_db, tlv_hash, ch, 0);
 
 	if (memcmp(data + 5 + data[4] + 1 + 8, crypto_hash_read(ch), 20)) {
-		PrintAndLogEx(ERR, "Calculated hash error\n");
+		pki_log(ERR, "Calculated hash error\n");
 		crypto_hash_close(ch);
 		free(data);
 		return NULL;
@@ -577,7 +631,7 @@ struct tlvdb *emv_pki_perform_cda_ex(const struct emv_pk *enc_pk, const struct t
 
 	size_t idn_len = data[4];
 	if (idn_len > data[3] - 1) {
-		PrintAndLogEx(ERR, "Invalid IDN length\n");
+		pki_log(ERR, "Invalid IDN length\n");
 		free(data);
 		return NULL;
 	}
@@ -22,6 +22,8 @@
 #include <stddef.h>
 
 extern void PKISetStrictExecution(bool se);
+// collect the calling thread's PKI errors in buf instead of printing them. NULL - print again
+extern void PKISetLogBuffer(char *buf, size_t size);
 
 unsigned char *emv_pki_sdatl_fill(const struct tlvdb *db, size_t *sdatl_len);
 struct emv_pk *emv_pki_recover_issuer_cert(const struct emv_pk *pk, struct tlvdb *db);
@@ -778,11 +778,74 @@ int trSDA(struct tlvdb *tlv) {
 static const unsigned char default_ddol_value[] = {0x9f, 0x37, 0x04};
 static struct tlv default_ddol_tlv = {.tag = 0x9f49, .len = 3, .value = default_ddol_value };
 
-int trDDA(EMVCommandChannel channel, bool decodeTLV, struct tlvdb *tlv) {
+int trDDAInternalAuthenticate(EMVCommandChannel channel, bool decodeTLV, struct tlvdb *tlv, struct tlv **ddol_data_tlv, struct tlvdb **dda_db) {
 	uint8_t buf[APDU_RESPONSE_LEN] = {0};
 	size_t len = 0;
 	uint16_t sw = 0;
 
+	*ddol_data_tlv = NULL;
+	*dda_db = NULL;
+
+	PrintAndLogEx(NORMAL, "\n* Calc DDOL");
+	const struct tlv *ddol_tlv = tlvdb_get(tlv, 0x9f49, NULL);
+	if (!ddol_tlv) {
+		ddol_tlv = &default_ddol_tlv;
+		PrintAndLogEx(NORMAL, "DDOL [9f49] not found. Using default DDOL");
+	}
+
+	struct tlv *ddol_data = dol_process(ddol_tlv, tlv, 0);
+	if (!ddol_data) {
+		PrintAndLogEx(WARNING, "Error: Can't create DDOL TLV");
+		return 5;
+	}
+
+	PrintAndLogEx(NORMAL, "DDOL data[%d]: %s", ddol_data->len, sprint_hex(ddol_data->value, ddol_data->len));
+
+	PrintAndLogEx(NORMAL, "\n* Internal Authenticate");
+	int res = EMVInternalAuthenticate(channel, true, (uint8_t *)ddol_data->value, ddol_data->len, buf, sizeof(buf), &len, &sw, NULL);
+	if (res) {
+		PrintAndLogEx(WARNING, "Internal Authenticate error(%d): %4x. Exit...", res, sw);
+		free(ddol_data);
+		return 6;
+	}
+
+	struct tlvdb *dda = NULL;
+	if (buf[0] == 0x80) {
+		if (len < 3 ) {
+			PrintAndLogEx(WARNING, "Error: Internal Authenticate format1 parsing error. length=%d", len);
+		} else {
+			// parse response 0x80
+			struct tlvdb *t80 = tlvdb_parse_multi(buf, len);
+			const struct tlv * t80tlv = tlvdb_get_tlv(t80);
+
+			// 9f4b Signed Dynamic Application Data
+			dda = tlvdb_fixed(0x9f4b, t80tlv->len, t80tlv->value);
+
+			tlvdb_free(t80);
+
+			if (decodeTLV){
+				PrintAndLogEx(NORMAL, "* * Decode response format 1:");
+				TLVPrintFromTLV(dda);
+			}
+		}
+	} else {
+		dda = tlvdb_parse_multi(buf, len);
+		if(!dda) {
+			PrintAndLogEx(WARNING, "Error: Can't parse Internal Authenticate result as TLV");
+			free(ddol_data);
+			return 7;
+		}
+
+		if (decodeTLV)
+			TLVPrintFromTLV(dda);
+	}
+
+	*ddol_data_tlv = ddol_data;
+	*dda_db = dda;
+	return 0;
+}
+
+int trDDA(EMVCommandChannel channel, bool decodeTLV, struct tlvdb *tlv) {
 	struct emv_pk *pk = get_ca_pk(tlv);
 	if (!pk) {
 		PrintAndLogEx(WARNING, "Error: Key not found. Exit.");
@@ -903,70 +966,16 @@ int trDDA(EMVCommandChannel channel, bool decodeTLV, struct tlvdb *tlv) {
 			return 4;
 		}
 
-		PrintAndLogEx(NORMAL, "\n* Calc DDOL");
-		const struct tlv *ddol_tlv = tlvdb_get(tlv, 0x9f49, NULL);
-		if (!ddol_tlv) {
-			ddol_tlv = &default_ddol_tlv;
-			PrintAndLogEx(NORMAL, "DDOL [9f49] not found. Using default DDOL");
-		}
-
-		struct tlv *ddol_data_tlv = dol_process(ddol_tlv, tlv, 0);
-		if (!ddol_data_tlv) {
-			PrintAndLogEx(WARNING, "Error: Can't create DDOL TLV");
-			emv_pk_free(pk);
-			emv_pk_free(issuer_pk);
-			emv_pk_free(icc_pk);
-			return 5;
-		}
-
-		PrintAndLogEx(NORMAL, "DDOL data[%d]: %s", ddol_data_tlv->len, sprint_hex(ddol_data_tlv->value, ddol_data_tlv->len));
-
-		PrintAndLogEx(NORMAL, "\n* Internal Authenticate");
-		int res = EMVInternalAuthenticate(channel, true, (uint8_t *)ddol_data_tlv->value, ddol_data_tlv->len, buf, sizeof(buf), &len, &sw, NULL);
+		struct tlv *ddol_data_tlv = NULL;
+		struct tlvdb *dda_db = NULL;
+		int res = trDDAInternalAuthenticate(channel, decodeTLV, tlv, &ddol_data_tlv, &dda_db);
 		if (res) {
-			PrintAndLogEx(WARNING, "Internal Authenticate error(%d): %4x. Exit...", res, sw);
-			free(ddol_data_tlv);
 			emv_pk_free(pk);
 			emv_pk_free(issuer_pk);
 			emv_pk_free(icc_pk);
-			return 6;
-		}
-
-		struct tlvdb *dda_db = NULL;
-		if (buf[0] == 0x80) {
-			if (len < 3 ) {
-				PrintAndLogEx(WARNING, "Error: Internal Authenticate format1 parsing error. length=%d", len);
-			} else {
-				// parse response 0x80
-				struct tlvdb *t80 = tlvdb_parse_multi(buf, len);
-				const struct tlv * t80tlv = tlvdb_get_tlv(t80);
-				
-				// 9f4b Signed Dynamic Application Data
-				dda_db = tlvdb_fixed(0x9f4b, t80tlv->len, t80tlv->value);
-				tlvdb_add(tlv, dda_db);
-				
-				tlvdb_free(t80);
-				
-				if (decodeTLV){
-					PrintAndLogEx(NORMAL, "* * Decode response format 1:");
-					TLVPrintFromTLV(dda_db);
-				}
-			}
-		} else {
-			dda_db = tlvdb_parse_multi(buf, len);
-			if(!dda_db) {
-				PrintAndLogEx(WARNING, "Error: Can't parse Internal Authenticate result as TLV");
-				free(ddol_data_tlv);
-				emv_pk_free(pk);
-				emv_pk_free(issuer_pk);
-				emv_pk_free(icc_pk);
-				return 7;
-			}
-			tlvdb_add(tlv, dda_db);
-
-			if (decodeTLV)
-				TLVPrintFromTLV(dda_db);
+			return res;
 		}
+		tlvdb_add(tlv, dda_db);
 
 		struct tlvdb *idn_db = emv_pki_recover_idn_ex(icc_pk, dda_db, ddol_data_tlv, true);
 		free(ddol_data_tlv);
@@ -82,6 +82,8 @@ int MSCComputeCryptoChecksum(EMVCommandChannel channel, bool LeaveFieldON, uint8
 // Auth
 extern int trSDA(struct tlvdb *tlv);
 extern int trDDA(EMVCommandChannel channel, bool decodeTLV, struct tlvdb *tlv);
+// DDA card exchange only: DDOL data and INTERNAL AUTHENTICATE result for a deferred check
+extern int trDDAInternalAuthenticate(EMVCommandChannel channel, bool decodeTLV, struct tlvdb *tlv, struct tlv **ddol_data_tlv, struct tlvdb **dda_db);
 extern int trCDA(struct tlvdb *tlv, struct tlvdb *ac_tlv, struct tlv *pdol_data_tlv, struct tlv *ac_data_tlv);
 
 extern int RecoveryCertificates(struct tlvdb *tlvRoot, json_t *root);
@@ -68,6 +68,14 @@ char* GetApplicationDataName(tlv_tag_t tag) {
 	return NULL;
 }
 
+tlv_tag_t GetApplicationDataTag(const char *name) {
+	for (int i = 0; i < ApplicationDataLen; i++)
+		if (!strcmp(ApplicationData[i].Name, name))
+			return ApplicationData[i].Tag;
+
+	return 0;
+}
+
 int JsonSaveJsonObject(json_t *root, char *path, json_t *value) {
 	json_error_t error;
 
@@ -295,6 +303,79 @@ int JsonLoadBufAsHex(json_t *elm, char *path, uint8_t *data, size_t maxbufferlen
 	return 0;
 };
 
+static bool JsonTLVPut(uint8_t *data, size_t maxdatalen, size_t *datalen, const uint8_t *tag, size_t taglen, const uint8_t *value, size_t valuelen) {
+	uint8_t lenbuf[3];
+	size_t lenlen = 0;
+	if (valuelen < 0x80) {
+		lenbuf[lenlen++] = valuelen;
+	} else if (valuelen < 0x100) {
+		lenbuf[lenlen++] = 0x81;
+		lenbuf[lenlen++] = valuelen;
+	} else {
+		lenbuf[lenlen++] = 0x82;
+		lenbuf[lenlen++] = valuelen >> 8;
+		lenbuf[lenlen++] = valuelen & 0xff;
+	}
+
+	if (*datalen + taglen + lenlen + valuelen > maxdatalen)
+		return false;
+
+	memcpy(&data[*datalen], tag, taglen);
+	*datalen += taglen;
+	memcpy(&data[*datalen], lenbuf, lenlen);
+	*datalen += lenlen;
+	memcpy(&data[*datalen], value, valuelen);
+	*datalen += valuelen;
+	return true;
+}
+
+// Encodes a TLV element saved by JsonSaveTLVTree/JsonSaveTLVTreeElm back to BER-TLV.
+// Handles leafs with `value`, constructed elements with `Childs` and `appdata` links to $.ApplicationData
+int JsonLoadTLVElm(json_t *root, json_t *elm, uint8_t *data, size_t maxdatalen, size_t *datalen) {
+	uint8_t tag[4] = {0};
+	size_t taglen = 0;
+	uint8_t value[2048];
+	size_t valuelen = 0;
+
+	if (!json_is_object(elm))
+		return 1;
+
+	json_t *jappdata = json_object_get(elm, "appdata");
+	if (json_is_string(jappdata)) {
+		tlv_tag_t apptag = GetApplicationDataTag(json_string_value(jappdata));
+		if (!apptag)
+			return 2;
+		if (apptag > 0xff)
+			tag[taglen++] = apptag >> 8;
+		tag[taglen++] = apptag & 0xff;
+
+		char appdatalink[200] = {0};
+		snprintf(appdatalink, sizeof(appdatalink) - 1, "$.ApplicationData.%s", json_string_value(jappdata));
+		if (JsonLoadBufAsHex(root, appdatalink, value, sizeof(value), &valuelen))
+			return 2;
+	} else {
+		if (JsonLoadBufAsHex(elm, "$.tag", tag, sizeof(tag), &taglen) || !taglen)
+			return 2;
+
+		json_t *jchilds = json_object_get(elm, "Childs");
+		if (json_is_array(jchilds)) {
+			for (int i = 0; i < json_array_size(jchilds); i++) {
+				int res = JsonLoadTLVElm(root, json_array_get(jchilds, i), value, sizeof(value), &valuelen);
+				if (res)
+					return res;
+			}
+		} else if (json_object_get(elm, "value")) {
+			if (JsonLoadBufAsHex(elm, "$.value", value, sizeof(value), &valuelen))
+				return 2;
+		}
+	}
+
+	if (!JsonTLVPut(data, maxdatalen, datalen, tag, taglen, value, valuelen))
+		return 3;
+
+	return 0;
+}
+
 bool ParamLoadFromJson(struct tlvdb *tlv) {
 	json_t *root;
 	json_error_t error;
@@ -19,6 +19,7 @@ typedef struct {
 } ApplicationDataElm;
 
 extern char* GetApplicationDataName(tlv_tag_t tag);
+extern tlv_tag_t GetApplicationDataTag(const char *name);
 
 extern int JsonSaveJsonObject(json_t *root, char *path, json_t *value);
 extern int JsonSaveStr(json_t *root, char *path, char *value);
@@ -35,6 +36,7 @@ extern int JsonSaveTLVTree(json_t *root, json_t *elm, char *path, struct tlvdb *
 
 extern int JsonLoadStr(json_t *root, char *path, char *value);
 extern int JsonLoadBufAsHex(json_t *elm, char *path, uint8_t *data, size_t maxbufferlen, size_t *datalen);
+extern int JsonLoadTLVElm(json_t *root, json_t *elm, uint8_t *data, size_t maxdatalen, size_t *datalen);
 
 extern bool ParamLoadFromJson(struct tlvdb *tlv);
 
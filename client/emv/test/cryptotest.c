@@ -73,6 +73,9 @@ int ExecuteCryptoTests(bool verbose) {
 	res = ecdsa_nist_test(verbose);
 	if (res) TestFail = true;
 
+	res = aes_cmac_nist_test(verbose);
+	if (res) TestFail = true;
+
 	res = mbedtls_ecp_self_test(verbose);
 	if (res) TestFail = true;
 
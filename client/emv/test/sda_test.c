@@ -22,6 +22,7 @@
 #include "../dump.h"
 #include "../tlv.h"
 #include "../emv_pki.h"
+#include "../emv_oda.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -254,6 +255,58 @@ static int sda_test_pk(bool verbose)
 	return 0;
 }
 
+#define SDA_BATCH_JOBS 8
+
+static int sda_test_batch(bool verbose)
+{
+	emv_oda_job_t jobs[SDA_BATCH_JOBS];
+
+	for (int i = 0; i < SDA_BATCH_JOBS; i++) {
+		struct tlvdb *db = tlvdb_external(0x90, sizeof(issuer_cert), issuer_cert);
+		tlvdb_add(db, tlvdb_external(0x9f32, sizeof(issuer_exp), issuer_exp));
+		tlvdb_add(db, tlvdb_external(0x92, sizeof(issuer_rem), issuer_rem));
+		tlvdb_add(db, tlvdb_external(0x5a, sizeof(pan), pan));
+		tlvdb_add(db, tlvdb_external(0x21, ssd1_tlv.len, ssd1_tlv.value));
+
+		// the last card has a broken signature
+		unsigned char ssad[sizeof(ssad_cr)];
+		memcpy(ssad, ssad_cr, sizeof(ssad));
+		if (i == SDA_BATCH_JOBS - 1)
+			ssad[sizeof(ssad) / 2] ^= 0x01;
+		tlvdb_add(db, tlvdb_fixed(0x93, sizeof(ssad), ssad));
+
+		emv_oda_job_init(&jobs[i], NULL, db, true);
+		jobs[i].methods = ODA_SDA;
+		jobs[i].ca_pk = &vsdc_01;
+	}
+
+	int failed = emv_oda_verify_batch(jobs, SDA_BATCH_JOBS, 4);
+
+	int ret = 0;
+	for (int i = 0; i < SDA_BATCH_JOBS; i++) {
+		int expected = (i == SDA_BATCH_JOBS - 1) ? 4 : 0;
+		if (jobs[i].sda_res != expected || !jobs[i].issuer_pk_ok) {
+			fprintf(stderr, "Job %d: SDA result %d, expected %d\n", i, jobs[i].sda_res, expected);
+			ret = 2;
+		}
+		if (!expected && !tlvdb_get(jobs[i].result_db, 0x9f45, NULL)) {
+			fprintf(stderr, "Job %d: DAC not found!\n", i);
+			ret = 2;
+		}
+		emv_oda_job_free(&jobs[i]);
+	}
+
+	if (failed != 1) {
+		fprintf(stderr, "Batch failed count %d, expected 1\n", failed);
+		ret = 2;
+	}
+
+	if (verbose)
+		printf("batch: %d jobs, %d failed\n", SDA_BATCH_JOBS, failed);
+
+	return ret;
+}
+
 int exec_sda_test(bool verbose)
 {
 	int ret;
@@ -273,5 +326,12 @@ int exec_sda_test(bool verbose)
 	}
 	fprintf(stdout, "SDA test pk: passed\n");
 
+	ret = sda_test_batch(verbose);
+	if (ret) {
+		fprintf(stderr, "SDA batch test: failed\n");
+		return ret;
+	}
+	fprintf(stdout, "SDA batch test: passed\n");
+
 	return 0;
 }
@@ -319,6 +319,188 @@ int JsonToCbor(json_t *elm, CborEncoder *encoder) {
 	return 0;
 }
 
+static CborError CborIndexContainer(CborIndex *index, CborValue *it, bool isMap, int parent) {
+	CborError err;
+
+	while (!cbor_value_at_end(it)) {
+		int keyelm = parent;
+		if (isMap) {
+			if (index->count >= CBOR_INDEX_MAX_KEYS) {
+				index->truncated = true;
+				return CborErrorOutOfMemory;
+			}
+
+			CborIndexKey *key = &index->keys[index->count];
+			memset(key, 0, sizeof(*key));
+			key->parent = parent;
+
+			if (cbor_value_is_integer(it)) {
+				cbor_value_get_int64(it, &key->id);
+				err = cbor_value_advance_fixed(it);
+				cbor_check(err);
+			} else if (cbor_value_is_text_string(it)) {
+				size_t n = 0;
+				key->isName = true;
+				err = cbor_value_calculate_string_length(it, &n);
+				cbor_check(err);
+				if (n < sizeof(key->name)) {
+					n = sizeof(key->name);
+					err = cbor_value_copy_text_string(it, key->name, &n, it);
+				} else {
+					// too long for a FIDO key. can't be found by name.
+					err = cbor_value_advance(it);
+				}
+				cbor_check(err);
+			} else {
+				err = cbor_value_advance(it);
+				cbor_check(err);
+				key->parent = -2;  // unsupported key type. never matches.
+			}
+
+			key->value = *it;
+			keyelm = index->count++;
+		}
+
+		if (cbor_value_is_container(it)) {
+			CborValue recursed;
+			err = cbor_value_enter_container(it, &recursed);
+			cbor_check(err);
+			err = CborIndexContainer(index, &recursed, cbor_value_is_map(it), keyelm);
+			cbor_check(err);
+			err = cbor_value_leave_container(it, &recursed);
+			cbor_check(err);
+		} else {
+			err = cbor_value_advance(it);
+			cbor_check(err);
+		}
+	}
+
+	return CborNoError;
+}
+
+// Walks the package once and records the position of every map key (top level and nested).
+// Lookups after that don't parse the package again. If the package has more keys than
+// CBOR_INDEX_MAX_KEYS, the index keeps the first ones and lookups of the rest scan the map.
+CborError CborIndexInit(CborIndex *index, uint8_t *data, size_t dataLen) {
+	index->count = 0;
+	index->truncated = false;
+	index->spare = 0;
+
+	CborError err = cbor_parser_init(data, dataLen, 0, &index->parser, &index->root);
+	cbor_check(err);
+
+	CborValue it = index->root;
+	if (!cbor_value_is_container(&it))
+		return CborNoError;
+
+	CborValue recursed;
+	err = cbor_value_enter_container(&it, &recursed);
+	cbor_check(err);
+	err = CborIndexContainer(index, &recursed, cbor_value_is_map(&it), CBOR_INDEX_ROOT);
+	if (index->truncated)
+		return CborNoError;
+	cbor_check(err);
+	return cbor_value_leave_container(&it, &recursed);
+}
+
+static bool CborIndexKeyMatch(CborIndexKey *k, int parent, bool isName, int64_t id, const char *name) {
+	if (k->parent != parent || k->isName != isName)
+		return false;
+
+	return isName ? !strcmp(k->name, name) : k->id == id;
+}
+
+// unindexed lookup for a truncated index: scans the parent map and keeps the hit in a spare slot,
+// so it can be the parent of further lookups. Spare slots are never reused, a lookup fails
+// when they are all taken, so a parent index handed out earlier stays valid.
+static int CborIndexScanMap(CborIndex *index, int parent, bool isName, int64_t id, const char *name, CborValue *value, int *elm) {
+	CborValue map;
+	if (parent == CBOR_INDEX_ROOT)
+		map = index->root;
+	else if ((parent >= 0 && parent < index->count) || (parent >= CBOR_INDEX_MAX_KEYS && parent < CBOR_INDEX_MAX_KEYS + index->spare))
+		map = index->keys[parent].value;
+	else
+		return 2;
+
+	if (!cbor_value_is_map(&map))
+		return 2;
+
+	CborValue it;
+	if (cbor_value_enter_container(&map, &it) != CborNoError)
+		return 2;
+
+	while (!cbor_value_at_end(&it)) {
+		bool match = false;
+		if (!isName && cbor_value_is_integer(&it)) {
+			int64_t kid = 0;
+			cbor_value_get_int64(&it, &kid);
+			match = kid == id;
+			if (cbor_value_advance_fixed(&it) != CborNoError)
+				return 2;
+		} else if (isName && cbor_value_is_text_string(&it)) {
+			bool equal = false;
+			if (cbor_value_text_string_equals(&it, name, &equal) != CborNoError || cbor_value_advance(&it) != CborNoError)
+				return 2;
+			match = equal;
+		} else if (cbor_value_advance(&it) != CborNoError) {
+			return 2;
+		}
+
+		if (match) {
+			if (index->spare >= CBOR_INDEX_SPARE_KEYS)
+				return 2;
+			int slot = CBOR_INDEX_MAX_KEYS + index->spare++;
+
+			CborIndexKey *k = &index->keys[slot];
+			memset(k, 0, sizeof(*k));
+			k->parent = parent;
+			k->isName = isName;
+			k->id = id;
+			if (isName)
+				strncpy(k->name, name, sizeof(k->name) - 1);
+			k->value = it;
+
+			if (value)
+				*value = it;
+			if (elm)
+				*elm = slot;
+			return 0;
+		}
+
+		if (cbor_value_advance(&it) != CborNoError)
+			return 2;
+	}
+
+	return 2;
+}
+
+static int CborIndexGetKey(CborIndex *index, int parent, bool isName, int64_t id, const char *name, CborValue *value, int *elm) {
+	// indexed keys, then the keys already found by a map scan
+	for (int j = 0; j < index->count + index->spare; j++) {
+		int i = (j < index->count) ? j : CBOR_INDEX_MAX_KEYS + j - index->count;
+		if (CborIndexKeyMatch(&index->keys[i], parent, isName, id, name)) {
+			if (value)
+				*value = index->keys[i].value;
+			if (elm)
+				*elm = i;
+			return 0;
+		}
+	}
+
+	if (!index->truncated)
+		return 2;
+
+	return CborIndexScanMap(index, parent, isName, id, name, value, elm);
+}
+
+int CborIndexGetKeyById(CborIndex *index, int parent, int64_t key, CborValue *value, int *elm) {
+	return CborIndexGetKey(index, parent, false, key, NULL, value, elm);
+}
+
+int CborIndexGetKeyByName(CborIndex *index, int parent, const char *key, CborValue *value, int *elm) {
+	return CborIndexGetKey(index, parent, true, 0, key, value, elm);
+}
+
 int CborMapGetKeyById(CborParser *parser, CborValue *map, uint8_t *data, size_t dataLen, int key) {
 	CborValue cb;
 
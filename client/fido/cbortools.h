@@ -21,9 +21,37 @@
 #define cbor_check_if(r) if ((r) != CborNoError) {return r;} else
 #define cbor_check(r) if ((r) != CborNoError) return r;
 
+#define CBOR_INDEX_ROOT       -1
+#define CBOR_INDEX_MAX_KEYS   128
+#define CBOR_INDEX_SPARE_KEYS 8       // keys found by scanning a map that didn't fit in the index. not reused
+#define CBOR_INDEX_MAX_NAME   32
+
+// map key found by the indexer. `value` points to the value of the key.
+typedef struct {
+	int parent;                        // key that holds this map (CBOR_INDEX_ROOT - top level map)
+	bool isName;                       // text key. otherwise integer key in `id`
+	int64_t id;
+	char name[CBOR_INDEX_MAX_NAME];
+	CborValue value;
+} CborIndexKey;
+
+// all the map keys of a CBOR package, collected in one pass
+typedef struct {
+	CborParser parser;
+	CborValue root;
+	CborIndexKey keys[CBOR_INDEX_MAX_KEYS + CBOR_INDEX_SPARE_KEYS];
+	int count;
+	bool truncated;                    // package has more keys than the index holds. misses fall back to a map scan
+	int spare;                         // spare slots used
+} CborIndex;
+
 extern int TinyCborPrintFIDOPackage(uint8_t cmdCode, bool isResponse, uint8_t *data, size_t length);
 extern int JsonToCbor(json_t *elm, CborEncoder *encoder);
 
+extern CborError CborIndexInit(CborIndex *index, uint8_t *data, size_t dataLen);
+extern int CborIndexGetKeyById(CborIndex *index, int parent, int64_t key, CborValue *value, int *elm);
+extern int CborIndexGetKeyByName(CborIndex *index, int parent, const char *key, CborValue *value, int *elm);
+
 extern int CborMapGetKeyById(CborParser *parser, CborValue *map, uint8_t *data, size_t dataLen, int key);
 extern CborError CborGetArrayBinStringValue(CborValue *elm, uint8_t *data, size_t maxdatalen, size_t *datalen);
 extern CborError CborGetArrayBinStringValueEx(CborValue *elm, uint8_t *data, size_t maxdatalen, size_t *datalen, uint8_t *delimeter, size_t delimeterlen);
@@ -158,16 +158,19 @@ const char *GetCOSEAlgDescription(int id) {
 }
 
 int COSEGetECDSAKey(uint8_t *data, size_t datalen, bool verbose, uint8_t *public_key) {
-	CborParser parser;
+	CborIndex index;
 	CborValue map;
 	int64_t i64;
 	size_t len;
 
 	if(verbose)
 		PrintAndLog("----------- CBOR decode ----------------");
+
+	int res = CborIndexInit(&index, data, datalen);
+	cbor_check(res);
 	
 	// kty
-	int res = CborMapGetKeyById(&parser, &map, data, datalen, 1);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, 1, &map, NULL);
 	if(!res) {
 		cbor_value_get_int64(&map, &i64);    
 		if(verbose)
@@ -177,7 +180,7 @@ int COSEGetECDSAKey(uint8_t *data, size_t datalen, bool verbose, uint8_t *public
 	}
 
 	// algorithm
-	res = CborMapGetKeyById(&parser, &map, data, datalen, 3);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, 3, &map, NULL);
 	if(!res) {
 		cbor_value_get_int64(&map, &i64);    
 		if(verbose)
@@ -187,7 +190,7 @@ int COSEGetECDSAKey(uint8_t *data, size_t datalen, bool verbose, uint8_t *public
 	}
 	
 	// curve
-	res = CborMapGetKeyById(&parser, &map, data, datalen, -1);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, -1, &map, NULL);
 	if(!res) {
 		cbor_value_get_int64(&map, &i64);    
 		if(verbose)
@@ -200,7 +203,7 @@ int COSEGetECDSAKey(uint8_t *data, size_t datalen, bool verbose, uint8_t *public
 	public_key[0] = 0x04;
 	
 	// x - coordinate
-	res = CborMapGetKeyById(&parser, &map, data, datalen, -2);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, -2, &map, NULL);
 	if(!res) {
 		res = CborGetBinStringValue(&map, &public_key[1], 32, &len);
 		cbor_check(res);
@@ -211,7 +214,7 @@ int COSEGetECDSAKey(uint8_t *data, size_t datalen, bool verbose, uint8_t *public
 	}
 
 	// y - coordinate
-	res = CborMapGetKeyById(&parser, &map, data, datalen, -3);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, -3, &map, NULL);
 	if(!res) {
 		res = CborGetBinStringValue(&map, &public_key[33], 32, &len);
 		cbor_check(res);
@@ -223,7 +226,7 @@ int COSEGetECDSAKey(uint8_t *data, size_t datalen, bool verbose, uint8_t *public
 
 	// d - private key
 	uint8_t private_key[128] = {0};
-	res = CborMapGetKeyById(&parser, &map, data, datalen, -4);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, -4, &map, NULL);
 	if(!res) {
 		res = CborGetBinStringValue(&map, private_key, sizeof(private_key), &len);
 		cbor_check(res);
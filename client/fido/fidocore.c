@@ -416,15 +416,19 @@ int FIDO2CheckSignature(json_t *root, uint8_t *publickey, uint8_t *sign, size_t
 }
 
 int FIDO2MakeCredentionalParseRes(json_t *root, uint8_t *data, size_t dataLen, bool verbose, bool verbose2, bool showCBOR, bool showDERTLV) {
-	CborParser parser;
+	CborIndex index;
 	CborValue map, mapsmt;
 	int res;
 	char *buf;
 	uint8_t *ubuf;
 	size_t n;
+
+	// one pass over the response. all the keys below are taken from the index.
+	res = CborIndexInit(&index, data, dataLen);
+	cbor_check(res);
 	
 	// fmt
-	res = CborMapGetKeyById(&parser, &map, data, dataLen, 1);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, 1, &map, NULL);
 	if (res)
 		return res;
 	
@@ -436,7 +440,7 @@ int FIDO2MakeCredentionalParseRes(json_t *root, uint8_t *data, size_t dataLen, b
 	// authData
 	uint8_t authData[400] = {0}; 
 	size_t authDataLen = 0;
-	res = CborMapGetKeyById(&parser, &map, data, dataLen, 2);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, 2, &map, NULL);
 	if (res)
 		return res;
 	res = cbor_value_dup_byte_string(&map, &ubuf, &n, &map);
@@ -520,49 +524,38 @@ int FIDO2MakeCredentionalParseRes(json_t *root, uint8_t *data, size_t dataLen, b
 	uint8_t der[4097] = {0};
 	size_t derLen = 0;
 	
-	res = CborMapGetKeyById(&parser, &map, data, dataLen, 3);
+	int attStmt;
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, 3, &map, &attStmt);
 	if (res)
 		return res;
 
-	res = cbor_value_enter_container(&map, &mapsmt);
-	cbor_check(res);
-	
-	while (!cbor_value_at_end(&mapsmt)) {
-		char key[100] = {0};
-		res = CborGetStringValue(&mapsmt, key, sizeof(key), &n);
+	if (!CborIndexGetKeyByName(&index, attStmt, "alg", &mapsmt, NULL)) {
+		cbor_value_get_int64(&mapsmt, &alg);    
+		PrintAndLog("Alg [%lld] %s", (long long)alg, GetCOSEAlgDescription(alg));
+	}
+
+	if (!CborIndexGetKeyByName(&index, attStmt, "sig", &mapsmt, NULL)) {
+		res = CborGetBinStringValue(&mapsmt, sign, sizeof(sign), &signLen);
 		cbor_check(res);
-		if (!strcmp(key, "alg")) {
-			cbor_value_get_int64(&mapsmt, &alg);    
-			PrintAndLog("Alg [%lld] %s", (long long)alg, GetCOSEAlgDescription(alg));
-			res = cbor_value_advance_fixed(&mapsmt);
-			cbor_check(res);
+		if (verbose2) {
+			PrintAndLog("signature [%d]: %s", signLen, sprint_hex_inrow(sign, signLen));
+		} else {
+			PrintAndLog("signature [%d]: %s...", signLen, sprint_hex(sign, MIN(signLen, 16)));
 		}
+	}
 
-		if (!strcmp(key, "sig")) {
-			res = CborGetBinStringValue(&mapsmt, sign, sizeof(sign), &signLen);
-			cbor_check(res);
-			if (verbose2) {
-				PrintAndLog("signature [%d]: %s", signLen, sprint_hex_inrow(sign, signLen));
-			} else {
-				PrintAndLog("signature [%d]: %s...", signLen, sprint_hex(sign, MIN(signLen, 16)));
-			}
+	if (!CborIndexGetKeyByName(&index, attStmt, "x5c", &mapsmt, NULL)) {
+		res = CborGetArrayBinStringValue(&mapsmt, der, sizeof(der), &derLen);
+		cbor_check(res);
+		if (verbose2) {
+			PrintAndLog("DER certificate[%d]:\n------------------DER-------------------", derLen);
+			dump_buffer_simple((const unsigned char *)der, derLen, NULL);
+			PrintAndLog("\n----------------DER---------------------");
+		} else {
+			PrintAndLog("DER [%d]: %s...", derLen, sprint_hex(der, MIN(derLen, 16)));
 		}
-
-		if (!strcmp(key, "x5c")) {
-			res = CborGetArrayBinStringValue(&mapsmt, der, sizeof(der), &derLen);
-			cbor_check(res);
-			if (verbose2) {
-				PrintAndLog("DER certificate[%d]:\n------------------DER-------------------", derLen);
-				dump_buffer_simple((const unsigned char *)der, derLen, NULL);
-				PrintAndLog("\n----------------DER---------------------");
-			} else {
-				PrintAndLog("DER [%d]: %s...", derLen, sprint_hex(der, MIN(derLen, 16)));
-			}
-				JsonSaveBufAsHexCompact(root, "$.AppData.DER", der, derLen);
-		}		
+		JsonSaveBufAsHexCompact(root, "$.AppData.DER", der, derLen);
 	}
-	res = cbor_value_leave_container(&map, &mapsmt);
-	cbor_check(res);
 	
 	uint8_t public_key[65] = {0};
 
@@ -656,46 +649,40 @@ int FIDO2CreateGetAssertionReq(json_t *root, uint8_t *data, size_t maxdatalen, s
 }
 
 int FIDO2GetAssertionParseRes(json_t *root, uint8_t *data, size_t dataLen, bool verbose, bool verbose2, bool showCBOR) {
-	CborParser parser;
+	CborIndex index;
 	CborValue map, mapint;
 	int res;
 	uint8_t *ubuf;
 	size_t n;
+
+	// one pass over the response. all the keys below are taken from the index.
+	res = CborIndexInit(&index, data, dataLen);
+	cbor_check(res);
 	
 	// credential
-	res = CborMapGetKeyById(&parser, &map, data, dataLen, 1);
+	int credential;
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, 1, &map, &credential);
 	if (res)
 		return res;
 
-	res = cbor_value_enter_container(&map, &mapint);
-	cbor_check(res);
-	
-	while (!cbor_value_at_end(&mapint)) {
-		char key[100] = {0};
-		res = CborGetStringValue(&mapint, key, sizeof(key), &n);
+	if (!CborIndexGetKeyByName(&index, credential, "type", &mapint, NULL)) {
+		char ctype[200] = {0};
+		res = CborGetStringValue(&mapint, ctype, sizeof(ctype), &n);
 		cbor_check(res);
+		PrintAndLog("credential type: %s", ctype);
+	}
 
-		if (!strcmp(key, "type")) {
-			char ctype[200] = {0};
-			res = CborGetStringValue(&mapint, ctype, sizeof(ctype), &n);
-			cbor_check(res);
-			PrintAndLog("credential type: %s", ctype);
-		}
-
-		if (!strcmp(key, "id")) {
-			uint8_t cid[200] = {0};
-			res = CborGetBinStringValue(&mapint, cid, sizeof(cid), &n);
-			cbor_check(res);
-			PrintAndLog("credential id [%d]: %s", n, sprint_hex(cid, n));
-		}
+	if (!CborIndexGetKeyByName(&index, credential, "id", &mapint, NULL)) {
+		uint8_t cid[200] = {0};
+		res = CborGetBinStringValue(&mapint, cid, sizeof(cid), &n);
+		cbor_check(res);
+		PrintAndLog("credential id [%d]: %s", n, sprint_hex(cid, n));
 	}
-	res = cbor_value_leave_container(&map, &mapint);
-	cbor_check(res);
 	
 	// authData
 	uint8_t authData[400] = {0}; 
 	size_t authDataLen = 0;
-	res = CborMapGetKeyById(&parser, &map, data, dataLen, 2);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, 2, &map, NULL);
 	if (res)
 		return res;
 	res = cbor_value_dup_byte_string(&map, &ubuf, &n, &map);
@@ -738,51 +725,44 @@ int FIDO2GetAssertionParseRes(json_t *root, uint8_t *data, size_t dataLen, bool
 	free(ubuf);
 
 	// publicKeyCredentialUserEntity
-	res = CborMapGetKeyById(&parser, &map, data, dataLen, 4);
+	int userEntity;
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, 4, &map, &userEntity);
 	if (res) {	
 		PrintAndLog("UserEntity n/a");
 	} else {
-		res = cbor_value_enter_container(&map, &mapint);
-		cbor_check(res);
-		
-		while (!cbor_value_at_end(&mapint)) {
-			char key[100] = {0};
-			res = CborGetStringValue(&mapint, key, sizeof(key), &n);
-			cbor_check(res);
-
-			if (!strcmp(key, "name") || !strcmp(key, "displayName")) {
+		const char *names[] = {"name", "displayName"};
+		for (int i = 0; i < 2; i++) {
+			if (!CborIndexGetKeyByName(&index, userEntity, names[i], &mapint, NULL)) {
 				char cname[200] = {0};
 				res = CborGetStringValue(&mapint, cname, sizeof(cname), &n);
 				cbor_check(res);
-				PrintAndLog("UserEntity %s: %s", key, cname);
+				PrintAndLog("UserEntity %s: %s", names[i], cname);
 			}
+		}
 
-			if (!strcmp(key, "id")) {
-				uint8_t cid[200] = {0};
-				res = CborGetBinStringValue(&mapint, cid, sizeof(cid), &n);
-				cbor_check(res);
-				PrintAndLog("UserEntity id [%d]: %s", n, sprint_hex(cid, n));
-				
-				// check
-				uint8_t idbuf[100] = {0};
-				size_t idbuflen;
-
-				JsonLoadBufAsHex(root, "$.UserEntity.id", idbuf, sizeof(idbuf), &idbuflen);
-
-				if (idbuflen == n && !memcmp(idbuf, cid, idbuflen)) {
-					PrintAndLog("UserEntity id OK.");
-				} else {
-					PrintAndLog("ERROR: Wrong UserEntity id (from json: %s)", sprint_hex(idbuf, idbuflen));
-				}
+		if (!CborIndexGetKeyByName(&index, userEntity, "id", &mapint, NULL)) {
+			uint8_t cid[200] = {0};
+			res = CborGetBinStringValue(&mapint, cid, sizeof(cid), &n);
+			cbor_check(res);
+			PrintAndLog("UserEntity id [%d]: %s", n, sprint_hex(cid, n));
+			
+			// check
+			uint8_t idbuf[100] = {0};
+			size_t idbuflen;
+
+			JsonLoadBufAsHex(root, "$.UserEntity.id", idbuf, sizeof(idbuf), &idbuflen);
+
+			if (idbuflen == n && !memcmp(idbuf, cid, idbuflen)) {
+				PrintAndLog("UserEntity id OK.");
+			} else {
+				PrintAndLog("ERROR: Wrong UserEntity id (from json: %s)", sprint_hex(idbuf, idbuflen));
 			}
 		}
-		res = cbor_value_leave_container(&map, &mapint);
-		cbor_check(res);
 	}
 	
 	
 	// signature
-	res = CborMapGetKeyById(&parser, &map, data, dataLen, 3);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, 3, &map, NULL);
 	if (res)
 		return res;
 	res = cbor_value_dup_byte_string(&map, &ubuf, &n, &map);
@@ -809,7 +789,7 @@ int FIDO2GetAssertionParseRes(json_t *root, uint8_t *data, size_t dataLen, bool
 	free(ubuf);
 
 	// numberOfCredentials
-	res = CborMapGetKeyById(&parser, &map, data, dataLen, 5);
+	res = CborIndexGetKeyById(&index, CBOR_INDEX_ROOT, 5, &map, NULL);
 	if (res) {
 		PrintAndLog("numberOfCredentials: 1 by default");
 	} else {
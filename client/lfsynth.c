@@ -0,0 +1,307 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Synthetic LF captures: device sim waveforms (common/lfsim.c) through a
+// fixed point model of the antenna and ADC path, and a demod benchmark.
+//-----------------------------------------------------------------------------
+
+#include "lfsynth.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "ui.h"
+#include "util_posix.h"
+#include "lfsim.h"
+#include "lfdemod.h"
+
+#define LFSYNTH_BENCH_FRAME   64
+#define LFSYNTH_BENCH_REPEAT  4
+#define LFSYNTH_BENCH_MAXLEN  40000   // same as the device sample buffer
+
+static const char *lfsynth_names[] = {"ask", "biphase", "nrz", "fsk", "psk1", "psk2"};
+
+const char *lfsynth_mod_name(lfsynth_mod_t modulation) {
+	if (modulation > LFSYNTH_PSK2)
+		return "?";
+	return lfsynth_names[modulation];
+}
+
+bool lfsynth_mod_from_name(const char *name, lfsynth_mod_t *modulation) {
+	for (int i = 0; i < sizeof(lfsynth_names) / sizeof(lfsynth_names[0]); i++) {
+		if (!strcmp(name, lfsynth_names[i])) {
+			*modulation = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// defaults are the ones of lf simask/simfsk/simpsk
+void lfsynth_init(lfsynth_t *synth, lfsynth_mod_t modulation) {
+	memset(synth, 0, sizeof(lfsynth_t));
+	synth->modulation = modulation;
+	synth->clk = 64;
+	if (modulation == LFSYNTH_FSK)
+		synth->clk = 50;
+	if (modulation == LFSYNTH_PSK1 || modulation == LFSYNTH_PSK2)
+		synth->clk = 32;
+	synth->fcHigh = 10;
+	synth->fcLow = 8;
+	synth->carrier = 2;
+	synth->amplitude = 100;
+	synth->driftPeriod = 4096;
+	synth->smooth = 1;
+	synth->seed = 1;
+}
+
+static uint32_t lfsynth_rand(uint32_t *state) {
+	// xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+size_t lfsynth_generate(lfsynth_t *synth, const uint8_t *bits, size_t size, int *dest, size_t maxlen) {
+	uint8_t *wave = calloc(maxlen, sizeof(uint8_t));
+	uint8_t *data = malloc(size ? size : 1);
+	if (!wave || !data) {
+		PrintAndLogEx(ERR, "Cannot allocate memory for the signal");
+		free(wave);
+		free(data);
+		return 0;
+	}
+	memcpy(data, bits, size);
+
+	size_t n = 0;
+	switch (synth->modulation) {
+		case LFSYNTH_ASK:
+			n = askSimWave(wave, maxlen, data, size, synth->clk, LFSIM_ASK_MANCHESTER, synth->invert, synth->separator);
+			break;
+		case LFSYNTH_BIPHASE:
+			n = askSimWave(wave, maxlen, data, size, synth->clk, LFSIM_ASK_BIPHASE, synth->invert, 0);
+			break;
+		case LFSYNTH_NRZ:
+			n = askSimWave(wave, maxlen, data, size, synth->clk, LFSIM_NRZ, synth->invert, 0);
+			break;
+		case LFSYNTH_FSK:
+			n = fskSimWave(wave, maxlen, data, size, synth->fcHigh, synth->fcLow, synth->clk, synth->invert);
+			break;
+		case LFSYNTH_PSK2:
+			// the same as lf simpsk 2
+			psk2TOpsk1(data, size);
+			// fall through
+		case LFSYNTH_PSK1:
+			n = pskSimWave(wave, maxlen, data, size, synth->carrier, synth->clk, synth->invert);
+			break;
+	}
+	free(data);
+
+	// all in ADC units. filter state is Q8
+	int amp = synth->amplitude;
+	int noisePeak = amp * synth->noise / 100;
+	int driftPeak = amp * synth->drift / 100;
+	uint32_t period = synth->driftPeriod ? synth->driftPeriod : 1;
+	uint32_t rnd = synth->seed ? synth->seed : 1;
+	int32_t y = (n && wave[0]) ? amp * 256 : -amp * 256;
+
+	for (size_t i = 0; i < n; i++) {
+		int x = wave[i] ? amp : -amp;
+		int v = x;
+		if (synth->smooth) {
+			y += (x * 256 - y) / (1 << synth->smooth);
+			v = y / 256;
+		}
+
+		// triangle -driftPeak..driftPeak
+		if (driftPeak) {
+			uint32_t ph = i % period;
+			int64_t tri = (ph < period / 2) ? ph : period - ph;
+			v += (int)((int64_t)driftPeak * (4 * tri - (int64_t)period) / (int64_t)period);
+		}
+
+		// sum of two uniforms. triangular distribution -noisePeak..noisePeak
+		if (noisePeak) {
+			uint32_t range = 2 * noisePeak + 1;
+			v += ((int)(lfsynth_rand(&rnd) % range) + (int)(lfsynth_rand(&rnd) % range)) / 2 - noisePeak;
+		}
+
+		if (synth->clip > 0) {
+			if (v > synth->clip) v = synth->clip;
+			if (v < -synth->clip) v = -synth->clip;
+		}
+
+		// ADC range as in GraphBuffer
+		if (v > 127) v = 127;
+		if (v < -128) v = -128;
+		dest[i] = v;
+	}
+	free(wave);
+
+	return n;
+}
+
+// demodulates samples (GraphBuffer + 128) in place the same way as `data rawdemod` with default parameters.
+// returns number of bits or -1
+int lfsynth_demod(lfsynth_t *synth, uint8_t *samples, size_t size) {
+	int clk = 0, invert = 0, startIdx = 0;
+	size_t len = size;
+	int errCnt = -1;
+
+	switch (synth->modulation) {
+		case LFSYNTH_ASK:
+			errCnt = askdemod_ext(samples, &len, &clk, &invert, 100, 0, 1, &startIdx);
+			break;
+		case LFSYNTH_BIPHASE:
+			errCnt = askdemod_ext(samples, &len, &clk, &invert, 100, 0, 0, &startIdx);
+			if (errCnt >= 0) {
+				int offset = 0;
+				errCnt = BiphaseRawDecode(samples, &len, &offset, invert);
+			}
+			break;
+		case LFSYNTH_NRZ:
+			errCnt = nrzRawDemod(samples, &len, &clk, &invert, &startIdx);
+			break;
+		case LFSYNTH_FSK: {
+			uint8_t fchigh = 10, fclow = 8;
+			uint16_t fcs = countFC(samples, len, 1);
+			if (fcs) {
+				fchigh = (fcs >> 8) & 0xFF;
+				fclow = fcs & 0xFF;
+			}
+			int firstClockEdge = 0;
+			uint8_t rfLen = detectFSKClk(samples, len, fchigh, fclow, &firstClockEdge);
+			if (!rfLen) rfLen = 50;
+			int n = fskdemod(samples, len, rfLen, 0, fchigh, fclow, &startIdx);
+			errCnt = (n > 0) ? 0 : -1;
+			len = (n > 0) ? n : 0;
+			break;
+		}
+		case LFSYNTH_PSK1:
+		case LFSYNTH_PSK2:
+			errCnt = pskRawDemod_ext(samples, &len, &clk, &invert, &startIdx);
+			if (errCnt >= 0 && synth->modulation == LFSYNTH_PSK2)
+				psk1TOpsk2(samples, len);
+			break;
+	}
+
+	if (errCnt < 0)
+		return -1;
+	return len;
+}
+
+// frame or inverted frame anywhere in the demodulated bits
+static bool lfsynth_match(uint8_t *bits, int len, uint8_t *frame, int framelen) {
+	for (int offset = 0; offset + framelen <= len; offset++) {
+		bool direct = true, inverted = true;
+		for (int i = 0; i < framelen && (direct || inverted); i++) {
+			if (bits[offset + i] != frame[i]) direct = false;
+			if (bits[offset + i] != (frame[i] ^ 1)) inverted = false;
+		}
+		if (direct || inverted)
+			return true;
+	}
+	return false;
+}
+
+typedef struct {
+	lfsynth_mod_t modulation;
+	uint8_t clk;
+	uint8_t carrier;
+} lfsynth_bench_t;
+
+static const lfsynth_bench_t benchConfigs[] = {
+	{LFSYNTH_ASK,     32, 0},
+	{LFSYNTH_ASK,     64, 0},
+	{LFSYNTH_BIPHASE, 32, 0},
+	{LFSYNTH_BIPHASE, 64, 0},
+	{LFSYNTH_NRZ,     32, 0},
+	{LFSYNTH_NRZ,     64, 0},
+	{LFSYNTH_FSK,     50, 0},
+	{LFSYNTH_FSK,    100, 0},     // not rf/64: fc/10 leaves a 4 sample wave per bit there, read as fc/8
+	{LFSYNTH_PSK1,    32, 2},
+	{LFSYNTH_PSK1,    32, 4},
+	{LFSYNTH_PSK2,    32, 2},
+};
+
+// decodes `trials` random frames per modulation, clock and noise level (0..maxNoise step 10%).
+// prints success rates and demod throughput. returns number of configurations failing on a clean signal.
+int lfsynth_bench(int trials, int maxNoise, uint32_t seed) {
+	int *signal = calloc(LFSYNTH_BENCH_MAXLEN, sizeof(int));
+	uint8_t *samples = calloc(LFSYNTH_BENCH_MAXLEN, sizeof(uint8_t));
+	if (!signal || !samples) {
+		PrintAndLogEx(ERR, "Cannot allocate memory for the signal");
+		free(signal);
+		free(samples);
+		return -1;
+	}
+
+	uint32_t rnd = seed ? seed : 1;
+	int cleanFails = 0;
+	char line[200];
+
+	int levels = maxNoise / 10 + 1;
+	int pos = snprintf(line, sizeof(line), "modulation clk carrier |");
+	for (int l = 0; l < levels && pos < sizeof(line); l++)
+		pos += snprintf(line + pos, sizeof(line) - pos, " %3d%%", l * 10);
+	PrintAndLogEx(NORMAL, "%s | Msamples/s", line);
+
+	for (int c = 0; c < sizeof(benchConfigs) / sizeof(benchConfigs[0]); c++) {
+		const lfsynth_bench_t *cfg = &benchConfigs[c];
+		uint64_t demodTime = 0;
+		uint64_t demodSamples = 0;
+
+		pos = snprintf(line, sizeof(line), "%-10s %3d %7d |", lfsynth_mod_name(cfg->modulation), cfg->clk, cfg->carrier);
+		for (int l = 0; l < levels; l++) {
+			int ok = 0;
+			for (int t = 0; t < trials; t++) {
+				uint8_t bits[LFSYNTH_BENCH_FRAME * LFSYNTH_BENCH_REPEAT];
+				for (int i = 0; i < LFSYNTH_BENCH_FRAME; i++)
+					bits[i] = lfsynth_rand(&rnd) & 1;
+				for (int r = 1; r < LFSYNTH_BENCH_REPEAT; r++)
+					memcpy(&bits[r * LFSYNTH_BENCH_FRAME], bits, LFSYNTH_BENCH_FRAME);
+
+				lfsynth_t synth;
+				lfsynth_init(&synth, cfg->modulation);
+				synth.clk = cfg->clk;
+				if (cfg->carrier)
+					synth.carrier = cfg->carrier;
+				synth.noise = l * 10;
+				synth.seed = lfsynth_rand(&rnd);
+
+				size_t n = lfsynth_generate(&synth, bits, sizeof(bits), signal, LFSYNTH_BENCH_MAXLEN);
+				for (size_t i = 0; i < n; i++)
+					samples[i] = signal[i] + 128;
+
+				uint64_t t1 = usclock();
+				int len = lfsynth_demod(&synth, samples, n);
+				demodTime += usclock() - t1;
+				demodSamples += n;
+
+				// the first bit of psk2 depends on the bit before it
+				if (len > 0 && lfsynth_match(samples, len, bits + 1, LFSYNTH_BENCH_FRAME - 1))
+					ok++;
+			}
+			if (l == 0 && ok != trials)
+				cleanFails++;
+			if (pos < sizeof(line))
+				pos += snprintf(line + pos, sizeof(line) - pos, " %3d%%", ok * 100 / trials);
+		}
+
+		// samples per microsecond = Msamples/s
+		if (demodTime)
+			PrintAndLogEx(NORMAL, "%s | %.1f", line, (double)demodSamples / demodTime);
+		else
+			PrintAndLogEx(NORMAL, "%s | -", line);
+	}
+
+	free(signal);
+	free(samples);
+	return cleanFails;
+}
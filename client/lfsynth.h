@@ -0,0 +1,50 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Synthetic LF captures: device sim waveforms (common/lfsim.c) through a
+// fixed point model of the antenna and ADC path, and a demod benchmark.
+//-----------------------------------------------------------------------------
+
+#ifndef LFSYNTH_H__
+#define LFSYNTH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+	LFSYNTH_ASK,
+	LFSYNTH_BIPHASE,
+	LFSYNTH_NRZ,
+	LFSYNTH_FSK,
+	LFSYNTH_PSK1,
+	LFSYNTH_PSK2,
+} lfsynth_mod_t;
+
+typedef struct {
+	lfsynth_mod_t modulation;
+	uint8_t clk;
+	uint8_t fcHigh;         // FSK
+	uint8_t fcLow;
+	uint8_t carrier;        // PSK
+	uint8_t invert;
+	uint8_t separator;      // ASK manchester sequence terminator
+	int amplitude;          // peak of the clean signal, ADC units (max 127)
+	int noise;              // peak noise, % of amplitude
+	int drift;              // peak DC drift, % of amplitude
+	uint32_t driftPeriod;   // samples per drift cycle
+	int clip;               // clip level, ADC units. 0 - ADC range only
+	uint8_t smooth;         // antenna low pass y += (x - y) >> smooth. 0 - off
+	uint32_t seed;
+} lfsynth_t;
+
+extern const char *lfsynth_mod_name(lfsynth_mod_t modulation);
+extern bool lfsynth_mod_from_name(const char *name, lfsynth_mod_t *modulation);
+extern void lfsynth_init(lfsynth_t *synth, lfsynth_mod_t modulation);
+extern size_t lfsynth_generate(lfsynth_t *synth, const uint8_t *bits, size_t size, int *dest, size_t maxlen);
+extern int lfsynth_demod(lfsynth_t *synth, uint8_t *samples, size_t size);
+extern int lfsynth_bench(int trials, int maxNoise, uint32_t seed);
+
+#endif
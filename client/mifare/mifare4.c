@@ -166,23 +166,43 @@ int CalculateMAC(mf4Session *session, MACType_t mtype, uint8_t blockNum, uint8_t
 	if (verbose)
 		PrintAndLog("MAC data[%d]: %s", macdatalen, sprint_hex(macdata, macdatalen));
 	
-	return aes_cmac8(NULL, session->Kmac, macdata, mac, macdatalen);
+	return aes_cmac8_ctx(&session->MacCtx, macdata, mac, macdatalen);
 }
 
 int MifareAuth4(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateField, bool leaveSignalON, bool verbose) {
+	return MifareAuth4Ex(session, keyn, key, activateField, leaveSignalON, true, false, verbose);
+}
+
+// firstAuth = false - AuthenticateNonFirst (0x76). Card must be authenticated in the same session.
+// TI and the read/write counters are kept, only the session keys change.
+int MifareAuth4Ex(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateField, bool leaveSignalON, bool firstAuth, bool silentMode, bool verbose) {
 	uint8_t data[257] = {0};
 	int datalen = 0;
 	
 	uint8_t RndA[17] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x00};
 	uint8_t RndB[17] = {0};
 	
+	if (!firstAuth && !(session && session->Authenticated)) {
+		if (!silentMode) PrintAndLogEx(ERR, "Following authentication needs an authenticated session");
+		return 1;
+	}
+
 	if (session)
 		session->Authenticated = false;	
 	
-	uint8_t cmd1[] = {0x70, keyn[1], keyn[0], 0x00};
-	int res = ExchangeRAW14a(cmd1, sizeof(cmd1), activateField, true, data, sizeof(data), &datalen);
+	// one key schedule for all the handshake
+	aes_key_context kctx;
+	if (aes_key_init(&kctx, key)) {
+		if (!silentMode) PrintAndLogEx(ERR, "AES key error");
+		DropField();
+		return 1;
+	}
+
+	uint8_t cmd1[] = {firstAuth ? 0x70 : 0x76, keyn[1], keyn[0], 0x00};
+	int res = ExchangeRAW14a(cmd1, firstAuth ? sizeof(cmd1) : sizeof(cmd1) - 1, activateField, true, data, sizeof(data), &datalen);
 	if (res) {
-        PrintAndLogEx(ERR, "Exchande raw error: %d", res);
+		if (!silentMode) PrintAndLogEx(ERR, "Exchande raw error: %d", res);
+		aes_key_free(&kctx);
 		DropField();
 		return 2;
 	}
@@ -191,24 +211,27 @@ int MifareAuth4(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateF
         PrintAndLogEx(INFO, "<phase1: %s", sprint_hex(data, datalen));
 
 	if (datalen < 1) {
-        PrintAndLogEx(ERR, "Card response wrong length: %d", datalen);
+		if (!silentMode) PrintAndLogEx(ERR, "Card response wrong length: %d", datalen);
+		aes_key_free(&kctx);
 		DropField();
 		return 3;
 	}
 	
 	if (data[0] != 0x90) {
-        PrintAndLogEx(ERR, "Card response error: %02x", data[2]);
+		if (!silentMode) PrintAndLogEx(ERR, "Card response error: %02x", data[0]);
+		aes_key_free(&kctx);
 		DropField();
 		return 3;
 	}
 
 	if (datalen != 19) { // code 1b + 16b + crc 2b
-        PrintAndLogEx(ERR, "Card response must be 19 bytes long instead of: %d", datalen);
+		if (!silentMode) PrintAndLogEx(ERR, "Card response must be 19 bytes long instead of: %d", datalen);
+		aes_key_free(&kctx);
 		DropField();
 		return 3;
 	}
 	
-    aes_decode(NULL, key, &data[1], RndB, 16);
+	aes_decode_ctx(&kctx, NULL, &data[1], RndB, 16);
 	RndB[16] = RndB[0];
 	if (verbose)
         PrintAndLogEx(INFO, "RndB: %s", sprint_hex(RndB, 16));
@@ -220,13 +243,14 @@ int MifareAuth4(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateF
 	memmove(raw, RndA, 16);
 	memmove(&raw[16], &RndB[1], 16);
 
-	aes_encode(NULL, key, raw, &cmd2[1], 32);
+	aes_encode_ctx(&kctx, NULL, raw, &cmd2[1], 32);
 	if (verbose)
         PrintAndLogEx(INFO, ">phase2: %s", sprint_hex(cmd2, 33));
 
 	res = ExchangeRAW14a(cmd2, sizeof(cmd2), false, true, data, sizeof(data), &datalen);
 	if (res) {
-        PrintAndLogEx(ERR, "Exchande raw error: %d", res);
+		if (!silentMode) PrintAndLogEx(ERR, "Exchande raw error: %d", res);
+		aes_key_free(&kctx);
 		DropField();
 		return 4;
 	}
@@ -234,24 +258,35 @@ int MifareAuth4(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateF
 	if (verbose)
         PrintAndLogEx(INFO, "<phase2: %s", sprint_hex(data, datalen));
 
-	aes_decode(NULL, key, &data[1], raw, 32);
+	// first: TI 4b + RndA' 16b + PICCap2 6b + PCDCap2 6b. following: RndA' 16b
+	int resplen = firstAuth ? 32 : 16;
+	uint8_t *rndaresp = firstAuth ? &raw[4] : &raw[0];
+	if (datalen != 1 + resplen + 2 || data[0] != 0x90) {
+		if (!silentMode) PrintAndLogEx(ERR, "\nAuthentication FAILED. Card response: %s", sprint_hex(data, datalen));
+		aes_key_free(&kctx);
+		DropField();
+		return 5;
+	}
+
+	aes_decode_ctx(&kctx, NULL, &data[1], raw, resplen);
 	
 	if (verbose) {
-        PrintAndLogEx(INFO, "res: %s", sprint_hex(raw, 32));
-        PrintAndLogEx(INFO, "RndA`: %s", sprint_hex(&raw[4], 16));
+        PrintAndLogEx(INFO, "res: %s", sprint_hex(raw, resplen));
+        PrintAndLogEx(INFO, "RndA`: %s", sprint_hex(rndaresp, 16));
 	}
 
-	if (memcmp(&raw[4], &RndA[1], 16)) {
-        PrintAndLogEx(ERR, "\nAuthentication FAILED. rnd not equal");
+	if (memcmp(rndaresp, &RndA[1], 16)) {
+		if (!silentMode) PrintAndLogEx(ERR, "\nAuthentication FAILED. rnd not equal");
 		if (verbose) {
             PrintAndLogEx(ERR, "RndA reader: %s", sprint_hex(&RndA[1], 16));
-            PrintAndLogEx(ERR, "RndA   card: %s", sprint_hex(&raw[4], 16));
+            PrintAndLogEx(ERR, "RndA   card: %s", sprint_hex(rndaresp, 16));
 		}
+		aes_key_free(&kctx);
 		DropField();
 		return 5;
 	}
 
-	if (verbose) {
+	if (verbose && firstAuth) {
         PrintAndLogEx(INFO, " TI: %s", sprint_hex(raw, 4));
         PrintAndLogEx(INFO, "pic: %s", sprint_hex(&raw[20], 6));
         PrintAndLogEx(INFO, "pcd: %s", sprint_hex(&raw[26], 6));
@@ -264,7 +299,7 @@ int MifareAuth4(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateF
 		kenc[10 + i] = RndA[4 + i] ^ RndB[4 + i];
 	kenc[15] = 0x11;
 	
-	aes_encode(NULL, key, kenc, kenc, 16);
+	aes_encode_ctx(&kctx, NULL, kenc, kenc, 16);
 	if (verbose) {
         PrintAndLogEx(INFO, "kenc: %s", sprint_hex(kenc, 16));
 	}
@@ -276,7 +311,8 @@ int MifareAuth4(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateF
 		kmac[10 + i] = RndA[0 + i] ^ RndB[0 + i];
 	kmac[15] = 0x22;
 	
-	aes_encode(NULL, key, kmac, kmac, 16);
+	aes_encode_ctx(&kctx, NULL, kmac, kmac, 16);
+	aes_key_free(&kctx);
 	if (verbose) {
 		PrintAndLog("kmac: %s", sprint_hex(kmac, 16));
 	}	
@@ -289,17 +325,20 @@ int MifareAuth4(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateF
 
 	if (session) {
 		session->Authenticated = true;
-		session->R_Ctr = 0;
-		session->W_Ctr = 0;
 		session->KeyNum = keyn[1] + (keyn[0] << 8);
 		memmove(session->RndA, RndA, 16);
 		memmove(session->RndB, RndB, 16);
 		memmove(session->Key, key, 16);
-		memmove(session->TI, raw, 4);
-		memmove(session->PICCap2, &raw[20], 6);
-		memmove(session->PCDCap2, &raw[26], 6);
+		if (firstAuth) {
+			session->R_Ctr = 0;
+			session->W_Ctr = 0;
+			memmove(session->TI, raw, 4);
+			memmove(session->PICCap2, &raw[20], 6);
+			memmove(session->PCDCap2, &raw[26], 6);
+		}
 		memmove(session->Kenc, kenc, 16);
 		memmove(session->Kmac, kmac, 16);
+		aes_cmac_init(&session->MacCtx, kmac);
 	}
 
     if (verbose)
@@ -308,6 +347,36 @@ int MifareAuth4(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateF
     return 0;
 }
 
+// Checks keys against a sniffed authentication. Needs no card.
+// phase1 - card answer to the first part: E(K, RndB) 16b
+// phase2 - reader second part: E(K, RndA || RndB <<< 8) 32b
+// returns 0 and the key index if found
+int MifareAuth4CheckKeys(uint8_t *phase1, uint8_t *phase2, uint8_t *keys, size_t keycount, size_t *keyindex) {
+	uint8_t RndB[16] = {0};
+	uint8_t raw[32] = {0};
+	aes_key_context kctx;
+
+	for (size_t i = 0; i < keycount; i++) {
+		// only decryption is needed here. keep the expansion to the one direction.
+		mbedtls_aes_init(&kctx.dec);
+		if (mbedtls_aes_setkey_dec(&kctx.dec, &keys[i * 16], 128))
+			continue;
+
+		aes_decode_ctx(&kctx, NULL, phase1, RndB, 16);
+		// second block of RndA || RndB' is enough: D(c2) ^ c1
+		aes_decode_ctx(&kctx, phase2, &phase2[16], &raw[16], 16);
+		mbedtls_aes_free(&kctx.dec);
+
+		if (!memcmp(&raw[16], &RndB[1], 15) && raw[31] == RndB[0]) {
+			if (keyindex)
+				*keyindex = i;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 int intExchangeRAW14aPlus(uint8_t *datain, int datainlen, bool activateField, bool leaveSignalON, uint8_t *dataout, int maxdataoutlen, int *dataoutlen) {
     if (VerboseMode)
         PrintAndLogEx(INFO, ">>> %s", sprint_hex(datain, datainlen));
@@ -371,61 +440,81 @@ int MFPWriteBlock(mf4Session *session, uint8_t blockNum, uint8_t *data, bool act
 }
 
 int mfpReadSector(uint8_t sectorNo, uint8_t keyType, uint8_t *key, uint8_t *dataout, bool verbose) {
+	return mfpReadSectors(&sectorNo, 1, keyType, key, dataout, verbose);
+}
+
+// Reads several sectors with the same key in one session. The first sector uses AuthenticateFirst,
+// next ones AuthenticateNonFirst without field reset. dataout gets the sectors one after another.
+int mfpReadSectors(uint8_t *sectors, size_t sectorCount, uint8_t keyType, uint8_t *key, uint8_t *dataout, bool verbose) {
     uint8_t keyn[2] = {0};
     bool plain = false;
-
-    uint16_t uKeyNum = 0x4000 + sectorNo * 2 + (keyType ? 1 : 0);
-    keyn[0] = uKeyNum >> 8;
-    keyn[1] = uKeyNum & 0xff;
-    if (verbose)
-        PrintAndLogEx(INFO, "--sector[%d]:%02x key:%04x", mfNumBlocksPerSector(sectorNo), sectorNo, uKeyNum);
-
     mf4Session session;
-    int res = MifareAuth4(&session, keyn, key, true, true, verbose);
-    if (res) {
-        PrintAndLogEx(ERR, "Sector %d authentication error: %d", sectorNo, res);
-        return res;
-    }
-
-    uint8_t data[250] = {0};
-    int datalen = 0;
-    uint8_t mac[8] = {0};
-    uint8_t firstBlockNo = mfFirstBlockOfSector(sectorNo);
-    for (int n = firstBlockNo; n < firstBlockNo + mfNumBlocksPerSector(sectorNo); n++) {
-        res = MFPReadBlock(&session, plain, n & 0xff, 1, false, true, data, sizeof(data), &datalen, mac);
+    session.Authenticated = false;
+    int res = 0;
+
+    for (size_t i = 0; i < sectorCount; i++) {
+        uint8_t sectorNo = sectors[i];
+        uint16_t uKeyNum = 0x4000 + sectorNo * 2 + (keyType ? 1 : 0);
+        keyn[0] = uKeyNum >> 8;
+        keyn[1] = uKeyNum & 0xff;
+        if (verbose)
+            PrintAndLogEx(INFO, "--sector[%d]:%02x key:%04x", mfNumBlocksPerSector(sectorNo), sectorNo, uKeyNum);
+
+        res = 1;
+        if (session.Authenticated)
+            res = MifareAuth4Ex(&session, keyn, key, false, true, false, true, verbose);
+        // new session if the following authentication fails. it drops the field.
+        if (res)
+            res = MifareAuth4(&session, keyn, key, true, true, verbose);
         if (res) {
-            PrintAndLogEx(ERR, "Sector %d read error: %d", sectorNo, res);
-            DropField();
+            PrintAndLogEx(ERR, "Sector %d authentication error: %d", sectorNo, res);
             return res;
         }
 
-        if (datalen && data[0] != 0x90) {
-            PrintAndLogEx(ERR, "Sector %d card read error: %02x %s", sectorNo, data[0], mfpGetErrorDescription(data[0]));
-            DropField();
-            return 5;
-        }
-        if (datalen != 1 + 16 + 8 + 2) {
-            PrintAndLogEx(ERR, "Sector %d error returned data length:%d", sectorNo, datalen);
-            DropField();
-            return 6;
-        }
-
-        memcpy(&dataout[(n - firstBlockNo) * 16], &data[1], 16);
+        uint8_t data[250] = {0};
+        int datalen = 0;
+        uint8_t mac[8] = {0};
+        uint8_t firstBlockNo = mfFirstBlockOfSector(sectorNo);
+        for (int n = firstBlockNo; n < firstBlockNo + mfNumBlocksPerSector(sectorNo); n++) {
+            res = MFPReadBlock(&session, plain, n & 0xff, 1, false, true, data, sizeof(data), &datalen, mac);
+            if (res) {
+                PrintAndLogEx(ERR, "Sector %d read error: %d", sectorNo, res);
+                DropField();
+                return res;
+            }
+
+            if (datalen && data[0] != 0x90) {
+                PrintAndLogEx(ERR, "Sector %d card read error: %02x %s", sectorNo, data[0], mfpGetErrorDescription(data[0]));
+                DropField();
+                return 5;
+            }
+            if (datalen != 1 + 16 + 8 + 2) {
+                PrintAndLogEx(ERR, "Sector %d error returned data length:%d", sectorNo, datalen);
+                DropField();
+                return 6;
+            }
+
+            memcpy(&dataout[(n - firstBlockNo) * 16], &data[1], 16);
 
-        if (verbose)
-            PrintAndLogEx(INFO, "data[%03d]: %s", n, sprint_hex(&data[1], 16));
-
-        if (memcmp(&data[1 + 16], mac, 8)) {
-            PrintAndLogEx(WARNING, "WARNING: mac on block %d not equal...", n);
-            PrintAndLogEx(WARNING, "MAC   card: %s", sprint_hex(&data[1 + 16], 8));
-            PrintAndLogEx(WARNING, "MAC reader: %s", sprint_hex(mac, 8));
-
-            if (!verbose)
-                return 7;
-        } else {
             if (verbose)
-                PrintAndLogEx(INFO, "MAC: %s", sprint_hex(&data[1 + 16], 8));
+                PrintAndLogEx(INFO, "data[%03d]: %s", n, sprint_hex(&data[1], 16));
+
+            if (memcmp(&data[1 + 16], mac, 8)) {
+                PrintAndLogEx(WARNING, "WARNING: mac on block %d not equal...", n);
+                PrintAndLogEx(WARNING, "MAC   card: %s", sprint_hex(&data[1 + 16], 8));
+                PrintAndLogEx(WARNING, "MAC reader: %s", sprint_hex(mac, 8));
+
+                if (!verbose) {
+                    DropField();
+                    return 7;
+                }
+            } else {
+                if (verbose)
+                    PrintAndLogEx(INFO, "MAC: %s", sprint_hex(&data[1 + 16], 8));
+            }
         }
+
+        dataout += mfNumBlocksPerSector(sectorNo) * 16;
     }
     DropField();
 
@@ -15,7 +15,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "crypto/libpcrypto.h"
 
+// MacCtx is built from Kmac at authentication. It points into the session: do not copy sessions.
 typedef struct {
 	bool Authenticated;
 	uint8_t Key[16];
@@ -29,6 +31,7 @@ typedef struct {
 	uint8_t Kmac[16];
 	uint16_t R_Ctr;
 	uint16_t W_Ctr;
+	aes_cmac_context MacCtx;
 }mf4Session;
 
 typedef enum {
@@ -48,12 +51,15 @@ extern const char *mfpGetErrorDescription(uint8_t errorCode);
 
 extern int CalculateMAC(mf4Session *session, MACType_t mtype, uint8_t blockNum, uint8_t blockCount, uint8_t *data, int datalen, uint8_t *mac, bool verbose);
 extern int MifareAuth4(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateField, bool leaveSignalON, bool verbose);
+extern int MifareAuth4Ex(mf4Session *session, uint8_t *keyn, uint8_t *key, bool activateField, bool leaveSignalON, bool firstAuth, bool silentMode, bool verbose);
+extern int MifareAuth4CheckKeys(uint8_t *phase1, uint8_t *phase2, uint8_t *keys, size_t keycount, size_t *keyindex);
 
 extern int MFPWritePerso(uint8_t *keyNum, uint8_t *key, bool activateField, bool leaveSignalON, uint8_t *dataout, int maxdataoutlen, int *dataoutlen);
 extern int MFPCommitPerso(bool activateField, bool leaveSignalON, uint8_t *dataout, int maxdataoutlen, int *dataoutlen);
 extern int MFPReadBlock(mf4Session *session, bool plain, uint8_t blockNum, uint8_t blockCount, bool activateField, bool leaveSignalON, uint8_t *dataout, int maxdataoutlen, int *dataoutlen, uint8_t *mac);
 extern int MFPWriteBlock(mf4Session *session, uint8_t blockNum, uint8_t *data, bool activateField, bool leaveSignalON, uint8_t *dataout, int maxdataoutlen, int *dataoutlen, uint8_t *mac);
 extern int mfpReadSector(uint8_t sectorNo, uint8_t keyType, uint8_t *key, uint8_t *dataout, bool verbose);
+extern int mfpReadSectors(uint8_t *sectors, size_t sectorCount, uint8_t keyType, uint8_t *key, uint8_t *dataout, bool verbose);
 
 extern char *mfGetAccessConditionsDesc(uint8_t blockn, uint8_t *data);
 
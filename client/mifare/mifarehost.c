@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <pthread.h>
 
 #include "crapto1/crapto1.h"
@@ -517,6 +518,123 @@ int mfCSetBlock(uint8_t blockNo, uint8_t *data, uint8_t *uid, bool wantWipe, uin
 	return 0;
 }
 
+// up to MF_CBLOCKS_PER_CMD blocks in one command. errorMask - bitmap of the blocks that failed.
+// Returns 0 - ok, 1 - timeout, 2 - some blocks failed, 3 - card lost (the field is off), *lostAt is the first block not tried
+int mfCSetBlocks(uint8_t firstBlock, uint8_t blocksCount, uint8_t *data, uint8_t params, uint32_t *errorMask, int *lostAt) {
+	UsbCommand c = {CMD_MIFARE_CSETBLOCKS, {params, firstBlock, blocksCount}};
+	memcpy(c.d.asBytes, data, blocksCount * 16);
+	SendCommand(&c);
+
+	UsbCommand resp;
+	if (!WaitForResponseTimeout(CMD_ACK, &resp, 2500)) {
+		PrintAndLog("Command execute timeout");
+		return 1;
+	}
+
+	*errorMask = resp.arg[1];
+	if (lostAt)
+		*lostAt = resp.arg[2] ? (int)resp.arg[2] - 1 : -1;
+	if (resp.arg[2])
+		return 3;
+	if (!(resp.arg[0] & 0xff))
+		return 2;
+	return 0;
+}
+
+int mfCGetBlocks(uint8_t firstBlock, uint8_t blocksCount, uint8_t *data, uint8_t params, uint32_t *errorMask, int *lostAt) {
+	UsbCommand c = {CMD_MIFARE_CGETBLOCKS, {params, firstBlock, blocksCount}};
+	SendCommand(&c);
+
+	UsbCommand resp;
+	if (!WaitForResponseTimeout(CMD_ACK, &resp, 2500)) {
+		PrintAndLog("Command execute timeout");
+		return 1;
+	}
+
+	memcpy(data, resp.d.asBytes, blocksCount * 16);
+	*errorMask = resp.arg[1];
+	if (lostAt)
+		*lostAt = resp.arg[2] ? (int)resp.arg[2] - 1 : -1;
+	if (resp.arg[2])
+		return 3;
+	if (!(resp.arg[0] & 0xff))
+		return 2;
+	return 0;
+}
+
+// writes/reads blocks 0..blocksCount-1 of a magic card in one backdoor session.
+// If the card is lost, it is selected and unlocked again once and the transfer goes on from the first block not tried.
+// errorMap - bitmap of the failed blocks, (blocksCount + 31) / 32 words. Returns number of failed blocks or -1 on timeout.
+static int mfCTransferCard(bool write, uint8_t *data, int blocksCount, bool gen1b, uint32_t *errorMap) {
+	int failed = 0;
+	bool reselected = false;
+	bool init = true;
+
+	memset(errorMap, 0x00, (blocksCount + 31) / 32 * sizeof(uint32_t));
+	for (int block = 0; block < blocksCount; ) {
+		// chunks stay inside one errorMap word
+		int count = MIN(MF_CBLOCKS_PER_CMD - block % 32, blocksCount - block);
+		uint8_t flags = 0;
+		if (init)
+			flags |= CSETBLOCK_INIT_FIELD | CSETBLOCK_WUPC;        // switch on field and send magic sequence
+		if (block + count >= blocksCount)
+			flags |= CSETBLOCK_HALT | CSETBLOCK_RESET_FIELD;      // Done. Magic Halt and switch off field.
+		if (gen1b)
+			flags |= CSETBLOCK_MAGIC_1B;
+		init = false;
+
+		uint32_t errorMask = 0;
+		int lostAt = -1;
+		int res;
+		if (write)
+			res = mfCSetBlocks(block, count, data + block * 16, flags, &errorMask, &lostAt);
+		else
+			res = mfCGetBlocks(block, count, data + block * 16, flags, &errorMask, &lostAt);
+		if (res == 1)
+			return -1;
+
+		if (res == 3) {
+			// the device has switched the field off. Blocks from lostAt on were not tried.
+			if (lostAt < 0 || lostAt > count)
+				lostAt = 0;
+			errorMask &= (1U << lostAt) - 1;
+		}
+
+		errorMap[block / 32] |= errorMask << (block % 32);
+		for (int i = 0; i < count; i++)
+			if (errorMask & (1U << i))
+				failed++;
+
+		if (res == 3) {
+			if (reselected) {
+				// lost again - give up, the rest has failed
+				for (int b = block + lostAt; b < blocksCount; b++) {
+					errorMap[b / 32] |= 1U << (b % 32);
+					failed++;
+				}
+				break;
+			}
+			PrintAndLog("Card lost at block %d. Selecting it again.", block + lostAt);
+			reselected = true;
+			init = true;
+			block += lostAt;
+			continue;
+		}
+
+		block += count;
+	}
+
+	return failed;
+}
+
+int mfCSetCard(uint8_t *data, int blocksCount, bool gen1b, uint32_t *errorMap) {
+	return mfCTransferCard(true, data, blocksCount, gen1b, errorMap);
+}
+
+int mfCGetCard(uint8_t *data, int blocksCount, bool gen1b, uint32_t *errorMap) {
+	return mfCTransferCard(false, data, blocksCount, gen1b, errorMap);
+}
+
 int mfCWipe(uint32_t numSectors, bool gen1b, bool wantWipe, bool wantFill) {
 	uint8_t isOK = 0;
 	uint8_t cmdParams = wantWipe + wantFill * 0x02 + gen1b * 0x04;
@@ -600,56 +718,40 @@ static uint8_t trailerAccessBytes[4] = {0x08, 0x77, 0x8F, 0x00};
 
 // variables
 char logHexFileName[FILE_PATH_SIZE] = {0x00};
-static uint8_t traceCard[4096] = {0x00};
-static char traceFileName[FILE_PATH_SIZE] = {0x00};
-static int traceState = TRACE_IDLE;
-static uint8_t traceCurBlock = 0;
-static uint8_t traceCurKey = 0;
-
-struct Crypto1State *traceCrypto1 = NULL;
-
-struct Crypto1State *revstate;
-uint64_t lfsr;
-uint64_t ui64Key;
-uint32_t ks2;
-uint32_t ks3;
-
-uint32_t uid;       // serial number
-uint32_t nt;        // tag challenge
-uint32_t nt_enc;    // encrypted tag challenge
-uint8_t nt_enc_par; // encrypted tag challenge parity
-uint32_t nr_enc;    // encrypted reader challenge
-uint32_t ar_enc;    // encrypted reader response
-uint8_t ar_enc_par; // encrypted reader response parity
-uint32_t at_enc;    // encrypted tag response
-uint8_t at_enc_par; // encrypted tag response parity
-
-int isTraceCardEmpty(void) {
-	return ((traceCard[0] == 0) && (traceCard[1] == 0) && (traceCard[2] == 0) && (traceCard[3] == 0));
+
+// one decoder session per card UID. Sessions live until mfTraceEnd() so a card coming
+// back into the field keeps its card image and recovered keys.
+static mf_trace_session_t *traceSessions[MF_TRACE_MAX_SESSIONS] = {NULL};
+static mf_trace_session_t *traceCurSession = NULL;
+static uint32_t traceSessionTick = 0;
+
+static bool isTraceCardEmpty(mf_trace_session_t *session) {
+	return ((session->card[0] == 0) && (session->card[1] == 0) && (session->card[2] == 0) && (session->card[3] == 0));
 }
 
-int isBlockEmpty(int blockN) {
+static bool isBlockEmpty(mf_trace_session_t *session, int blockN) {
 	for (int i = 0; i < 16; i++)
-		if (traceCard[blockN * 16 + i] != 0) return 0;
+		if (session->card[blockN * 16 + i] != 0) return false;
 
-	return 1;
+	return true;
 }
 
-int isBlockTrailer(int blockN) {
+static bool isBlockTrailer(int blockN) {
  return ((blockN & 0x03) == 0x03);
 }
 
-int saveTraceCard(void) {
+static int saveTraceCard(mf_trace_session_t *session) {
 	FILE * f;
 
-	if ((!strlen(traceFileName)) || (isTraceCardEmpty())) return 0;
+	session->cardChanged = false;
+	if ((!strlen(session->emlFileName)) || (isTraceCardEmpty(session))) return 0;
 
-	f = fopen(traceFileName, "w+");
+	f = fopen(session->emlFileName, "w+");
 	if ( !f ) return 1;
 
 	for (int i = 0; i < 64; i++) {  // blocks
 		for (int j = 0; j < 16; j++)  // bytes
-			fprintf(f, "%02x", *(traceCard + i * 16 + j));
+			fprintf(f, "%02x", session->card[i * 16 + j]);
 		if (i < 63)
 			fprintf(f,"\n");
 	}
@@ -657,26 +759,23 @@ int saveTraceCard(void) {
 	return 0;
 }
 
-int loadTraceCard(uint8_t *tuid) {
+static int loadTraceCard(mf_trace_session_t *session) {
 	FILE * f;
 	char buf[64] = {0x00};
 	uint8_t buf8[64] = {0x00};
 	int i, blockNum;
 
-	if (!isTraceCardEmpty())
-		saveTraceCard();
+	memset(session->card, 0x00, sizeof(session->card));
+	memcpy(session->card, session->uid + 3, 4);
 
-	memset(traceCard, 0x00, 4096);
-	memcpy(traceCard, tuid + 3, 4);
+	FillFileNameByUID(session->emlFileName, session->uid, ".eml", 7);
 
-	FillFileNameByUID(traceFileName, tuid, ".eml", 7);
-
-	f = fopen(traceFileName, "r");
+	f = fopen(session->emlFileName, "r");
 	if (!f) return 1;
 
 	blockNum = 0;
 
-	while(!feof(f)){
+	while(!feof(f) && blockNum < 256){
 
 		memset(buf, 0, sizeof(buf));
 		if (fgets(buf, sizeof(buf), f) == NULL) {
@@ -694,7 +793,7 @@ int loadTraceCard(uint8_t *tuid) {
 		for (i = 0; i < 32; i += 2)
 			sscanf(&buf[i], "%02x", (unsigned int *)&buf8[i / 2]);
 
-		memcpy(traceCard + blockNum * 16, buf8, 16);
+		memcpy(session->card + blockNum * 16, buf8, 16);
 
 		blockNum++;
 	}
@@ -703,25 +802,71 @@ int loadTraceCard(uint8_t *tuid) {
 	return 0;
 }
 
-int mfTraceInit(uint8_t *tuid, uint8_t *atqa, uint8_t sak, bool wantSaveToEmlFile) {
+static void mfTraceSessionFree(mf_trace_session_t *session) {
+	if (session->saveToEml && session->cardChanged)
+		saveTraceCard(session);
+	if (session->crypto1)
+		crypto1_destroy(session->crypto1);
+	free(session);
+}
 
-	if (traceCrypto1)
-		crypto1_destroy(traceCrypto1);
+// finds the session of the card or creates one. The least recently selected session is dropped if the table is full.
+mf_trace_session_t *mfTraceSessionGet(uint8_t *tuid, bool wantSaveToEmlFile) {
+	int freeSlot = -1;
+	int oldest = 0;
 
-	traceCrypto1 = NULL;
+	for (int i = 0; i < MF_TRACE_MAX_SESSIONS; i++) {
+		mf_trace_session_t *s = traceSessions[i];
+		if (!s) {
+			if (freeSlot < 0)
+				freeSlot = i;
+			continue;
+		}
+		if (!memcmp(s->uid, tuid, 7)) {
+			s->lastSelect = ++traceSessionTick;
+			return s;
+		}
+		if (traceSessions[oldest] == NULL || s->lastSelect < traceSessions[oldest]->lastSelect)
+			oldest = i;
+	}
 
-	if (wantSaveToEmlFile)
-		loadTraceCard(tuid);
+	mf_trace_session_t *session = calloc(1, sizeof(mf_trace_session_t));
+	if (!session)
+		return NULL;
+
+	if (freeSlot < 0) {
+		freeSlot = oldest;
+		if (traceSessions[oldest] == traceCurSession)
+			traceCurSession = NULL;
+		mfTraceSessionFree(traceSessions[oldest]);
+	}
+	traceSessions[freeSlot] = session;
 
-	traceCard[4] = traceCard[0] ^ traceCard[1] ^ traceCard[2] ^ traceCard[3];
-	traceCard[5] = sak;
-	memcpy(&traceCard[6], atqa, 2);
-	traceCurBlock = 0;
-	uid = bytes_to_num(tuid + 3, 4);
+	memcpy(session->uid, tuid, 7);
+	session->cuid = bytes_to_num(tuid + 3, 4);
+	session->saveToEml = wantSaveToEmlFile;
+	session->state = TRACE_IDLE;
+	session->lastSelect = ++traceSessionTick;
+	if (wantSaveToEmlFile)
+		loadTraceCard(session);
+	else
+		memcpy(session->card, tuid + 3, 4);
 
-	traceState = TRACE_IDLE;
+	return session;
+}
 
-	return 0;
+// card (re)selected. Crypto state of the previous selection is dropped.
+void mfTraceSessionSelect(mf_trace_session_t *session, uint8_t *atqa, uint8_t sak) {
+	if (session->crypto1)
+		crypto1_destroy(session->crypto1);
+	session->crypto1 = NULL;
+
+	session->uidLen = (atqa[0] & 0xC0) == 0x40 ? 7 : 4;
+	session->card[4] = session->card[0] ^ session->card[1] ^ session->card[2] ^ session->card[3];
+	session->card[5] = sak;
+	memcpy(&session->card[6], atqa, 2);
+	session->curBlock = 0;
+	session->state = TRACE_IDLE;
 }
 
 void mf_crypto1_decrypt(struct Crypto1State *pcs, uint8_t *data, int len, bool isEncrypted){
@@ -741,7 +886,14 @@ void mf_crypto1_decrypt(struct Crypto1State *pcs, uint8_t *data, int len, bool i
 	return;
 }
 
-bool NTParityCheck(uint32_t ntx) {
+static bool NTParityCheck(mf_trace_session_t *session, uint32_t ntx) {
+	uint32_t nt_enc = session->nt_enc;
+	uint8_t nt_enc_par = session->nt_enc_par;
+	uint32_t ar_enc = session->ar_enc;
+	uint8_t ar_enc_par = session->ar_enc_par;
+	uint32_t at_enc = session->at_enc;
+	uint8_t at_enc_par = session->at_enc_par;
+
 	if (
 		(oddparity8(ntx >> 8 & 0xff) ^ (ntx & 0x01) ^ ((nt_enc_par >> 5) & 0x01) ^ (nt_enc & 0x01)) ||
 		(oddparity8(ntx >> 16 & 0xff) ^ (ntx >> 8 & 0x01) ^ ((nt_enc_par >> 6) & 0x01) ^ (nt_enc >> 8 & 0x01)) ||
@@ -769,60 +921,187 @@ bool NTParityCheck(uint32_t ntx) {
 	return true;
 }
 
+// mfkey64 on the sniffed auth. Leaves the keystream in ks2/ks3 and returns the key.
+static uint64_t mfTraceRecoverKey(mf_trace_session_t *session, uint32_t ntx, uint32_t *ks2, uint32_t *ks3) {
+	uint64_t lfsr = 0;
+
+	*ks2 = session->ar_enc ^ prng_successor(ntx, 64);
+	*ks3 = session->at_enc ^ prng_successor(ntx, 96);
+	struct Crypto1State *revstate = lfsr_recovery64(*ks2, *ks3);
+	lfsr_rollback_word(revstate, 0, 0);
+	lfsr_rollback_word(revstate, 0, 0);
+	lfsr_rollback_word(revstate, session->nr_enc, 1);
+	lfsr_rollback_word(revstate, session->cuid ^ ntx, 0);
+
+	crypto1_get_lfsr(revstate, &lfsr);
+	crypto1_destroy(revstate);
+	return lfsr;
+}
 
-int mfTraceDecode(uint8_t *data_src, int len, uint8_t parity, bool wantSaveToEmlFile) {
+static void mfTraceAddKey(mf_trace_session_t *session, uint8_t sector, uint8_t keyType, uint64_t key) {
+	for (int i = 0; i < session->keysCount; i++)
+		if (session->keys[i].sector == sector && session->keys[i].keyType == keyType && session->keys[i].key == key)
+			return;
+
+	if (session->keysCount >= MF_TRACE_MAX_KEYS)
+		return;
+
+	session->keys[session->keysCount].sector = sector;
+	session->keys[session->keysCount].keyType = keyType;
+	session->keys[session->keysCount].key = key;
+	session->keysCount++;
+}
+
+static int mfTraceAuthOk(mf_trace_session_t *session) {
+	uint32_t ks2 = 0, ks3 = 0;
+	uint64_t lfsr = 0;
+
+	session->authCount++;
+	if (!session->crypto1) {
+		//  decode key here)
+		lfsr = mfTraceRecoverKey(session, session->nt, &ks2, &ks3);
+		printf("key> probable key:%012" PRIx64 " Prng:%s ks2:%08x ks3:%08x\n",
+			lfsr,
+			validate_prng_nonce(session->nt) ? "WEAK": "HARDEND",
+			ks2,
+			ks3);
+	} else {
+		if (!validate_prng_nonce(session->nt)) {
+			printf("key> hardnested not implemented!\n");
+
+			crypto1_destroy(session->crypto1);
+			session->crypto1 = NULL;
+
+			// not implemented
+			session->state = TRACE_ERROR;
+			return 1;
+		}
+
+		uint32_t nt_enc = session->nt_enc;
+		uint32_t ar_enc = session->ar_enc;
+		uint32_t at_enc = session->at_enc;
+		uint32_t nr_enc = session->nr_enc;
+		uint32_t uid = session->cuid;
+
+		struct Crypto1State *pcs;
+		pcs = crypto1_create(session->key);
+		uint32_t nt1 = crypto1_word(pcs, nt_enc ^ uid, 1) ^ nt_enc;
+		uint32_t ar = prng_successor(nt1, 64);
+		uint32_t at = prng_successor(nt1, 96);
+		printf("key> nested auth uid: %08x nt: %08x nt_parity: %s ar: %08x at: %08x\n", uid, nt1, printBitsPar(&session->nt_enc_par, 4), ar, at);
+		uint32_t nr1 = crypto1_word(pcs, nr_enc, 1) ^ nr_enc;
+		uint32_t ar1 = crypto1_word(pcs, 0, 0) ^ ar_enc;
+		uint32_t at1 = crypto1_word(pcs, 0, 0) ^ at_enc;
+		crypto1_destroy(pcs);
+		printf("key> the same key test. nr1: %08x ar1: %08x at1: %08x \n", nr1, ar1, at1);
+
+		if (NTParityCheck(session, nt1))
+			printf("key> the same key test OK. key=%012" PRIx64 "\n", session->key);
+		else
+			printf("key> the same key test. check nt parity error.\n");
+
+		uint32_t ntc = prng_successor(session->nt, 90);
+		uint32_t ntx = 0;
+		int ntcnt = 0;
+		for (int i = 0; i < 16383; i++) {
+			ntc = prng_successor(ntc, 1);
+			if (NTParityCheck(session, ntc)){
+				if (!ntcnt)
+					ntx = ntc;
+				ntcnt++;
+			}
+		}
+		if (ntcnt)
+			printf("key> nt candidate=%08x nonce distance=%d candidates count=%d\n", ntx, nonce_distance(session->nt, ntx), ntcnt);
+		else
+			printf("key> don't have any nt candidate( \n");
+
+		session->nt = ntx;
+
+		// decode key
+		lfsr = mfTraceRecoverKey(session, ntx, &ks2, &ks3);
+		printf("key> probable key:%012" PRIx64 "  ks2:%08x ks3:%08x\n",
+			lfsr,
+			ks2,
+			ks3);
+	}
+	AddLogUint64(session->logFileName, "key> ", lfsr);
+	session->key = lfsr;
+	mfTraceAddKey(session, session->curBlock / 4, session->curKey, lfsr);
+
+	int blockShift = ((session->curBlock & 0xFC) + 3) * 16;
+	if (isBlockEmpty(session, (session->curBlock & 0xFC) + 3)) memcpy(session->card + blockShift + 6, trailerAccessBytes, 4);
+
+	if (session->curKey) {
+		num_to_bytes(lfsr, 6, session->card + blockShift + 10);
+	} else {
+		num_to_bytes(lfsr, 6, session->card + blockShift);
+	}
+	session->cardChanged = true;
+
+	if (session->crypto1) {
+		crypto1_destroy(session->crypto1);
+	}
+
+	// set cryptosystem state
+	session->crypto1 = lfsr_recovery64(ks2, ks3);
+	return 0;
+}
+
+int mfTraceSessionDecode(mf_trace_session_t *session, uint8_t *data_src, int len, uint8_t parity) {
 	uint8_t data[64];
 
-	if (traceState == TRACE_ERROR) return 1;
+	if (session->state == TRACE_ERROR) return 1;
 	if (len > 64) {
-		traceState = TRACE_ERROR;
+		session->state = TRACE_ERROR;
 		return 1;
 	}
 
 	memcpy(data, data_src, len);
-	if ((traceCrypto1) && ((traceState == TRACE_IDLE) || (traceState > TRACE_AUTH_OK))) {
-		mf_crypto1_decrypt(traceCrypto1, data, len, 0);
+	if ((session->crypto1) && ((session->state == TRACE_IDLE) || (session->state > TRACE_AUTH_OK))) {
+		mf_crypto1_decrypt(session->crypto1, data, len, 0);
 		uint8_t parity[16];
 		oddparitybuf(data, len, parity);
-		PrintAndLog("dec> %s [%s]", sprint_hex(data, len), printBitsPar(parity, len));
-		AddLogHex(logHexFileName, "dec> ", data, len);
+		char hex[SPRINT_HEX_SIZE(64)], par[SPRINT_BIN_SIZE(64)];
+		PrintAndLog("dec> %s [%s]", sprint_hex_r(hex, sizeof(hex), data, len), printBitsPar_r(par, sizeof(par), parity, len));
+		AddLogHex(session->logFileName, "dec> ", data, len);
 	}
 
-	switch (traceState) {
+	switch (session->state) {
 	case TRACE_IDLE:
 		// check packet crc16!
 		if ((len >= 4) && (!CheckCrc14443(CRC_14443_A, data, len))) {
 			PrintAndLog("dec> CRC ERROR!!!");
-			AddLogLine(logHexFileName, "dec> ", "CRC ERROR!!!");
-			traceState = TRACE_ERROR;  // do not decrypt the next commands
+			AddLogLine(session->logFileName, "dec> ", "CRC ERROR!!!");
+			session->state = TRACE_ERROR;  // do not decrypt the next commands
 			return 1;
 		}
 
 		// AUTHENTICATION
 		if ((len ==4) && ((data[0] == 0x60) || (data[0] == 0x61))) {
-			traceState = TRACE_AUTH1;
-			traceCurBlock = data[1];
-			traceCurKey = data[0] == 60 ? 1:0;
+			session->state = TRACE_AUTH1;
+			session->curBlock = data[1];
+			session->curKey = data[0] == 0x61 ? 1:0;
 			return 0;
 		}
 
 		// READ
 		if ((len ==4) && ((data[0] == 0x30))) {
-			traceState = TRACE_READ_DATA;
-			traceCurBlock = data[1];
+			session->state = TRACE_READ_DATA;
+			session->curBlock = data[1];
 			return 0;
 		}
 
 		// WRITE
 		if ((len ==4) && ((data[0] == 0xA0))) {
-			traceState = TRACE_WRITE_OK;
-			traceCurBlock = data[1];
+			session->state = TRACE_WRITE_OK;
+			session->curBlock = data[1];
 			return 0;
 		}
 
 		// HALT
 		if ((len ==4) && ((data[0] == 0x50) && (data[1] == 0x00))) {
-			traceState = TRACE_ERROR;  // do not decrypt the next commands
+			session->state = TRACE_ERROR;  // do not decrypt the next commands
 			return 0;
 		}
 
@@ -831,196 +1110,157 @@ int mfTraceDecode(uint8_t *data_src, int len, uint8_t parity, bool wantSaveToEml
 
 	case TRACE_READ_DATA:
 		if (len == 18) {
-			traceState = TRACE_IDLE;
+			session->state = TRACE_IDLE;
 
-			if (isBlockTrailer(traceCurBlock)) {
-				memcpy(traceCard + traceCurBlock * 16 + 6, data + 6, 4);
+			if (isBlockTrailer(session->curBlock)) {
+				memcpy(session->card + session->curBlock * 16 + 6, data + 6, 4);
 			} else {
-				memcpy(traceCard + traceCurBlock * 16, data, 16);
+				memcpy(session->card + session->curBlock * 16, data, 16);
 			}
-			if (wantSaveToEmlFile) saveTraceCard();
+			session->cardChanged = true;
 			return 0;
 		} else {
-			traceState = TRACE_ERROR;
+			session->state = TRACE_ERROR;
 			return 1;
 		}
 	break;
 
 	case TRACE_WRITE_OK:
 		if ((len == 1) && (data[0] == 0x0a)) {
-			traceState = TRACE_WRITE_DATA;
+			session->state = TRACE_WRITE_DATA;
 
 			return 0;
 		} else {
-			traceState = TRACE_ERROR;
+			session->state = TRACE_ERROR;
 			return 1;
 		}
 	break;
 
 	case TRACE_WRITE_DATA:
 		if (len == 18) {
-			traceState = TRACE_IDLE;
+			session->state = TRACE_IDLE;
 
-			memcpy(traceCard + traceCurBlock * 16, data, 16);
-			if (wantSaveToEmlFile) saveTraceCard();
+			memcpy(session->card + session->curBlock * 16, data, 16);
+			session->cardChanged = true;
 			return 0;
 		} else {
-			traceState = TRACE_ERROR;
+			session->state = TRACE_ERROR;
 			return 1;
 		}
 	break;
 
 	case TRACE_AUTH1:
 		if (len == 4) {
-			traceState = TRACE_AUTH2;
-			if (!traceCrypto1) {
-				nt = bytes_to_num(data, 4);
+			session->state = TRACE_AUTH2;
+			if (!session->crypto1) {
+				session->nt = bytes_to_num(data, 4);
 			} else {
-				nt_enc = bytes_to_num(data, 4);
-				nt_enc_par = parity;
+				session->nt_enc = bytes_to_num(data, 4);
+				session->nt_enc_par = parity;
 			}
 			return 0;
 		} else {
-			traceState = TRACE_ERROR;
+			session->state = TRACE_ERROR;
 			return 1;
 		}
 	break;
 
 	case TRACE_AUTH2:
 		if (len == 8) {
-			traceState = TRACE_AUTH_OK;
+			session->state = TRACE_AUTH_OK;
 
-			nr_enc = bytes_to_num(data, 4);
-			ar_enc = bytes_to_num(data + 4, 4);
-			ar_enc_par = parity << 4;
+			session->nr_enc = bytes_to_num(data, 4);
+			session->ar_enc = bytes_to_num(data + 4, 4);
+			session->ar_enc_par = parity << 4;
 			return 0;
 		} else {
-			traceState = TRACE_ERROR;
+			session->state = TRACE_ERROR;
 			return 1;
 		}
 	break;
 
 	case TRACE_AUTH_OK:
 		if (len ==4) {
-			traceState = TRACE_IDLE;
-
-			at_enc = bytes_to_num(data, 4);
-			at_enc_par = parity;
-			if (!traceCrypto1) {
-
-				//  decode key here)
-				ks2 = ar_enc ^ prng_successor(nt, 64);
-				ks3 = at_enc ^ prng_successor(nt, 96);
-				revstate = lfsr_recovery64(ks2, ks3);
-				lfsr_rollback_word(revstate, 0, 0);
-				lfsr_rollback_word(revstate, 0, 0);
-				lfsr_rollback_word(revstate, nr_enc, 1);
-				lfsr_rollback_word(revstate, uid ^ nt, 0);
-
-				crypto1_get_lfsr(revstate, &lfsr);
-				crypto1_destroy(revstate);
-				ui64Key = lfsr;
-				printf("key> probable key:%x%x Prng:%s ks2:%08x ks3:%08x\n", 
-					(unsigned int)((lfsr & 0xFFFFFFFF00000000) >> 32), (unsigned int)(lfsr & 0xFFFFFFFF), 
-					validate_prng_nonce(nt) ? "WEAK": "HARDEND",
-					ks2,
-					ks3);
-				AddLogUint64(logHexFileName, "key> ", lfsr);
-			} else {
-				if (validate_prng_nonce(nt)) {
-					struct Crypto1State *pcs;
-					pcs = crypto1_create(ui64Key);
-					uint32_t nt1 = crypto1_word(pcs, nt_enc ^ uid, 1) ^ nt_enc;
-					uint32_t ar = prng_successor(nt1, 64);
-					uint32_t at = prng_successor(nt1, 96);
-					printf("key> nested auth uid: %08x nt: %08x nt_parity: %s ar: %08x at: %08x\n", uid, nt1, printBitsPar(&nt_enc_par, 4), ar, at);
-					uint32_t nr1 = crypto1_word(pcs, nr_enc, 1) ^ nr_enc;
-					uint32_t ar1 = crypto1_word(pcs, 0, 0) ^ ar_enc;
-					uint32_t at1 = crypto1_word(pcs, 0, 0) ^ at_enc;
-					crypto1_destroy(pcs);
-					printf("key> the same key test. nr1: %08x ar1: %08x at1: %08x \n", nr1, ar1, at1);
-
-					if (NTParityCheck(nt1))
-						printf("key> the same key test OK. key=%x%x\n", (unsigned int)((ui64Key & 0xFFFFFFFF00000000) >> 32), (unsigned int)(ui64Key & 0xFFFFFFFF));
-					else
-						printf("key> the same key test. check nt parity error.\n");
-					
-					uint32_t ntc = prng_successor(nt, 90);
-					uint32_t ntx = 0;
-					int ntcnt = 0;
-					for (int i = 0; i < 16383; i++) {
-						ntc = prng_successor(ntc, 1);
-						if (NTParityCheck(ntc)){
-							if (!ntcnt)
-								ntx = ntc;
-							ntcnt++;
-						}						
-					}
-					if (ntcnt)
-						printf("key> nt candidate=%08x nonce distance=%d candidates count=%d\n", ntx, nonce_distance(nt, ntx), ntcnt);
-					else
-						printf("key> don't have any nt candidate( \n");
-
-					nt = ntx;
-					ks2 = ar_enc ^ prng_successor(ntx, 64);
-					ks3 = at_enc ^ prng_successor(ntx, 96);
-
-					// decode key
-					revstate = lfsr_recovery64(ks2, ks3);
-					lfsr_rollback_word(revstate, 0, 0);
-					lfsr_rollback_word(revstate, 0, 0);
-					lfsr_rollback_word(revstate, nr_enc, 1);
-					lfsr_rollback_word(revstate, uid ^ nt, 0);
-
-					crypto1_get_lfsr(revstate, &lfsr);
-					crypto1_destroy(revstate);
-					ui64Key = lfsr;
-					printf("key> probable key:%x%x  ks2:%08x ks3:%08x\n", 
-						(unsigned int)((lfsr & 0xFFFFFFFF00000000) >> 32), (unsigned int)(lfsr & 0xFFFFFFFF),
-						ks2,
-						ks3);
-					AddLogUint64(logHexFileName, "key> ", lfsr);
-				} else {				
-					printf("key> hardnested not implemented!\n");
-				
-					crypto1_destroy(traceCrypto1);
-
-					// not implemented
-					traceState = TRACE_ERROR;
-				}
-			}
-
-			int blockShift = ((traceCurBlock & 0xFC) + 3) * 16;
-			if (isBlockEmpty((traceCurBlock & 0xFC) + 3)) memcpy(traceCard + blockShift + 6, trailerAccessBytes, 4);
-
-			if (traceCurKey) {
-				num_to_bytes(lfsr, 6, traceCard + blockShift + 10);
-			} else {
-				num_to_bytes(lfsr, 6, traceCard + blockShift);
-			}
-			if (wantSaveToEmlFile) saveTraceCard();
+			session->state = TRACE_IDLE;
 
-			if (traceCrypto1) {
-				crypto1_destroy(traceCrypto1);
-			}
-
-			// set cryptosystem state
-			traceCrypto1 = lfsr_recovery64(ks2, ks3);
-			return 0;
+			session->at_enc = bytes_to_num(data, 4);
+			session->at_enc_par = parity;
+			return mfTraceAuthOk(session);
 		} else {
-			traceState = TRACE_ERROR;
+			session->state = TRACE_ERROR;
 			return 1;
 		}
 	break;
 
 	default:
-		traceState = TRACE_ERROR;
+		session->state = TRACE_ERROR;
 		return 1;
 	}
 
 	return 0;
 }
 
+int mfTraceInit(uint8_t *tuid, uint8_t *atqa, uint8_t sak, bool wantSaveToEmlFile) {
+	traceCurSession = mfTraceSessionGet(tuid, wantSaveToEmlFile);
+	if (!traceCurSession)
+		return 1;
+
+	memcpy(traceCurSession->logFileName, logHexFileName, FILE_PATH_SIZE);
+	mfTraceSessionSelect(traceCurSession, atqa, sak);
+	return 0;
+}
+
+int mfTraceDecode(uint8_t *data_src, int len, uint8_t parity, bool wantSaveToEmlFile) {
+	if (!traceCurSession)
+		return 1;
+
+	return mfTraceSessionDecode(traceCurSession, data_src, len, parity);
+}
+
+// saves changed card images and flushes the log. Called after each chunk of sniffed data.
+void mfTraceFlush(void) {
+	for (int i = 0; i < MF_TRACE_MAX_SESSIONS; i++) {
+		mf_trace_session_t *s = traceSessions[i];
+		if (s && s->saveToEml && s->cardChanged)
+			saveTraceCard(s);
+	}
+	AddLogFlush();
+}
+
+// prints the recovered keys and drops all sessions
+void mfTraceEnd(void) {
+	bool header = false;
+
+	for (int i = 0; i < MF_TRACE_MAX_SESSIONS; i++) {
+		mf_trace_session_t *s = traceSessions[i];
+		if (!s)
+			continue;
+
+		if (s->keysCount) {
+			if (!header) {
+				PrintAndLog("|----------------|--------|-----|--------------|");
+				PrintAndLog("|      uid       | sector | key |     value    |");
+				PrintAndLog("|----------------|--------|-----|--------------|");
+				header = true;
+			}
+			for (int j = 0; j < s->keysCount; j++)
+				PrintAndLog("| %-14s |  %3d   |  %c  | %012" PRIx64 " |",
+					sprint_hex_inrow(s->uid + 7 - s->uidLen, s->uidLen),
+					s->keys[j].sector,
+					s->keys[j].keyType ? 'B' : 'A',
+					s->keys[j].key);
+		}
+
+		mfTraceSessionFree(s);
+		traceSessions[i] = NULL;
+	}
+	if (header)
+		PrintAndLog("|----------------|--------|-----|--------------|");
+
+	traceCurSession = NULL;
+	AddLogClose();
+}
+
 // DECODING
 
 int tryDecryptWord(uint32_t nt, uint32_t ar_enc, uint32_t at_enc, uint8_t *data, int len){
@@ -1029,17 +1269,14 @@ int tryDecryptWord(uint32_t nt, uint32_t ar_enc, uint32_t at_enc, uint8_t *data,
 	uint32_t ar_enc;  // encrypted reader response
 	uint32_t at_enc;  // encrypted tag response
 	*/
-	if (traceCrypto1) {
-		crypto1_destroy(traceCrypto1);
-	}
-	ks2 = ar_enc ^ prng_successor(nt, 64);
-	ks3 = at_enc ^ prng_successor(nt, 96);
-	traceCrypto1 = lfsr_recovery64(ks2, ks3);
+	uint32_t ks2 = ar_enc ^ prng_successor(nt, 64);
+	uint32_t ks3 = at_enc ^ prng_successor(nt, 96);
+	struct Crypto1State *pcs = lfsr_recovery64(ks2, ks3);
 
-	mf_crypto1_decrypt(traceCrypto1, data, len, 0);
+	mf_crypto1_decrypt(pcs, data, len, 0);
 
 	PrintAndLog("Decrypted data: [%s]", sprint_hex(data,len) );
-	crypto1_destroy(traceCrypto1);
+	crypto1_destroy(pcs);
 	return 0;
 }
 
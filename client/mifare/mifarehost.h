@@ -30,11 +30,53 @@
 #define CSETBLOCK_SINGLE_OPER			0x1F
 #define CSETBLOCK_MAGIC_1B 			0x40
 
+// blocks per mfCSetBlocks/mfCGetBlocks command (USB_CMD_DATA_SIZE / 16)
+#define MF_CBLOCKS_PER_CMD			32
+
 typedef struct {
 	uint64_t Key[2];
 	int foundKey[2];
 } sector_t;
 
+// sniffer decoder
+#define MF_TRACE_MAX_SESSIONS		8
+#define MF_TRACE_MAX_KEYS			80
+
+typedef struct {
+	uint8_t sector;
+	uint8_t keyType;
+	uint64_t key;
+} mf_trace_key_t;
+
+// decoder state of one card. uid is 7 bytes, 4 byte uids start at uid + 3.
+typedef struct {
+	uint8_t uid[7];
+	uint8_t uidLen;
+	uint32_t cuid;
+	uint32_t lastSelect;
+	int state;
+	uint8_t curBlock;
+	uint8_t curKey;
+	struct Crypto1State *crypto1;
+	uint64_t key;
+	uint32_t nt;        // tag challenge
+	uint32_t nt_enc;    // encrypted tag challenge
+	uint8_t nt_enc_par; // encrypted tag challenge parity
+	uint32_t nr_enc;    // encrypted reader challenge
+	uint32_t ar_enc;    // encrypted reader response
+	uint8_t ar_enc_par; // encrypted reader response parity
+	uint32_t at_enc;    // encrypted tag response
+	uint8_t at_enc_par; // encrypted tag response parity
+	uint32_t authCount;
+	int keysCount;
+	mf_trace_key_t keys[MF_TRACE_MAX_KEYS];
+	bool saveToEml;
+	bool cardChanged;
+	char emlFileName[FILE_PATH_SIZE];
+	char logFileName[FILE_PATH_SIZE];
+	uint8_t card[4096];
+} mf_trace_session_t;
+
 extern char logHexFileName[FILE_PATH_SIZE];
 
 extern int mfDarkside(uint64_t *key);
@@ -51,15 +93,19 @@ extern int mfCWipe(uint32_t numSectors, bool gen1b, bool wantWipe, bool wantFill
 extern int mfCSetUID(uint8_t *uid, uint8_t *atqa, uint8_t *sak, uint8_t *oldUID);
 extern int mfCSetBlock(uint8_t blockNo, uint8_t *data, uint8_t *uid, bool wantWipe, uint8_t params);
 extern int mfCGetBlock(uint8_t blockNo, uint8_t *data, uint8_t params);
+extern int mfCSetBlocks(uint8_t firstBlock, uint8_t blocksCount, uint8_t *data, uint8_t params, uint32_t *errorMask, int *lostAt);
+extern int mfCGetBlocks(uint8_t firstBlock, uint8_t blocksCount, uint8_t *data, uint8_t params, uint32_t *errorMask, int *lostAt);
+extern int mfCSetCard(uint8_t *data, int blocksCount, bool gen1b, uint32_t *errorMap);
+extern int mfCGetCard(uint8_t *data, int blocksCount, bool gen1b, uint32_t *errorMap);
 
+extern mf_trace_session_t *mfTraceSessionGet(uint8_t *tuid, bool wantSaveToEmlFile);
+extern void mfTraceSessionSelect(mf_trace_session_t *session, uint8_t *atqa, uint8_t sak);
+extern int mfTraceSessionDecode(mf_trace_session_t *session, uint8_t *data_src, int len, uint8_t parity);
 extern int mfTraceInit(uint8_t *tuid, uint8_t *atqa, uint8_t sak, bool wantSaveToEmlFile);
 extern int mfTraceDecode(uint8_t *data_src, int len, uint8_t parity, bool wantSaveToEmlFile);
+extern void mfTraceFlush(void);
+extern void mfTraceEnd(void);
 
-extern int isTraceCardEmpty(void);
-extern int isBlockEmpty(int blockN);
-extern int isBlockTrailer(int blockN);
-extern int loadTraceCard(uint8_t *tuid);
-extern int saveTraceCard(void);
 extern int tryDecryptWord(uint32_t nt, uint32_t ar_enc, uint32_t at_enc, uint8_t *data, int len);
 
 extern int mfCIdentify();
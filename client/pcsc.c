@@ -39,8 +39,9 @@ static SCARDHANDLE SC_Card;
 static DWORD SC_Protocol;
 static char* AlternativeSmartcardReader = NULL;
 
-#define PCSC_MAX_TRACELEN 60000
-static uint8_t pcsc_trace_buf[PCSC_MAX_TRACELEN];
+#define PCSC_TRACE_CHUNK_SIZE (1<<16)
+static uint8_t *pcsc_trace_buf = NULL;
+static uint32_t pcsc_trace_size = 0;
 static bool tracing = false;
 static uint32_t traceLen = 0;
 
@@ -72,16 +73,26 @@ static bool pcsc_LogTrace(const uint8_t *btBytes, uint16_t iLen, uint32_t timest
 {
 	if (!tracing) return false;
 
-	uint8_t *trace = pcsc_trace_buf;
-
 	uint32_t num_paritybytes = (iLen-1)/8 + 1;	// number of paritybytes
 	uint32_t duration = timestamp_end - timestamp_start;
 
-	// Return when trace is full
-	if (traceLen + sizeof(iLen) + sizeof(timestamp_start) + sizeof(duration) + num_paritybytes + iLen >= PCSC_MAX_TRACELEN) {
-		tracing = false;	// don't trace any more
-		return false;
+	// Grow the trace buffer when it is full
+	uint32_t needed = traceLen + sizeof(iLen) + sizeof(timestamp_start) + sizeof(uint16_t) + num_paritybytes + iLen;
+	if (needed > pcsc_trace_size) {
+		uint32_t new_size = pcsc_trace_size;
+		while (new_size < needed) {
+			new_size += PCSC_TRACE_CHUNK_SIZE;
+		}
+		uint8_t *p = realloc(pcsc_trace_buf, new_size);
+		if (p == NULL) {
+			tracing = false;	// don't trace any more
+			return false;
+		}
+		pcsc_trace_buf = p;
+		pcsc_trace_size = new_size;
 	}
+
+	uint8_t *trace = pcsc_trace_buf;
 	// Traceformat:
 	// 32 bits timestamp (little endian)
 	// 16 bits duration (little endian)
@@ -1,6 +1,7 @@
 --
 -- lf_bulk_program.lua - A tool to clone a large number of tags at once.
 -- Updated 2017-04-18
+-- Cards are programmed with `lf hid bulk`, one device command for the whole batch
 --
 -- The getopt-functionality is loaded from pm3/client/lualibs/getopt.lua
 -- Have a look there for further details
@@ -141,18 +142,12 @@ local function main(args)
 	--where users specifying -c 1 (count = 1) would try to program two
 	--tags.  This makes it so that -c 0 & -c 1 both code one tag, and all
 	--other values encode the expected amount.
-	if tonumber(count) > 0 then count = count -1 end
+	if tonumber(count) < 1 then count = 1 end
 
-	endid = baseid + count
-
-	for cardnum = baseid,endid do
-		local card = cardHex(cardnum, facility)
-		print("Press enter to program card "..cardnum..":"..facility.." (hex: "..card..")")
-		--This would be better with "press any key", but we'll take
-		--what we can get.
-		io.read()
-		core.console( ('lf hid clone %s'):format(card) )
-	end
+	--The device runs the whole batch: it waits for every card, writes
+	--it and reads it back, so there is no key press per card anymore.
+	print(("Programming %d cards from %d:%d (hex: %s)"):format(count, baseid, facility, cardHex(baseid, facility)))
+	core.console( ('lf hid bulk H10301 f %d c %d n %d'):format(facility, baseid, count) )
 end
 
 
@@ -0,0 +1,380 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Smartcard exchange recording and replay (PCSC readers and RDV40 slot)
+//
+// Trace file format (all values little endian):
+//   8 bytes  magic "PM3SCTR" + version byte
+//   records:
+//     32 bits flags (SMARTCARD_COMMAND flags or SCTRACE_ATR)
+//     16 bits command length
+//     16 bits response length (signed, < 0 if the exchange failed)
+//     command bytes
+//     response bytes (if response length > 0)
+//-----------------------------------------------------------------------------
+
+#include "sctrace.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ui.h"
+
+#define SCTRACE_MAGIC          "PM3SCTR"
+#define SCTRACE_VERSION        1
+#define SCTRACE_HEADER_LEN     8
+#define SCTRACE_RECORD_HDR_LEN 8
+
+// flags that have to match for a replayed record to answer a command
+#define SCTRACE_MATCH_FLAGS    (SC_RAW | SC_RAW_T0 | SCTRACE_ATR)
+
+typedef struct {
+	uint32_t flags;
+	uint32_t hash;
+	uint16_t cmd_len;
+	int16_t resp_len;
+	uint8_t *cmd;
+	uint8_t *resp;
+	uint32_t next;             // next record in the same hash bucket, in recording order
+} sctrace_record_t;
+
+#define SCTRACE_NO_RECORD      0xffffffffU
+
+static FILE *record_file = NULL;
+static uint32_t record_count = 0;
+
+static uint8_t *replay_data = NULL;
+static sctrace_record_t *replay_index = NULL;
+static uint32_t *replay_buckets = NULL;
+static uint32_t replay_bucket_mask = 0;
+static uint32_t replay_count = 0;
+static uint32_t replay_pos = 0;
+static uint32_t replay_hits = 0;
+static uint32_t replay_misses = 0;
+
+
+static uint32_t sctrace_hash(uint32_t flags, const uint8_t *data, uint32_t len)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261U ^ (flags & SCTRACE_MATCH_FLAGS);
+	for (uint32_t i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+
+static uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+bool sctrace_start_record(const char *filename)
+{
+	sctrace_stop_record();
+
+	record_file = fopen(filename, "wb");
+	if (record_file == NULL) {
+		PrintAndLogEx(ERR, "Could not create trace file %s", filename);
+		return false;
+	}
+
+	uint8_t header[SCTRACE_HEADER_LEN] = SCTRACE_MAGIC;
+	header[SCTRACE_HEADER_LEN - 1] = SCTRACE_VERSION;
+	if (fwrite(header, 1, sizeof(header), record_file) != sizeof(header)) {
+		PrintAndLogEx(ERR, "Could not write trace file %s", filename);
+		fclose(record_file);
+		record_file = NULL;
+		return false;
+	}
+
+	record_count = 0;
+	return true;
+}
+
+
+void sctrace_stop_record(void)
+{
+	if (record_file == NULL)
+		return;
+
+	fclose(record_file);
+	record_file = NULL;
+	PrintAndLogEx(INFO, "Recorded %u smartcard exchanges", record_count);
+}
+
+
+bool sctrace_is_recording(void)
+{
+	return record_file != NULL;
+}
+
+
+void sctrace_record(uint32_t flags, const uint8_t *cmd, uint32_t cmd_len, const uint8_t *resp, int resp_len)
+{
+	if (record_file == NULL)
+		return;
+
+	if (cmd_len > 0xffff || resp_len > 0x7fff || (resp == NULL && resp_len > 0))
+		return;
+
+	if (resp_len < 0)
+		resp_len = -1;
+
+	uint8_t hdr[SCTRACE_RECORD_HDR_LEN];
+	hdr[0] = (flags >> 0) & 0xff;
+	hdr[1] = (flags >> 8) & 0xff;
+	hdr[2] = (flags >> 16) & 0xff;
+	hdr[3] = (flags >> 24) & 0xff;
+	put_le16(hdr + 4, cmd_len);
+	put_le16(hdr + 6, (uint16_t)(int16_t)resp_len);
+
+	bool ok = fwrite(hdr, 1, sizeof(hdr), record_file) == sizeof(hdr);
+	if (ok && cmd_len > 0)
+		ok = fwrite(cmd, 1, cmd_len, record_file) == cmd_len;
+	if (ok && resp_len > 0)
+		ok = fwrite(resp, 1, resp_len, record_file) == (size_t)resp_len;
+	// one exchange takes milliseconds on the wire. Flushing keeps the trace usable if the client dies.
+	if (ok)
+		ok = fflush(record_file) == 0;
+
+	if (!ok) {
+		PrintAndLogEx(ERR, "Error writing trace file. Recording stopped.");
+		sctrace_stop_record();
+		return;
+	}
+
+	record_count++;
+}
+
+
+void sctrace_stop_replay(void)
+{
+	free(replay_buckets);
+	free(replay_index);
+	free(replay_data);
+	replay_buckets = NULL;
+	replay_bucket_mask = 0;
+	replay_index = NULL;
+	replay_data = NULL;
+	replay_count = 0;
+	replay_pos = 0;
+}
+
+
+bool sctrace_start_replay(const char *filename)
+{
+	sctrace_stop_replay();
+
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		PrintAndLogEx(ERR, "Could not open trace file %s", filename);
+		return false;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long fsize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	if (fsize < SCTRACE_HEADER_LEN) {
+		PrintAndLogEx(ERR, "Trace file %s is too short", filename);
+		fclose(f);
+		return false;
+	}
+
+	replay_data = malloc(fsize);
+	if (replay_data == NULL) {
+		PrintAndLogEx(ERR, "Cannot allocate memory for trace");
+		fclose(f);
+		return false;
+	}
+
+	size_t bytes_read = fread(replay_data, 1, fsize, f);
+	fclose(f);
+	if (bytes_read != fsize) {
+		PrintAndLogEx(ERR, "Could not read trace file %s", filename);
+		sctrace_stop_replay();
+		return false;
+	}
+
+	if (memcmp(replay_data, SCTRACE_MAGIC, SCTRACE_HEADER_LEN - 1) || replay_data[SCTRACE_HEADER_LEN - 1] != SCTRACE_VERSION) {
+		PrintAndLogEx(ERR, "%s is not a smartcard trace file", filename);
+		sctrace_stop_replay();
+		return false;
+	}
+
+	// first pass: count records and validate lengths
+	uint32_t count = 0;
+	long pos = SCTRACE_HEADER_LEN;
+	while (pos + SCTRACE_RECORD_HDR_LEN <= fsize) {
+		uint16_t cmd_len = get_le16(replay_data + pos + 4);
+		int16_t resp_len = (int16_t)get_le16(replay_data + pos + 6);
+		long next = pos + SCTRACE_RECORD_HDR_LEN + cmd_len + (resp_len > 0 ? resp_len : 0);
+		if (next > fsize)
+			break;
+		pos = next;
+		count++;
+	}
+
+	if (pos != fsize)
+		PrintAndLogEx(WARNING, "Trace file %s is truncated. Using the first %u records.", filename, count);
+
+	// hash index on (flags, command): a power of two buckets, at least one per record
+	uint32_t nbuckets = 1;
+	while (nbuckets < count)
+		nbuckets <<= 1;
+
+	replay_index = calloc(count ? count : 1, sizeof(sctrace_record_t));
+	replay_buckets = malloc(nbuckets * sizeof(uint32_t));
+	if (replay_index == NULL || replay_buckets == NULL) {
+		PrintAndLogEx(ERR, "Cannot allocate memory for trace index");
+		sctrace_stop_replay();
+		return false;
+	}
+
+	replay_bucket_mask = nbuckets - 1;
+	for (uint32_t b = 0; b < nbuckets; b++)
+		replay_buckets[b] = SCTRACE_NO_RECORD;
+
+	// second pass: build the index. Records are inserted in reverse so that every
+	// bucket chain ends up in recording order.
+	pos = SCTRACE_HEADER_LEN;
+	for (uint32_t i = 0; i < count; i++) {
+		sctrace_record_t *r = &replay_index[i];
+		r->flags = get_le32(replay_data + pos);
+		r->cmd_len = get_le16(replay_data + pos + 4);
+		r->resp_len = (int16_t)get_le16(replay_data + pos + 6);
+		r->cmd = replay_data + pos + SCTRACE_RECORD_HDR_LEN;
+		r->resp = r->cmd + r->cmd_len;
+		r->hash = sctrace_hash(r->flags, r->cmd, r->cmd_len);
+		pos += SCTRACE_RECORD_HDR_LEN + r->cmd_len + (r->resp_len > 0 ? r->resp_len : 0);
+	}
+	for (uint32_t i = count; i-- > 0; ) {
+		uint32_t b = replay_index[i].hash & replay_bucket_mask;
+		replay_index[i].next = replay_buckets[b];
+		replay_buckets[b] = i;
+	}
+
+	replay_count = count;
+	replay_pos = 0;
+	replay_hits = 0;
+	replay_misses = 0;
+
+	PrintAndLogEx(INFO, "Loaded %u smartcard exchanges from %s", replay_count, filename);
+	return true;
+}
+
+
+bool sctrace_is_replaying(void)
+{
+	return replay_data != NULL;
+}
+
+
+static bool record_matches(const sctrace_record_t *r, uint32_t flags, uint32_t hash, const uint8_t *cmd, uint32_t cmd_len)
+{
+	return r->hash == hash
+		&& ((r->flags ^ flags) & SCTRACE_MATCH_FLAGS) == 0
+		&& r->cmd_len == cmd_len
+		&& (cmd_len == 0 || memcmp(r->cmd, cmd, cmd_len) == 0);
+}
+
+
+// Replays are answered in recording order. If the client deviates from the recorded
+// sequence, the next matching record after the current position is used, wrapping
+// around once, so repeated runs over the same trace keep working.
+static const sctrace_record_t *find_record(uint32_t flags, const uint8_t *cmd, uint32_t cmd_len)
+{
+	uint32_t hash = sctrace_hash(flags, cmd, cmd_len);
+	uint32_t first = SCTRACE_NO_RECORD;
+	uint32_t found = SCTRACE_NO_RECORD;
+
+	if (replay_count > 0) {
+		for (uint32_t i = replay_buckets[hash & replay_bucket_mask]; i != SCTRACE_NO_RECORD; i = replay_index[i].next) {
+			if (!record_matches(&replay_index[i], flags, hash, cmd, cmd_len))
+				continue;
+			if (first == SCTRACE_NO_RECORD)
+				first = i;
+			if (i >= replay_pos) {
+				found = i;
+				break;
+			}
+		}
+	}
+
+	if (found == SCTRACE_NO_RECORD)
+		found = first;
+
+	if (found == SCTRACE_NO_RECORD) {
+		replay_misses++;
+		return NULL;
+	}
+
+	replay_pos = (found + 1) % replay_count;
+	replay_hits++;
+	return &replay_index[found];
+}
+
+
+bool sctrace_replay(uint32_t flags, const uint8_t *cmd, uint32_t cmd_len, uint8_t *resp, int *resp_len, uint32_t max_resp_len)
+{
+	const sctrace_record_t *r = find_record(flags, cmd, cmd_len);
+	if (r == NULL) {
+		*resp_len = -1;
+		return false;
+	}
+
+	*resp_len = r->resp_len;
+	if (r->resp_len > 0) {
+		if (r->resp_len > max_resp_len || resp == NULL) {
+			*resp_len = -1;
+			return false;
+		}
+		memcpy(resp, r->resp, r->resp_len);
+	}
+	return true;
+}
+
+
+bool sctrace_replay_atr(smart_card_atr_t *card)
+{
+	const sctrace_record_t *r = find_record(SCTRACE_ATR, NULL, 0);
+	if (r == NULL || r->resp_len <= 0 || r->resp_len > sizeof(card->atr))
+		return false;
+
+	memset(card->atr, 0, sizeof(card->atr));
+	memcpy(card->atr, r->resp, r->resp_len);
+	card->atr_len = r->resp_len;
+	return true;
+}
+
+
+void sctrace_print_stats(void)
+{
+	if (record_file != NULL)
+		PrintAndLogEx(INFO, "Recording: %u exchanges written", record_count);
+
+	if (replay_data != NULL)
+		PrintAndLogEx(INFO, "Replaying: %u exchanges loaded, %u answered, %u unmatched", replay_count, replay_hits, replay_misses);
+
+	if (record_file == NULL && replay_data == NULL)
+		PrintAndLogEx(INFO, "Smartcard trace recording and replay are off");
+}
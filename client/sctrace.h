@@ -0,0 +1,31 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Smartcard exchange recording and replay (PCSC readers and RDV40 slot)
+//-----------------------------------------------------------------------------
+
+#ifndef SCTRACE_H__
+#define SCTRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "smartcard.h"
+
+// record type for ATRs. Lives above the SMARTCARD_COMMAND flag bits.
+#define SCTRACE_ATR        (1 << 16)
+
+bool sctrace_start_record(const char *filename);
+void sctrace_stop_record(void);
+bool sctrace_is_recording(void);
+void sctrace_record(uint32_t flags, const uint8_t *cmd, uint32_t cmd_len, const uint8_t *resp, int resp_len);
+
+bool sctrace_start_replay(const char *filename);
+void sctrace_stop_replay(void);
+bool sctrace_is_replaying(void);
+bool sctrace_replay(uint32_t flags, const uint8_t *cmd, uint32_t cmd_len, uint8_t *resp, int *resp_len, uint32_t max_resp_len);
+bool sctrace_replay_atr(smart_card_atr_t *card);
+void sctrace_print_stats(void);
+
+#endif
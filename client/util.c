@@ -76,28 +76,58 @@ int ukbhit(void) {
 #endif
 
 // log files functions
-void AddLogLine(char *file, char *extData, char *c) {
-	FILE *fLog = NULL;
-    char filename[FILE_PATH_SIZE] = {0x00};
-    int len = 0;
-
-    len = strlen(file);
-    if (len > FILE_PATH_SIZE) len = FILE_PATH_SIZE;
-    memcpy(filename, file, len);
-   
-	fLog = fopen(filename, "a");
-	if (!fLog) {
+// the log file stays open between lines and is written through a stdio buffer.
+// It is flushed by AddLogFlush() and closed by AddLogClose() or when another file is logged to.
+static FILE *logFile = NULL;
+static char logFileName[FILE_PATH_SIZE] = {0x00};
+
+static FILE *AddLogOpen(char *file) {
+	char filename[FILE_PATH_SIZE] = {0x00};
+	int len = strlen(file);
+	if (len > FILE_PATH_SIZE - 1) len = FILE_PATH_SIZE - 1;
+	memcpy(filename, file, len);
+
+	if (logFile && !strcmp(filename, logFileName))
+		return logFile;
+
+	AddLogClose();
+	logFile = fopen(filename, "a");
+	if (!logFile) {
 		printf("Could not append log file %s", filename);
-		return;
+		return NULL;
 	}
+	setvbuf(logFile, NULL, _IOFBF, 64 * 1024);
+	strcpy(logFileName, filename);
+	return logFile;
+}
+
+void AddLogLine(char *file, char *extData, char *c) {
+	FILE *fLog = AddLogOpen(file);
+	if (!fLog)
+		return;
 
 	fprintf(fLog, "%s", extData);
 	fprintf(fLog, "%s\n", c);
-	fclose(fLog);
+}
+
+void AddLogFlush(void) {
+	if (logFile)
+		fflush(logFile);
+}
+
+void AddLogClose(void) {
+	if (logFile)
+		fclose(logFile);
+	logFile = NULL;
+	logFileName[0] = 0x00;
 }
 
 void AddLogHex(char *fileName, char *extData, const uint8_t * data, const size_t len){
-	AddLogLine(fileName, extData, sprint_hex(data, len));
+	char *buf = malloc(SPRINT_HEX_SIZE(len));
+	if (!buf)
+		return;
+	AddLogLine(fileName, extData, sprint_hex_r(buf, SPRINT_HEX_SIZE(len), data, len));
+	free(buf);
 }
 
 void AddLogUint64(char *fileName, char *extData, const uint64_t data) {
@@ -165,40 +195,61 @@ bool CheckStringIsHEXValue(const char *value) {
 	return true;
 }
 
+static const char hex_digits[] = "0123456789abcdef";
+static const char hex_digits_upper[] = "0123456789ABCDEF";
+
+// table lookup per nibble. Writes whole bytes only, at most destlen - 1 characters and the terminator.
+// returns number of characters written
+size_t hex_to_str(char *dest, const size_t destlen, const uint8_t *data, const size_t len, const size_t spaces_between, bool uppercase) {
+	if (destlen == 0)
+		return 0;
+
+	const char *digits = (uppercase) ? hex_digits_upper : hex_digits;
+	size_t n = (destlen - 1) / (2 + spaces_between);
+	if (n > len)
+		n = len;
+
+	char *tmp = dest;
+	for (size_t i = 0; i < n; i++) {
+		*tmp++ = digits[data[i] >> 4];
+		*tmp++ = digits[data[i] & 0x0F];
+		for (size_t j = 0; j < spaces_between; j++)
+			*tmp++ = ' ';
+	}
+	*tmp = '\0';
+
+	return tmp - dest;
+}
+
+// buf must hold hex_max_len characters and the terminator
 void hex_to_buffer(const uint8_t *buf, const uint8_t *hex_data, const size_t hex_len, const size_t hex_max_len, 
 	const size_t min_str_len, const size_t spaces_between, bool uppercase) {
 		
 	char *tmp = (char *)buf;
-	size_t i;
-	memset(tmp, 0x00, hex_max_len);
+	size_t i = hex_to_str(tmp, hex_max_len + 1, hex_data, hex_len, spaces_between, uppercase);
 
-	int maxLen = ( hex_len > hex_max_len) ? hex_max_len : hex_len;
+	size_t minStrLen = min_str_len > hex_max_len ? hex_max_len : min_str_len;
+	for(; i < minStrLen; i++)
+		tmp[i] = ' ';
+	tmp[i] = '\0';
+}
 
-	for (i = 0; i < maxLen; ++i, tmp += 2 + spaces_between) {
-		sprintf(tmp, (uppercase) ? "%02X" : "%02x", (unsigned int) hex_data[i]); 
-		
-		for (int j = 0; j < spaces_between; j++)
-			sprintf(tmp + 2 + j, " ");
-	}
-	
-	i *= (2 + spaces_between);
-	int minStrLen = min_str_len > i ? min_str_len : 0;
-	if (minStrLen > hex_max_len)
-		minStrLen = hex_max_len;
-	for(; i < minStrLen; i++, tmp += 1) 
-		sprintf(tmp, " ");
+// printing and converting functions
 
-	return;
+char *sprint_hex_r(char *dest, const size_t destlen, const uint8_t *data, const size_t len) {
+	hex_to_str(dest, destlen, data, len, 1, false);
+	return dest;
 }
 
-// printing and converting functions
+char *sprint_hex_inrow_r(char *dest, const size_t destlen, const uint8_t *data, const size_t len) {
+	hex_to_str(dest, destlen, data, len, 0, false);
+	return dest;
+}
 
 char *sprint_hex(const uint8_t *data, const size_t len) {
 	static char buf[4097] = {0};
 	
-	hex_to_buffer((uint8_t *)buf, data, len, sizeof(buf) - 1, 0, 1, false);
-
-	return buf;
+	return sprint_hex_r(buf, sizeof(buf), data, len);
 }
 
 char *sprint_hex_inrow_ex(const uint8_t *data, const size_t len, const size_t min_str_len) {
@@ -213,35 +264,43 @@ char *sprint_hex_inrow(const uint8_t *data, const size_t len) {
 	return sprint_hex_inrow_ex(data, len, 0);
 }
 
-char *sprint_bin_break(const uint8_t *data, const size_t len, const uint8_t breaks) {
-	// make sure we don't go beyond our char array memory
-	int max_len;
-	if (breaks==0)
-		max_len = ( len > MAX_BIN_BREAK_LENGTH ) ? MAX_BIN_BREAK_LENGTH : len;
-	else
-		max_len = ( len+(len/breaks) > MAX_BIN_BREAK_LENGTH ) ? MAX_BIN_BREAK_LENGTH : len+(len/breaks);
+char *sprint_bin_break_r(char *dest, const size_t destlen, const uint8_t *data, const size_t len, const uint8_t breaks) {
+	if (destlen == 0)
+		return dest;
 
-	static char buf[MAX_BIN_BREAK_LENGTH]; // 3072 + end of line characters if broken at 8 bits
-	//clear memory
-	memset(buf, 0x00, sizeof(buf));
-	char *tmp = buf;
+	// make sure we don't go beyond the buffer
+	size_t max_len = (breaks == 0) ? len : len + len / breaks;
+	if (max_len > destlen - 1)
+		max_len = destlen - 1;
 
+	char *tmp = dest;
 	size_t in_index = 0;
 	// loop through the out_index to make sure we don't go too far
-	for (size_t out_index=0; out_index < max_len; out_index++) {
+	for (size_t out_index = 0; out_index < max_len; out_index++) {
 		// set character - (should be binary but verify it isn't more than 1 digit)
-		if (data[in_index]<10)
-			sprintf(tmp++, "%u", (unsigned int) data[in_index]);
+		if (data[in_index] < 10)
+			*tmp++ = '0' + data[in_index];
 		// check if a line break is needed and we have room to print it in our array
 		if ( (breaks > 0) && !((in_index+1) % breaks) && (out_index+1 < max_len) ) {
 			// increment and print line break
 			out_index++;
-			sprintf(tmp++, "%s","\n");
+			*tmp++ = '\n';
 		}
 		in_index++;
 	}
+	*tmp = '\0';
 
-	return buf;
+	return dest;
+}
+
+char *sprint_bin_r(char *dest, const size_t destlen, const uint8_t *data, const size_t len) {
+	return sprint_bin_break_r(dest, destlen, data, len, 0);
+}
+
+char *sprint_bin_break(const uint8_t *data, const size_t len, const uint8_t breaks) {
+	static char buf[MAX_BIN_BREAK_LENGTH]; // 3072 + end of line characters if broken at 8 bits
+
+	return sprint_bin_break_r(buf, sizeof(buf), data, len, breaks);
 }
 
 char *sprint_bin(const uint8_t *data, const size_t len) {
@@ -352,6 +411,19 @@ char *printBits(size_t const size, void const * const ptr)
 	return buf;
 }
 
+char *printBitsPar_r(char *dest, const size_t destlen, const uint8_t *b, size_t len) {
+	if (destlen == 0)
+		return dest;
+	if (len > destlen - 1)
+		len = destlen - 1;
+
+	for (int i = 0; i < len; i++) {
+		dest[i] = ((b[i / 8] << (i % 8)) & 0x80) ? '1':'0';
+	}
+	dest[len] = '\0';
+	return dest;
+}
+
 char *printBitsPar(const uint8_t *b, size_t len) {
 	static char buf1[512] = {0};
 	static char buf2[512] = {0};
@@ -360,12 +432,8 @@ char *printBitsPar(const uint8_t *b, size_t len) {
 		buf = buf1;
 	else
 		buf = buf2;
-	memset(buf, 0x00, 512);
 
-	for (int i = 0; i < len; i++) {
-		buf[i] = ((b[i / 8] << (i % 8)) & 0x80) ? '1':'0';
-	}
-	return buf;
+	return printBitsPar_r(buf, 512, b, len);
 }
 
 
@@ -86,6 +86,8 @@ extern void AddLogLine(char *fileName, char *extData, char *c);
 extern void AddLogHex(char *fileName, char *extData, const uint8_t * data, const size_t len);
 extern void AddLogUint64(char *fileName, char *extData, const uint64_t data);
 extern void AddLogCurrentDT(char *fileName);
+extern void AddLogFlush(void);
+extern void AddLogClose(void);
 extern void FillFileNameByUID(char *fileName, uint8_t * uid, char *ext, int byteCount);
 
 // fill buffer from structure [{uint8_t data, size_t length},...]
@@ -95,6 +97,20 @@ extern bool CheckStringIsHEXValue(const char *value);
 extern void hex_to_buffer(const uint8_t *buf, const uint8_t *hex_data, const size_t hex_len, 
 	const size_t hex_max_len, const size_t min_str_len, const size_t spaces_between, bool uppercase);
 
+extern size_t hex_to_str(char *dest, const size_t destlen, const uint8_t *data, const size_t len, const size_t spaces_between, bool uppercase);
+
+// the sprint_ and printBits functions below return one static buffer, the _r versions
+// write into the caller's buffer (destlen including the terminator) and can be used from any thread.
+// Output that doesn't fit is cut.
+#define SPRINT_HEX_SIZE(len)       ((len) * 3 + 1)
+#define SPRINT_HEX_INROW_SIZE(len) ((len) * 2 + 1)
+#define SPRINT_BIN_SIZE(len)       ((len) + 1)
+extern char *sprint_hex_r(char *dest, const size_t destlen, const uint8_t *data, const size_t len);
+extern char *sprint_hex_inrow_r(char *dest, const size_t destlen, const uint8_t *data, const size_t len);
+extern char *sprint_bin_r(char *dest, const size_t destlen, const uint8_t *data, const size_t len);
+extern char *sprint_bin_break_r(char *dest, const size_t destlen, const uint8_t *data, const size_t len, const uint8_t breaks);
+extern char *printBitsPar_r(char *dest, const size_t destlen, const uint8_t *b, size_t len);
+
 extern char *sprint_hex(const uint8_t * data, const size_t len);
 extern char *sprint_hex_inrow(const uint8_t *data, const size_t len);
 extern char *sprint_hex_inrow_ex(const uint8_t *data, const size_t len, const size_t min_str_len);
@@ -133,3 +133,17 @@ uint64_t msclock() {
 #endif
 }
 
+
+// a microseconds timer for performance measurement of short runs
+uint64_t usclock() {
+#if defined(_WIN32)
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64_t)count.QuadPart * 1000000 / freq.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000);
+#endif
+}
@@ -22,5 +22,6 @@ extern void msleep(uint32_t n);		// sleep n milliseconds
 #endif // _WIN32
 
 extern uint64_t msclock(); 			// a milliseconds clock
+extern uint64_t usclock(); 			// a microseconds clock
 
 #endif
@@ -33,45 +33,109 @@
 #include "cmd.h"
 #include "string.h"
 #include "proxmark3.h"
+#ifdef ON_DEVICE
+#include "usb_compact.h"
+
+// layout of the last command received. The answers use the same.
+// Back to UsbCommand when the host starts a new session
+static bool compact = false;
+
+// drops the rest of a broken frame, up to the short packet that ends its transfer
+static void cmd_resync(size_t rxlen) {
+  byte_t rx[USB_PACKET_SIZE];
+  if (rxlen % USB_PACKET_SIZE) return;
+  while (usb_poll_validate_length() && usb_read(rx,USB_PACKET_SIZE) == USB_PACKET_SIZE);
+}
+#endif
 
 bool cmd_receive(UsbCommand* cmd) {
  
   // Check if there is a usb packet available
   if (!usb_poll()) return false;
   
+#ifdef ON_DEVICE
+  byte_t rx[USB_COMPACT_MAX_SIZE];
+
+  if (usb_new_session()) compact = false;
+
+  // The first packet tells the layout
+  size_t rxlen = usb_read(rx,USB_PACKET_SIZE);
+  if (rxlen >= sizeof(UsbCompactHeader) && usb_compact_is_frame(rx)) {
+    size_t size = usb_compact_frame_size(rx);
+    if (size == 0) {
+      cmd_resync(rxlen);
+      return false;
+    }
+    if (rxlen < size) rxlen += usb_read(rx+rxlen,size-rxlen);
+    if (!usb_compact_decode(rx,rxlen,cmd)) {
+      cmd_resync(rxlen);
+      return false;
+    }
+    compact = true;
+    return true;
+  }
+
+  if (rxlen < sizeof(UsbCommand)) rxlen += usb_read(rx+rxlen,sizeof(UsbCommand)-rxlen);
+  if (rxlen != sizeof(UsbCommand)) {
+    cmd_resync(rxlen);
+    return false;
+  }
+  memcpy(cmd,rx,sizeof(UsbCommand));
+  compact = false;
+#else
   // Try to retrieve the available command frame
   size_t rxlen = usb_read((byte_t*)cmd,sizeof(UsbCommand));
 
   // Check if the transfer was complete
   if (rxlen != sizeof(UsbCommand)) return false;
+#endif
   
   // Received command successfully
   return true;
 }
 
 bool cmd_send(uint32_t cmd, uint32_t arg0, uint32_t arg1, uint32_t arg2, void* data, size_t len) {
-  UsbCommand txcmd;
+  union {
+    UsbCommand legacy;
+#ifdef ON_DEVICE
+    byte_t compact[USB_COMPACT_MAX_SIZE];
+#endif
+  } tx;
+  UsbCommand *txcmd = &tx.legacy;
+  size_t size = sizeof(UsbCommand);
 
+#ifdef ON_DEVICE
+  if (usb_new_session()) compact = false;
+  if (compact) {
+    uint64_t arg[3] = {arg0, arg1, arg2};
+    size = usb_compact_encode(tx.compact, cmd, arg, data, MIN(len,USB_CMD_DATA_SIZE));
+  } else {
+#endif
   for (size_t i=0; i<sizeof(UsbCommand); i++) {
-    ((byte_t*)&txcmd)[i] = 0x00;
+    ((byte_t*)txcmd)[i] = 0x00;
   }
   
   // Compose the outgoing command frame
-  txcmd.cmd = cmd;
-  txcmd.arg[0] = arg0;
-  txcmd.arg[1] = arg1;	
-  txcmd.arg[2] = arg2;
+  txcmd->cmd = cmd;
+  txcmd->arg[0] = arg0;
+  txcmd->arg[1] = arg1;	
+  txcmd->arg[2] = arg2;
 
   // Add the (optional) content to the frame, with a maximum size of USB_CMD_DATA_SIZE
   if (data && len) {
     len = MIN(len,USB_CMD_DATA_SIZE);
     for (size_t i=0; i<len; i++) {
-      txcmd.d.asBytes[i] = ((byte_t*)data)[i];
+      txcmd->d.asBytes[i] = ((byte_t*)data)[i];
     }
   }
+#ifdef ON_DEVICE
+  }
+#endif
   
-  // Send frame and make sure all bytes are transmitted
-  if (usb_write((byte_t*)&txcmd,sizeof(UsbCommand)) != 0) return false;
+  // Queue the frame. Waits only while the transmit queue is full
+  while (!usb_write_async((byte_t*)&tx,size)) {
+    if (!usb_check()) return false;
+  }
   
   return true;
 }
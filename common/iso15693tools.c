@@ -9,8 +9,10 @@
 
 #include "proxmark3.h"
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
-//#include "iso15693tools.h"
+#include "iso15693tools.h"
+#include "protocols.h"
 #ifdef ON_DEVICE
 #include "printf.h"
 #else
@@ -70,6 +72,88 @@ char* Iso15693sprintUID(char *target,uint8_t *uid) {
   return target;
 }
 
+void Iso15693InvInit(iso15693_inv_t *inv)
+{
+	inv->pending[0].mask = 0;
+	inv->pending[0].masklen = 0;
+	inv->npending = 1;
+	inv->overflow = false;
+}
+
+// next mask to inventory. false if the inventory is complete
+bool Iso15693InvNext(iso15693_inv_t *inv, iso15693_inv_node_t *node)
+{
+	if (inv->npending == 0)
+		return false;
+	*node = inv->pending[--inv->npending];
+	return true;
+}
+
+// more than one tag answered in slot of the inventory with node's mask.
+// The tags in that slot share the next 4 UID bits, which become part of the mask.
+void Iso15693InvCollision(iso15693_inv_t *inv, const iso15693_inv_node_t *node, uint8_t slot)
+{
+	// full UID as mask - the same UID twice or a broken answer. Nothing to split.
+	if (node->masklen + 4 > 64)
+		return;
+	if (inv->npending >= ISO15693_INV_MAX_PENDING) {
+		inv->overflow = true;
+		return;
+	}
+	iso15693_inv_node_t *child = &inv->pending[inv->npending++];
+	child->mask = node->mask | ((uint64_t)(slot & 0x0F) << node->masklen);
+	child->masklen = node->masklen + 4;
+}
+
+// inventory request with CRC for node's mask. returns its length
+int Iso15693InvBuildRequest(uint8_t *req, bool slot1, bool use_afi, uint8_t afi, const iso15693_inv_node_t *node)
+{
+	int n = 0;
+	req[n++] = ISO15693_REQ_DATARATE_HIGH | ISO15693_REQ_INVENTORY
+		| (use_afi ? ISO15693_REQINV_AFI : 0)
+		| (slot1 ? ISO15693_REQINV_SLOT1 : 0);
+	req[n++] = ISO15693_INVENTORY;
+	if (use_afi)
+		req[n++] = afi;
+	req[n++] = node->masklen;
+	for (int i = 0; i < (node->masklen + 7) / 8; i++) {
+		uint8_t b = (node->mask >> (8 * i)) & 0xFF;
+		// unused bits of the last byte are 0
+		if (node->masklen - 8 * i < 8)
+			b &= (1 << (node->masklen - 8 * i)) - 1;
+		req[n++] = b;
+	}
+	return Iso15693AddCrc(req, n);
+}
+
+// does a tag with tag_afi answer an inventory with req_afi (ISO15693-3 table 4)
+bool Iso15693AfiMatch(uint8_t req_afi, uint8_t tag_afi)
+{
+	uint8_t family = req_afi >> 4;
+	uint8_t subfamily = req_afi & 0x0F;
+	return (family == 0 || family == (tag_afi >> 4))
+		&& (subfamily == 0 || subfamily == (tag_afi & 0x0F));
+}
+
+// AFI sweep order. Starts with afi = -1, returns -1 at the end.
+// All sub-families 01..0F answer independent of the family. The families 10..F0
+// are probed as a whole and their sub-families X1..XF only if the family answered.
+int Iso15693AfiNext(int afi, bool answered)
+{
+	if (afi < 0)
+		return 0x01;
+	if (afi < 0x0F)
+		return afi + 1;
+	if (afi == 0x0F)
+		return 0x10;
+	if ((afi & 0x0F) == 0 && answered)
+		return afi + 1;
+	if ((afi & 0x0F) != 0 && (afi & 0x0F) != 0x0F)
+		return afi + 1;
+	afi = (afi & 0xF0) + 0x10;
+	return afi > 0xF0 ? -1 : afi;
+}
+
 uint16_t iclass_crc16(char *data_p, unsigned short length)
 {
       unsigned char i;
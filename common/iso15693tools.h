@@ -4,14 +4,56 @@
 #ifndef ISO15693_H__
 #define ISO15693_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
 // ISO15693 CRC
 #define ISO15693_CRC_PRESET  (uint16_t)0xFFFF
 #define ISO15693_CRC_POLY    (uint16_t)0x8408
 #define ISO15693_CRC_CHECK   ((uint16_t)(~0xF0B8 & 0xFFFF))  // use this for checking of a correct crc
 
+// 16 slot inventory (ISO15693-3 Annex D). Slots that collided are inventoried again
+// with the UID mask extended by the slot number, depth first.
+#define ISO15693_INV_MAX_PENDING  32
+#define ISO15693_INV_MAX_REQUEST  14  // flags, cmd, AFI, mask length, 8 bytes mask, CRC
+
+// CMD_ISO_15693_INVENTORY arg0
+#define ISO15693_INV_AFI          0x01  // only tags with the AFI in arg1
+#define ISO15693_INV_SWEEP        0x02  // all tags, then every AFI that answers
+
+// CMD_ACK arg1 of the inventory answers
+#define ISO15693_INV_DONE         0x01  // last frame
+#define ISO15693_INV_INCOMPLETE   0x02  // too many collisions, some branches were not inventoried
+#define ISO15693_INV_ABORTED      0x04  // button or usb command
+
+typedef struct {
+	uint64_t mask;                  // UID bits, LSB first
+	uint8_t masklen;                // in bits
+} iso15693_inv_node_t;
+
+typedef struct {
+	iso15693_inv_node_t pending[ISO15693_INV_MAX_PENDING];
+	uint8_t npending;
+	bool overflow;
+} iso15693_inv_t;
+
+// one tag found. afi is 0 for the inventory without AFI. uid in transmission order
+typedef struct {
+	uint8_t afi;
+	uint8_t uid[8];
+	uint8_t dsfid;
+} __attribute__((__packed__)) iso15693_inv_record_t;
+
 uint16_t Iso15693Crc(uint8_t *v, int n);
 int Iso15693AddCrc(uint8_t *req, int n);
 char* Iso15693sprintUID(char *target,uint8_t *uid);
 unsigned short iclass_crc16(char *data_p, unsigned short length);
 
+void Iso15693InvInit(iso15693_inv_t *inv);
+bool Iso15693InvNext(iso15693_inv_t *inv, iso15693_inv_node_t *node);
+void Iso15693InvCollision(iso15693_inv_t *inv, const iso15693_inv_node_t *node, uint8_t slot);
+int Iso15693InvBuildRequest(uint8_t *req, bool slot1, bool use_afi, uint8_t afi, const iso15693_inv_node_t *node);
+bool Iso15693AfiMatch(uint8_t req_afi, uint8_t tag_afi);
+int Iso15693AfiNext(int afi, bool answered);
+
 #endif
@@ -0,0 +1,204 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Lossless compression of 8 bit LF captures.
+// ASK/NRZ envelopes are flat between edges and compress with the previous
+// sample as prediction. FSK/PSK repeat with the field clock, so the sample one
+// carrier period before is a good prediction. The encoder does a constant
+// amount of work per sample so it can run in the sampling loop.
+//-----------------------------------------------------------------------------
+
+#include "lfcompress.h"
+
+// worst case of one block. A residual never takes more than 2 bytes with the code it opens.
+#define LFCOMPRESS_BLOCK_MAX  (2 + 2 * LFCOMPRESS_BLOCK)
+
+static const uint8_t lfPredictors[LFCOMPRESS_PREDICTORS] = {1, 2, 4, 5, 8, 10, 16};
+
+void lfCompressInit(lfcompress_t *c, uint8_t *dest, uint32_t size) {
+	c->dest = dest;
+	c->size = size;
+	c->len = 0;
+	for (int i = 0; i < LFCOMPRESS_HISTORY; i++)
+		c->hist[i] = 128;
+	c->histPos = 0;
+	for (int p = 0; p < LFCOMPRESS_PREDICTORS; p++)
+		c->cost[p] = 0;
+	c->count = 0;
+	c->outLen = 0;
+	c->outPos = 0;
+	c->run = 0;
+	c->havePending = false;
+	c->rawCnt = 0;
+}
+
+static void lfCompressFlush(lfcompress_t *c) {
+	if (c->havePending) {
+		c->dest[c->len++] = 0x80 | (c->pending & 0x3F);
+		c->havePending = false;
+	}
+	if (c->run) {
+		c->dest[c->len++] = c->run - 1;
+		c->run = 0;
+	}
+	c->rawCnt = 0;
+}
+
+static void lfCompressResidual(lfcompress_t *c, int8_t r) {
+	bool small = (r >= -4 && r <= 3);
+
+	if (c->havePending && small) {
+		c->dest[c->len++] = 0x40 | ((c->pending & 0x07) << 3) | (r & 0x07);
+		c->havePending = false;
+		return;
+	}
+
+	if (r == 0 && !c->havePending) {
+		c->rawCnt = 0;
+		if (++c->run == 64) {
+			c->dest[c->len++] = c->run - 1;
+			c->run = 0;
+		}
+		return;
+	}
+
+	if (r >= -32 && r <= 31) {
+		lfCompressFlush(c);
+		if (small) {
+			c->pending = r;
+			c->havePending = true;
+		} else {
+			c->dest[c->len++] = 0x80 | (r & 0x3F);
+		}
+		return;
+	}
+
+	if (c->rawCnt == 0 || c->rawCnt == 64) {
+		lfCompressFlush(c);
+		c->rawPos = c->len++;
+	}
+	c->dest[c->len++] = (uint8_t)r;
+	c->dest[c->rawPos] = 0xC0 | c->rawCnt++;
+}
+
+// picks the predictor of the collected block and makes it the block being written
+static void lfCompressStartBlock(lfcompress_t *c) {
+	uint8_t best = 0;
+	for (uint8_t p = 1; p < LFCOMPRESS_PREDICTORS; p++)
+		if (c->cost[p] < c->cost[best])
+			best = p;
+
+	c->dest[c->len++] = ((c->count - 1) << 3) | best;
+	for (uint8_t i = 0; i < c->count; i++)
+		c->out[i] = c->res[best][i];
+	c->outLen = c->count;
+	c->outPos = 0;
+
+	c->count = 0;
+	for (uint8_t p = 0; p < LFCOMPRESS_PREDICTORS; p++)
+		c->cost[p] = 0;
+}
+
+static void lfCompressWriteNext(lfcompress_t *c) {
+	if (c->outPos >= c->outLen) return;
+	lfCompressResidual(c, c->out[c->outPos++]);
+	if (c->outPos == c->outLen)
+		lfCompressFlush(c);
+}
+
+bool lfCompressPush(lfcompress_t *c, uint8_t sample) {
+	// room for the rest of the block being written, this block and the end code
+	if (c->count == 0 && c->len + 2 * LFCOMPRESS_BLOCK_MAX + 1 > c->size)
+		return false;
+
+	for (uint8_t p = 0; p < LFCOMPRESS_PREDICTORS; p++) {
+		int8_t r = (int8_t)(sample - c->hist[(c->histPos - lfPredictors[p]) & (LFCOMPRESS_HISTORY - 1)]);
+		c->res[p][c->count] = r;
+		if (r == 0)
+			c->cost[p] += 1;
+		else if (r >= -4 && r <= 3)
+			c->cost[p] += 2;
+		else if (r >= -32 && r <= 31)
+			c->cost[p] += 4;
+		else
+			c->cost[p] += 5;
+	}
+	c->hist[c->histPos] = sample;
+	c->histPos = (c->histPos + 1) & (LFCOMPRESS_HISTORY - 1);
+	c->count++;
+
+	// the previous block is done exactly when this one is full
+	lfCompressWriteNext(c);
+	if (c->count == LFCOMPRESS_BLOCK)
+		lfCompressStartBlock(c);
+	return true;
+}
+
+uint32_t lfCompressFinish(lfcompress_t *c) {
+	while (c->outPos < c->outLen)
+		lfCompressWriteNext(c);
+	if (c->count) {
+		lfCompressStartBlock(c);
+		while (c->outPos < c->outLen)
+			lfCompressWriteNext(c);
+	}
+	c->dest[c->len++] = LFCOMPRESS_END;
+	return c->len;
+}
+
+int lfDecompress(const uint8_t *src, size_t len, int *dest, size_t maxlen) {
+	uint8_t hist[LFCOMPRESS_HISTORY];
+	uint8_t histPos = 0;
+	size_t n = 0, i = 0;
+	for (int k = 0; k < LFCOMPRESS_HISTORY; k++)
+		hist[k] = 128;
+
+	while (i < len && n < maxlen) {
+		uint8_t header = src[i++];
+		if (header == LFCOMPRESS_END)
+			break;
+		if ((header & 0x07) >= LFCOMPRESS_PREDICTORS)
+			return -1;
+		uint8_t dist = lfPredictors[header & 0x07];
+		int cnt = (header >> 3) + 1;
+
+		int8_t r[64];
+		while (cnt > 0) {
+			if (i >= len) return -1;
+			uint8_t code = src[i++];
+			int m = 0;
+			switch (code & 0xC0) {
+				case 0x00:
+					m = (code & 0x3F) + 1;
+					for (int k = 0; k < m; k++) r[k] = 0;
+					break;
+				case 0x40:
+					m = 2;
+					r[0] = (int8_t)(code << 2) >> 5;
+					r[1] = (int8_t)(code << 5) >> 5;
+					break;
+				case 0x80:
+					m = 1;
+					r[0] = (int8_t)(code << 2) >> 2;
+					break;
+				default:
+					m = (code & 0x3F) + 1;
+					if (i + m > len) return -1;
+					for (int k = 0; k < m; k++) r[k] = (int8_t)src[i++];
+					break;
+			}
+			if (m > cnt) return -1;
+			cnt -= m;
+			for (int k = 0; k < m; k++) {
+				uint8_t s = hist[(histPos - dist) & (LFCOMPRESS_HISTORY - 1)] + r[k];
+				hist[histPos] = s;
+				histPos = (histPos + 1) & (LFCOMPRESS_HISTORY - 1);
+				if (n < maxlen)
+					dest[n++] = s - 128;
+			}
+		}
+	}
+	return n;
+}
@@ -0,0 +1,73 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Lossless compression of 8 bit LF captures.
+// The device encodes while sampling, the client decodes into GraphBuffer.
+//-----------------------------------------------------------------------------
+
+#ifndef LFCOMPRESS_H__
+#define LFCOMPRESS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Samples are coded in blocks of up to 32. Every block predicts its samples from
+// the sample 1, 2, 4, 5, 8, 10 or 16 before it (whatever fits the field clock
+// best) and stores the residuals.
+//
+//   block header       nnnnnppp           n+1 samples, predictor p (0..6)
+//   end of capture     11111111
+// residuals
+//   00nnnnnn           n+1 times 0
+//   01aaabbb           two residuals, a and b (3 bit signed, -4..3)
+//   10dddddd           one residual (6 bit signed, -32..31)
+//   11nnnnnn ...       n+1 residuals, one byte each
+#define LFCOMPRESS_BLOCK       32
+#define LFCOMPRESS_PREDICTORS  7
+#define LFCOMPRESS_HISTORY     16     // > largest predictor distance, power of 2
+#define LFCOMPRESS_END         0xFF
+
+// A compressed capture in BigBuf starts with this tag. It is part of the capture,
+// so anything that writes BigBuf afterwards also removes the compressed mark.
+#define LFCOMPRESS_TAG         "LFZ1"
+#define LFCOMPRESS_TAG_LEN     4
+
+// longest capture, the size of the client GraphBuffer
+#define LFCOMPRESS_MAX_SAMPLES (40000 * 8)
+
+typedef struct {
+	uint8_t *dest;
+	uint32_t size;                  // bytes available in dest
+	uint32_t len;                   // bytes written
+	uint8_t hist[LFCOMPRESS_HISTORY];
+	uint8_t histPos;
+	// block being collected. residuals of every predictor
+	int8_t res[LFCOMPRESS_PREDICTORS][LFCOMPRESS_BLOCK];
+	uint16_t cost[LFCOMPRESS_PREDICTORS];
+	uint8_t count;
+	// block being written, one residual per new sample
+	int8_t out[LFCOMPRESS_BLOCK];
+	uint8_t outLen;
+	uint8_t outPos;
+	// open code
+	uint8_t run;
+	int8_t pending;
+	bool havePending;
+	uint32_t rawPos;
+	uint8_t rawCnt;
+} lfcompress_t;
+
+extern void lfCompressInit(lfcompress_t *c, uint8_t *dest, uint32_t size);
+// false if dest is full, the sample is not stored then
+extern bool lfCompressPush(lfcompress_t *c, uint8_t sample);
+// writes what is pending and the end code. returns number of bytes
+extern uint32_t lfCompressFinish(lfcompress_t *c);
+
+// dest gets sample - 128 (GraphBuffer values). Stops at the end code, at len or at maxlen.
+// returns number of samples or -1 on a bad code
+extern int lfDecompress(const uint8_t *src, size_t len, int *dest, size_t maxlen);
+
+#endif
@@ -37,6 +37,7 @@
 #include <stdint.h>  // for uint_32+
 #include <stdbool.h> // for bool
 #include "parity.h"  // for parity test
+#include "protocols.h" // for T55x7 config
 
 //**********************************************************************************************
 //---------------------------------Utilities Section--------------------------------------------
@@ -330,6 +331,33 @@ uint32_t manchesterEncode2Bytes(uint16_t datain) {
 	return output;
 }
 
+// T55x7 blocks of a HID Prox clone, config block 0 first.
+// blocks needs room for 7 entries. returns the number of blocks, 0 if the id is too long
+uint8_t HIDtoT55x7Blocks(uint32_t hi2, uint32_t hi, uint32_t lo, bool longFMT, uint8_t preamble, uint32_t *blocks) {
+	uint8_t last_block;
+	if (longFMT) {
+		// no more than 84 bits
+		if (hi2 > 0xFFFFF) return 0;
+		last_block = 6;
+		// preamble & long format identifier (9E manchester encoded)
+		blocks[1] = (preamble << 24) | 0x96A900 | (manchesterEncode2Bytes((hi2 >> 16) & 0xF) & 0xFF);
+		blocks[2] = manchesterEncode2Bytes(hi2 & 0xFFFF);
+		blocks[3] = manchesterEncode2Bytes(hi >> 16);
+		blocks[4] = manchesterEncode2Bytes(hi & 0xFFFF);
+		blocks[5] = manchesterEncode2Bytes(lo >> 16);
+		blocks[6] = manchesterEncode2Bytes(lo & 0xFFFF);
+	} else {
+		// no more than 44 bits
+		if (hi > 0xFFF) return 0;
+		last_block = 3;
+		blocks[1] = (preamble << 24) | (manchesterEncode2Bytes(hi) & 0xFFFFFF);
+		blocks[2] = manchesterEncode2Bytes(lo >> 16);
+		blocks[3] = manchesterEncode2Bytes(lo & 0xFFFF);
+	}
+	blocks[0] = T55x7_BITRATE_RF_50 | T55x7_MODULATION_FSK2a | last_block << T55x7_MAXBLOCK_SHIFT;
+	return last_block + 1;
+}
+
 //by marshmellow
 //encode binary data into binary manchester 
 //NOTE: BitStream must have triple the size of "size" available in memory to do the swap
@@ -1639,6 +1667,11 @@ int AWIDdemodFSK(uint8_t *dest, size_t *size, int *waveStartIdx) {
 
 	// FSK demodulator
 	*size = fskdemod(dest, *size, 50, 1, 10, 8, waveStartIdx);  // fsk2a RF/50 
+	return AWIDdemodBits(dest, size);
+}
+
+// AWID ID in fsk2a RF/50 demodulated bits
+int AWIDdemodBits(uint8_t *dest, size_t *size) {
 	if (*size < 96) return -3;  //did we get a good demod?
 
 	uint8_t preamble[] = {0,0,0,0,0,0,0,1};
@@ -1721,9 +1754,15 @@ int gProxII_Demod(uint8_t BitStream[], size_t *size) {
 
 // loop to get raw HID waveform then FSK demodulate the TAG ID from it
 int HIDdemodFSK(uint8_t *dest, size_t *size, uint32_t *hi2, uint32_t *hi, uint32_t *lo, int *waveStartIdx) {
-	size_t numStart=0, size2=*size, startIdx=0; 
+	size_t size2=*size;
 	// FSK demodulator  fsk2a so invert and fc/10/8
 	*size = fskdemod(dest, size2, 50, 1, 10, 8, waveStartIdx);
+	return HIDdemodBits(dest, size, hi2, hi, lo);
+}
+
+// HID ID in fsk2a RF/50 demodulated bits, the bits are not changed
+int HIDdemodBits(uint8_t *dest, size_t *size, uint32_t *hi2, uint32_t *hi, uint32_t *lo) {
+	size_t numStart=0, startIdx=0;
 	if (*size < 96*2) return -2;
 	// 00011101 bit pattern represent start of frame, 01 pattern represents a 0 and 10 represents a 1
 	uint8_t preamble[] = {0,0,0,1,1,1,0,1};
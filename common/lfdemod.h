@@ -34,7 +34,9 @@ extern int      DetectStrongAskClock(uint8_t dest[], size_t size, int high, int
 extern bool     DetectST(uint8_t buffer[], size_t *size, int *foundclock, size_t *ststart, size_t *stend);
 extern int      fskdemod(uint8_t *dest, size_t size, uint8_t rfLen, uint8_t invert, uint8_t fchigh, uint8_t fclow, int *startIdx);
 extern int      getHiLo(uint8_t *BitStream, size_t size, int *high, int *low, uint8_t fuzzHi, uint8_t fuzzLo);
+extern uint8_t  justNoise(uint8_t *BitStream, size_t size);
 extern uint32_t manchesterEncode2Bytes(uint16_t datain);
+extern uint8_t  HIDtoT55x7Blocks(uint32_t hi2, uint32_t hi, uint32_t lo, bool longFMT, uint8_t preamble, uint32_t *blocks);
 extern int      ManchesterEncode(uint8_t *BitStream, size_t size);
 extern int      manrawdecode(uint8_t *BitStream, size_t *size, uint8_t invert, uint8_t *alignPos);
 extern int      nrzRawDemod(uint8_t *dest, size_t *size, int *clk, int *invert, int *startIdx);
@@ -49,10 +51,12 @@ extern size_t   removeParity(uint8_t *BitStream, size_t startIdx, uint8_t pLen,
 
 //tag specific
 extern int AWIDdemodFSK(uint8_t *dest, size_t *size, int *waveStartIdx);
+extern int AWIDdemodBits(uint8_t *dest, size_t *size);
 extern uint8_t Em410xDecode(uint8_t *BitStream, size_t *size, size_t *startIdx, uint32_t *hi, uint64_t *lo);
 extern int FDXBdemodBI(uint8_t *dest, size_t *size);
 extern int gProxII_Demod(uint8_t BitStream[], size_t *size);
 extern int HIDdemodFSK(uint8_t *dest, size_t *size, uint32_t *hi2, uint32_t *hi, uint32_t *lo, int *waveStartIdx);
+extern int HIDdemodBits(uint8_t *dest, size_t *size, uint32_t *hi2, uint32_t *hi, uint32_t *lo);
 extern int IOdemodFSK(uint8_t *dest, size_t size, int *waveStartIdx);
 extern int indala64decode(uint8_t *bitStream, size_t *size, uint8_t *invert);
 extern int indala224decode(uint8_t *bitStream, size_t *size, uint8_t *invert);
@@ -0,0 +1,516 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Low frequency simulation waveforms (ASK/FSK/PSK), one sample per field clock.
+// by marshmellow, moved out of armsrc/lfops.c to be used by the client too
+//-----------------------------------------------------------------------------
+
+#include "lfsim.h"
+#include <string.h>
+#include <stdbool.h>
+
+// compose fc/X fc/Y waveform (FSKx)
+static void fcAll(uint8_t *dest, uint8_t fc, size_t *n, uint8_t clock, uint16_t *modCnt)
+{
+	uint8_t halfFC = fc/2;
+	uint8_t wavesPerClock = clock/fc;
+	uint8_t mod = clock % fc;    //modifier
+	// loop through clock - step field clock
+	for (uint8_t idx=0; idx < wavesPerClock; idx++){
+		// put 1/2 FC length 1's and 1/2 0's per field clock wave (to create the wave)
+		memset(dest+(*n), 0, fc-halfFC);  //in case of odd number use extra here
+		memset(dest+(*n)+(fc-halfFC), 1, halfFC);
+		*n += fc;
+	}
+	if (mod == 0)
+		return;
+
+	uint8_t modAdj = fc/mod;     //how often to apply modifier
+	bool modAdjOk = !(fc % mod); //if (fc % mod==0) modAdjOk=true;
+	(*modCnt)++;
+	if (modAdjOk){  //fsk2 
+		if ((*modCnt % modAdj) == 0){ //if 4th 8 length wave in a rf/50 add extra 8 length wave
+			memset(dest+(*n), 0, fc-halfFC);
+			memset(dest+(*n)+(fc-halfFC), 1, halfFC);
+			*n += fc;
+		}
+	} else {  //fsk1
+		memset(dest+(*n), 0, mod-(mod/2));
+		memset(dest+(*n)+(mod-(mod/2)), 1, mod/2);
+		*n += mod;
+	}
+}
+
+size_t fskSimWave(uint8_t *dest, size_t maxlen, const uint8_t *bits, size_t size, uint8_t fcHigh, uint8_t fcLow, uint8_t clk, uint8_t invert)
+{
+	size_t n = 0;
+	uint16_t modCnt = 0;
+	if (fcHigh == 0 || fcLow == 0)
+		return 0;
+
+	// one bit is at most clk samples plus one extra wave
+	uint8_t fcMax = fcHigh > fcLow ? fcHigh : fcLow;
+	for (size_t i=0; i<size && n + clk + fcMax <= maxlen; i++){
+		if (bits[i] == invert){
+			fcAll(dest, fcLow, &n, clk, &modCnt);
+		} else {
+			fcAll(dest, fcHigh, &n, clk, &modCnt);
+		}
+	}
+	return n;
+}
+
+// compose ask waveform for one bit(ASK)
+static void askSimBit(uint8_t *dest, uint8_t c, size_t *n, uint8_t clock, uint8_t manchester)
+{
+	uint8_t halfClk = clock/2;
+	// c = current bit 1 or 0
+	if (manchester==1){
+		memset(dest+(*n), c, halfClk);
+		memset(dest+(*n) + halfClk, c^1, halfClk);
+	} else {
+		memset(dest+(*n), c, clock);
+	}
+	*n += clock;
+}
+
+static void biphaseSimBit(uint8_t *dest, uint8_t c, size_t *n, uint8_t clock, uint8_t *phase)
+{
+	uint8_t halfClk = clock/2;
+	if (c){
+		memset(dest+(*n), c ^ 1 ^ *phase, halfClk);
+		memset(dest+(*n) + halfClk, c ^ *phase, halfClk);
+	} else {
+		memset(dest+(*n), c ^ *phase, clock);
+		*phase ^= 1;
+	}
+	*n += clock;
+}
+
+static void stAskSimBit(uint8_t *dest, size_t *n, uint8_t clock) {
+	uint8_t halfClk = clock/2;
+	//ST = .5 high .5 low 1.5 high .5 low 1 high	
+	memset(dest+(*n), 1, halfClk);
+	memset(dest+(*n) + halfClk, 0, halfClk);
+	memset(dest+(*n) + clock, 1, clock + halfClk);
+	memset(dest+(*n) + clock*2 + halfClk, 0, halfClk);
+	memset(dest+(*n) + clock*3, 1, clock);
+	*n += clock*4;
+}
+
+size_t askSimWave(uint8_t *dest, size_t maxlen, const uint8_t *bits, size_t size, uint8_t clk, uint8_t encoding, uint8_t invert, uint8_t separator)
+{
+	size_t n = 0;
+	if (size == 0 || clk == 0)
+		return 0;
+
+	// ask/raw and biphase may need a second inverted set, then the separator
+	if ((size_t)clk * (size * 2 + 4) > maxlen)
+		size = maxlen / clk / 2 > 2 ? maxlen / clk / 2 - 2 : 0;
+
+	if (encoding == LFSIM_ASK_BIPHASE){
+		uint8_t phase=0;
+		for (size_t i=0; i<size; i++){
+			biphaseSimBit(dest, bits[i]^invert, &n, clk, &phase);
+		}
+		if (phase==1) { //run a second set inverted to keep phase in check
+			for (size_t i=0; i<size; i++){
+				biphaseSimBit(dest, bits[i]^invert, &n, clk, &phase);
+			}
+		}
+	} else {  // ask/manchester || ask/raw
+		for (size_t i=0; i<size; i++){
+			askSimBit(dest, bits[i]^invert, &n, clk, encoding);
+		}
+		if (encoding == LFSIM_ASK_RAW && size && bits[0]==bits[size-1]){ //run a second set inverted (for ask/raw || biphase phase)
+			for (size_t i=0; i<size; i++){
+				askSimBit(dest, bits[i]^invert^1, &n, clk, encoding);
+			}
+		}
+	}
+	if (separator==1 && encoding == LFSIM_ASK_MANCHESTER)
+		stAskSimBit(dest, &n, clk);
+
+	return n;
+}
+
+//carrier can be 2,4 or 8
+static void pskSimBit(uint8_t *dest, uint8_t waveLen, size_t *n, uint8_t clk, uint8_t *curPhase, bool phaseChg)
+{
+	uint8_t halfWave = waveLen/2;
+	int i = 0;
+	if (phaseChg){
+		// write phase change
+		memset(dest+(*n), *curPhase^1, halfWave);
+		memset(dest+(*n) + halfWave, *curPhase, halfWave);
+		*n += waveLen;
+		*curPhase ^= 1;
+		i += waveLen;
+	}
+	//write each normal clock wave for the clock duration
+	for (; i < clk; i+=waveLen){
+		memset(dest+(*n), *curPhase, halfWave);
+		memset(dest+(*n) + halfWave, *curPhase^1, halfWave);
+		*n += waveLen;
+	}
+}
+
+size_t pskSimWave(uint8_t *dest, size_t maxlen, const uint8_t *bits, size_t size, uint8_t carrier, uint8_t clk, uint8_t invert)
+{
+	size_t n = 0;
+	uint8_t curPhase = 0;
+	if (carrier == 0)
+		return 0;
+
+	for (size_t i=0; i<size && n + clk + carrier <= maxlen; i++){
+		if ((bits[i]^invert) == curPhase){
+			pskSimBit(dest, carrier, &n, clk, &curPhase, false);
+		} else {
+			pskSimBit(dest, carrier, &n, clk, &curPhase, true);
+		}
+	}
+	return n;
+}
+
+size_t lfsimDescBits(lfsim_desc_t *desc, size_t maxlen, const uint8_t *bits, size_t size)
+{
+	size_t len = sizeof(lfsim_desc_t) + (size + 7) / 8;
+	if (size == 0 || size > 0xFFFF || len > maxlen)
+		return 0;
+
+	desc->length = size;
+	memset(desc->data, 0, (size + 7) / 8);
+	for (size_t i = 0; i < size; i++) {
+		if (bits[i])
+			desc->data[i / 8] |= 0x80 >> (i % 8);
+	}
+	return len;
+}
+
+static bool rlePut(lfsim_desc_t *desc, size_t maxlen, size_t *pos, uint16_t run)
+{
+	size_t len = run > 0x7F ? 2 : 1;
+	if (sizeof(lfsim_desc_t) + *pos + len > maxlen || *pos + len > 0xFFFF)
+		return false;
+	if (len == 2)
+		desc->data[(*pos)++] = 0x80 | (run >> 8);
+	desc->data[(*pos)++] = run & 0xFF;
+	return true;
+}
+
+size_t lfsimDescRle(lfsim_desc_t *desc, size_t maxlen, const uint8_t *samples, size_t size)
+{
+	size_t pos = 0;
+	if (size == 0 || maxlen < sizeof(lfsim_desc_t))
+		return 0;
+
+	memset(desc, 0, sizeof(lfsim_desc_t));
+	desc->type = LFSIM_DESC_RLE;
+	desc->level = samples[0] ? 1 : 0;
+	for (size_t i = 0; i < size; ) {
+		size_t run = 1;
+		while (i + run < size && !samples[i + run] == !samples[i])
+			run++;
+		i += run;
+		// longer runs are split by an empty run of the other level
+		for (; run > 0x7FFF; run -= 0x7FFF) {
+			if (!rlePut(desc, maxlen, &pos, 0x7FFF) || !rlePut(desc, maxlen, &pos, 0))
+				return 0;
+		}
+		if (!rlePut(desc, maxlen, &pos, run))
+			return 0;
+	}
+	desc->length = pos;
+	return sizeof(lfsim_desc_t) + pos;
+}
+
+static uint8_t descBit(const lfsim_desc_t *desc, size_t i)
+{
+	return (desc->data[i / 8] >> (7 - i % 8)) & 1;
+}
+
+// next non empty run, false at the end of the runs
+static bool rleNextRun(lfsim_expander_t *e)
+{
+	const lfsim_desc_t *desc = e->desc;
+	while (e->pos < desc->length) {
+		uint16_t run = desc->data[e->pos++];
+		if (run & 0x80)
+			run = ((run & 0x7F) << 8) | desc->data[e->pos++];
+		e->level ^= 1;
+		if (run) {
+			e->idx = run;
+			return true;
+		}
+	}
+	return false;
+}
+
+// first run of a symbol of nruns runs at level
+static void symbolRuns(lfsim_expander_t *e, uint8_t level, uint8_t nruns)
+{
+	e->level = level;
+	e->inWave = false;
+	e->idx = e->runs[0];
+	e->run = 1;
+	e->nruns = nruns;
+}
+
+// first run of a symbol of waves (at least one) at level, then nruns runs
+static void symbolWaves(lfsim_expander_t *e, uint8_t level, uint16_t waves, uint8_t nruns)
+{
+	e->level = level;
+	e->inWave = true;
+	e->waveHalf = false;
+	e->waves = waves - 1;
+	e->idx = e->wave[0];
+	e->run = 0;
+	e->nruns = nruns;
+}
+
+// next run of the current symbol, false at its end
+static bool symbolNextRun(lfsim_expander_t *e)
+{
+	e->level ^= 1;
+	if (e->inWave) {
+		if (!e->waveHalf) {
+			e->waveHalf = true;
+			e->idx = e->wave[1];
+			return true;
+		}
+		if (e->waves) {
+			e->waves--;
+			e->waveHalf = false;
+			e->idx = e->wave[0];
+			return true;
+		}
+		e->inWave = false;
+	}
+	if (e->run == e->nruns)
+		return false;
+	e->idx = e->runs[e->run++];
+	return true;
+}
+
+// same waveforms as askSimBit, biphaseSimBit, stAskSimBit, fcAll and pskSimBit.
+// Those leave samples unset for odd clocks and waves, here they go to the second half
+static bool nextSymbol(lfsim_expander_t *e)
+{
+	const lfsim_desc_t *desc = e->desc;
+	if (e->pos == desc->length) {
+		if (e->pass + 1 < e->passes) {
+			e->pass++;
+			e->pos = 0;
+		} else if (desc->type == LFSIM_DESC_ASK && desc->separator == 1 && desc->encoding == LFSIM_ASK_MANCHESTER && !e->separator) {
+			//ST = .5 high .5 low 1.5 high .5 low 1 high
+			e->runs[0] = e->clkHalf;
+			e->runs[1] = desc->clk - e->clkHalf;
+			e->runs[2] = desc->clk + e->clkHalf;
+			e->runs[3] = desc->clk - e->clkHalf;
+			e->runs[4] = desc->clk;
+			symbolRuns(e, 1, 5);
+			e->separator = true;
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	uint8_t bit = descBit(desc, e->pos++);
+	switch (desc->type) {
+		case LFSIM_DESC_ASK:
+			if (desc->encoding == LFSIM_ASK_BIPHASE) {
+				if (bit ^ desc->invert) {
+					e->runs[0] = e->clkHalf;
+					e->runs[1] = desc->clk - e->clkHalf;
+					symbolRuns(e, e->phase, 2);
+				} else {
+					e->runs[0] = desc->clk;
+					symbolRuns(e, e->phase, 1);
+					e->phase ^= 1;
+				}
+			} else if (desc->encoding == LFSIM_ASK_MANCHESTER) {
+				e->runs[0] = e->clkHalf;
+				e->runs[1] = desc->clk - e->clkHalf;
+				symbolRuns(e, bit ^ desc->invert ^ e->pass, 2);
+			} else {
+				e->runs[0] = desc->clk;
+				symbolRuns(e, bit ^ desc->invert ^ e->pass, 1);
+			}
+			break;
+		case LFSIM_DESC_FSK: {
+			uint8_t fc = (bit == desc->invert) ? 0 : 1;
+			uint16_t waves = e->fcWaves[fc];
+			uint8_t nruns = 0;
+			e->wave[0] = e->fcWave[fc][0];
+			e->wave[1] = e->fcWave[fc][1];
+			if (e->fcMod[fc]) {
+				// modCnt of fcAll for both fc
+				for (int i = 0; i < 2; i++) {
+					if (e->fcModAdj[i] && ++e->fcModCnt[i] == e->fcModAdj[i])
+						e->fcModCnt[i] = 0;
+				}
+				if (e->fcModAdj[fc]) {
+					// fsk2, an extra wave
+					if (e->fcModCnt[fc] == 0)
+						waves++;
+				} else {
+					// fsk1, a short wave
+					e->runs[0] = e->fcMod[fc] - e->fcMod[fc] / 2;
+					e->runs[1] = e->fcMod[fc] / 2;
+					nruns = 2;
+				}
+			}
+			symbolWaves(e, 0, waves, nruns);
+			break;
+		}
+		case LFSIM_DESC_PSK: {
+			// a phase change starts with an inverted wave, the bit continues from there
+			uint8_t level = bit ^ desc->invert;
+			symbolWaves(e, level, e->pskWaves[level != e->phase], 0);
+			e->phase = level;
+			break;
+		}
+	}
+	return true;
+}
+
+// next non empty run, of this symbol or the next ones. False at the end of the period
+static bool nextRun(lfsim_expander_t *e)
+{
+	do {
+		if (!symbolNextRun(e) && !nextSymbol(e))
+			return false;
+	} while (e->idx == 0);
+	return true;
+}
+
+// back to the start of the sequence, as a replayed buffer would
+static void restart(lfsim_expander_t *e)
+{
+	e->pos = 0;
+	e->pass = 0;
+	e->separator = false;
+	e->phase = 0;
+	e->fcModCnt[0] = 0;
+	e->fcModCnt[1] = 0;
+	if (e->desc->type == LFSIM_DESC_RLE) {
+		e->level = e->desc->level ^ 1;
+		rleNextRun(e);
+	} else {
+		nextSymbol(e);
+		if (e->idx == 0)
+			nextRun(e);
+	}
+}
+
+bool lfsimExpanderInit(lfsim_expander_t *e, const lfsim_desc_t *desc, size_t len)
+{
+	if (len < sizeof(lfsim_desc_t) || desc->length == 0)
+		return false;
+
+	memset(e, 0, sizeof(lfsim_expander_t));
+	e->desc = desc;
+	e->passes = 1;
+	switch (desc->type) {
+		case LFSIM_DESC_RLE: {
+			if (sizeof(lfsim_desc_t) + desc->length > len)
+				return false;
+			// runs must not end in the middle and there must be samples
+			bool samples = false;
+			for (size_t i = 0; i < desc->length; i++) {
+				uint16_t run = desc->data[i];
+				if (run & 0x80) {
+					if (++i == desc->length)
+						return false;
+					run = ((run & 0x7F) << 8) | desc->data[i];
+				}
+				samples |= run != 0;
+			}
+			if (!samples)
+				return false;
+			break;
+		}
+		case LFSIM_DESC_ASK:
+			if (desc->clk == 0)
+				return false;
+			e->clkHalf = desc->clk / 2;
+			break;
+		case LFSIM_DESC_FSK:
+			if (desc->fcHigh == 0 || desc->fcLow == 0 || desc->clk < desc->fcHigh || desc->clk < desc->fcLow)
+				return false;
+			for (int i = 0; i < 2; i++) {
+				uint8_t fc = i ? desc->fcHigh : desc->fcLow;
+				e->fcWave[i][0] = fc - fc / 2;
+				e->fcWave[i][1] = fc / 2;
+				e->fcWaves[i] = desc->clk / fc;
+				e->fcMod[i] = desc->clk % fc;
+				if (e->fcMod[i] && fc % e->fcMod[i] == 0)
+					e->fcModAdj[i] = fc / e->fcMod[i];
+			}
+			break;
+		case LFSIM_DESC_PSK:
+			if (desc->fcHigh == 0 || desc->clk == 0)
+				return false;
+			e->wave[0] = desc->fcHigh / 2;
+			e->wave[1] = desc->fcHigh - desc->fcHigh / 2;
+			e->pskWaves[0] = (desc->clk + desc->fcHigh - 1) / desc->fcHigh;
+			e->pskWaves[1] = 1 + (desc->clk > desc->fcHigh ? (desc->clk - 1) / desc->fcHigh : 0);
+			break;
+		default:
+			return false;
+	}
+	if (desc->type != LFSIM_DESC_RLE) {
+		if (sizeof(lfsim_desc_t) + ((size_t)desc->length + 7) / 8 > len)
+			return false;
+		// same second inverted set as askSimWave
+		if (desc->type == LFSIM_DESC_ASK && desc->encoding == LFSIM_ASK_RAW && descBit(desc, 0) == descBit(desc, desc->length - 1))
+			e->passes = 2;
+		if (desc->type == LFSIM_DESC_ASK && desc->encoding == LFSIM_ASK_BIPHASE) {
+			// every zero flips the phase
+			uint8_t phase = 0;
+			for (size_t i = 0; i < desc->length; i++)
+				phase ^= (descBit(desc, i) ^ desc->invert) == 0;
+			e->passes = phase ? 2 : 1;
+		}
+	}
+	restart(e);
+	return true;
+}
+
+uint8_t lfsimExpanderNext(lfsim_expander_t *e)
+{
+	if (e->desc->type == LFSIM_DESC_RLE) {
+		uint8_t level = e->level;
+		if (--e->idx == 0 && !rleNextRun(e)) {
+			restart(e);
+			level |= LFSIM_PERIOD_END;
+		}
+		return level;
+	}
+
+	uint8_t sample = e->level;
+	if (--e->idx == 0 && !nextRun(e)) {
+		restart(e);
+		sample |= LFSIM_PERIOD_END;
+	}
+	return sample;
+}
+
+size_t lfsimExpand(const lfsim_desc_t *desc, size_t len, uint8_t *dest, size_t maxlen)
+{
+	lfsim_expander_t e;
+	size_t n = 0;
+	if (!lfsimExpanderInit(&e, desc, len))
+		return 0;
+
+	while (n < maxlen) {
+		uint8_t sample = lfsimExpanderNext(&e);
+		dest[n++] = sample & 1;
+		if (sample & LFSIM_PERIOD_END)
+			break;
+	}
+	return n;
+}
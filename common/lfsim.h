@@ -0,0 +1,94 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Low frequency simulation waveforms (ASK/FSK/PSK), one sample per field clock.
+// Shared by the device sim commands and the client signal synthesizer.
+//-----------------------------------------------------------------------------
+
+#ifndef LFSIM_H__
+#define LFSIM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ASK encodings. Same values as CMD_ASK_SIM_TAG arg1
+#define LFSIM_ASK_RAW        0
+#define LFSIM_ASK_MANCHESTER 1
+#define LFSIM_ASK_BIPHASE    2
+#define LFSIM_NRZ            3    // plain levels, no inverted second set for looping
+
+// all return the number of samples written to dest. Bits that do not fit in maxlen are dropped.
+extern size_t askSimWave(uint8_t *dest, size_t maxlen, const uint8_t *bits, size_t size, uint8_t clk, uint8_t encoding, uint8_t invert, uint8_t separator);
+extern size_t fskSimWave(uint8_t *dest, size_t maxlen, const uint8_t *bits, size_t size, uint8_t fcHigh, uint8_t fcLow, uint8_t clk, uint8_t invert);
+extern size_t pskSimWave(uint8_t *dest, size_t maxlen, const uint8_t *bits, size_t size, uint8_t carrier, uint8_t clk, uint8_t invert);
+
+// Compact sim description (CMD_SIMULATE_TAG_125K_COMPACT). The device expands it
+// sample by sample while it simulates, so it never holds the whole waveform.
+#define LFSIM_DESC_ASK       0    // clk, encoding, invert, separator
+#define LFSIM_DESC_FSK       1    // clk, fcHigh, fcLow, invert
+#define LFSIM_DESC_PSK       2    // clk, carrier in fcHigh, invert
+#define LFSIM_DESC_RLE       3    // runs of alternating levels, the first one at level
+
+typedef struct {
+	uint8_t type;
+	uint8_t clk;
+	uint8_t fcHigh;
+	uint8_t fcLow;
+	uint8_t encoding;
+	uint8_t invert;
+	uint8_t separator;
+	uint8_t level;
+	uint16_t length;     // bits for ASK/FSK/PSK, bytes of runs for RLE
+	// bits packed msb first. Runs are one byte 0x01-0x7F, or 0x80|hi, lo up to 0x7FFF.
+	// A zero run only toggles the level, it splits longer runs.
+	uint8_t data[];
+} __attribute__((__packed__)) lfsim_desc_t;
+
+// set in the value of lfsim_expander_next() on the last sample of a period
+#define LFSIM_PERIOD_END     0x80
+
+// A symbol is kept as runs of samples with alternating levels: a number of
+// waves of two runs, then up to five single runs. Every sample costs a
+// counter decrement, a new symbol only table lookups.
+typedef struct {
+	const lfsim_desc_t *desc;
+	size_t pos;          // next bit, or next byte of runs
+	uint8_t pass;        // 1 on the inverted second set
+	uint8_t passes;
+	bool separator;      // separator sent in this period
+	uint8_t phase;
+	uint8_t level;
+	uint16_t idx;        // samples left in the current run
+	// rest of the current symbol
+	bool inWave;
+	bool waveHalf;       // in the second run of a wave
+	uint16_t waves;      // waves left after the current one
+	uint16_t wave[2];
+	uint8_t run;         // next of runs
+	uint8_t nruns;
+	uint16_t runs[5];
+	// from the description, so a new symbol needs no division
+	uint8_t clkHalf;
+	uint16_t fcWave[2][2];    // FSK fcLow, fcHigh: the 0 and the 1 run of a wave
+	uint8_t fcWaves[2];       // whole waves in a bit
+	uint8_t fcMod[2];         // samples left over, clk % fc
+	uint8_t fcModAdj[2];      // fsk2: every fcModAdj-th bit gets an extra wave, 0 - fsk1
+	uint8_t fcModCnt[2];      // bits with left over samples, modulo fcModAdj
+	uint16_t pskWaves[2];     // PSK waves in a bit without and with a phase change
+} lfsim_expander_t;
+
+// fill in the data of a description, return its size in bytes or 0 if it doesn't fit maxlen.
+// The modulation fields of a bit description are set by the caller.
+extern size_t lfsimDescBits(lfsim_desc_t *desc, size_t maxlen, const uint8_t *bits, size_t size);
+extern size_t lfsimDescRle(lfsim_desc_t *desc, size_t maxlen, const uint8_t *samples, size_t size);
+// false if the description of len bytes is broken
+extern bool lfsimExpanderInit(lfsim_expander_t *e, const lfsim_desc_t *desc, size_t len);
+// next sample (0/1), LFSIM_PERIOD_END is or'ed in on the last one before the sequence restarts
+extern uint8_t lfsimExpanderNext(lfsim_expander_t *e);
+// one period into dest, the number of samples. Samples that do not fit in maxlen are dropped.
+extern size_t lfsimExpand(const lfsim_desc_t *desc, size_t len, uint8_t *dest, size_t maxlen);
+
+#endif
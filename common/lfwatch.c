@@ -0,0 +1,221 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Multi protocol LF watch. Decodes as the single protocol loops in
+// armsrc/lfops.c do. One RF/50 fsk demod is shared by HID and AWID.
+//-----------------------------------------------------------------------------
+
+#include "lfwatch.h"
+#include <string.h>
+#include "lfdemod.h"
+
+void lfWatchInit(lfwatch_t *w, uint32_t protocols)
+{
+	memset(w, 0, sizeof(lfwatch_t));
+	w->protocols = protocols & LFWATCH_ALL;
+}
+
+// the window in order into work, the demods overwrite their input
+static void copyWindow(uint8_t *work, const uint8_t *ring, size_t ringSize, size_t start, size_t len)
+{
+	size_t first = ringSize - start < len ? ringSize - start : len;
+	memcpy(work, ring + start, first);
+	memcpy(work + first, ring, len - first);
+}
+
+static bool hidDecode(uint8_t *bits, size_t size, lfwatch_record_t *rec)
+{
+	uint32_t hi2 = 0, hi = 0, lo = 0;
+	int idx = HIDdemodBits(bits, &size, &hi2, &hi, &lo);
+	if (idx < 0 || lo == 0 || (size != 96 && size != 192))
+		return false;
+
+	uint8_t bitlen = 0;
+	uint32_t bp = 0;
+	if ((hi2 & 0x000FFFF) != 0) { //extra large HID tags  88/192 bits
+		bp = hi2 & 0x000FFFFF;
+		bitlen = 63;
+	} else if ((hi >> 6) > 0) {
+		bp = hi;
+		bitlen = 31;
+	} else if (((hi >> 5) & 1) == 0) {
+		bitlen = 37;
+	} else if ((hi & 0x0000001F) > 0) {
+		bp = hi & 0x0000001F;
+		bitlen = 31;
+	} else {
+		// without the sentinel bit
+		bp = lo >> 1;
+	}
+	for (; bp > 0; bp >>= 1)
+		bitlen++;
+
+	rec->protocol = LFWATCH_HID;
+	rec->bits = bitlen;
+	if (bitlen == 26) {
+		rec->cn = (lo >> 1) & 0xFFFF;
+		rec->fc = (lo >> 17) & 0xFF;
+	} else if (bitlen == 35) {
+		rec->cn = (lo >> 1) & 0xFFFFF;
+		rec->fc = ((hi & 1) << 11) | (lo >> 21);
+	}
+	rec->raw[0] = hi2;
+	rec->raw[1] = hi;
+	rec->raw[2] = lo;
+	return true;
+}
+
+static bool awidDecode(uint8_t *bits, size_t size, lfwatch_record_t *rec)
+{
+	int idx = AWIDdemodBits(bits, &size);
+	if (idx < 0 || size != 96)
+		return false;
+
+	rec->raw[0] = bytebits_to_byte(bits + idx, 32);
+	rec->raw[1] = bytebits_to_byte(bits + idx + 32, 32);
+	rec->raw[2] = bytebits_to_byte(bits + idx + 64, 32);
+	if (removeParity(bits, idx + 8, 4, 1, 88) != 66)
+		return false;
+
+	rec->protocol = LFWATCH_AWID;
+	rec->bits = bytebits_to_byte(bits, 8);
+	if (rec->bits == 26) {
+		rec->fc = bytebits_to_byte(bits + 9, 8);
+		rec->cn = bytebits_to_byte(bits + 17, 16);
+	} else if (rec->bits >= 17 && rec->bits <= 58) {
+		rec->cn = bytebits_to_byte(bits + 8 + (rec->bits - 17), 16);
+	}
+	return true;
+}
+
+static bool ioDecode(uint8_t *samples, size_t size, lfwatch_record_t *rec)
+{
+	int dummyIdx = 0;
+	int idx = IOdemodFSK(samples, size, &dummyIdx);
+	if (idx < 0)
+		return false;
+
+	rec->protocol = LFWATCH_IO;
+	rec->bits = 64;
+	rec->version = bytebits_to_byte(samples + idx + 27, 8);
+	rec->fc = bytebits_to_byte(samples + idx + 18, 8);
+	rec->cn = (bytebits_to_byte(samples + idx + 36, 8) << 8) | bytebits_to_byte(samples + idx + 45, 8);
+	rec->raw[1] = bytebits_to_byte(samples + idx, 32);
+	rec->raw[2] = bytebits_to_byte(samples + idx + 32, 32);
+	return true;
+}
+
+static bool emDecode(uint8_t *samples, size_t size, int *clock, lfwatch_record_t *rec)
+{
+	int clk = *clock, invert = 0;
+	size_t idx = 0;
+	uint32_t hi = 0;
+	uint64_t lo = 0;
+	// the clock search is most of the demod, the next window starts with this clock
+	*clock = 0;
+	if (askdemod(samples, &size, &clk, &invert, 20, 0, 1) < 0)
+		return false;
+	if (!Em410xDecode(samples, &size, &idx, &hi, &lo))
+		return false;
+	*clock = clk;
+
+	rec->protocol = LFWATCH_EM410X;
+	rec->bits = size;
+	rec->fc = (lo >> 16) & 0xFF;
+	rec->cn = lo & 0xFFFF;
+	rec->raw[0] = hi;
+	rec->raw[1] = lo >> 32;
+	rec->raw[2] = lo;
+	return true;
+}
+
+// false if the credential was reported within LFWATCH_HOLD samples
+static bool isNew(lfwatch_t *w, lfwatch_record_t *rec)
+{
+	lfwatch_record_t *last = &w->last[rec->protocol];
+	bool fresh = !w->seen[rec->protocol]
+		|| memcmp(last, rec, offsetof(lfwatch_record_t, sample))
+		|| rec->sample - last->sample > LFWATCH_HOLD;
+	w->seen[rec->protocol] = true;
+	*last = *rec;
+	return fresh;
+}
+
+// samples a protocol demodulates
+static size_t windowSize(int protocol)
+{
+	switch (protocol) {
+		case LFWATCH_HID:
+		case LFWATCH_AWID:
+			return LFWATCH_FSK_CHUNKS * LFWATCH_CHUNK_SIZE;
+		case LFWATCH_IO:
+			return LFWATCH_IO_CHUNKS * LFWATCH_CHUNK_SIZE;
+		default:
+			return LFWATCH_WINDOW_CHUNKS * LFWATCH_CHUNK_SIZE;
+	}
+}
+
+// the enabled protocol at or after protocol. AWID is demodulated with HID when both are on
+static int nextProtocol(lfwatch_t *w, int protocol)
+{
+	for (int i = 0; i < LFWATCH_PROTOCOLS; i++, protocol = (protocol + 1) % LFWATCH_PROTOCOLS) {
+		if (protocol == LFWATCH_AWID && (w->protocols & (1 << LFWATCH_HID)))
+			continue;
+		if (w->protocols & (1 << protocol))
+			return protocol;
+	}
+	return -1;
+}
+
+int lfWatchDemod(lfwatch_t *w, const uint8_t *ring, size_t ringSize, size_t end, size_t contiguous,
+	uint8_t *work, uint32_t sample, lfwatch_record_t *rec, size_t max)
+{
+	int protocol = nextProtocol(w, w->turn);
+	if (protocol < 0)
+		return -1;
+	size_t len = windowSize(protocol);
+	if (contiguous < len)
+		return -1;
+	w->turn = (protocol + 1) % LFWATCH_PROTOCOLS;
+
+	lfwatch_record_t found;
+	memset(&found, 0, sizeof(found));
+	found.sample = sample;
+	copyWindow(work, ring, ringSize, (end + ringSize - len) % ringSize, len);
+	bool ok = false;
+	switch (protocol) {
+		case LFWATCH_HID:
+		case LFWATCH_AWID: {
+			int dummyIdx = 0;
+			size_t size = fskdemod(work, len, 50, 1, 10, 8, &dummyIdx);  // fsk2a RF/50
+			// AWID changes the bits, HID doesn't
+			if ((w->protocols & (1 << LFWATCH_HID)) && hidDecode(work, size, &found)) {
+				ok = true;
+			} else if (w->protocols & (1 << LFWATCH_AWID)) {
+				memset(&found, 0, sizeof(found));
+				found.sample = sample;
+				ok = awidDecode(work, size, &found);
+			}
+			break;
+		}
+		case LFWATCH_IO:
+			ok = ioDecode(work, len, &found);
+			break;
+		case LFWATCH_EM410X:
+			// a tag is either, no ask demod while an fsk tag is there
+			if (!w->fsk)
+				ok = emDecode(work, len, &w->emClock, &found);
+			break;
+	}
+	if (protocol != LFWATCH_EM410X) {
+		uint8_t bit = 1 << (protocol == LFWATCH_IO ? LFWATCH_IO : LFWATCH_HID);
+		w->fsk = ok ? (w->fsk | bit) : (w->fsk & ~bit);
+	}
+	if (ok && max > 0 && isNew(w, &found)) {
+		rec[0] = found;
+		return 1;
+	}
+	return 0;
+}
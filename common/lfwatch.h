@@ -0,0 +1,77 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Multi protocol LF watch (CMD_LF_WATCH). Each time a chunk of a sample ring
+// completes, the demod of common/lfdemod.c of the next protocol runs over the
+// last chunks.
+// Shared by the device watch loop and the client offline watch.
+//-----------------------------------------------------------------------------
+
+#ifndef LFWATCH_H__
+#define LFWATCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define LFWATCH_HID          0
+#define LFWATCH_AWID         1
+#define LFWATCH_IO           2
+#define LFWATCH_EM410X       3
+#define LFWATCH_PROTOCOLS    4
+#define LFWATCH_ALL          ((1 << LFWATCH_PROTOCOLS) - 1)
+
+#define LFWATCH_CHUNK_SIZE     2048
+// demod windows. Two HID/AWID frames at RF/50, two ioProx frames at RF/64 and
+// a chunk to find the start, two EM410x XL frames at RF/64
+#define LFWATCH_FSK_CHUNKS     5
+#define LFWATCH_IO_CHUNKS      5
+#define LFWATCH_WINDOW_CHUNKS  8
+// the smallest window
+#define LFWATCH_MIN_CHUNKS     5
+// the window plus the two chunks the DMA fills
+#define LFWATCH_RING_CHUNKS    (LFWATCH_WINDOW_CHUNKS + 2)
+// the same credential is reported again after it was missing this long (1s at 125kHz)
+#define LFWATCH_HOLD           125000
+#define LFWATCH_MAX_RECORDS    16
+
+// one recognised credential, CMD_LF_WATCH_RECORDS carries arg0 of them
+typedef struct {
+	uint8_t protocol;
+	uint8_t bits;        // format length (EM410x: 40 or 88 id bits), 0 if unknown
+	uint8_t version;     // ioProx version
+	uint8_t reserved;
+	uint32_t fc;
+	uint32_t cn;
+	uint32_t raw[3];     // HID hi2 hi lo, AWID 96 raw bits, ioProx 64 raw bits in raw[1..2], EM410x hi, lo
+	uint32_t sample;     // end of the window it was found in, samples since the start
+} __attribute__((__packed__)) lfwatch_record_t;
+
+// CMD_ACK data at the end of a device watch
+typedef struct {
+	uint32_t lost;       // samples missed while the DMA was stopped, estimated from the timer
+	uint32_t maxDemod;   // longest demod run in us
+} __attribute__((__packed__)) lfwatch_stats_t;
+
+typedef struct {
+	uint32_t protocols;  // mask of 1 << LFWATCH_xxx
+	uint8_t turn;        // protocol of the next demod
+	uint8_t fsk;         // mask of the fsk protocols found by their last demod
+	int emClock;         // clock of the last EM410x, only that one is tried while the tag stays
+	bool seen[LFWATCH_PROTOCOLS];
+	lfwatch_record_t last[LFWATCH_PROTOCOLS];
+} lfwatch_t;
+
+extern void lfWatchInit(lfwatch_t *w, uint32_t protocols);
+// One demod per call, the protocols take turns. The contiguous samples of ring
+// (wraps at ringSize) end at offset end, with sample number sample. The protocol
+// in turn waits until they cover its window, no other demod runs meanwhile, so a
+// demod that makes the DMA stop can't starve the longer windows. work holds
+// LFWATCH_WINDOW_CHUNKS chunks. Writes up to max records of credentials not
+// reported within LFWATCH_HOLD samples and returns their number, -1 if no demod ran.
+extern int lfWatchDemod(lfwatch_t *w, const uint8_t *ring, size_t ringSize, size_t end, size_t contiguous,
+	uint8_t *work, uint32_t sample, lfwatch_record_t *rec, size_t max);
+
+#endif
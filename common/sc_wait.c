@@ -0,0 +1,58 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Waiting for the answer of the RDV40 smart card module. SCL is sampled as
+// often as the caller likes, so a short low pulse isn't missed and the read
+// starts as soon as the settle time after the release is over.
+// A timeout doesn't fail the wait, the caller reads anyway and the module
+// tells by the length byte whether it had an answer.
+//-----------------------------------------------------------------------------
+
+#include "sc_wait.h"
+
+static void sc_wait_enter(sc_wait_t *w, sc_wait_state_t state, uint32_t now) {
+	w->state = state;
+	w->since = now;
+}
+
+void sc_wait_start(sc_wait_t *w, uint32_t now, uint32_t settle) {
+	w->settle = settle;
+	w->timeout = false;
+	sc_wait_enter(w, SC_WAIT_BUSY, now);
+}
+
+sc_wait_state_t sc_wait_poll(sc_wait_t *w, bool scl, uint32_t now) {
+	// unsigned difference, the timer may wrap during a wait
+	uint32_t elapsed = now - w->since;
+
+	switch (w->state) {
+		case SC_WAIT_BUSY:
+			if (!scl) {
+				sc_wait_enter(w, SC_WAIT_CARD, now);
+			} else if (elapsed >= SC_WAIT_BUSY_TIMEOUT) {
+				w->timeout = true;
+				sc_wait_enter(w, SC_WAIT_SETTLE, now);
+			}
+			break;
+		case SC_WAIT_CARD:
+			if (scl) {
+				sc_wait_enter(w, SC_WAIT_SETTLE, now);
+			} else if (elapsed >= SC_WAIT_CARD_TIMEOUT) {
+				w->timeout = true;
+				sc_wait_enter(w, SC_WAIT_SETTLE, now);
+			}
+			break;
+		case SC_WAIT_SETTLE:
+			break;
+		case SC_WAIT_DONE:
+			return w->state;
+	}
+
+	// settle 0 finishes in the same poll
+	if (w->state == SC_WAIT_SETTLE && now - w->since >= w->settle)
+		w->state = SC_WAIT_DONE;
+
+	return w->state;
+}
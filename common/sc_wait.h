@@ -0,0 +1,44 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Waiting for the answer of the RDV40 smart card module. After a request the
+// module pulls SCL low while it talks to the card and releases it when the
+// answer is there. No hardware access, the os polls SCL and its timer
+// (armsrc/i2c.c), the client runs the same code in `sc waittest`.
+//-----------------------------------------------------------------------------
+
+#ifndef SC_WAIT_H__
+#define SC_WAIT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// times are in ticks of the os timer (StartTicks), 1.5 per us
+#define SC_WAIT_US(us)        ((uint32_t)(us) * 3 / 2)
+#define SC_WAIT_MS(ms)        ((uint32_t)(ms) * 1500)
+
+#define SC_WAIT_BUSY_TIMEOUT  SC_WAIT_MS(1800)  // module doesn't take SCL
+#define SC_WAIT_CARD_TIMEOUT  SC_WAIT_MS(1535)  // card doesn't answer
+#define SC_WAIT_SETTLE_TIME   SC_WAIT_US(600)   // from SCL released until the module takes a read
+
+typedef enum {
+	SC_WAIT_BUSY = 0,   // request sent, SCL still high
+	SC_WAIT_CARD,       // module holds SCL low
+	SC_WAIT_SETTLE,     // SCL released, counting down the settle time
+	SC_WAIT_DONE,       // read the answer now
+} sc_wait_state_t;
+
+typedef struct {
+	sc_wait_state_t state;
+	uint32_t since;     // start of the state
+	uint32_t settle;
+	bool timeout;       // a phase timed out, the answer may still be there
+} sc_wait_t;
+
+extern void sc_wait_start(sc_wait_t *w, uint32_t now, uint32_t settle);
+// one sample of SCL (true = high). Returns the new state
+extern sc_wait_state_t sc_wait_poll(sc_wait_t *w, bool scl, uint32_t now);
+
+#endif
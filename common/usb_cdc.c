@@ -35,6 +35,9 @@
 #include "usb_cdc.h"
 #include "at91sam7s512.h"
 #include "config_gpio.h"
+#ifdef ON_DEVICE
+#include "usb_txq.h"
+#endif
 
 
 #define AT91C_EP_CONTROL     0
@@ -281,12 +284,74 @@ byte_t btConfiguration = 0;
 byte_t btConnection    = 0;
 byte_t btReceiveBank   = AT91C_UDP_RX_DATA_BK0;
 
+#ifdef ON_DEVICE
+// set by a bus reset, a new configuration and a port open/close (control line state)
+static bool usbNewSession = true;
+#endif
+
+#ifdef ON_DEVICE
+// The os image queues outgoing frames and feeds the IN endpoint from usb_check(),
+// which every usb_poll() and usb_poll_validate_length() in the main loop and
+// in the long running loops calls. The bootrom keeps the blocking usb_write().
+#define USB_TX_QUEUE_SIZE 2048   // 3 UsbCommand frames, power of 2
+
+static uint8_t txQueueBuf[USB_TX_QUEUE_SIZE];
+static usb_txq_t txQueue = {txQueueBuf, USB_TX_QUEUE_SIZE - 1, 0, 0};
+static bool txBusy = false;      // a bank is handed to the UDP, TXCOMP not seen yet
+static bool txFilled = false;    // the other bank is written, TXPKTRDY not set yet
+
+static bool usb_tx_wait(uint32_t polls);
+
+static void usb_tx_reset() {
+	usb_txq_init(&txQueue, txQueueBuf, USB_TX_QUEUE_SIZE);
+	txBusy = false;
+	txFilled = false;
+}
+
+//*----------------------------------------------------------------------------
+//* \fn    usb_tx_service
+//* \brief Move queued data to the IN endpoint banks without waiting for the host
+//*----------------------------------------------------------------------------
+static void usb_tx_service() {
+	if (!btConfiguration) return;
+
+	for (;;) {
+		if (txBusy && (pUdp->UDP_CSR[AT91C_EP_IN] & AT91C_UDP_TXCOMP)) {
+			UDP_CLEAR_EP_FLAGS(AT91C_EP_IN, AT91C_UDP_TXCOMP);
+			while (pUdp->UDP_CSR[AT91C_EP_IN] & AT91C_UDP_TXCOMP);
+			txBusy = false;
+		}
+
+		if (!txFilled) {
+			byte_t packet[AT91C_EP_IN_SIZE];
+			size_t cpt = usb_txq_pop(&txQueue, packet, sizeof(packet));
+			for (size_t i = 0; i < cpt; i++) {
+				pUdp->UDP_FDR[AT91C_EP_IN] = packet[i];
+			}
+			txFilled = (cpt > 0);
+		}
+
+		// ping-pong: the second bank is written while the first one goes out
+		if (!txFilled || txBusy) break;
+		UDP_SET_EP_FLAGS(AT91C_EP_IN, AT91C_UDP_TXPKTRDY);
+		txBusy = true;
+		txFilled = false;
+	}
+}
+#endif
+
 
 //*----------------------------------------------------------------------------
 //* \fn    usb_disable
 //* \brief This function deactivates the USB device
 //*----------------------------------------------------------------------------
 void usb_disable() {
+#ifdef ON_DEVICE
+	// don't lose the last messages before a reset. Give up if the host stopped reading
+	usb_tx_wait(0x100000);
+	usb_tx_reset();
+#endif
+
 	// Disconnect the USB device
 	AT91C_BASE_PIOA->PIO_ODR = GPIO_USB_PU;
 
@@ -346,10 +411,17 @@ bool usb_check() {
 		pUdp->UDP_FADDR = AT91C_UDP_FEN;
 		// Configure endpoint 0
 		pUdp->UDP_CSR[AT91C_EP_CONTROL] = (AT91C_UDP_EPEDS | AT91C_UDP_EPTYPE_CTRL);
+#ifdef ON_DEVICE
+		usb_tx_reset();
+		usbNewSession = true;
+#endif
 	} else if (isr & AT91C_UDP_EPINT0) {
 		pUdp->UDP_ICR = AT91C_UDP_EPINT0;
 		AT91F_CDC_Enumerate();
 	}
+#ifdef ON_DEVICE
+	usb_tx_service();
+#endif
 	return (btConfiguration) ? true : false;
 }
 
@@ -389,7 +461,8 @@ uint32_t usb_read(byte_t* data, size_t len) {
 		if (!usb_check()) break;
 
 		if ( pUdp->UDP_CSR[AT91C_EP_OUT] & bank ) {
-			packetSize = MIN(pUdp->UDP_CSR[AT91C_EP_OUT] >> 16, len);
+			uint32_t received = pUdp->UDP_CSR[AT91C_EP_OUT] >> 16;
+			packetSize = MIN(received, len);
 			len -= packetSize;
 			while(packetSize--)
 				data[nbBytesRcv++] = pUdp->UDP_FDR[AT91C_EP_OUT];
@@ -399,6 +472,8 @@ uint32_t usb_read(byte_t* data, size_t len) {
 			} else {
 				bank = AT91C_UDP_RX_DATA_BK0;
 			}
+			// a short packet ends the transfer
+			if (received < AT91C_EP_OUT_SIZE) break;
 		}
 		if (time_out++ == 0x1fff) break;
 	}
@@ -408,6 +483,89 @@ uint32_t usb_read(byte_t* data, size_t len) {
 }
 
 
+#ifdef ON_DEVICE
+//*----------------------------------------------------------------------------
+//* \fn    usb_write_async
+//* \brief Queue data for endpoint 2 and return. False if the queue has no room
+//*        for all of it, nothing is queued then
+//*----------------------------------------------------------------------------
+bool usb_write_async(const byte_t* data, const size_t len) {
+	if (!usb_check()) return false;
+	if (!usb_txq_push(&txQueue, data, len)) return false;
+	usb_tx_service();
+	return true;
+}
+
+
+//*----------------------------------------------------------------------------
+//* \fn    usb_new_session
+//* \brief True once after the host reset, configured or opened the port
+//*----------------------------------------------------------------------------
+bool usb_new_session() {
+	bool newSession = usbNewSession;
+	usbNewSession = false;
+	return newSession;
+}
+
+//*----------------------------------------------------------------------------
+//* \fn    usb_tx_free
+//* \brief Bytes usb_write_async() can queue now
+//*----------------------------------------------------------------------------
+size_t usb_tx_free() {
+	return usb_txq_free(&txQueue);
+}
+
+
+// polls - give up after that many usb_check(). 0 - no limit
+static bool usb_tx_wait(uint32_t polls) {
+	while (txBusy || txFilled || usb_txq_used(&txQueue)) {
+		if (!usb_check()) return false;
+		if (polls && --polls == 0) return false;
+	}
+	return true;
+}
+
+
+//*----------------------------------------------------------------------------
+//* \fn    usb_tx_flush
+//* \brief Wait until the host has all queued data. False if the USB went away
+//*----------------------------------------------------------------------------
+bool usb_tx_flush() {
+	return usb_tx_wait(0);
+}
+
+
+//*----------------------------------------------------------------------------
+//* \fn    usb_write
+//* \brief Send through endpoint 2 and wait for the end of transfer
+//*----------------------------------------------------------------------------
+uint32_t usb_write(const byte_t* data, const size_t len) {
+	size_t length = len;
+
+	while (length) {
+		size_t cpt = MIN(length, usb_tx_free());
+		if (cpt && usb_write_async(data, cpt)) {
+			data += cpt;
+			length -= cpt;
+		} else if (!usb_check()) {
+			return length;
+		}
+	}
+
+	return usb_tx_flush() ? 0 : len;
+}
+
+#else
+
+//*----------------------------------------------------------------------------
+//* \fn    usb_write_async
+//* \brief The bootrom sends blocking
+//*----------------------------------------------------------------------------
+bool usb_write_async(const byte_t* data, const size_t len) {
+	return usb_write(data, len) == 0;
+}
+
+
 //*----------------------------------------------------------------------------
 //* \fn    usb_write
 //* \brief Send through endpoint 2
@@ -453,6 +611,7 @@ uint32_t usb_write(const byte_t* data, const size_t len) {
 
 	return length;
 }
+#endif // ON_DEVICE
 
 
 //*----------------------------------------------------------------------------
@@ -574,11 +733,17 @@ void AT91F_CDC_Enumerate() {
 		break;
 	case STD_SET_CONFIGURATION:
 		btConfiguration = wValue;
+#ifdef ON_DEVICE
+		usbNewSession = true;
+#endif
 		AT91F_USB_SendZlp(pUdp);
 		pUdp->UDP_GLBSTATE  = (wValue) ? AT91C_UDP_CONFG : AT91C_UDP_FADDEN;
 		pUdp->UDP_CSR[AT91C_EP_OUT]    = (wValue) ? (AT91C_UDP_EPEDS | AT91C_UDP_EPTYPE_BULK_OUT) : 0;
 		pUdp->UDP_CSR[AT91C_EP_IN]     = (wValue) ? (AT91C_UDP_EPEDS | AT91C_UDP_EPTYPE_BULK_IN)  : 0;
 		pUdp->UDP_CSR[AT91C_EP_NOTIFY] = (wValue) ? (AT91C_UDP_EPEDS | AT91C_UDP_EPTYPE_INT_IN)   : 0;
+#ifdef ON_DEVICE
+		usb_tx_reset();
+#endif
 		break;
 	case STD_GET_CONFIGURATION:
 		AT91F_USB_SendData(pUdp, (char *) &(btConfiguration), sizeof(btConfiguration));
@@ -652,6 +817,9 @@ void AT91F_CDC_Enumerate() {
 		break;
 	case SET_CONTROL_LINE_STATE:
 		btConnection = wValue;
+#ifdef ON_DEVICE
+		usbNewSession = true;
+#endif
 		AT91F_USB_SendZlp(pUdp);
 		break;
 	default:
@@ -37,6 +37,8 @@
 
 #include "common.h"
 
+#define USB_PACKET_SIZE 0x40    // bulk endpoints
+
 void usb_disable();
 void usb_enable();
 bool usb_check();
@@ -44,6 +46,12 @@ bool usb_poll();
 bool usb_poll_validate_length();
 uint32_t usb_read(byte_t* data, size_t len);
 uint32_t usb_write(const byte_t* data, const size_t len);
+bool usb_write_async(const byte_t* data, const size_t len);
+#ifdef ON_DEVICE
+bool usb_new_session();
+size_t usb_tx_free();
+bool usb_tx_flush();
+#endif
 
 #endif // _USB_CDC_H_
 
@@ -0,0 +1,93 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Compact USB frames. A CMD_ACK is 9 bytes instead of 544, a Dbprintf about
+// the length of its text. Frames are unaligned, all fields are read and
+// written byte by byte.
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include "usb_compact.h"
+
+static void put_le(uint8_t *p, uint64_t v, int n) {
+	for (int i = 0; i < n; i++) {
+		p[i] = v & 0xFF;
+		v >>= 8;
+	}
+}
+
+static uint64_t get_le(const uint8_t *p, int n) {
+	uint64_t v = 0;
+	for (int i = n - 1; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+bool usb_compact_is_frame(const uint8_t *frame) {
+	return get_le(frame, 4) == USB_COMPACT_MAGIC;
+}
+
+size_t usb_compact_frame_size(const uint8_t *frame) {
+	uint8_t args = frame[6];
+	size_t length = get_le(frame + 7, 2);
+	if (!usb_compact_is_frame(frame) || (args & ~(USB_COMPACT_NARGS | USB_COMPACT_ARGS_64)) || length > USB_CMD_DATA_SIZE)
+		return 0;
+	int width = (args & USB_COMPACT_ARGS_64) ? 8 : 4;
+	return sizeof(UsbCompactHeader) + (args & USB_COMPACT_NARGS) * width + length;
+}
+
+size_t usb_compact_encode(uint8_t *dest, uint64_t cmd, const uint64_t *arg, const void *data, size_t len) {
+	if (cmd > 0xFFFF || len > USB_CMD_DATA_SIZE)
+		return 0;
+	if (!data)
+		len = 0;
+
+	int nargs = 3;
+	while (nargs > 0 && arg[nargs - 1] == 0)
+		nargs--;
+	int width = 4;
+	for (int i = 0; i < nargs; i++) {
+		if (arg[i] > 0xFFFFFFFF)
+			width = 8;
+	}
+
+	put_le(dest, USB_COMPACT_MAGIC, 4);
+	put_le(dest + 4, cmd, 2);
+	dest[6] = nargs | (width == 8 ? USB_COMPACT_ARGS_64 : 0);
+	put_le(dest + 7, len, 2);
+	size_t pos = sizeof(UsbCompactHeader);
+	for (int i = 0; i < nargs; i++) {
+		put_le(dest + pos, arg[i], width);
+		pos += width;
+	}
+	if (len)
+		memcpy(dest + pos, data, len);
+	return pos + len;
+}
+
+size_t usb_compact_from_command(uint8_t *dest, const UsbCommand *c) {
+	size_t len = USB_CMD_DATA_SIZE;
+	while (len > 0 && c->d.asBytes[len - 1] == 0)
+		len--;
+	uint64_t arg[3] = {c->arg[0], c->arg[1], c->arg[2]};
+	return usb_compact_encode(dest, c->cmd, arg, c->d.asBytes, len);
+}
+
+bool usb_compact_decode(const uint8_t *frame, size_t len, UsbCommand *c) {
+	if (len < sizeof(UsbCompactHeader) || usb_compact_frame_size(frame) != len)
+		return false;
+
+	memset(c, 0, sizeof(UsbCommand));
+	c->cmd = get_le(frame + 4, 2);
+	int nargs = frame[6] & USB_COMPACT_NARGS;
+	int width = (frame[6] & USB_COMPACT_ARGS_64) ? 8 : 4;
+	size_t pos = sizeof(UsbCompactHeader);
+	for (int i = 0; i < nargs; i++) {
+		c->arg[i] = get_le(frame + pos, width);
+		pos += width;
+	}
+	memcpy(c->d.asBytes, frame + pos, len - pos);
+	return true;
+}
@@ -0,0 +1,29 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Compact USB frames (see UsbCompactHeader in usb_cmd.h). Used by the client
+// and the os image.
+//-----------------------------------------------------------------------------
+
+#ifndef USB_COMPACT_H__
+#define USB_COMPACT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "usb_cmd.h"
+
+// first 4 bytes of a frame
+extern bool usb_compact_is_frame(const uint8_t *frame);
+// size of the whole frame from its header. 0 if the header is broken
+extern size_t usb_compact_frame_size(const uint8_t *frame);
+// returns size of the frame in dest (up to USB_COMPACT_MAX_SIZE), 0 if it doesn't fit a compact frame
+extern size_t usb_compact_encode(uint8_t *dest, uint64_t cmd, const uint64_t *arg, const void *data, size_t len);
+// the same for a UsbCommand. Zero bytes at the end of its data are left out
+extern size_t usb_compact_from_command(uint8_t *dest, const UsbCommand *c);
+// false if the frame is broken
+extern bool usb_compact_decode(const uint8_t *frame, size_t len, UsbCommand *c);
+
+#endif
@@ -0,0 +1,50 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// USB transmit queue. A byte ring with free running 16 bit indices. The host
+// sees a CDC byte stream, so frames need no markers in the queue and one
+// endpoint packet may carry the end of one frame and the start of the next.
+//-----------------------------------------------------------------------------
+
+#include "usb_txq.h"
+
+void usb_txq_init(usb_txq_t *q, uint8_t *buf, uint16_t size) {
+	q->buf = buf;
+	q->mask = size - 1;
+	q->head = 0;
+	q->tail = 0;
+}
+
+size_t usb_txq_used(const usb_txq_t *q) {
+	return (uint16_t)(q->head - q->tail);
+}
+
+size_t usb_txq_free(const usb_txq_t *q) {
+	return (size_t)q->mask + 1 - usb_txq_used(q);
+}
+
+bool usb_txq_push(usb_txq_t *q, const uint8_t *data, size_t len) {
+	if (len > usb_txq_free(q))
+		return false;
+
+	uint16_t head = q->head;
+	for (size_t i = 0; i < len; i++)
+		q->buf[head++ & q->mask] = data[i];
+	// publish the frame at once
+	q->head = head;
+	return true;
+}
+
+size_t usb_txq_pop(usb_txq_t *q, uint8_t *dest, size_t max) {
+	size_t n = usb_txq_used(q);
+	if (n > max)
+		n = max;
+
+	uint16_t tail = q->tail;
+	for (size_t i = 0; i < n; i++)
+		dest[i] = q->buf[tail++ & q->mask];
+	q->tail = tail;
+	return n;
+}
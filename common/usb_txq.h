@@ -0,0 +1,35 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// USB transmit queue. Frames are copied in whole by the sender and taken out
+// one endpoint packet at a time by the USB driver (common/usb_cdc.c), so the
+// sender doesn't wait for the host. No hardware access, the client runs the
+// same code in `hw txqtest`.
+//-----------------------------------------------------------------------------
+
+#ifndef USB_TXQ_H__
+#define USB_TXQ_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// size of the storage must be a power of 2
+typedef struct {
+	uint8_t *buf;
+	uint16_t mask;
+	uint16_t head;          // written by the sender only, free running
+	uint16_t tail;          // written by the driver only, free running
+} usb_txq_t;
+
+extern void usb_txq_init(usb_txq_t *q, uint8_t *buf, uint16_t size);
+extern size_t usb_txq_used(const usb_txq_t *q);
+extern size_t usb_txq_free(const usb_txq_t *q);
+// all or nothing. false if there is no room for len bytes (backpressure)
+extern bool usb_txq_push(usb_txq_t *q, const uint8_t *data, size_t len);
+// takes up to max bytes out, returns the number taken
+extern size_t usb_txq_pop(usb_txq_t *q, uint8_t *dest, size_t max);
+
+#endif
@@ -0,0 +1,54 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// HF tag discovery (CMD_HF_SEARCH) shared definitions
+//-----------------------------------------------------------------------------
+
+#ifndef _HFSEARCH_H_
+#define _HFSEARCH_H_
+
+#include "common.h"
+
+// protocols (arg0). Probed in this order.
+#define HF_SEARCH_14A         0x01
+#define HF_SEARCH_ICLASS      0x02
+#define HF_SEARCH_15          0x04
+#define HF_SEARCH_14B         0x08
+#define HF_SEARCH_SRX         0x10
+#define HF_SEARCH_LEGIC       0x20
+#define HF_SEARCH_ALL         0x3F
+
+// flags (arg1)
+#define HF_SEARCH_WAIT        0x01    // repeat until a tag answers
+#define HF_SEARCH_CONTINUOUS  0x02    // report every new tag until button or usb command
+
+// arg2 - timeout in ms for WAIT/CONTINUOUS. 0 - no timeout.
+
+// time a tag gets to power up before the first command (device)
+#define HF_SEARCH_POWERUP_MS  10
+
+// Device answers CMD_ACK arg0=1 with a record for every tag found and
+// a final CMD_ACK arg0=0 (done) or 0xFF (cancelled), arg1=rounds.
+//
+// uid is in display order (15693 and SRx uids are reversed on the device)
+//   14A:    uid, atqa, sak
+//   iCLASS: uid=CSN, info=CC (8 bytes, if it could be read)
+//   15:     uid, info=DSFID
+//   14B:    uid=PUPI, info=application data + protocol info (7 bytes)
+//   SRx:    uid, info=chip id
+//   LEGIC:  uid, info=tag type + card size (16 bits LE)
+typedef struct {
+	uint8_t protocol;       // one of HF_SEARCH_xx
+	uint8_t uidlen;
+	uint8_t uid[10];
+	uint8_t atqa[2];
+	uint8_t sak;
+	uint8_t infolen;
+	uint8_t info[12];
+	uint16_t round;         // search round the tag was found in (1..)
+	uint32_t time;          // ms since start of the search
+} __attribute__((__packed__)) hf_search_result_t;
+
+#endif // _HFSEARCH_H_
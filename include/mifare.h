@@ -59,4 +59,101 @@ typedef struct {
 	uint32_t nr2;
 } nonces_t;
 
+//-----------------------------------------------------------------------------
+// Ultralight/NTAG
+//-----------------------------------------------------------------------------
+// key type for CMD_MIFAREU_CHKKEYS (arg0). CMD_MIFAREU_FINGERPRINT takes any
+// type but MFU_KEY_NONE and uses 3des for UL-C, PWD_AUTH for the rest
+#define MFU_KEY_NONE       0
+#define MFU_KEY_3DES       1    // UL-C, 16 bytes
+#define MFU_KEY_PWD        2    // EV1/NTAG PWD_AUTH, 4 bytes
+
+// keys in one CMD_MIFAREU_CHKKEYS command
+#define MFU_CHK_3DES_KEYS  32
+#define MFU_CHK_PWD_KEYS   128
+
+// mfu_fingerprint_t flags, what the tag answered
+#define MFU_FP_SELECTED    0x0001
+#define MFU_FP_VERSION     0x0002    // GET_VERSION
+#define MFU_FP_ULC_AUTH    0x0004    // UL-C AUTHENTICATE part 1
+#define MFU_FP_READ_29     0x0008    // READ page 0x29 (last NTAG203 page)
+#define MFU_FP_READ_30     0x0010    // READ page 0x30
+#define MFU_FP_BAD_CRC     0x0020    // one byte answer to a READ with a wrong CRC, in badcrc
+#define MFU_FP_MAGIC       0x0040    // ACK to the first part of a compatibility write to page 0
+#define MFU_FP_AUTH        0x0080    // key accepted
+#define MFU_FP_PAGES       0x0100    // pages 0-3
+#define MFU_FP_SIGNATURE   0x0200
+#define MFU_FP_CONFIG      0x0400    // config pages from cfgpage
+#define MFU_FP_ULC_CONFIG  0x0800    // UL-C pages 0x28-0x2B
+#define MFU_FP_ULC_KEY     0x1000    // UL-C key pages 0x2C-0x2F (magic tags)
+#define MFU_FP_PROBED      0x2000    // all type probes done
+
+// Answer to CMD_MIFAREU_FINGERPRINT. Fields are only valid with their flag,
+// counters with their bit in counters_ok.
+typedef struct {
+	uint8_t uid[10];
+	uint8_t uidlen;
+	uint8_t atqa[2];
+	uint8_t sak;
+	uint16_t flags;
+	uint8_t badcrc;
+	uint8_t version[8];
+	uint8_t pages[16];
+	uint8_t signature[32];
+	uint8_t counters_ok;
+	uint8_t counters[3][3];
+	uint8_t tearing[3];
+	uint8_t cfgpage;
+	uint8_t config[16];
+	uint8_t ulc_config[16];
+	uint8_t ulc_key[16];
+	uint8_t pack[4];
+} __attribute__((__packed__)) mfu_fingerprint_t;
+
+//-----------------------------------------------------------------------------
+// Classic access condition audit (CMD_MIFARE_AUDIT)
+//-----------------------------------------------------------------------------
+#define MF_AUDIT_FRAME_SECTORS  16
+
+// status (arg0 of the answer)
+#define MF_AUDIT_OK             0
+#define MF_AUDIT_NO_CARD        1
+
+// mf_audit_sector_t flags
+#define MF_AUDIT_AUTH_A         0x01
+#define MF_AUDIT_AUTH_B         0x02
+#define MF_AUDIT_ACL_OK         0x04    // access bits read and their inverted copy matches
+#define MF_AUDIT_KEYB_DATA      0x08    // key B is readable, it can't be used for authentication
+
+// rights on a data block group, key A in the low nibble, key B in the high nibble
+#define MF_ACL_READ             0x01
+#define MF_ACL_WRITE            0x02
+#define MF_ACL_INC              0x04
+#define MF_ACL_DEC              0x08    // decrement, transfer, restore
+
+// rights on the sector trailer, key A in the low byte, key B in the high byte
+#define MF_ACL_WRITE_KEYA       0x01
+#define MF_ACL_READ_ACCESS      0x02
+#define MF_ACL_WRITE_ACCESS     0x04
+#define MF_ACL_READ_KEYB        0x08
+#define MF_ACL_WRITE_KEYB       0x10
+
+// Device answers with CMD_ACK frames of up to MF_AUDIT_FRAME_SECTORS reports,
+// arg0=status, arg1=reports in the frame, arg2=1 on the last frame.
+// Blocks are numbered from the first block of the sector, a group is one
+// block in small sectors and five blocks in the large 4K sectors. Rights are
+// only valid with MF_AUDIT_ACL_OK.
+typedef struct {
+	uint8_t sector;
+	uint8_t flags;
+	uint8_t access[4];          // trailer bytes 6-9, access bits and GPB
+	uint8_t rights[3];          // data block groups
+	uint16_t trailer_rights;
+	uint16_t read;              // blocks read with one of the keys
+	uint16_t value;             // data blocks in value block format
+	int32_t values[3];          // first value block of each group
+	uint8_t value_addr[3];
+	uint8_t reserved[2];        // 32 bytes, 16 reports fill a frame
+} __attribute__((__packed__)) mf_audit_sector_t;
+
 #endif // _MIFARE_H_
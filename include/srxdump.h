@@ -0,0 +1,55 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// ST SRI512/SRIX4K memory dump (CMD_READ_SRI512_TAG, CMD_READ_SRIX4K_TAG)
+// shared definitions
+//-----------------------------------------------------------------------------
+
+#ifndef _SRXDUMP_H_
+#define _SRXDUMP_H_
+
+#include "common.h"
+
+#define SRX_DUMP_SRI512_BLOCKS    16
+#define SRX_DUMP_SRIX4K_BLOCKS    128
+#define SRX_DUMP_SYSTEM_BLOCK     0xFF
+#define SRX_DUMP_BLOCK_SIZE       4
+
+// blocks in one frame
+#define SRX_DUMP_FRAME_BLOCKS     96
+
+// tries per block before it is given up
+#define SRX_DUMP_RETRIES          3
+// blocks in a row without an answer before the tag is taken for lost
+#define SRX_DUMP_MAX_LOST         3
+
+// session status (arg0)
+#define SRX_DUMP_OK               0
+#define SRX_DUMP_NO_TAG           1    // no answer to INITIATE
+#define SRX_DUMP_SELECT_FAILED    2
+#define SRX_DUMP_UID_FAILED       3
+#define SRX_DUMP_TAG_LOST         4    // some blocks have no answer
+
+// block status
+#define SRX_BLOCK_OK              0
+#define SRX_BLOCK_CRC_ERROR       1    // data of the last try with a CRC error
+#define SRX_BLOCK_NO_ANSWER       2
+
+// Device answers with CMD_ACK frames, arg0=session status, arg1=number of
+// blocks in the dump, arg2=1 on the last frame. Only a single frame is sent
+// if the tag couldn't be selected.
+//
+// The dump holds the memory blocks from 0 in order followed by the system
+// block 0xFF. The uid is in display order (reversed on the device).
+typedef struct {
+	uint8_t uid[8];
+	uint8_t chipid;
+	uint8_t first;          // position of the first block of this frame in the dump
+	uint8_t count;          // blocks in this frame
+	uint8_t status[SRX_DUMP_FRAME_BLOCKS];
+	uint8_t data[SRX_DUMP_FRAME_BLOCKS][SRX_DUMP_BLOCK_SIZE];
+} __attribute__((__packed__)) srx_dump_frame_t;
+
+#endif // _SRXDUMP_H_
@@ -0,0 +1,48 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// T55x7 bulk cloning (CMD_T55XX_CLONE_BATCH) shared definitions
+//-----------------------------------------------------------------------------
+
+#ifndef _T55XXCLONE_H_
+#define _T55XXCLONE_H_
+
+#include "common.h"
+#include "usb_cmd.h"
+
+// The job is uploaded to the start of BigBuf with CMD_DOWNLOADED_SIM_SAMPLES_125K
+// (arg0 = offset). The device moves it to the end of BigBuf, the samples of the
+// verification read go to the start, in front of it.
+#define T55XX_CLONE_JOB_SIZE    (23 * USB_CMD_DATA_SIZE)
+
+// one record per card:
+//   uint8_t  number of blocks (1..8), block 0 first
+//   uint32_t blocks, little endian. Written last to first, block 0 last.
+#define T55XX_CLONE_MAX_BLOCKS  8
+
+// flags (arg1)
+#define T55XX_CLONE_NOVERIFY    0x01    // write only
+
+// status of a card
+#define T55XX_CLONE_OK          0       // written and read back
+#define T55XX_CLONE_UNVERIFIED  1       // written, block 0 config can't be read back (AOR, ST, X-mode, PSK3 ...)
+#define T55XX_CLONE_MISMATCH    2       // read back data differs
+#define T55XX_CLONE_NO_SIGNAL   3       // nothing to demodulate after the write
+#define T55XX_CLONE_BAD_RECORD  4       // job record is broken, card skipped
+
+// Device answers CMD_ACK arg0=1 with a result for every card written and
+// a final CMD_ACK arg0=0 (done) or 0xFF (cancelled), arg1=cards written.
+// Before every card it waits until the previous card left the field and
+// a new one is placed.
+typedef struct {
+	uint16_t card;          // index in the job
+	uint8_t status;         // T55XX_CLONE_xx
+	uint8_t attempts;       // writes done
+	uint32_t block0;
+	uint16_t bits;          // bits compared in the read back
+	uint16_t time;          // ms from card detected to result
+} __attribute__((__packed__)) t55xx_clone_result_t;
+
+#endif // _T55XXCLONE_H_
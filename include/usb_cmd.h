@@ -34,6 +34,26 @@ typedef struct {
   } d;
 } PACKED UsbCommand;
 
+// Compact frames carry only the args and data that are used (common/usb_compact.c).
+// A UsbCommand starts with cmd, which is below 0x10000, so the magic tells the two
+// layouts apart. The client sends compact frames if the device reports
+// HAS_COMPACT_FRAMES to CMD_VERSION. The device answers in the layout of the last
+// command it received, the bootrom only knows UsbCommand.
+//   header, args (little endian, 32 or 64 bit each), data
+// args and data that are left out are 0.
+#define USB_COMPACT_MAGIC      0x63334d50  // "PM3c"
+#define USB_COMPACT_NARGS      0x03        // args: number of args
+#define USB_COMPACT_ARGS_64    0x80        // args: args are 64 bit
+
+typedef struct {
+  uint32_t magic;
+  uint16_t cmd;
+  uint8_t  args;
+  uint16_t length;                         // data bytes, up to USB_CMD_DATA_SIZE for now
+} PACKED UsbCompactHeader;
+
+#define USB_COMPACT_MAX_SIZE   (sizeof(UsbCompactHeader) + 3 * sizeof(uint64_t) + USB_CMD_DATA_SIZE)
+
 // A struct used to send sample-configs over USB
 typedef struct{
 	uint8_t decimation;
@@ -42,6 +62,7 @@ typedef struct{
 	int divisor;
 	int trigger_threshold;
 	int samples_to_skip;
+	int compress;           // 8 bits/sample captures are compressed on the device (common/lfcompress.c)
 } sample_config;
 
 // For the bootloader
@@ -118,6 +139,12 @@ typedef struct{
 #define CMD_COTAG                                                         0x0225
 #define CMD_PARADOX_CLONE_TAG                                             0x0226
 #define CMD_EM4X_PROTECT                                                  0x0228
+#define CMD_LF_STREAM_ADC_SAMPLES                                         0x0229
+#define CMD_LF_STREAMED_ADC_SAMPLES                                       0x022A
+#define CMD_T55XX_CLONE_BATCH                                             0x022B
+#define CMD_SIMULATE_TAG_125K_COMPACT                                     0x022C
+#define CMD_LF_WATCH                                                      0x022D
+#define CMD_LF_WATCH_RECORDS                                              0x022E
 
 // For the 13.56 MHz tags
 #define CMD_ACQUIRE_RAW_ADC_SAMPLES_ISO_15693                             0x0300
@@ -133,6 +160,7 @@ typedef struct{
 #define CMD_ISO_15693_DEBUG                                               0x0316
 #define CMD_LF_SNOOP_RAW_ADC_SAMPLES                                      0x0317
 #define CMD_CSETUID_ISO_15693                                             0x0318
+#define CMD_ISO_15693_INVENTORY                                           0x0319
 
 // For Hitag2 transponders
 #define CMD_SNOOP_HITAG                                                   0x0370
@@ -189,6 +217,8 @@ typedef struct{
 #define CMD_MIFARE_CGETBLOCK                                              0x0606
 #define CMD_MIFARE_CIDENT                                                 0x0607
 #define CMD_MIFARE_CWIPE                                                  0x0608
+#define CMD_MIFARE_CSETBLOCKS                                             0x0609
+#define CMD_MIFARE_CGETBLOCKS                                             0x060A
 
 #define CMD_SIMULATE_MIFARE_CARD                                          0x0610
 
@@ -205,12 +235,15 @@ typedef struct{
 #define CMD_MIFAREU_WRITEBL_COMPAT                                        0x0723
 
 #define CMD_MIFARE_CHKKEYS                                                0x0623
+#define CMD_MIFARE_AUDIT                                                  0x0624
 
 #define CMD_MIFARE_SNIFFER                                                0x0630
 //ultralightC
 #define CMD_MIFAREUC_AUTH                                                 0x0724
 //0x0725 and 0x0726 no longer used 
 #define CMD_MIFAREUC_SETPWD                                               0x0727
+#define CMD_MIFAREU_FINGERPRINT                                           0x0730
+#define CMD_MIFAREU_CHKKEYS                                               0x0731
 
 
 // mifare desfire
@@ -224,6 +257,7 @@ typedef struct{
 
 #define CMD_HF_SNIFFER                                                    0x0800
 #define CMD_HF_PLOT                                                       0x0801
+#define CMD_HF_SEARCH                                                     0x0802
 
 #define CMD_UNKNOWN                                                       0xFFFF
 
@@ -254,6 +288,7 @@ typedef struct{
 // Hardware capabilities
 #define HAS_EXTRA_FLASH_MEM    (1 << 0)
 #define HAS_SMARTCARD_SLOT     (1 << 1)
+#define HAS_COMPACT_FRAMES     (1 << 2)
 
 
 // CMD_DEVICE_INFO response packet has flags in arg[0], flag definitions: